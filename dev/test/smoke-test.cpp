@@ -1,10 +1,14 @@
 #include "../ril.h"
 #include "../3rd-party/catch2/catch.hpp"
 #include <cstdio>
+#include <cstring>
 #include <filesystem>
+#include <atomic>
+#include <stdexcept>
 #include <memory>
 #include <chrono>
 #include <thread>
+#include <tuple>
 
 #ifdef __clang__
 #pragma clang diagnostic ignored "-Wc++98-compat-pedantic"
@@ -18,6 +22,58 @@
 using namespace ril;
 using namespace std::string_literals;
 
+// A stream buffer that can't seek, like a pipe.
+struct PipeBuf : std::streambuf {
+    std::string data;
+    size_t      pos = 0;
+    char        c   = 0;
+    PipeBuf(std::string d): data(std::move(d)) {}
+    int_type underflow() override {
+        if (pos >= data.size()) return traits_type::eof();
+        c = data[pos++];
+        setg(&c, &c, &c + 1);
+        return traits_type::to_int_type(c);
+    }
+};
+
+// Packs bit fields into a 16 byte block, least significant bit first. Fields are appended to the previous one, or
+// written at an explicit bit position.
+struct Bits {
+    uint8_t  block[16] = {};
+    uint32_t pos       = 0;
+
+    Bits & put(uint32_t value, uint32_t count) {
+        for (uint32_t i = 0; i < count; ++i, ++pos) block[pos / 8] |= (uint8_t) (((value >> i) & 1) << (pos % 8));
+        return *this;
+    }
+
+    Bits & put(uint32_t at, uint32_t value, uint32_t count) {
+        pos = at;
+        return put(value, count);
+    }
+};
+
+// Decodes an odd sized plane with several block rows of arbitrary blocks: float and RGBA8 outputs must agree, and
+// partial blocks must be clipped.
+static void checkOddSizedDecode(PixelFormat format) {
+    INFO(format.toString());
+    auto              plane = PlaneDesc::make(format, {37, 21, 2});
+    std::vector<char> pixels(plane.size);
+    for (size_t i = 0; i < pixels.size(); ++i) pixels[i] = (char) (i * 7919 % 251);
+    auto floats = plane.toFloat4(pixels.data());
+    auto bytes  = plane.toRGBA8(pixels.data());
+    REQUIRE(37 * 21 * 2 == floats.size());
+    REQUIRE(37 * 21 * 2 == bytes.size());
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        for (int c = 0; c < 4; ++c) REQUIRE(bytes[i].u8[c] == (uint8_t) (floats[i].f32[c] * 255.0f));
+    }
+    // the last texel of the 2nd slice comes from the last block of it.
+    uint32_t bw = format.layoutDesc().blockWidth, bh = format.layoutDesc().blockHeight;
+    uint32_t x = 36 / bw * bw, y = 20 / bh * bh;
+    auto     last = PlaneDesc::make(format, {bw, bh, 1}).toRGBA8(pixels.data() + plane.pixel(x, y, 1));
+    CHECK(last[(20 - y) * bw + 36 - x].u32 == bytes.back().u32);
+}
+
 TEST_CASE("pixel-size") {
     CHECK(8 == PixelFormat::A_8_UNORM().bitsPerPixel());
     CHECK(1 == PixelFormat::A_8_UNORM().bytesPerBlock());
@@ -81,6 +137,25 @@ TEST_CASE("default-alignment") {
     for (const auto & p : desc.planes) { REQUIRE(0 == (p.offset % desc.alignment)); }
 }
 
+// Write the image in the layout of V1 RIL file: tag, header, plane array, then pixel array w/o any padding.
+static std::string saveAsRILV1(const Image & image) {
+    const auto & desc = image.desc();
+    std::string  str  = "RIL_";
+    auto         u32  = [&](uint32_t v) { str.append((const char *) &v, 4); };
+    u32(1);                                 // version
+    u32(36);                                // header size
+    u32((uint32_t) sizeof(desc.planes[0])); // plane desc size
+    u32(44);                                // offset to plane array
+    u32(desc.ranks);
+    u32(desc.faces);
+    u32(desc.levels);
+    u32(desc.alignment);
+    str.append((const char *) &desc.size, 8);
+    str.append((const char *) desc.planes.data(), desc.planes.size() * sizeof(desc.planes[0]));
+    str.append((const char *) image.data(), desc.size);
+    return str;
+}
+
 TEST_CASE("ril-save-load") {
     // create a multi-plane image with default alignment
     Image img1(ImageDesc::make(PlaneDesc::make(PixelFormat::RGBA8(), {2, 2, 2}), 4, 1, 0));
@@ -101,6 +176,355 @@ TEST_CASE("ril-save-load") {
 
     // make sure img1 and img2 are identical.
     REQUIRE(img1.desc() == img2.desc());
+
+    SECTION("v2") {
+        for (size_t i = 0; i < img1.size(); ++i) img1.data()[i] = (uint8_t) (i * 5);
+        std::stringstream ss2;
+        img1.save(ImageDesc::SaveToStreamParameters().setPayloadAlignment(64), ss2);
+        auto str2 = ss2.str();
+        CHECK(0 == (str2.size() - img1.size()) % 64); // pixel array is padded to requested alignment.
+        auto img3 = Image::load(str2.data(), str2.size());
+        REQUIRE(img1.desc() == img3.desc());
+        CHECK(0 == memcmp(img1.data(), img3.data(), img1.size()));
+
+        // corrupted pixels are caught by checksum.
+        str2[str2.size() - 1] ^= 1;
+        CHECK(Image::load(str2.data(), str2.size()).empty());
+    }
+
+    SECTION("v1") {
+        // V1 files are still readable.
+        for (size_t i = 0; i < img1.size(); ++i) img1.data()[i] = (uint8_t) (i * 3);
+        auto str3 = saveAsRILV1(img1);
+        auto img4 = Image::load(str3.data(), str3.size());
+        REQUIRE(img1.desc() == img4.desc());
+        CHECK(0 == memcmp(img1.data(), img4.data(), img1.size()));
+    }
+}
+
+TEST_CASE("ril-map-file") {
+    Image img1(ImageDesc::make(PlaneDesc::make(PixelFormat::RGBA8(), {16, 16, 1}), 2, 1, 0));
+    for (size_t i = 0; i < img1.size(); ++i) img1.data()[i] = (uint8_t) (i * 7);
+    auto path = (std::filesystem::temp_directory_path() / "rapid-image-map-file-test.ril").string();
+    img1.save(path);
+
+    {
+        // pixels are used in place.
+        auto img2 = Image::mapFile(path);
+        REQUIRE(!img2.empty());
+        CHECK(img2.mapped());
+        CHECK(img1.desc() == img2.desc());
+        CHECK(0 == (((size_t) (intptr_t) img2.data()) % 4096)); // pixel array is page aligned in the file.
+        CHECK(0 == memcmp(img1.data(), img2.data(), img1.size()));
+
+        // writes are private to the mapping.
+        img2.data()[0] = 1;
+        auto img3      = Image::mapFile(path);
+        CHECK(img1.data()[0] == img3.data()[0]);
+
+        // moving and clearing releases the mapping properly.
+        Image img4 = std::move(img3);
+        CHECK(img3.empty());
+        CHECK(img4.mapped());
+        img4.clear();
+        CHECK(!img4.mapped());
+    }
+
+    {
+        // Pixel array of V1 file is only 4 bytes aligned in the file. Fall back to loading it.
+        auto str = saveAsRILV1(img1);
+        std::ofstream(path, std::ios::binary).write(str.data(), (std::streamsize) str.size());
+        auto img5 = Image::mapFile(path);
+        REQUIRE(!img5.empty());
+        CHECK(img5.mapped() == (0 == (str.size() - img1.size()) % img1.desc().alignment));
+        CHECK(img1.desc() == img5.desc());
+        CHECK(0 == memcmp(img1.data(), img5.data(), img1.size()));
+    }
+
+    CHECK(Image::mapFile(path + ".does-not-exist").empty());
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("image-loader") {
+    // a few files of different sizes, so that the in-flight budget (smaller than 2 of them) holds reads back.
+    std::vector<Image>       images;
+    std::vector<std::string> paths;
+    for (uint32_t i = 0; i < 8; ++i) {
+        images.emplace_back(ImageDesc::make(PlaneDesc::make(PixelFormat::RGBA8(), {16 + i * 8, 16, 1}), 1, 1, 0));
+        for (size_t j = 0; j < images.back().size(); ++j) images.back().data()[j] = (uint8_t) (j * 5 + i);
+        paths.push_back((std::filesystem::temp_directory_path() / ("rapid-image-loader-test-" + std::to_string(i) + ".ril")).string());
+        images.back().save(paths.back());
+    }
+    paths.push_back(paths.back() + ".does-not-exist");
+
+    ImageLoader loader(ImageLoader::Parameters().setIOThreads(2).setDecodeThreads(3).setMaxBytesInFlight(images.back().size() + 1024));
+    auto        futures = loader.load(paths);
+
+    // in-memory images and callbacks.
+    std::stringstream ss;
+    images[3].save({ImageDesc::RIL}, ss);
+    auto             str = ss.str();
+    std::atomic<int> called {0};
+    loader.load(str.data(), str.size(), [&](Image && image) {
+        CHECK(images[3].desc() == image.desc());
+        ++called;
+    });
+    loader.load(paths.back(), [&](Image && image) {
+        CHECK(image.empty());
+        ++called;
+    });
+
+    REQUIRE(futures.size() == paths.size());
+    for (size_t i = 0; i < images.size(); ++i) {
+        auto image = futures[i].get();
+        REQUIRE(images[i].desc() == image.desc());
+        CHECK(0 == memcmp(images[i].data(), image.data(), image.size()));
+    }
+    CHECK(futures.back().get().empty());
+    loader.wait();
+    CHECK(2 == called);
+
+    // an empty path fails on a decoder thread too, and a throwing callback doesn't keep wait() from returning.
+    auto caller = std::this_thread::get_id();
+    loader.load(std::string(), [&](Image && image) {
+        CHECK(image.empty());
+        CHECK(caller != std::this_thread::get_id());
+        ++called;
+        throw std::runtime_error("callback");
+    });
+    CHECK(loader.load(std::string()).get().empty());
+    loader.wait();
+    CHECK(3 == called);
+
+    // exceptions thrown while loading go to the futures, and callbacks get an empty image. The budget is given back
+    // either way, so that the loads queued after them still go through.
+    struct Throwing : Allocator {
+        void * allocate(size_t, size_t) override { throw std::bad_alloc(); }
+        void   deallocate(void *, size_t, size_t) override {}
+    } throwing;
+    ImageLoader failing(ImageLoader::Parameters().setIOThreads(1).setDecodeThreads(1).setMaxBytesInFlight(1).setAllocator(&throwing));
+    auto        thrown = failing.load(std::vector<std::string>(paths.begin(), paths.begin() + 3));
+    failing.load(str.data(), str.size(), [&](Image && image) {
+        CHECK(image.empty());
+        ++called;
+    });
+    for (auto & f : thrown) CHECK_THROWS_AS(f.get(), std::bad_alloc);
+    CHECK_THROWS_AS(failing.load(str.data(), str.size()).get(), std::bad_alloc);
+    failing.wait();
+    CHECK(4 == called);
+    for (size_t i = 0; i < images.size(); ++i) std::filesystem::remove(paths[i]);
+}
+
+TEST_CASE("ril-view") {
+    Image img1(ImageDesc::make(PlaneDesc::make(PixelFormat::RGBA8(), {16, 16, 1}), 2, 1, 0));
+    for (size_t i = 0; i < img1.size(); ++i) img1.data()[i] = (uint8_t) (i * 11);
+    std::stringstream ss;
+    img1.save({ImageDesc::RIL}, ss);
+    auto str = ss.str();
+
+    // copy the file to a page aligned buffer, like an archive loaded in memory.
+    ImageDesc::AlignedUniquePtr buffer((uint8_t *) rii_details::aalloc(4096, str.size() + 1));
+    memcpy(buffer.get(), str.data(), str.size());
+
+    // the proxy points to the pixels inside the buffer.
+    auto proxy = ImageProxy::view(buffer.get(), str.size());
+    REQUIRE(!proxy.empty());
+    CHECK(proxy.desc == img1.desc());
+    CHECK(proxy.data == buffer.get() + str.size() - img1.size());
+    CHECK(0 == memcmp(img1.data(), proxy.data, img1.size()));
+
+    // misaligned, truncated or non-RIL buffers can't be viewed. They can still be loaded.
+    memmove(buffer.get() + 1, buffer.get(), str.size());
+    CHECK(ImageProxy::view(buffer.get() + 1, str.size()).empty());
+    auto img2 = Image::load(buffer.get() + 1, str.size());
+    REQUIRE(img1.desc() == img2.desc());
+    CHECK(0 == memcmp(img1.data(), img2.data(), img1.size()));
+    CHECK(ImageProxy::view(str.data(), str.size() - 1).empty());
+    CHECK(ImageProxy::view("not a RIL file", 14).empty());
+    CHECK(ImageProxy::view(nullptr, 0).empty());
+}
+
+TEST_CASE("codec-registry") {
+    // built-in codecs load from non-seekable streams.
+    Image img1(ImageDesc::make(PlaneDesc::make(PixelFormat::RGBA8(), {8, 8, 1}), 1, 1, 1));
+    for (size_t i = 0; i < img1.size(); ++i) img1.data()[i] = (uint8_t) (i * 3);
+    for (auto format : {ImageDesc::RIL, ImageDesc::DDS}) {
+        std::stringstream ss;
+        img1.save({format}, ss);
+        PipeBuf      pipe(ss.str());
+        std::istream stream(&pipe);
+        auto         img2 = Image::load(stream);
+        REQUIRE(!img2.empty());
+        CHECK(img1.format() == img2.format());
+        CHECK(img1.extent() == img2.extent());
+        CHECK(0 == memcmp(img1.data(), img2.data(), img1.size()));
+    }
+    CHECK(ImageCodec::find("ril"));
+    CHECK(ImageCodec::find("dds") == ImageCodec::findByExtension(".dds"));
+    CHECK(ImageCodec::detect("DDS ", 4) == ImageCodec::find("dds"));
+    CHECK(!ImageCodec::find("no-such-codec"));
+
+    // a custom codec: "TEST" followed by one RGBA8 pixel.
+    ImageCodec test;
+    test.name       = "test";
+    test.extensions = {".test"};
+    test.match      = [](const uint8_t * header, size_t size) { return size >= 4 && 0 == memcmp(header, "TEST", 4); };
+    test.load       = [](ImageDesc & desc, std::istream & stream, const char *) -> ImageDesc::AlignedUniquePtr {
+        char tag[4];
+        desc = ImageDesc::make(PlaneDesc::make(PixelFormat::RGBA8(), {1, 1, 1}));
+        ImageDesc::AlignedUniquePtr pixels((uint8_t *) rii_details::aalloc(desc.alignment, desc.size));
+        if (!stream.read(tag, 4) || !stream.read((char *) pixels.get(), 4)) return {};
+        return pixels;
+    };
+    test.save = [](const ImageDesc &, std::ostream & stream, const void * pixels) {
+        stream.write("TEST", 4);
+        stream.write((const char *) pixels, 4);
+    };
+    ImageCodec::registerCodec(test);
+    CHECK(ImageCodec::detect("TEST", 4) == ImageCodec::find("test"));
+
+    std::stringstream ss("TEST\x01\x02\x03\x04 and whatever follows"s);
+    auto              img3 = Image::load(ss);
+    REQUIRE(1 == img3.width());
+    CHECK(0x04030201 == *(const uint32_t *) img3.data());
+    CHECK(' ' == ss.get()); // seekable streams are left right after the image.
+
+    auto path = (std::filesystem::temp_directory_path() / "rapid-image-codec-test.test").string();
+    img3.save(path);
+    auto img4 = Image::load(std::ifstream(path, std::ios::binary));
+    REQUIRE(1 == img4.width());
+    CHECK(0x04030201 == *(const uint32_t *) img4.data());
+    std::filesystem::remove(path);
+
+    // registering again replaces the codec.
+    test.match = [](const uint8_t *, size_t) { return false; };
+    ImageCodec::registerCodec(test);
+    CHECK(!ImageCodec::detect("TEST", 4));
+    CHECK(Image::load("TEST\x01\x02\x03\x04", 8).empty());
+
+    // a codec that replaces a built-in format saves it too, to streams and to files. Put the built-in one back however
+    // the test leaves.
+    struct Restore {
+        ~Restore() {
+            for (const auto & c : ImageCodec::builtIns())
+                if ("dds" == c.name) ImageCodec::registerCodec(c);
+        }
+    } restore;
+    auto dds = *ImageCodec::find("dds");
+    dds.save = [](const ImageDesc &, std::ostream & stream, const void *) { stream.write("custom", 6); };
+    ImageCodec::registerCodec(dds);
+    std::stringstream custom;
+    img1.save({ImageDesc::DDS}, custom);
+    CHECK("custom" == custom.str());
+    path = (std::filesystem::temp_directory_path() / "rapid-image-codec-test.dds").string();
+    img1.save(path);
+    std::ifstream file(path, std::ios::binary);
+    CHECK("custom" == std::string(std::istreambuf_iterator<char>(file), {}));
+    file.close();
+    std::filesystem::remove(path);
+
+    // a built-in codec registered again saves the real format again.
+    for (const auto & c : ImageCodec::builtIns())
+        if ("dds" == c.name) ImageCodec::registerCodec(c);
+    std::stringstream builtIn;
+    img1.save({ImageDesc::DDS}, builtIn);
+    auto img5 = Image::load(builtIn);
+    REQUIRE(!img5.empty());
+    CHECK(0 == memcmp(img1.data(), img5.data(), img1.size()));
+}
+
+TEST_CASE("probe") {
+    Image img1(ImageDesc::make(PlaneDesc::make(PixelFormat::RGBA8(), {64, 32, 1}), 2, 6, 0));
+    for (auto format : {ImageDesc::RIL, ImageDesc::DDS}) {
+        std::stringstream ss;
+        img1.save({format}, ss);
+        auto str  = ss.str();
+        auto img2 = Image::load(str.data(), str.size());
+        REQUIRE(!img2.empty());
+
+        // the descriptor matches the loaded one, including the size of the pixel array.
+        ImageDesc desc;
+        REQUIRE(desc.probe(ss));
+        CHECK(desc == img2.desc());
+        CHECK(ss.tellg() < (std::streamoff) str.size() / 2); // pixels are not read.
+
+        // pixels don't even need to be there.
+        auto header = str.substr(0, str.size() - img2.size());
+        CHECK(Image::load(header.data(), header.size()).empty());
+        ImageDesc desc2;
+        REQUIRE(desc2.probe(header.data(), header.size()));
+        CHECK(desc2 == img2.desc());
+
+        auto path = (std::filesystem::temp_directory_path() / "rapid-image-probe-test.bin").string();
+        std::ofstream(path, std::ios::binary).write(header.data(), (std::streamsize) header.size());
+        ImageDesc desc3;
+        REQUIRE(desc3.probe(path));
+        CHECK(desc3 == img2.desc());
+        std::filesystem::remove(path);
+    }
+
+    // failures leave the descriptor untouched.
+    ImageDesc desc = img1.desc();
+    CHECK(!desc.probe("not an image", 12));
+    CHECK(!desc.probe("DDS ", 4));
+    CHECK(!desc.probe("/no/such/file.ril"s));
+    CHECK(desc == img1.desc());
+}
+
+TEST_CASE("ril-partial-load") {
+    for (auto order : {ImageDesc::FACE_MAJOR, ImageDesc::MIP_MAJOR}) {
+        Image img1(ImageDesc {}.reset(PlaneDesc::make(PixelFormat::RGBA8(), {64, 32, 1}), 2, 6, 0, order));
+        for (size_t i = 0; i < img1.size(); ++i) img1.data()[i] = (uint8_t) (i * 13 + 7);
+        std::stringstream ss;
+        img1.save({ImageDesc::RIL}, ss);
+
+        // load the low mips only.
+        auto img2 = Image::loadRILLevels(ss, 3);
+        REQUIRE(!img2.empty());
+        CHECK(img2.desc().levels == img1.desc().levels - 3);
+        CHECK(img2.size() < img1.size() / 32);
+        for (uint32_t r = 0; r < 2; ++r) {
+            for (uint32_t f = 0; f < 6; ++f) {
+                for (uint32_t l = 0; l < img2.desc().levels; ++l) {
+                    CHECK(img1.plane({r, f, l + 3}) == img2.plane({r, f, l}));
+                    CHECK(0 == memcmp(img1.at({r, f, l + 3}), img2.at({r, f, l}), img2.plane({r, f, l}).size));
+                }
+            }
+        }
+
+        // load a level range in the middle.
+        ss.clear();
+        ss.seekg(0);
+        auto img3 = Image::loadRILLevels(ss, 1, 2);
+        REQUIRE(img3.desc().levels == 2);
+        CHECK(0 == memcmp(img1.at({1, 5, 2}), img3.at({1, 5, 1}), img3.plane({1, 5, 1}).size));
+
+        // fetch one plane on demand.
+        ss.clear();
+        ss.seekg(0);
+        ImageDesc desc;
+        uint64_t  payload = 0;
+        REQUIRE(desc.loadRILHeader(ss, payload));
+        CHECK(desc == img1.desc());
+        std::vector<uint8_t> plane(desc.plane({1, 2, 0}).size);
+        REQUIRE(desc.readRILPlane(ss, payload, {1, 2, 0}, plane.data()));
+        CHECK(0 == memcmp(img1.at({1, 2, 0}), plane.data(), plane.size()));
+
+        // out of range
+        CHECK(!desc.readRILPlane(ss, payload, {desc.ranks, 0, 0}, plane.data()));
+        CHECK(!desc.readRILPlane(ss, payload, {0, desc.faces, 0}, plane.data()));
+        CHECK(!desc.readRILPlane(ss, payload, {0, 0, desc.levels}, plane.data()));
+        ss.clear();
+        ss.seekg(0);
+        CHECK(Image::loadRILLevels(ss, img1.desc().levels).empty());
+
+        // a stream that can't tell where the pixel array is.
+        PipeBuf      pipe(ss.str());
+        std::istream stream(&pipe);
+        ImageDesc    desc2;
+        CHECK(!desc2.loadRILHeader(stream, payload));
+        CHECK(desc2.empty());
+    }
 }
 
 TEST_CASE("dds") {
@@ -118,6 +542,73 @@ TEST_CASE("dds") {
     REQUIRE(p0.w == 255);
 }
 
+TEST_CASE("dds-save-load") {
+    // compare format, extent and pixels of every plane.
+    auto same = [](const Image & a, const Image & b) {
+        if (a.desc().ranks != b.desc().ranks || a.desc().faces != b.desc().faces || a.desc().levels != b.desc().levels) return false;
+        for (size_t i = 0; i < a.desc().planes.size(); ++i) {
+            const auto & pa = a.desc().planes[i];
+            const auto & pb = b.desc().planes[i];
+            if (pa.desc.format != pb.desc.format || pa.desc.extent != pb.desc.extent) return false;
+            const auto & ld   = pa.desc.format.layoutDesc();
+            auto         rows = (pa.desc.extent.h + ld.blockHeight - 1) / ld.blockHeight;
+            auto         row  = (pa.desc.extent.w + ld.blockWidth - 1) / ld.blockWidth * ld.blockBytes;
+            for (uint32_t z = 0; z < pa.desc.extent.d; ++z)
+                for (uint32_t y = 0; y < rows; ++y)
+                    if (memcmp(a.data() + pa.offset + z * pa.desc.slice + y * pa.desc.pitch, b.data() + pb.offset + z * pb.desc.slice + y * pb.desc.pitch, row))
+                        return false;
+        }
+        return true;
+    };
+
+    struct Case {
+        PixelFormat format;
+        Extent3D    extent;
+        size_t      ranks, faces, levels;
+    } cases[] = {
+        {PixelFormat::RGBA_8_8_8_8_UNORM(), {16, 8, 1}, 1, 1, 0},      // legacy header with mipmaps
+        {PixelFormat::BGR_8_8_8_UNORM(), {3, 3, 1}, 1, 1, 2},          // legacy header, odd pitch
+        {PixelFormat::L_8_UNORM(), {8, 8, 1}, 1, 6, 0},                // legacy cube map
+        {PixelFormat::R_32_FLOAT(), {8, 8, 1}, 2, 6, 0},               // DX10 cube map array
+        {PixelFormat::RGBA_16_16_16_16_FLOAT(), {8, 4, 4}, 1, 1, 0},   // DX10 volume
+        {PixelFormat::RGBA_8_8_8_8_UNORM(), {5, 5, 1}, 3, 1, 0},       // DX10 2D array
+        {PixelFormat::BC1_UNORM(), {16, 16, 1}, 1, 1, 0},              // compressed
+        {PixelFormat::BC7_SRGB(), {12, 8, 1}, 1, 1, 0},               // DX10 only
+        {PixelFormat::BC6H_SNORM(), {8, 8, 1}, 1, 1, 0},              // DX10 only
+    };
+    for (const auto & c : cases) {
+        Image img1(ImageDesc::make(PlaneDesc::make(c.format, c.extent), c.ranks, c.faces, c.levels));
+        for (size_t i = 0; i < img1.size(); ++i) img1.data()[i] = (uint8_t) (i * 11 + 3);
+        std::stringstream ss;
+        img1.save({ImageDesc::DDS}, ss);
+        auto img2 = Image::load(ss);
+        REQUIRE(!img2.empty());
+        CHECK(same(img1, img2));
+    }
+
+    // uncompressed rows are byte packed, like other DDS readers expect: 5x3, 2x1 and 1x1 L8 levels take 15 + 2 + 1
+    // bytes after the 128 bytes of header, and the header pitch is the 5 bytes of a row.
+    Image l8(ImageDesc::make(PlaneDesc::make(PixelFormat::L_8_UNORM(), {5, 3, 1}), 1, 1, 0));
+    REQUIRE(3 == l8.desc().levels);
+    for (size_t i = 0; i < l8.size(); ++i) l8.data()[i] = (uint8_t) (i * 7 + 1);
+    std::stringstream ss;
+    l8.save({ImageDesc::DDS}, ss);
+    auto file = ss.str();
+    REQUIRE(128 + 15 + 2 + 1 == file.size());
+    uint32_t pitch;
+    memcpy(&pitch, file.data() + 20, sizeof(pitch));
+    CHECK(5 == pitch);
+    size_t pos = 128;
+    for (const auto & p : l8.desc().planes) {
+        for (uint32_t y = 0; y < p.desc.extent.h; ++y, pos += p.desc.extent.w) {
+            CHECK(0 == memcmp(file.data() + pos, l8.data() + p.offset + y * p.desc.pitch, p.desc.extent.w));
+        }
+    }
+    auto loaded = Image::load(ss);
+    REQUIRE(!loaded.empty());
+    CHECK(same(l8, loaded));
+}
+
 TEST_CASE("copy") {
     union RG8 {
         struct {
@@ -221,6 +712,956 @@ TEST_CASE("astc-smoke", "[astc]") {
     CHECK(compressedSize == plane.size);
 }
 
+TEST_CASE("astc-decode", "[astc]") {
+    // Block mode 0x42: a 4x4 grid of 2-bit weights, 0, 21, 43 and 64. One partition, 8-bit color values from bit 17.
+    // Weights are stored bit-reversed from the top of the block: texel i in bits 127 - 2i (low) and 126 - 2i (high).
+    auto block = [](uint32_t cem, const std::vector<uint32_t> & values) {
+        Bits b;
+        b.put(0, 0x42, 11).put(13, cem, 4);
+        for (auto v : values) b.put(v, 8);
+        b.put(117, 1, 1); // texel 5: weight 21
+        b.put(96, 3, 2);  // texel 15: weight 64
+        return b;
+    };
+
+    // LDR RGB from black to white. 8-bit texels are the top 8 bits of the 16-bit results.
+    auto rgb = block(8, {0, 255, 0, 255, 0, 255});
+    auto u8  = PlaneDesc::make(PixelFormat::ASTC_4x4_UNORM(), {4, 4, 1}).toRGBA8(rgb.block);
+    CHECK(0xff000000u == u8[0].u32);
+    CHECK(RGBA8::makeU8(84, 84, 84, 255).u32 == u8[5].u32);
+    CHECK(0xffffffffu == u8[15].u32);
+
+    // SFLOAT formats decode LDR end points to UNORM16 / 65535.
+    auto f = PlaneDesc::make(PixelFormat::ASTC_4x4_SFLOAT(), {4, 4, 1}).toFloat4(rgb.block);
+    CHECK(21504.0f / 65535.0f == f[5].y);
+    CHECK(1.0f == f[15].z);
+
+    // HDR luminance: 0x780 is 1.0 in the logarithmic encoding, and too large values clamp to the max half. LDR formats
+    // decode HDR end points to the error color.
+    f = PlaneDesc::make(PixelFormat::ASTC_4x4_SFLOAT(), {4, 4, 1}).toFloat4(block(2, {0, 120}).block);
+    CHECK(0.0f == f[0].x);
+    CHECK(1.0f == f[15].x);
+    CHECK(1.0f == f[15].w);
+    CHECK(65504.0f == PlaneDesc::make(PixelFormat::ASTC_4x4_SFLOAT(), {4, 4, 1}).toFloat4(block(2, {0, 255}).block)[15].y);
+    CHECK(0xffff00ffu == PlaneDesc::make(PixelFormat::ASTC_4x4_UNORM(), {4, 4, 1}).toRGBA8(block(2, {0, 120}).block)[0].u32);
+
+    // The expected texels of the golden blocks below come from a separate model of the ASTC chapter of the Khronos Data
+    // Format Specification, not from this decoder.
+
+    // LDR end point modes, texels 0, 5 and 15 of each. The 2nd blocks of modes 9 and 13 have negative offsets, and the
+    // blocks of modes 8 and 12 have the larger sum first, so their colors are blue contracted and swapped.
+    struct LdrMode {
+        uint32_t              cem;
+        std::vector<uint32_t> values;
+        uint32_t              texels[3];
+    };
+    const LdrMode ldrModes[] = {
+        {0, {0x1e, 0xc8}, {0xff1e1e1e, 0xff565656, 0xffc8c8c8}},
+        {1, {0x85, 0xe7}, {0xffe1e1e1, 0xffebebeb, 0xffffffff}},
+        {4, {0x0a, 0xfa, 0xc8, 0x28}, {0xc80a0a0a, 0x94595959, 0x28fafafa}},
+        {5, {0x90, 0xf0, 0x40, 0x20}, {0x20c8c8c8, 0x25c6c6c6, 0x30c0c0c0}},
+        {6, {0xc8, 0x64, 0x32, 0x80}, {0xff193264, 0xff214285, 0xff3264c8}},
+        {8, {0xc8, 0x0a, 0x96, 0x14, 0x64, 0x1e}, {0xff1e1914, 0xff353a3e, 0xff647d96}},
+        {9, {0x64, 0x1e, 0x64, 0x14, 0x64, 0x0a}, {0xff323232, 0xff333537, 0xff373c41}},
+        {9, {0xc8, 0x70, 0x64, 0x70, 0x3c, 0x60}, {0xff0e1c35, 0xff132039, 0xff1e2841}},
+        {10, {0xc8, 0x64, 0x32, 0x80, 0x1e, 0xdc}, {0x1e193264, 0x5c214285, 0xdc3264c8}},
+        {12, {0xc8, 0x0a, 0x96, 0x14, 0x64, 0x1e, 0x3c, 0xfa}, {0xfa1e1914, 0xbc353a3e, 0x3c647d96}},
+        {13, {0x28, 0x1e, 0x64, 0x14, 0x64, 0x0a, 0xc8, 0x8c}, {0xe4323214, 0xe6333519, 0xea373c23}},
+        {13, {0xc8, 0x70, 0x64, 0x70, 0x3c, 0x60, 0xfa, 0x7e}, {0x7c0e1c35, 0x7c132039, 0x7d1e2841}},
+    };
+    for (const auto & m : ldrModes) {
+        INFO("cem " << m.cem);
+        u8 = PlaneDesc::make(PixelFormat::ASTC_4x4_UNORM(), {4, 4, 1}).toRGBA8(block(m.cem, m.values).block);
+        CHECK(m.texels[0] == u8[0].u32);
+        CHECK(m.texels[1] == u8[5].u32);
+        CHECK(m.texels[2] == u8[15].u32);
+    }
+
+    // HDR end point modes: luminance with swapped end points and both small range layouts, then RGB base and scale in
+    // modes 2, 4 and 5 with the major component green, blue and red, RGB in modes 3 and 6 and the direct mode, and
+    // RGB with LDR alpha and HDR alpha of both layouts.
+    struct HdrMode {
+        uint32_t              cem;
+        std::vector<uint32_t> values;
+        Float4                texels[3];
+    };
+    const HdrMode hdrModes[] = {
+        {2, {0xc8, 0x64}, {Float4::make(0.1875f, 0.1875f, 0.1875f, 1.0f), Float4::make(3.12109375f, 3.12109375f, 3.12109375f, 1.0f), Float4::make(984.0f, 984.0f, 984.0f, 1.0f)}},
+        {3, {0x30, 0x95}, {Float4::make(13.5f, 13.5f, 13.5f, 1.0f), Float4::make(13.7578125f, 13.7578125f, 13.7578125f, 1.0f), Float4::make(14.28125f, 14.28125f, 14.28125f, 1.0f)}},
+        {3, {0xb0, 0x95}, {Float4::make(5.75f, 5.75f, 5.75f, 1.0f), Float4::make(6.609375f, 6.609375f, 6.609375f, 1.0f), Float4::make(8.9375f, 8.9375f, 8.9375f, 1.0f)}},
+        {7,
+         {0xa1, 0xcb, 0x19, 0xa3},
+         {Float4::make(0.095703125f, 0.1201171875f, 0.06982421875f, 1.0f), Float4::make(0.300537109375f, 0.386474609375f, 0.2230224609375f, 1.0f),
+          Float4::make(3.25f, 4.09375f, 2.375f, 1.0f)}},
+        {7,
+         {0xad, 0xa1, 0x8e, 0x6a},
+         {Float4::make(0.78125f, 0.1484375f, 2.625f, 1.0f), Float4::make(2.5703125f, 0.491455078125f, 8.5859375f, 1.0f), Float4::make(29.5f, 5.75f, 100.0f, 1.0f)}},
+        {7,
+         {0xd7, 0xd3, 0xcd, 0x9c},
+         {Float4::make(0.84375f, 0.421875f, 0.1484375f, 1.0f), Float4::make(4.140625f, 2.0703125f, 0.7421875f, 1.0f), Float4::make(108.0f, 54.0f, 19.0f, 1.0f)}},
+        {11,
+         {0x97, 0x8b, 0xbe, 0x3b, 0x75, 0x9a},
+         {Float4::make(6.625f, 13.8125f, 42.0f, 1.0f), Float4::make(8.5859375f, 13.8125f, 45.59375f, 1.0f), Float4::make(14.75f, 13.8125f, 53.0f, 1.0f)}},
+        {11,
+         {0xcf, 0x44, 0xa8, 0xbd, 0xdd, 0x5c},
+         {Float4::make(13.96875f, 17.03125f, 12.625f, 1.0f), Float4::make(15.6328125f, 19.15625f, 14.046875f, 1.0f), Float4::make(19.875f, 24.875f, 17.6875f, 1.0f)}},
+        {11,
+         {0x64, 0xc8, 0x32, 0x96, 0xa0, 0xf0},
+         {Float4::make(0.1796875f, 0.0023193359375f, 0.0078125f, 1.0f), Float4::make(3.078125f, 0.040283203125f, 0.75f, 1.0f),
+          Float4::make(1024.0f, 13.5f, 8192.0f, 1.0f)}},
+        {14,
+         {0xcf, 0x44, 0xa8, 0xbd, 0xdd, 0x5c, 0x1e, 0xc8},
+         {Float4::make(13.96875f, 17.03125f, 12.625f, 7710 / 65535.0f), Float4::make(15.6328125f, 19.15625f, 14.046875f, 22046 / 65535.0f),
+          Float4::make(19.875f, 24.875f, 17.6875f, 51400 / 65535.0f)}},
+        {15,
+         {0xcf, 0x44, 0xa8, 0xbd, 0xdd, 0x5c, 0x50, 0x2f},
+         {Float4::make(13.96875f, 17.03125f, 12.625f, 0.03125f), Float4::make(15.6328125f, 19.15625f, 14.046875f, 0.019378662109375f),
+          Float4::make(19.875f, 24.875f, 17.6875f, 0.0072021484375f)}},
+        {15,
+         {0xcf, 0x44, 0xa8, 0xbd, 0xdd, 0x5c, 0xc0, 0xf0},
+         {Float4::make(13.96875f, 17.03125f, 12.625f, 2.0f), Float4::make(15.6328125f, 19.15625f, 14.046875f, 30.75f), Float4::make(19.875f, 24.875f, 17.6875f, 8192.0f)}},
+    };
+    for (const auto & m : hdrModes) {
+        INFO("cem " << m.cem);
+        f = PlaneDesc::make(PixelFormat::ASTC_4x4_SFLOAT(), {4, 4, 1}).toFloat4(block(m.cem, m.values).block);
+        for (int c = 0; c < 4; ++c) {
+            CHECK(m.texels[0].f32[c] == f[0].f32[c]);
+            CHECK(m.texels[1].f32[c] == f[5].f32[c]);
+            CHECK(m.texels[2].f32[c] == f[15].f32[c]);
+        }
+    }
+
+    // Partitions of the hash function: zero weights and one color per partition, so each texel shows its partition.
+    // 2 partitions of a small block with luminance and luminance-alpha end points, whose modes take the extra bits
+    // below the weights, and 3 and 4 partitions of larger blocks with luminance end points.
+    struct Partitioned {
+        PixelFormat format;
+        uint8_t     block[16];
+        const char * map;
+        uint32_t    colors[4];
+    };
+    const Partitioned partitioned[] = {
+        {PixelFormat::ASTC_4x4_UNORM(),
+         {0x42, 0x48, 0xfc, 0x04, 0x00, 0xe0, 0xff, 0x1f, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // seed 994
+         "0000011100011111",
+         {0xff000000, 0x80ffffff}},
+        {PixelFormat::ASTC_6x6_UNORM(),
+         {0x42, 0xf0, 0x72, 0x00, 0x00, 0x00, 0x10, 0xf0, 0xff, 0x1f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // seed 919
+         "000211000211002211002211022211022211",
+         {0xff000000, 0xff808080, 0xffffffff}},
+        {PixelFormat::ASTC_8x8_UNORM(),
+         {0x42, 0x58, 0x45, 0x00, 0x00, 0xa0, 0xaa, 0x4a, 0x55, 0xf5, 0xff, 0x1f, 0x00, 0x00, 0x00, 0x00}, // seed 554
+         "1111133220000332220023222220231122033111003331110013311001332220",
+         {0xff000000, 0xff555555, 0xffaaaaaa, 0xffffffff}},
+    };
+    for (const auto & p : partitioned) {
+        INFO(p.format.toString());
+        uint32_t size = p.format.layoutDesc().blockWidth;
+        u8            = PlaneDesc::make(p.format, {size, size, 1}).toRGBA8(p.block);
+        REQUIRE(strlen(p.map) == u8.size());
+        for (size_t i = 0; i < u8.size(); ++i) CHECK(p.colors[p.map[i] - '0'] == u8[i].u32);
+    }
+
+    // Integer sequence encoding of trits and quints: a 4x4 grid of 12 level weights (a trit and 2 bits each) that holds
+    // all of them, with RGBA end points of 96 levels (a trit and 5 bits), and a 4x3 grid of 20 level weights (a quint
+    // and 2 bits) with RGBA end points of 160 levels (a quint and 5 bits). Then dual planes: a 4x4 grid of 2-bit weights
+    // for RGB and another one for alpha, the 4th component.
+    struct Golden {
+        const char * name;
+        uint8_t     block[16];
+        uint32_t    texels[16];
+    };
+    const Golden goldens[] = {
+        {"trits",
+         {0x51, 0x82, 0xc5, 0x25, 0xe3, 0xe1, 0xce, 0xc2, 0x40, 0xf7, 0xdc, 0x55, 0xf9, 0x69, 0x58, 0x08},
+         {0xfa3b1d0a, 0x05b4c7ef, 0xb95b4a47, 0x46949ab2, 0xe7442a1c, 0x18abbadd, 0xa2665a5c, 0x5d898a9d, 0xd0503a31, 0x2f9faac8, 0x8f70676e, 0x707f7d8b,
+          0x46949ab2, 0xa2665a5c, 0x2f9faac8, 0x707f7d8b}},
+        {"quints",
+         {0x32, 0x82, 0xc5, 0x0b, 0xe6, 0x07, 0xf7, 0x34, 0x0c, 0x1c, 0xbc, 0xf2, 0x68, 0xe1, 0x71, 0xc8},
+         {0x747e7a87, 0xfb3c1e09, 0x4d9095ab, 0xd94d3529, 0x26a3afcf, 0xae615351, 0x23a5b2d3, 0xaa635554, 0x0bb0c2e8, 0x936f656a, 0x1fa7b5d6, 0xa6655858,
+          0x1ba9b7da, 0xa2675b5c, 0x42969db6, 0xc9544037}},
+        {"dual planes",
+         {0x42, 0x84, 0x81, 0x00, 0x5c, 0x80, 0x09, 0xc0, 0x4c, 0x08, 0x6e, 0x2a, 0x5d, 0x19, 0x7f, 0x3b},
+         {0x00000000, 0x001f4254, 0x004187ab, 0x0061c9ff, 0x54000000, 0x541f4254, 0x544187ab, 0x5461c9ff, 0xab000000, 0xab1f4254, 0xab4187ab, 0xab61c9ff,
+          0xff000000, 0xff1f4254, 0xff4187ab, 0xff61c9ff}},
+    };
+    for (const auto & g : goldens) {
+        INFO(g.name);
+        u8 = PlaneDesc::make(PixelFormat::ASTC_4x4_UNORM(), {4, 4, 1}).toRGBA8(g.block);
+        for (size_t i = 0; i < 16; ++i) CHECK(g.texels[i] == u8[i].u32);
+    }
+
+    // Weight infill: a 5x4 grid of 4-bit weights stretched over an 8x8 block, with black to white end points.
+    const uint8_t infill[16]       = {0xc2, 0x02, 0x00, 0xfe, 0x01, 0x00, 0x11, 0x11, 0xf1, 0xf0, 0xf0, 0xf2, 0x13, 0x02, 0x0f, 0x0f};
+    const uint8_t infillTexels[64] = {0,   143, 223, 80,  80,  223, 143, 0,   28,  128, 191, 131, 143, 235, 155, 28,  60,  112, 163, 179, 211, 251,
+                                      167, 60,  128, 104, 116, 179, 199, 187, 147, 128, 195, 116, 64,  183, 199, 92,  135, 195, 239, 112, 48,  175,
+                                      175, 48,  112, 239, 191, 128, 96,  159, 159, 96,  128, 191, 139, 139, 139, 139, 139, 139, 139, 139};
+    u8                             = PlaneDesc::make(PixelFormat::ASTC_8x8_UNORM(), {8, 8, 1}).toRGBA8(infill);
+    for (size_t i = 0; i < 64; ++i) CHECK(RGBA8::makeU8(infillTexels[i], infillTexels[i], infillTexels[i], 255).u32 == u8[i].u32);
+
+    // void extent blocks of every footprint: one UNORM16 color, clipped to the plane.
+    Bits solid;
+    solid.put(0, 0xdfc, 12).put(12, 0xfffff, 20).put(32, 0xffffffff, 32).put(64, 0x1234, 16).put(80, 0x8000, 16).put(96, 0xffff, 16);
+    const PixelFormat footprints[] = {PixelFormat::ASTC_4x4_UNORM(),   PixelFormat::ASTC_5x4_UNORM(),   PixelFormat::ASTC_5x5_UNORM(),
+                                      PixelFormat::ASTC_6x5_UNORM(),   PixelFormat::ASTC_6x6_UNORM(),   PixelFormat::ASTC_8x5_UNORM(),
+                                      PixelFormat::ASTC_8x6_UNORM(),   PixelFormat::ASTC_8x8_UNORM(),   PixelFormat::ASTC_10x5_UNORM(),
+                                      PixelFormat::ASTC_10x6_UNORM(),  PixelFormat::ASTC_10x8_UNORM(),  PixelFormat::ASTC_10x10_UNORM(),
+                                      PixelFormat::ASTC_12x10_UNORM(), PixelFormat::ASTC_12x12_UNORM()};
+    for (auto format : footprints) {
+        INFO(format.toString());
+        auto texels = PlaneDesc::make(format, {3, 2, 1}).toRGBA8(solid.block);
+        REQUIRE(6 == texels.size());
+        CHECK(RGBA8::makeU8(0x12, 0x80, 0xff, 0).u32 == texels[5].u32);
+    }
+
+    // HDR void extent blocks hold half floats, which LDR formats can't decode.
+    Bits hdr;
+    hdr.put(0, 0xffc, 12).put(12, 0xfffff, 20).put(32, 0xffffffff, 32).put(64, 0x3c00, 16).put(80, 0x4000, 16).put(96, 0xc000, 16).put(112, 0x3800, 16);
+    f = PlaneDesc::make(PixelFormat::ASTC_8x8_SFLOAT(), {8, 8, 1}).toFloat4(hdr.block);
+    CHECK(1.0f == f[63].x);
+    CHECK(2.0f == f[63].y);
+    CHECK(-2.0f == f[63].z);
+    CHECK(0.5f == f[63].w);
+    CHECK(0xffff00ffu == PlaneDesc::make(PixelFormat::ASTC_8x8_UNORM(), {8, 8, 1}).toRGBA8(hdr.block)[0].u32);
+
+    for (auto format : {PixelFormat::ASTC_6x5_UNORM(), PixelFormat::ASTC_12x12_UNORM()}) checkOddSizedDecode(format);
+}
+
+TEST_CASE("pixel-kernels") {
+    // The row converters must produce exactly the same result as the per-pixel conversion functions.
+    const PixelFormat formats[] = {
+        PixelFormat::RGBA_8_8_8_8_UNORM(),     PixelFormat::BGRA_8_8_8_8_UNORM(),     PixelFormat::RGBX_8_8_8_8_UNORM(), PixelFormat::BGRX_8_8_8_8_UNORM(),
+        PixelFormat::RGB_8_8_8_UNORM(),        PixelFormat::RG_8_8_UNORM(),           PixelFormat::R_8_UNORM(),          PixelFormat::L_8_UNORM(),
+        PixelFormat::RGBA_10_10_10_2_UNORM(),  PixelFormat::RGB_11_11_10_FLOAT(),     PixelFormat::R_16_FLOAT(),         PixelFormat::RG_16_16_FLOAT(),
+        PixelFormat::RGBA_16_16_16_16_FLOAT(), PixelFormat::RGBA_16_16_16_16_UNORM(), PixelFormat::R_32_FLOAT(),         PixelFormat::RGBA_32_32_32_32_FLOAT(),
+        PixelFormat::BGRA_5_5_5_1_UNORM(),     PixelFormat::BGR_5_6_5_UNORM(),        PixelFormat::LA_8_8_UNORM(),       PixelFormat::RGBA_8_8_8_8_SRGB(),
+        PixelFormat::RGB_8_8_8_SRGB(),         PixelFormat::RGBA_8_8_8_8_SNORM(),     PixelFormat::RG_8_8_SNORM(),       PixelFormat::RG_16_16_SNORM(),
+    };
+    // The row is wide enough to cover both the SIMD loops and the scalar tail. Every 3rd pixel has out of range, tiny
+    // (denormal in half and 11/10-bit floats) or huge values in it.
+    const uint32_t      w = 37, h = 3;
+    const float         inf     = std::numeric_limits<float>::infinity();
+    const float         edges[] = {-0.0f, -0.5f, 1.5f, 1e-5f, 6e-8f, 1e-40f, 65504.0f, 65535.0f, 1e6f, -1e6f, inf, -inf};
+    std::vector<Float4> source(w * h);
+    for (size_t i = 0; i < source.size(); ++i) {
+        auto f    = (float) i / (float) source.size();
+        source[i] = Float4::make(f, 1.0f - f, f * 0.5f, 0.25f + f * 0.5f);
+        if (0 == i % 3) source[i].f32[i % 4] = edges[i % std::size(edges)];
+    }
+    for (auto format : formats) {
+        INFO(format.toString());
+        auto              plane = PlaneDesc::make(format, {w, h, 1}, 0, 0, 0, 16);
+        std::vector<char> pixels(plane.size);
+        plane.fromFloat4(pixels.data(), pixels.size(), 0, source.data());
+        auto floats = plane.toFloat4(pixels.data());
+        auto rgba8  = plane.toRGBA8(pixels.data());
+        REQUIRE(floats.size() == w * h);
+        REQUIRE(rgba8.size() == w * h);
+        for (uint32_t y = 0; y < h; ++y) {
+            for (uint32_t x = 0; x < w; ++x) {
+                auto i = y * w + x;
+                auto p = format.loadFromFloat4(source[i]);
+                REQUIRE(0 == memcmp(&p, pixels.data() + plane.pixel(x, y), format.bytesPerBlock()));
+                auto f = format.storeToFloat4(pixels.data() + plane.pixel(x, y));
+                REQUIRE(0 == memcmp(&f, &floats[i], sizeof(f)));
+                CHECK(rgba8[i].r == (uint8_t) (std::clamp(f.x, 0.f, 1.f) * 255.0f));
+                CHECK(rgba8[i].a == (uint8_t) (std::clamp(f.w, 0.f, 1.f) * 255.0f));
+            }
+        }
+    }
+
+    // check swizzling of BGRA format.
+    auto    bgra     = PlaneDesc::make(PixelFormat::BGRA_8_8_8_8_UNORM(), {1, 1, 1});
+    uint8_t bytes[4] = {1, 2, 3, 4};
+    auto    c        = bgra.toRGBA8(bytes)[0];
+    CHECK(c.r == 3);
+    CHECK(c.g == 2);
+    CHECK(c.b == 1);
+    CHECK(c.a == 4);
+    uint8_t back[4] = {};
+    bgra.fromFloat4(back, sizeof(back), 0, bgra.toFloat4(bytes).data());
+    CHECK(0 == memcmp(bytes, back, 4));
+}
+
+TEST_CASE("bc-decode") {
+    // BC1 with red and blue end points, indices 0, 1, 2, 3 in every row.
+    const uint8_t bc1[] = {0x00, 0xf8, 0x1f, 0x00, 0xe4, 0xe4, 0xe4, 0xe4};
+    auto          rgba  = PlaneDesc::make(PixelFormat::BC1_UNORM(), {4, 4, 1}).toRGBA8(bc1);
+    REQUIRE(16 == rgba.size());
+    for (int y = 0; y < 4; ++y) {
+        CHECK(0xff0000ffu == rgba[y * 4 + 0].u32);
+        CHECK(0xffff0000u == rgba[y * 4 + 1].u32);
+        CHECK(0xff5500aau == rgba[y * 4 + 2].u32);
+        CHECK(0xffaa0055u == rgba[y * 4 + 3].u32);
+    }
+
+    // 3 color mode, when c0 <= c1: index 3 is black. BC1_UNORM ignores alpha.
+    const uint8_t bc1b[] = {0x1f, 0x00, 0x00, 0xf8, 0xff, 0xff, 0xff, 0xff};
+    CHECK(0xff000000u == PlaneDesc::make(PixelFormat::BC1_UNORM(), {4, 4, 1}).toRGBA8(bc1b)[5].u32);
+
+    // BC3: interpolated alpha, 8 value mode (255, 0, 219, 182, ...). Texel 1 uses index 2.
+    uint8_t bc3[16] = {0xff, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00};
+    memcpy(bc3 + 8, bc1, 8);
+    rgba = PlaneDesc::make(PixelFormat::BC3_UNORM(), {4, 4, 1}).toRGBA8(bc3);
+    CHECK(0xff0000ffu == rgba[0].u32);
+    CHECK(0xdbff0000u == rgba[1].u32);
+
+    // BC4 signed: -128 is clamped to -1, and 6 value mode has an explicit 1 at index 7.
+    const uint8_t bc4[] = {0x80, 0x7f, 0xc8, 0xff, 0xff, 0xff, 0xff, 0xff};
+    auto          f     = PlaneDesc::make(PixelFormat::BC4_SNORM(), {4, 4, 1}).toFloat4(bc4);
+    CHECK(-1.0f == f[0].x);
+    CHECK(1.0f == f[1].x);
+    CHECK(0.0f == f[0].y);
+    CHECK(1.0f == f[0].w);
+    CHECK(1.0f == f[15].x);
+
+    // sRGB end points decode to linear.
+    auto srgb = PlaneDesc::make(PixelFormat::BC1_SRGB(), {4, 4, 1}).toFloat4(bc1);
+    CHECK(std::abs(srgb[2].x - std::pow((170.0f / 255.0f + 0.055f) / 1.055f, 2.4f)) < 1e-6f);
+
+    for (auto format : {PixelFormat::BC1_UNORM(), PixelFormat::BC2_UNORM(), PixelFormat::BC3_UNORM(), PixelFormat::BC4_UNORM(), PixelFormat::BC5_UNORM()}) {
+        checkOddSizedDecode(format);
+    }
+}
+
+TEST_CASE("bc6h-bc7-decode") {
+    // BC7 mode 6: 7-bit RGBA end points plus p-bits, so (0, 0, 0, 254) to (255, 255, 255, 1). Texel i uses index i.
+    Bits bc7;
+    bc7.put(1 << 6, 7).put(0, 7).put(127, 7).put(0, 7).put(127, 7).put(0, 7).put(127, 7).put(127, 7).put(0, 7).put(0, 1).put(1, 1);
+    for (uint32_t i = 0; i < 16; ++i) bc7.put(i, i ? 4 : 3);
+    auto rgba = PlaneDesc::make(PixelFormat::BC7_UNORM(), {4, 4, 1}).toRGBA8(bc7.block);
+    CHECK(RGBA8::makeU8(0, 0, 0, 254).u32 == rgba[0].u32);
+    CHECK(RGBA8::makeU8(135, 135, 135, 120).u32 == rgba[8].u32); // weight 34
+    CHECK(RGBA8::makeU8(255, 255, 255, 1).u32 == rgba[15].u32);
+
+    // BC7 mode 5: separate color and alpha indices, then alpha is rotated into red.
+    Bits bc7r;
+    bc7r.put(1 << 5, 6).put(1, 2).put(0, 7).put(127, 7).put(0, 7).put(127, 7).put(0, 7).put(127, 7).put(0, 8).put(255, 8).put(0, 31).put(0x7fffffff, 31);
+    CHECK(RGBA8::makeU8(255, 0, 0, 0).u32 == PlaneDesc::make(PixelFormat::BC7_UNORM(), {4, 4, 1}).toRGBA8(bc7r.block)[5].u32);
+
+    // BC7 blocks without a mode are transparent black.
+    const uint8_t zeros[16] = {};
+    CHECK(0 == PlaneDesc::make(PixelFormat::BC7_UNORM(), {4, 4, 1}).toRGBA8(zeros)[3].u32);
+
+    // BC6H mode 11: one subset, 10-bit end points from 0 to 1023. Texel i uses index i.
+    Bits bc6;
+    bc6.put(3, 5).put(0, 10).put(0, 10).put(0, 10).put(1023, 10).put(1023, 10).put(1023, 10);
+    for (uint32_t i = 0; i < 16; ++i) bc6.put(i, i ? 4 : 3);
+    auto f = PlaneDesc::make(PixelFormat::BC6H_UNORM(), {4, 4, 1}).toFloat4(bc6.block);
+    CHECK(0.0f == f[0].x);
+    CHECK(2.935546875f == f[8].y); // half 0x41df
+    CHECK(65504.0f == f[15].z);    // max half
+    CHECK(1.0f == f[15].w);
+    CHECK(RGBA8::makeU8(255, 255, 255, 255).u32 == PlaneDesc::make(PixelFormat::BC6H_UNORM(), {4, 4, 1}).toRGBA8(bc6.block)[15].u32);
+
+    // the same bits as signed: 1023 is -1, which decodes to a negative denormal half.
+    f = PlaneDesc::make(PixelFormat::BC6H_SNORM(), {4, 4, 1}).toFloat4(bc6.block);
+    CHECK(0.0f == f[0].x);
+    CHECK(-93.0f / 16777216.0f == f[15].x);
+
+    // reserved BC6H modes are black.
+    const uint8_t reserved[16] = {0x13};
+    f                          = PlaneDesc::make(PixelFormat::BC6H_UNORM(), {4, 4, 1}).toFloat4(reserved);
+    CHECK(0.0f == f[7].x);
+    CHECK(1.0f == f[7].w);
+
+    // DXGI formats of DDS files.
+    CHECK(PixelFormat::BC6H_UNORM() == PixelFormat::fromDXGI(95));
+    CHECK(PixelFormat::BC6H_SNORM() == PixelFormat::fromDXGI(96));
+    CHECK(PixelFormat::BC7_UNORM() == PixelFormat::fromDXGI(98));
+    CHECK(99 == PixelFormat::BC7_SRGB().toDXGI());
+}
+
+TEST_CASE("bc-encode") {
+    // smooth gradients with a little noise, and a hard edge in the middle.
+    auto               plane = PlaneDesc::make(PixelFormat::RGBA8(), {37, 21, 1});
+    std::vector<RGBA8> source(37 * 21);
+    for (uint32_t y = 0; y < 21; ++y) {
+        for (uint32_t x = 0; x < 37; ++x) {
+            auto noise         = (uint8_t) ((x * 7919 + y * 104729) % 7);
+            source[y * 37 + x] = RGBA8::makeU8((uint8_t) (x * 6 + noise), (uint8_t) (y * 12), x < 18 ? (uint8_t) 40 : (uint8_t) 200, (uint8_t) (255 - x * 6));
+        }
+    }
+    auto rmse = [&](const Image & image, int channels) {
+        auto   decoded = image.plane().toRGBA8(image.data());
+        double sum     = 0;
+        for (size_t i = 0; i < decoded.size(); ++i) {
+            for (int c = 0; c < channels; ++c) sum += std::pow((double) decoded[i].u8[c] - (double) source[i].u8[c], 2.0);
+        }
+        return std::sqrt(sum / (double) (decoded.size() * channels));
+    };
+
+    SECTION("presets") {
+        using P = PlaneDesc::CompressParameters;
+        for (auto [format, channels, limit] : {std::make_tuple(PixelFormat::BC1_UNORM(), 3, 6.0), std::make_tuple(PixelFormat::BC2_UNORM(), 4, 6.0),
+                                               std::make_tuple(PixelFormat::BC3_UNORM(), 4, 5.0), std::make_tuple(PixelFormat::BC4_UNORM(), 1, 2.0),
+                                               std::make_tuple(PixelFormat::BC5_UNORM(), 2, 2.0), std::make_tuple(PixelFormat::BC7_UNORM(), 4, 3.0),
+                                               std::make_tuple(PixelFormat::ETC2_UNORM(), 3, 6.0), std::make_tuple(PixelFormat::ETC2_EAC_UNORM(), 4, 5.0)}) {
+            INFO(format.toString());
+            auto fast    = plane.compress(source.data(), format, P().setPreset(P::FAST));
+            auto quality = plane.compress(source.data(), format, P().setPreset(P::QUALITY));
+            REQUIRE(format == fast.format());
+            REQUIRE(37 == fast.width());
+            CHECK(rmse(fast, channels) < limit);
+            CHECK(rmse(quality, channels) <= rmse(fast, channels));
+        }
+    }
+
+    SECTION("solid and alpha") {
+        // a solid color is reproduced within 565 precision.
+        std::vector<RGBA8> solid(16, RGBA8::makeU8(100, 150, 200, 255));
+        auto               bc1  = PlaneDesc::make(PixelFormat::RGBA8(), {4, 4, 1}).compress(solid.data(), PixelFormat::BC1_UNORM());
+        auto               rgba = bc1.plane().toRGBA8(bc1.data());
+        for (int c = 0; c < 3; ++c) CHECK(std::abs(rgba[5].u8[c] - solid[5].u8[c]) <= 1);
+
+        // BC1 with alpha channel gets 1-bit alpha: transparent texels use the transparent black of the 3 color mode.
+        for (size_t i = 0; i < 16; i += 3) solid[i].a = 0;
+        auto format = PixelFormat::make(PixelFormat::LAYOUT_BC1, PixelFormat::SIGN_UNORM, PixelFormat::SWIZZLE_XYZW);
+        auto bc1a   = PlaneDesc::make(PixelFormat::RGBA8(), {4, 4, 1}).compress(solid.data(), format);
+        rgba        = bc1a.plane().toRGBA8(bc1a.data());
+        for (size_t i = 0; i < 16; ++i) CHECK(rgba[i].a == (i % 3 ? 255 : 0));
+        CHECK(std::abs(rgba[1].g - 150) <= 2);
+    }
+
+    SECTION("signed") {
+        // BC4 and BC5 SNORM from float ramps, with negative values.
+        auto               rg = PlaneDesc::make(PixelFormat::RG_32_32_FLOAT(), {8, 8, 1});
+        std::vector<float> values(8 * 8 * 2);
+        for (size_t i = 0; i < 64; ++i) {
+            values[i * 2 + 0] = (float) (i % 8) / 7.0f - 0.5f;
+            values[i * 2 + 1] = 0.5f - (float) (i / 8) / 7.0f;
+        }
+        for (auto format : {PixelFormat::BC4_SNORM(), PixelFormat::BC5_SNORM()}) {
+            auto image  = rg.compress(values.data(), format);
+            auto floats = image.plane().toFloat4(image.data());
+            int  used   = PixelFormat::BC5_SNORM() == format ? 2 : 1;
+            for (size_t i = 0; i < floats.size(); ++i) {
+                for (int c = 0; c < used; ++c) CHECK(std::abs(floats[i].f32[c] - values[i * 2 + c]) < 0.05f);
+            }
+        }
+    }
+
+    SECTION("mipmaps") {
+        // compress the whole mipmap chain in one call. Threads and executor produce the same bits.
+        auto     mipmaps  = plane.generateMipmaps(source.data());
+        auto     single   = mipmaps.compress(PixelFormat::BC3_UNORM(), PlaneDesc::CompressParameters().setThreads(1));
+        auto     multi    = mipmaps.compress(PixelFormat::BC3_UNORM(), PlaneDesc::CompressParameters().setThreads(4));
+        size_t   jobs     = 0;
+        Executor executor = [&](size_t count, const std::function<void(size_t)> & job) {
+            for (size_t i = 0; i < count; ++i) job(i);
+            jobs += count;
+        };
+        auto hooked = mipmaps.compress(PixelFormat::BC3_UNORM(), PlaneDesc::CompressParameters().setExecutor(executor));
+        REQUIRE(mipmaps.desc().levels == single.desc().levels);
+        REQUIRE(single.size() == multi.size());
+        CHECK(jobs >= mipmaps.desc().levels);
+        CHECK(0 == memcmp(single.data(), multi.data(), single.size()));
+        CHECK(0 == memcmp(single.data(), hooked.data(), single.size()));
+        for (uint32_t l = 0; l < mipmaps.desc().levels; ++l) {
+            INFO(l);
+            auto expected = mipmaps.plane({0, 0, l}).toRGBA8(mipmaps.at({0, 0, l}));
+            auto actual   = single.plane({0, 0, l}).toRGBA8(single.at({0, 0, l}));
+            REQUIRE(expected.size() == actual.size());
+            for (size_t i = 0; i < actual.size(); ++i) CHECK(std::abs(actual[i].a - expected[i].a) <= 8);
+        }
+
+        // compressed sources are decoded first.
+        auto bc1 = single.compress(PixelFormat::BC1_UNORM());
+        CHECK(bc1.desc().levels == single.desc().levels);
+
+        // they are decoded on the executor too: one batch per level to decode, then one to encode.
+        size_t   calls    = 0;
+        Executor counting = [&](size_t count, const std::function<void(size_t)> & job) {
+            for (size_t i = 0; i < count; ++i) job(i);
+            ++calls;
+        };
+        auto bc1b = single.compress(PixelFormat::BC1_UNORM(), PlaneDesc::CompressParameters().setExecutor(counting));
+        CHECK(single.desc().levels + 1 == calls);
+        CHECK(0 == memcmp(bc1.data(), bc1b.data(), bc1.size()));
+
+        // layouts without an encoder yet.
+        CHECK(plane.compress(source.data(), PixelFormat::BC6H_UNORM()).empty());
+    }
+
+    SECTION("bc7") {
+        using P = PlaneDesc::CompressParameters;
+
+        // solid blocks are exact, alpha included.
+        std::vector<RGBA8> solid(16, RGBA8::makeU8(17, 128, 251, 99));
+        auto               bc7  = PlaneDesc::make(PixelFormat::RGBA8(), {4, 4, 1}).compress(solid.data(), PixelFormat::BC7_UNORM());
+        auto               rgba = bc7.plane().toRGBA8(bc7.data());
+        for (size_t i = 0; i < 16; ++i) CHECK(rgba[i].u32 == solid[i].u32);
+
+        // the mode mask is honored, and blocks with alpha fall back to mode 6 when only modes without alpha are on.
+        for (auto [modes, expected] : {std::make_pair(0x40u, 0x40), std::make_pair(0x02u, 0x40), std::make_pair(0x20u, 0x20)}) {
+            INFO(modes);
+            auto image = plane.compress(source.data(), PixelFormat::BC7_UNORM(), P().setBc7Modes(modes));
+            for (size_t i = 0; i < image.size(); i += 16) CHECK(expected == (image.data()[i] & -image.data()[i]));
+        }
+
+        // more effort gives a better result, regardless of how the blocks are spread over the threads.
+        auto fast = plane.compress(source.data(), PixelFormat::BC7_UNORM(), P().setThreads(1));
+        auto best = plane.compress(source.data(), PixelFormat::BC7_UNORM(), P().setPreset(P::QUALITY).setBc7Partitions(64).setThreads(1));
+        auto many = plane.compress(source.data(), PixelFormat::BC7_UNORM(), P().setPreset(P::QUALITY).setBc7Partitions(64).setThreads(3));
+        CHECK(rmse(best, 4) <= rmse(fast, 4));
+        REQUIRE(best.size() == many.size());
+        CHECK(0 == memcmp(best.data(), many.data(), best.size()));
+
+        // sRGB formats are encoded in sRGB space, BC7 still well ahead of BC3.
+        auto srgb = plane.compress(source.data(), PixelFormat::BC7_SRGB());
+        CHECK(rmse(srgb, 4) < rmse(plane.compress(source.data(), PixelFormat::BC3_SRGB()), 4));
+    }
+}
+
+TEST_CASE("etc2") {
+    SECTION("decode") {
+        // individual mode: red and black 4-bit base colors side by side, table 0. Texel (3, 3) has index 3 (-8), the
+        // others index 0 (+2). Indices are in column major order, MSBs first.
+        const uint8_t etc[8] = {0xf0, 0, 0, 0, 0x80, 0, 0x80, 0};
+        auto          rgba   = PlaneDesc::make(PixelFormat::ETC2_UNORM(), {4, 4, 1}).toRGBA8(etc);
+        CHECK(RGBA8::makeU8(255, 2, 2, 255).u32 == rgba[0].u32);
+        CHECK(RGBA8::makeU8(2, 2, 2, 255).u32 == rgba[2].u32);
+        CHECK(RGBA8::makeU8(0, 0, 0, 255).u32 == rgba[15].u32);
+
+        // The expected texels below come from a separate model of the ETC2 chapter of the Khronos Data Format
+        // Specification, not from this decoder. Every block has indices 0, 1, 2, 3 in its first row, and 1, 2, 3, 0 and
+        // so on in the others.
+        auto decode = [](std::initializer_list<uint8_t> block) {
+            REQUIRE(8 == block.size());
+            return PlaneDesc::make(PixelFormat::ETC2_UNORM(), {4, 4, 1}).toRGBA8(block.begin());
+        };
+
+        // differential mode: 5-bit base (20, 10, 31) and delta (-3, 2, -1), so (165, 82, 255) and (140, 99, 247).
+        // Tables 2 and 5 for the top and bottom halves (flipped).
+        rgba = decode({0xa5, 0x52, 0xff, 0x57, 0x93, 0x6c, 0x5a, 0x5a});
+        CHECK(RGBA8::makeU8(174, 91, 255, 255).u32 == rgba[0].u32);
+        CHECK(RGBA8::makeU8(194, 111, 255, 255).u32 == rgba[1].u32);
+        CHECK(RGBA8::makeU8(156, 73, 246, 255).u32 == rgba[2].u32);
+        CHECK(RGBA8::makeU8(136, 53, 226, 255).u32 == rgba[3].u32);
+        CHECK(RGBA8::makeU8(116, 75, 223, 255).u32 == rgba[8].u32);
+        CHECK(RGBA8::makeU8(60, 19, 167, 255).u32 == rgba[9].u32);
+        CHECK(RGBA8::makeU8(164, 123, 255, 255).u32 == rgba[10].u32);
+        CHECK(RGBA8::makeU8(220, 179, 255, 255).u32 == rgba[11].u32);
+
+        // T mode, red overflows: 4-bit bases (a, 3, 5) and (4, c, 8), distance 32 around the 2nd base.
+        rgba = decode({0xf2, 0x35, 0x4c, 0x8b, 0x93, 0x6c, 0x5a, 0x5a});
+        CHECK(RGBA8::makeU8(170, 51, 85, 255).u32 == rgba[0].u32);
+        CHECK(RGBA8::makeU8(100, 236, 168, 255).u32 == rgba[1].u32);
+        CHECK(RGBA8::makeU8(68, 204, 136, 255).u32 == rgba[2].u32);
+        CHECK(RGBA8::makeU8(36, 172, 104, 255).u32 == rgba[3].u32);
+        CHECK(RGBA8::makeU8(170, 51, 85, 255).u32 == rgba[7].u32);
+
+        // H mode, green overflows: bases (c, 6, 3) and (5, 9, e) with distance bits 01. The LSB of the distance index is
+        // 1 when the 1st base is the larger one, so the distance is 16, and 11 with the bases the other way around.
+        rgba = decode({0x63, 0x05, 0xac, 0xf3, 0x93, 0x6c, 0x5a, 0x5a});
+        CHECK(RGBA8::makeU8(220, 118, 67, 255).u32 == rgba[0].u32);
+        CHECK(RGBA8::makeU8(188, 86, 35, 255).u32 == rgba[1].u32);
+        CHECK(RGBA8::makeU8(101, 169, 254, 255).u32 == rgba[2].u32);
+        CHECK(RGBA8::makeU8(69, 137, 222, 255).u32 == rgba[3].u32);
+        rgba = decode({0x2c, 0xfb, 0x63, 0x1b, 0x93, 0x6c, 0x5a, 0x5a});
+        CHECK(RGBA8::makeU8(96, 164, 249, 255).u32 == rgba[0].u32);
+        CHECK(RGBA8::makeU8(74, 142, 227, 255).u32 == rgba[1].u32);
+        CHECK(RGBA8::makeU8(215, 113, 62, 255).u32 == rgba[2].u32);
+        CHECK(RGBA8::makeU8(193, 91, 40, 255).u32 == rgba[3].u32);
+
+        // planar mode, blue overflows: origin (10, 100, 50), horizontal (60, 20, 5) and vertical (30, 120, 63) in 6, 7
+        // and 6 bits.
+        rgba = decode({0x95, 0x49, 0x15, 0x7a, 0x28, 0x2b, 0xde, 0x3f});
+        CHECK(RGBA8::makeU8(40, 201, 203, 255).u32 == rgba[0].u32);
+        CHECK(RGBA8::makeU8(192, 80, 66, 255).u32 == rgba[3].u32);
+        CHECK(RGBA8::makeU8(111, 171, 170, 255).u32 == rgba[5].u32);
+        CHECK(RGBA8::makeU8(101, 231, 242, 255).u32 == rgba[12].u32);
+        CHECK(RGBA8::makeU8(253, 110, 105, 255).u32 == rgba[15].u32);
+
+        // EAC alpha first: base 128, multiplier 1 and table 13, whose index 4 is 0 and index 7 is 9.
+        const uint8_t eac[16] = {128, 0x1d, 0xf2, 0x49, 0x24, 0x92, 0x49, 0x24, 0xf0, 0, 0, 0, 0x80, 0, 0x80, 0};
+        rgba                  = PlaneDesc::make(PixelFormat::ETC2_EAC_UNORM(), {4, 4, 1}).toRGBA8(eac);
+        CHECK(RGBA8::makeU8(255, 2, 2, 137).u32 == rgba[0].u32);
+        CHECK(RGBA8::makeU8(0, 0, 0, 128).u32 == rgba[15].u32);
+    }
+
+    SECTION("encode") {
+        using P   = PlaneDesc::CompressParameters;
+        auto rgba = PlaneDesc::make(PixelFormat::RGBA8(), {4, 4, 1});
+
+        // 2 colors that the base colors of the T mode hold exactly, with opaque and transparent alpha.
+        std::vector<RGBA8> checker(16);
+        for (size_t i = 0; i < 16; ++i) checker[i] = (i + i / 4) % 2 ? RGBA8::makeU8(255, 0, 0, 255) : RGBA8::makeU8(0, 0, 255, 0);
+        for (auto preset : {P::FAST, P::QUALITY}) {
+            auto image   = rgba.compress(checker.data(), PixelFormat::ETC2_EAC_UNORM(), P().setPreset(preset));
+            auto decoded = image.plane().toRGBA8(image.data());
+            for (size_t i = 0; i < 16; ++i) CHECK(checker[i].u32 == decoded[i].u32);
+        }
+
+        // a smooth gradient takes the planar mode.
+        std::vector<RGBA8> gradient(16);
+        for (uint32_t i = 0; i < 16; ++i) gradient[i] = RGBA8::makeU8((uint8_t) (i % 4 * 40 + 30), (uint8_t) (i / 4 * 30 + 60), 90, 255);
+        auto image   = rgba.compress(gradient.data(), PixelFormat::ETC2_UNORM());
+        auto decoded = image.plane().toRGBA8(image.data());
+        for (size_t i = 0; i < 16; ++i)
+            for (int c = 0; c < 3; ++c) CHECK(std::abs(decoded[i].u8[c] - gradient[i].u8[c]) <= 2);
+
+        // the whole mipmap chain at once, with the same bits regardless of the threads, and sRGB in sRGB space.
+        auto               plane = PlaneDesc::make(PixelFormat::RGBA8(), {37, 21, 1});
+        std::vector<RGBA8> source(37 * 21);
+        for (uint32_t i = 0; i < source.size(); ++i) source[i] = RGBA8::makeU8((uint8_t) (i * 7), (uint8_t) (i / 37 * 12), (uint8_t) (i % 37 * 6), (uint8_t) i);
+        auto mipmaps = plane.generateMipmaps(source.data());
+        for (auto format : {PixelFormat::ETC2_UNORM(), PixelFormat::ETC2_SRGB(), PixelFormat::ETC2_EAC_UNORM(), PixelFormat::ETC2_EAC_SRGB()}) {
+            INFO(format.toString());
+            auto single = mipmaps.compress(format, P().setPreset(P::QUALITY).setThreads(1));
+            auto multi  = mipmaps.compress(format, P().setPreset(P::QUALITY).setThreads(3));
+            REQUIRE(mipmaps.desc().levels == single.desc().levels);
+            REQUIRE(single.size() == multi.size());
+            CHECK(0 == memcmp(single.data(), multi.data(), single.size()));
+            auto   expected = mipmaps.plane().toRGBA8(mipmaps.data());
+            auto   actual   = single.plane().toRGBA8(single.data());
+            double sum      = 0;
+            for (size_t i = 0; i < actual.size(); ++i) sum += std::abs(actual[i].g - expected[i].g);
+            CHECK(sum / (double) actual.size() < 4.0);
+        }
+    }
+}
+
+TEST_CASE("small-float") {
+    // half, rounded toward zero, with denormals, overflow and infinity.
+    auto half = [](float f) { return PixelFormat::R_16_FLOAT().loadFromFloat4(Float4::make(f, 0, 0, 0)).u16[0]; };
+    CHECK(0x3c00 == half(1.0f));
+    CHECK(0xc000 == half(-2.0f));
+    CHECK(0x3555 == half(1.0f / 3.0f));
+    CHECK(0x0001 == half(6e-8f));
+    CHECK(0x0000 == half(1e-8f));
+    CHECK(0x8000 == half(-0.0f));
+    CHECK(0x7bff == half(65504.0f));
+    CHECK(0x7bff == half(1e6f));
+    CHECK(0xfc00 == half(-std::numeric_limits<float>::infinity()));
+    CHECK(0x7c00 == (half(std::numeric_limits<float>::quiet_NaN()) & 0x7c00));
+
+    // every half value (except NaN) must survive the round trip.
+    auto fmt = PixelFormat::R_16_FLOAT();
+    for (uint32_t i = 0; i < 0x10000; ++i) {
+        if ((i & 0x7c00) == 0x7c00 && (i & 0x3ff)) continue;
+        uint16_t h = (uint16_t) i;
+        auto     f = fmt.storeToFloat4(&h);
+        REQUIRE(h == fmt.loadFromFloat4(f).u16[0]);
+    }
+    CHECK(std::ldexp(1.0f, -24) == fmt.storeToFloat4("\x01\x00").x);
+
+    // unsigned 11/10-bit floats: negative values clamp to zero.
+    auto r11 = PixelFormat::RGB_11_11_10_FLOAT();
+    CHECK(0 == r11.loadFromFloat4(Float4::make(-1.0f, -std::numeric_limits<float>::infinity(), -0.0f, 1.0f)).u32[0]);
+    auto p = r11.loadFromFloat4(Float4::make(1.0f, 65024.0f, 1e9f, 1.0f));
+    CHECK(0x3c0u == (p.u32[0] & 0x7ff));
+    CHECK(0x7bfu == ((p.u32[0] >> 11) & 0x7ff));
+    CHECK(0x3dfu == (p.u32[0] >> 22));
+}
+
+TEST_CASE("srgb-and-signed") {
+    // every 8-bit sRGB value must survive the round trip, and decode to the exact transfer function.
+    auto srgb = PixelFormat::RGBA_8_8_8_8_SRGB();
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint8_t p[4] = {(uint8_t) i, (uint8_t) (255 - i), (uint8_t) i, (uint8_t) i};
+        auto    f    = srgb.storeToFloat4(p);
+        auto    c    = (float) i / 255.0f;
+        auto    ref  = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        REQUIRE(f.x == ref);
+        REQUIRE(f.w == c); // alpha is linear
+        REQUIRE(0 == memcmp(p, srgb.loadFromFloat4(f).u8, 4));
+    }
+    // encoding rounds to the nearest sRGB code, and clamps.
+    CHECK(188 == srgb.loadFromFloat4(Float4::make(0.5f, 0, 0, 0)).u8[0]);
+    CHECK(0 == srgb.loadFromFloat4(Float4::make(-1.0f, 0, 0, 0)).u8[0]);
+    CHECK(0 == srgb.loadFromFloat4(Float4::make(1e-30f, 0, 0, 0)).u8[0]);
+    CHECK(255 == srgb.loadFromFloat4(Float4::make(2.0f, 0, 0, 0)).u8[0]);
+    CHECK(0 == srgb.loadFromFloat4(Float4::make(std::numeric_limits<float>::quiet_NaN(), 0, 0, 0)).u8[0]);
+
+    // SNORM: both -128 and -127 map to -1.0, and every value except -128 survives the round trip.
+    auto snorm = PixelFormat::R_8_SNORM();
+    CHECK(-1.0f == snorm.storeToFloat4("\x80").x);
+    CHECK(-1.0f == snorm.storeToFloat4("\x81").x);
+    CHECK(1.0f == snorm.storeToFloat4("\x7f").x);
+    CHECK(0.0f == snorm.storeToFloat4("\x00").x);
+    for (int i = -127; i < 128; ++i) {
+        auto b = (int8_t) i;
+        REQUIRE(b == (int8_t) snorm.loadFromFloat4(snorm.storeToFloat4(&b)).u8[0]);
+    }
+    CHECK(0x81 == snorm.loadFromFloat4(Float4::make(-5.0f, 0, 0, 0)).u8[0]);
+    CHECK(0x7f == snorm.loadFromFloat4(Float4::make(5.0f, 0, 0, 0)).u8[0]);
+    CHECK(0 == snorm.loadFromFloat4(Float4::make(std::numeric_limits<float>::quiet_NaN(), 0, 0, 0)).u8[0]);
+    int16_t s16 = -32767;
+    CHECK(-1.0f == PixelFormat::R_16_SNORM().storeToFloat4(&s16).x);
+
+    // SINT clamps to the signed range.
+    auto sint = PixelFormat::R_8_SINT();
+    CHECK(-128.0f == sint.storeToFloat4("\x80").x);
+    CHECK(0x80 == sint.loadFromFloat4(Float4::make(-1000.0f, 0, 0, 0)).u8[0]);
+    CHECK(0x7f == sint.loadFromFloat4(Float4::make(1000.0f, 0, 0, 0)).u8[0]);
+    CHECK(0xfd == sint.loadFromFloat4(Float4::make(-3.0f, 0, 0, 0)).u8[0]);
+    CHECK(0 == sint.loadFromFloat4(Float4::make(std::numeric_limits<float>::quiet_NaN(), 0, 0, 0)).u8[0]);
+
+    // biased formats.
+    auto bnorm = PixelFormat::make(PixelFormat::LAYOUT_8, PixelFormat::SIGN_BNORM, PixelFormat::SWIZZLE_X001);
+    CHECK(-1.0f == bnorm.storeToFloat4("\x00").x);
+    CHECK(1.0f == bnorm.storeToFloat4("\xff").x);
+    CHECK(0x80 == bnorm.loadFromFloat4(Float4::make(0.0f, 0, 0, 0)).u8[0]);
+    CHECK(0x80 == bnorm.loadFromFloat4(Float4::make(std::numeric_limits<float>::quiet_NaN(), 0, 0, 0)).u8[0]);
+    auto bint = PixelFormat::make(PixelFormat::LAYOUT_8, PixelFormat::SIGN_BINT, PixelFormat::SWIZZLE_X001);
+    CHECK(-128.0f == bint.storeToFloat4("\x00").x);
+    CHECK(0x83 == bint.loadFromFloat4(Float4::make(3.0f, 0, 0, 0)).u8[0]);
+    CHECK(0x80 == bint.loadFromFloat4(Float4::make(std::numeric_limits<float>::quiet_NaN(), 0, 0, 0)).u8[0]);
+
+    // sRGB mipmaps are filtered in linear space: black and white average to linear 0.5, not to sRGB 128.
+    auto desc = ImageDesc::make(PlaneDesc::make(srgb, {2, 1, 1}), 1, 1, 0);
+    for (bool fused : {true, false}) {
+        Image image(desc);
+        memset(image.data(), 0, 4);
+        memset(image.data() + 4, 255, 4);
+        REQUIRE(desc.generateMipmaps(image.data(), PlaneDesc::GenerateMipmapsParameters().setFused(fused)));
+        auto level1 = image.at({0, 0, 1});
+        CHECK(188 == level1[0]);
+        CHECK(188 == level1[2]);
+        CHECK(127 == level1[3]); // alpha is averaged as is
+    }
+}
+
+TEST_CASE("generate-mipmaps") {
+    SECTION("plane") {
+        // 2x2 R32F plane with padding at the end of each row.
+        auto  plane    = PlaneDesc::make(PixelFormat::R_32_FLOAT(), {2, 2, 1}, 0, 16);
+        float texels[] = {1.0f, 3.0f, -1.0f, -1.0f, 5.0f, 7.0f, -1.0f, -1.0f};
+        auto  mipmaps  = plane.generateMipmaps(texels);
+        REQUIRE(mipmaps.desc().levels == 2);
+        REQUIRE(mipmaps.desc().faces == 1);
+        CHECK(mipmaps.width({0, 0, 1}) == 1);
+        auto base = (const float *) mipmaps.at({0, 0, 0});
+        CHECK(base[0] == 1.0f);
+        CHECK(base[1] == 3.0f);
+        CHECK(*(const float *) mipmaps.at({0, 0, 0}, 0, 1) == 5.0f);
+        CHECK(*(const float *) mipmaps.at({0, 0, 1}) == 4.0f);
+    }
+
+    SECTION("parallel") {
+        // cube array: all faces and ranks are filled with different content.
+        auto  desc   = ImageDesc::make(PlaneDesc::make(PixelFormat::RGBA8(), {64, 64, 1}), 2, 6, 0);
+        Image single = Image(desc);
+        for (size_t r = 0; r < desc.ranks; ++r) {
+            for (size_t f = 0; f < desc.faces; ++f) {
+                auto p = single.at({r, f, 0});
+                for (size_t i = 0; i < desc.plane().size; ++i) p[i] = (uint8_t) (i * 7 + r * 31 + f * 13);
+            }
+        }
+        Image multi  = single.clone();
+        Image hooked = single.clone();
+        REQUIRE(desc.generateMipmaps(single.data(), PlaneDesc::GenerateMipmapsParameters().setThreads(1)));
+        REQUIRE(desc.generateMipmaps(multi.data(), PlaneDesc::GenerateMipmapsParameters().setThreads(4)));
+        size_t   jobs     = 0;
+        Executor executor = [&](size_t count, const std::function<void(size_t)> & job) {
+            for (size_t i = 0; i < count; ++i) job(i);
+            jobs += count;
+        };
+        REQUIRE(desc.generateMipmaps(hooked.data(), PlaneDesc::GenerateMipmapsParameters().setExecutor(executor)));
+        CHECK(jobs >= desc.faces * desc.ranks);
+        CHECK(0 == memcmp(single.data(), multi.data(), desc.size));
+        CHECK(0 == memcmp(single.data(), hooked.data(), desc.size));
+
+        // last level is the average of the whole face.
+        auto  top = single.at({1, 5, desc.levels - 1});
+        auto  all = single.plane({1, 5, 0}).toFloat4(single.at({1, 5, 0}));
+        float sum = 0;
+        for (const auto & c : all) sum += c.x;
+        CHECK(std::abs((float) top[0] - sum / (float) all.size() * 255.0f) <= 1.0f);
+    }
+
+    SECTION("fused") {
+        // For float format, the fused pyramid must match the level-by-level path exactly. The images are large enough
+        // to take more than one pass, for 1D, 2D and 3D. The last one has a partial column of tiles.
+        std::pair<Extent3D, size_t> cases[] = {{{256, 128, 1}, 0}, {{64, 32, 32}, 0}, {{8192, 1, 1}, 0}, {{4160, 64, 1}, 7}};
+        for (auto [extent, levels] : cases) {
+            auto  desc = ImageDesc::make(PlaneDesc::make(PixelFormat::R_32_FLOAT(), extent), 1, 2, levels);
+            Image a(desc);
+            auto  p = (float *) a.data();
+            for (size_t i = 0; i < desc.size / 4; ++i) p[i] = (float) ((i * 2654435761u) % 1000) / 1000.0f;
+            Image b = a.clone();
+            REQUIRE(desc.generateMipmaps(a.data(), PlaneDesc::GenerateMipmapsParameters().setFused(true)));
+            REQUIRE(desc.generateMipmaps(b.data(), PlaneDesc::GenerateMipmapsParameters().setFused(false)));
+            CHECK(0 == memcmp(a.data(), b.data(), desc.size));
+        }
+
+        // For 8-bit format, quantizing each level only once gives more accurate small mips.
+        auto  desc = ImageDesc::make(PlaneDesc::make(PixelFormat::R_8_UNORM(), {64, 64, 1}), 1, 1, 0);
+        Image a(desc);
+        for (size_t i = 0; i < 64 * 64; ++i) a.data()[i] = (uint8_t) ((i * 37) % 256);
+        Image  b   = a.clone();
+        double sum = 0;
+        for (size_t i = 0; i < 64 * 64; ++i) sum += a.data()[i];
+        auto expected = (int) (sum / (64.0 * 64.0));
+        REQUIRE(desc.generateMipmaps(a.data(), PlaneDesc::GenerateMipmapsParameters().setFused(true)));
+        REQUIRE(desc.generateMipmaps(b.data(), PlaneDesc::GenerateMipmapsParameters().setFused(false)));
+        auto fused   = *a.at({0, 0, desc.levels - 1});
+        auto chained = *b.at({0, 0, desc.levels - 1});
+        CHECK(std::abs(fused - expected) <= 1);
+        CHECK(std::abs(fused - expected) <= std::abs(chained - expected));
+    }
+
+    SECTION("npot") {
+        // Odd sizes use the 3-tap polyphase box filter, which keeps the average of every level. The fused and the level
+        // by level paths agree within rounding error.
+        Extent3D extents[] = {{7, 1, 1}, {1023, 767, 1}, {13, 8, 5}, {96, 48, 1}};
+        for (auto extent : extents) {
+            auto  desc = ImageDesc::make(PlaneDesc::make(PixelFormat::R_32_FLOAT(), extent), 1, 1, 0);
+            Image a(desc);
+            auto  p   = (float *) a.data();
+            auto  n   = (size_t) extent.w * extent.h * extent.d;
+            float avg = 0;
+            for (size_t i = 0; i < n; ++i) avg += p[i] = (float) ((i * 2654435761u) % 1000) / 1000.0f;
+            avg /= (float) n;
+            Image b = a.clone();
+            REQUIRE(desc.generateMipmaps(a.data(), PlaneDesc::GenerateMipmapsParameters().setFused(true)));
+            REQUIRE(desc.generateMipmaps(b.data(), PlaneDesc::GenerateMipmapsParameters().setFused(false)));
+            for (size_t l = 1; l < desc.levels; ++l) {
+                const auto & plane = desc.planes[desc.index(0, 0, l)];
+                auto         fa    = (const float *) (a.data() + plane.offset);
+                auto         fb    = (const float *) (b.data() + plane.offset);
+                auto         count = (size_t) plane.desc.extent.w * plane.desc.extent.h * plane.desc.extent.d;
+                double       sum   = 0;
+                for (size_t i = 0; i < count; ++i) {
+                    CHECK(std::abs(fa[i] - fb[i]) <= 1e-5f);
+                    sum += fa[i];
+                }
+                CHECK(std::abs(sum / (double) count - avg) <= 1e-4);
+            }
+        }
+
+        // 7 -> 3: the first pixel covers 7/3 of the source pixels, weighted 3/7, 3/7 and 1/7.
+        auto  desc = ImageDesc::make(PlaneDesc::make(PixelFormat::R_32_FLOAT(), {7, 1, 1}), 1, 1, 2);
+        Image a(desc);
+        for (size_t i = 0; i < 7; ++i) ((float *) a.data())[i] = (float) i;
+        REQUIRE(desc.generateMipmaps(a.data(), PlaneDesc::GenerateMipmapsParameters().setFused(false)));
+        CHECK(std::abs(*(const float *) a.at({0, 0, 1}) - 5.0f / 7.0f) <= 1e-6f);
+    }
+
+    SECTION("filters") {
+        using Parameters = PlaneDesc::GenerateMipmapsParameters;
+        auto desc        = ImageDesc::make(PlaneDesc::make(PixelFormat::RGBA_8_8_8_8_UNORM(), {32, 32, 1}), 1, 1, 0);
+
+        // constant image stays constant with every filter.
+        for (auto filter : {Parameters::BOX, Parameters::KAISER, Parameters::LANCZOS}) {
+            Image a(desc);
+            memset(a.data(), 100, desc.size);
+            REQUIRE(desc.generateMipmaps(a.data(), Parameters().setFilter(filter)));
+            for (size_t i = 0; i < desc.size; ++i) CHECK(100 == a.data()[i]);
+        }
+
+        // windowed sinc filters differ from box on a non-trivial pattern, and all of them keep the average.
+        Image base(desc);
+        for (size_t i = 0; i < desc.size; ++i) base.data()[i] = (uint8_t) ((i * 37) % 256);
+        Image box = base.clone(), kaiser = base.clone(), lanczos = base.clone();
+        REQUIRE(desc.generateMipmaps(box.data(), Parameters().setFused(false)));
+        REQUIRE(desc.generateMipmaps(kaiser.data(), Parameters().setFilter(Parameters::KAISER)));
+        REQUIRE(desc.generateMipmaps(lanczos.data(), Parameters().setFilter(Parameters::LANCZOS)));
+        auto level1 = desc.planes[desc.index(0, 0, 1)];
+        CHECK(0 != memcmp(box.data() + level1.offset, kaiser.data() + level1.offset, level1.desc.size));
+        CHECK(0 != memcmp(box.data() + level1.offset, lanczos.data() + level1.offset, level1.desc.size));
+        CHECK(0 != memcmp(kaiser.data() + level1.offset, lanczos.data() + level1.offset, level1.desc.size));
+        for (const auto & img : {&kaiser, &lanczos}) {
+            for (size_t c = 0; c < 4; ++c) CHECK(std::abs((int) img->at({0, 0, desc.levels - 1})[c] - (int) box.at({0, 0, desc.levels - 1})[c]) <= 4);
+        }
+
+        // the separable box filter matches the 2x2 average.
+        Image separable = base.clone();
+        REQUIRE(desc.generateMipmaps(separable.data(), Parameters().setFilter(Parameters::BOX).setFused(false).setGammaCorrect(false)));
+        CHECK(0 == memcmp(box.data(), separable.data(), desc.size));
+
+        // gamma correct box filter of a black and white checker board gives 50% linear intensity.
+        Image checker(desc);
+        for (uint32_t y = 0; y < 32; ++y)
+            for (uint32_t x = 0; x < 32; ++x) memset(checker.at({0, 0, 0}, x, y), ((x ^ y) & 1) ? 255 : 0, 4);
+        Image linear = checker.clone();
+        REQUIRE(desc.generateMipmaps(checker.data(), Parameters().setGammaCorrect(true)));
+        REQUIRE(desc.generateMipmaps(linear.data()));
+        CHECK(std::abs((int) checker.at({0, 0, 1})[0] - 188) <= 1);
+        CHECK(std::abs((int) checker.at({0, 0, 1})[3] - 127) <= 1); // alpha is always linear
+        CHECK(std::abs((int) linear.at({0, 0, 1})[0] - 127) <= 1);
+    }
+
+    // compressed formats are rejected.
+    auto                 bc1 = ImageDesc().set2D(PixelFormat::BC1_UNORM(), 8, 8, 0);
+    std::vector<uint8_t> bc1Data(bc1.size);
+    CHECK(!bc1.generateMipmaps(bc1Data.data()));
+}
+
+TEST_CASE("parallel-for") {
+    SECTION("jobs") {
+        // every job runs once, nested batches included.
+        std::vector<std::atomic<int>> counts(100);
+        parallelFor(10, [&](size_t i) { parallelFor(10, [&](size_t j) { ++counts[i * 10 + j]; }); });
+        for (const auto & c : counts) CHECK(1 == c);
+
+        // the first exception gets to the caller, after the other jobs are done.
+        std::atomic<int> done {0};
+        CHECK_THROWS_AS(parallelFor(64,
+                                    [&](size_t i) {
+                                        if (7 == i) throw std::runtime_error("job 7");
+                                        ++done;
+                                    }),
+                        std::runtime_error);
+        CHECK(63 == done);
+    }
+
+    SECTION("rows") {
+        // tiles cover every row of blocks of every slice once.
+        auto                          bc1 = PlaneDesc::make(PixelFormat::BC1_UNORM(), {1030, 4099, 3});
+        std::vector<std::atomic<int>> rows(1025 * 3);
+        parallelForRows(bc1, [&](uint32_t z, uint32_t y0, uint32_t y1) {
+            for (uint32_t y = y0; y < y1; ++y) ++rows[z * 1025 + y];
+        });
+        for (const auto & r : rows) CHECK(1 == r);
+
+        // same over all planes of an image.
+        auto                          desc = ImageDesc::make(PlaneDesc::make(PixelFormat::RGBA8(), {300, 200, 1}), 2, 1, 0);
+        std::vector<std::atomic<int>> pixels(desc.size / 4);
+        parallelForRows(desc, [&](size_t plane, uint32_t z, uint32_t y0, uint32_t y1) {
+            for (uint32_t y = y0; y < y1; ++y)
+                for (uint32_t x = 0; x < desc.planes[plane].desc.extent.w; ++x) ++pixels[desc.planes[plane].pixel(x, y, z) / 4];
+        });
+        size_t covered = 0;
+        for (const auto & p : desc.planes) covered += p.desc.extent.w * p.desc.extent.h;
+        size_t ones = 0;
+        for (const auto & p : pixels) ones += (1 == p);
+        CHECK(covered == ones);
+    }
+
+    SECTION("default-executor") {
+        auto                 plane = PlaneDesc::make(PixelFormat::RGBA8(), {256, 256, 1});
+        std::vector<uint8_t> pixels(plane.size);
+        for (size_t i = 0; i < pixels.size(); ++i) pixels[i] = (uint8_t) (i * 13);
+        auto pooled = plane.toRGBA8(pixels.data());
+
+        // the default executor captures 'jobs' below, so it has to be gone by the time the section leaves, however it
+        // leaves.
+        struct Restore {
+            ~Restore() { setDefaultExecutor({}); }
+        } restore;
+
+        // the default executor takes over the work of the built-in pool, but not the work asked for a number of threads.
+        std::atomic<size_t> jobs {0};
+        setDefaultExecutor([&](size_t count, const std::function<void(size_t)> & job) {
+            for (size_t i = 0; i < count; ++i) job(i);
+            jobs += count;
+        });
+        auto hooked = plane.toRGBA8(pixels.data());
+        CHECK(jobs > 1);
+        auto                 mipmaps = ImageDesc::make(plane, 1, 1, 0);
+        std::vector<uint8_t> chain(mipmaps.size);
+        memcpy(chain.data(), pixels.data(), pixels.size());
+        for (size_t threads : {1, 2}) {
+            jobs = 0;
+            CHECK(mipmaps.generateMipmaps(chain.data(), PlaneDesc::GenerateMipmapsParameters().setThreads(threads)));
+            CHECK(0 == jobs);
+        }
+        CHECK(0 == memcmp(pooled.data(), hooked.data(), pooled.size() * sizeof(RGBA8)));
+    }
+}
+
 TEST_CASE("aalloc") {
     for (size_t i = 0; i < 10; ++i) {
         size_t alignment = 1llu << i;
@@ -232,6 +1673,160 @@ TEST_CASE("aalloc") {
     }
 }
 
+TEST_CASE("allocator") {
+    // a counting allocator sees every buffer of the scope, and gets them back on free.
+    struct Counting : Allocator {
+        std::atomic<int> live {0};
+        void *           allocate(size_t size, size_t alignment) override {
+            ++live;
+            return rii_details::aalloc(alignment, size, nullptr);
+        }
+        void deallocate(void * p, size_t, size_t) override {
+            --live;
+            rii_details::afree(p);
+        }
+    } counting;
+    auto plane = PlaneDesc::make(PixelFormat::RGBA8(), {64, 64, 1});
+    {
+        Allocator::Scope scope(&counting);
+        Image            image(ImageDesc::make(plane, 1, 1, 1));
+        CHECK(0 == ((size_t) image.data() % image.desc().alignment));
+        CHECK(1 == counting.live);
+        std::stringstream ss;
+        image.save({ImageDesc::RIL}, ss);
+        auto loaded = Image::load(ss);
+        CHECK(2 == counting.live);
+    }
+    CHECK(0 == counting.live);
+    CHECK(nullptr == Allocator::current());
+
+    // per call allocator of generateMipmaps().
+    std::vector<uint8_t> pixels(plane.size, 1);
+    auto mipmaps = plane.generateMipmaps(pixels.data(), PlaneDesc::GenerateMipmapsParameters().setAllocator(&counting));
+    CHECK(1 == counting.live);
+    mipmaps.clear();
+    CHECK(0 == counting.live);
+
+    SECTION("arena") {
+        ArenaAllocator arena(1 << 16);
+        for (size_t i = 0; i < 10; ++i) {
+            size_t alignment = 1llu << i;
+            auto   ptr       = rii_details::aalloc(alignment, 1000 + i, &arena);
+            REQUIRE(ptr);
+            CHECK(0 == ((size_t) ptr % alignment));
+            memset(ptr, 0xcc, 1000 + i);
+            rii_details::afree(ptr);
+        }
+        auto large = rii_details::aalloc(16, 1 << 20, &arena);
+        REQUIRE(large);
+        rii_details::afree(large);
+        CHECK(arena.used() > (1u << 20));
+        arena.reset();
+        CHECK(0 == arena.used());
+    }
+
+    SECTION("pool") {
+        PoolAllocator pool(1 << 20);
+        auto          p1 = rii_details::aalloc(64, 5000, &pool);
+        REQUIRE(p1);
+        rii_details::afree(p1);
+        CHECK(pool.cachedBytes() > 5000);
+        auto p2 = rii_details::aalloc(64, 4900, &pool); // same size class, so the buffer is reused.
+        CHECK(p1 == p2);
+        CHECK(0 == pool.cachedBytes());
+        auto p3 = rii_details::aalloc(4096, 4900, &pool);
+        REQUIRE(p3);
+        CHECK(0 == ((size_t) p3 % 4096));
+        rii_details::afree(p2);
+        rii_details::afree(p3);
+        auto p4 = rii_details::aalloc(64, 2 << 20, &pool); // larger than the cache. Goes back to the heap on free.
+        rii_details::afree(p4);
+        CHECK(pool.cachedBytes() < (1u << 20));
+        pool.trim();
+        CHECK(0 == pool.cachedBytes());
+    }
+}
+
+TEST_CASE("page-allocator") {
+    // the threshold is global. Put the default back however the test leaves.
+    struct Restore {
+        ~Restore() { PageAllocator::setLargeAllocations(2 << 20, {}); }
+    } restore;
+
+    // large buffers are mapped from the OS, small ones come from the heap.
+    PageAllocator::setLargeAllocations(1 << 20, PageAllocator::Parameters().setPopulate(true));
+    CHECK(nullptr == PageAllocator::large((1 << 20) - 1));
+    CHECK(nullptr != PageAllocator::large(1 << 20));
+    for (size_t i = 0; i < 13; ++i) {
+        size_t alignment = 1llu << i;
+        auto   ptr       = rii_details::aalloc(alignment, (3 << 20) + 1);
+        REQUIRE(ptr);
+        CHECK(0 == ((size_t) ptr % alignment));
+
+#ifndef _WIN32
+        // huge pages align the mapping to 2 MB, and the buffer starts right after the aalloc() header (64 bytes, or
+        // one alignment unit). A heap block lands that close to a 2 MB boundary only by chance.
+        CHECK(((size_t) ptr % (2 << 20)) <= std::max<size_t>(alignment, 64));
+#endif
+        memset(ptr, 0xcc, (3 << 20) + 1);
+        rii_details::afree(ptr);
+    }
+    Image image(ImageDesc::make(PlaneDesc::make(PixelFormat::RGBA8(), {1024, 1024, 1}), 1, 1, 0));
+    REQUIRE(!image.empty());
+    std::vector<uint8_t> pixels(image.desc().planes[0].desc.size, 7);
+    auto                 mipmaps = image.desc().planes[0].desc.generateMipmaps(pixels.data());
+    REQUIRE(!mipmaps.empty());
+    CHECK(7 == mipmaps.data()[mipmaps.size() - 1]);
+
+    // buffers allocated before the change are freed by the allocator that allocated them.
+    PageAllocator::setLargeAllocations(0, {});
+    CHECK(nullptr == PageAllocator::large(1 << 30));
+    image.clear();
+}
+
+TEST_CASE("image-pool") {
+    auto      desc1 = ImageDesc::make(PlaneDesc::make(PixelFormat::RGBA8(), {64, 64, 1}), 1, 1, 1);
+    auto      desc2 = ImageDesc::make(PlaneDesc::make(PixelFormat::R_32_FLOAT(), {64, 64, 1}), 1, 1, 1);
+    auto      desc3 = ImageDesc::make(PlaneDesc::make(PixelFormat::RGBA8(), {32, 32, 1}), 1, 1, 1);
+    ImagePool pool(ImagePool::Parameters().setMaxBytes(desc1.size * 2));
+
+    // the buffer of a released image is handed out again.
+    auto image = pool.acquire(desc1);
+    REQUIRE(!image.empty());
+    auto data = image.data();
+    pool.release(std::move(image));
+    CHECK(image.empty());
+    CHECK(1 == pool.stats().buffers);
+    image = pool.acquire(desc1);
+    CHECK(data == image.data());
+    CHECK(desc1 == image.desc());
+
+    // so is a buffer of the same size.
+    pool.release(std::move(image));
+    auto image2 = pool.acquire(desc2);
+    CHECK(data == image2.data());
+    CHECK(desc2 == image2.desc());
+    auto stats = pool.stats();
+    CHECK(2 == stats.hits);
+    CHECK(1 == stats.misses);
+    CHECK(0 == stats.buffers);
+
+    // least recently released buffers are freed to stay in budget.
+    auto image3 = pool.acquire(desc3);
+    auto image4 = pool.acquire(desc1);
+    pool.release(std::move(image2));
+    pool.release(std::move(image3));
+    pool.release(std::move(image4));
+    stats = pool.stats();
+    CHECK(1 == stats.evictions);
+    CHECK(2 == stats.buffers);
+    CHECK(desc1.size + desc3.size == stats.bytes);
+    pool.trim();
+    CHECK(0 == pool.stats().bytes);
+    pool.resetStats();
+    CHECK(0 == pool.stats().hits);
+}
+
 // TEST_CASE("save-to-png") {
 //     auto path1 = (std::filesystem::path(TEST_FOLDER) / "alien-planet.jpg").string();
 //     PH_LOGI("load image from file: %s", path1.c_str());
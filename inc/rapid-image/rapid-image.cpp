@@ -28,8 +28,47 @@ SOFTWARE.
 
 #include <numeric>
 #include <cstring>
+#include <cfloat>
+#include <climits>
 #include <filesystem>
 #include <inttypes.h>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if RAPID_IMAGE_ENABLE_SIMD && (defined(__x86_64__) || defined(_M_X64))
+#define RII_SIMD_SSE 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif RAPID_IMAGE_ENABLE_SIMD && (defined(__aarch64__) || defined(_M_ARM64))
+#define RII_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
 
 namespace RAPID_IMAGE_NAMESPACE {
 
@@ -91,24 +130,40 @@ static_assert(5 == nextMultiple(5, 0));
 constexpr uint64_t MEMORY_TAG1 = 0x63f3a6d25be665c0;
 constexpr uint64_t MEMORY_TAG2 = 0x60f098421dbb4e1e;
 struct MemHeader {
-    uint64_t offset; // offset from the user visible memory to the actual memory allocated.
-    uint64_t tag1;
-    uint64_t tag2;
+    uint64_t    offset;    // offset from the user visible memory to the actual memory allocated.
+    uint64_t    size;      // size of the actual memory allocated.
+    uint64_t    alignment; // alignment of the actual memory allocated. Used by custom allocator only.
+    Allocator * allocator; // the allocator that allocated the memory. null means malloc().
+    uint64_t    tag1;
+    uint64_t    tag2;
 };
 
+RII_API void * aalloc(size_t a, size_t s) { return aalloc(a, s, Allocator::current()); }
+
 /// We can't use system provided aligned_alloc because we might have alignment requirement that is not supported by the system.
-RII_API void * aalloc(size_t a, size_t s) {
+RII_API void * aalloc(size_t a, size_t s, Allocator * allocator) {
     // validate input parameter range.
     constexpr size_t MAX_SIZE_AND_ALIGNMENT = (size_t(-1)) / 2; // to avoid overflow.
     if (0 == a) a = 1;
     if (0 == s) s = 1;
     if (a >= MAX_SIZE_AND_ALIGNMENT || s >= MAX_SIZE_AND_ALIGNMENT) return nullptr;
 
+    // Large buffers go straight to the OS, unless that fails.
+    if (!allocator) {
+        if (auto large = PageAllocator::large(s)) {
+            if (auto p = aalloc(a, s, large)) return p;
+            RAPID_IMAGE_LOGW("Fall back to the C heap.");
+        }
+    }
+
     // Need to allocate at least (sizeof(header) + a - 1) bytes to make sure we can align the address returned to user
-    // while still having enough space in front of user visible memory to store the header.
-    size_t additional = sizeof(MemHeader) + a - 1;
+    // while still having enough space in front of user visible memory to store the header. A custom allocator aligns
+    // the memory by itself, so the header only takes the space of one alignment unit (or a few, for small alignments).
+    size_t alignment  = allocator ? std::max(a, alignof(MemHeader)) : 1;
+    size_t additional = allocator ? nextMultiple(sizeof(MemHeader), alignment) : sizeof(MemHeader) + a - 1;
+    if (allocator && 0 != alignment % a) additional += a - 1; // alignments that are not powers of 2.
     size_t totalSize  = additional + s;
-    void * p          = malloc(totalSize);
+    void * p          = allocator ? allocator->allocate(totalSize, alignment) : malloc(totalSize);
     if (nullptr == p) {
         RAPID_IMAGE_LOGE("failed to allocate aligned memory: alignment = %zu bytes, requested size = %zu bytes, total allocation = %zu.", a, s, totalSize);
         return nullptr;
@@ -123,9 +178,12 @@ RII_API void * aalloc(size_t a, size_t s) {
     RII_ASSERT(((uint8_t *) result + s) <= ((uint8_t *) p + totalSize));
 
     // fill the header.
-    header->offset = alignedAddress - (uintptr_t) p;
-    header->tag1   = MEMORY_TAG1;
-    header->tag2   = MEMORY_TAG2;
+    header->offset    = alignedAddress - (uintptr_t) p;
+    header->size      = totalSize;
+    header->alignment = alignment;
+    header->allocator = allocator;
+    header->tag1      = MEMORY_TAG1;
+    header->tag2      = MEMORY_TAG2;
     RII_ASSERT(header->offset >= sizeof(MemHeader));
 
     // done
@@ -146,10 +204,274 @@ RII_API void afree(void * p) {
     }
 
     // Now get to the real pointer of the allocate memory
-    auto realAddress = (uintptr_t) p - (uintptr_t) header->offset;
+    auto realAddress = (void *) ((uintptr_t) p - (uintptr_t) header->offset);
 
     // free the memory.
-    free((void *) realAddress);
+    if (header->allocator) {
+        header->allocator->deallocate(realAddress, (size_t) header->size, (size_t) header->alignment);
+    } else {
+        free(realAddress);
+    }
+}
+
+/// Map the whole file into memory, copy-on-write. Return nullptr on failure.
+static void * mapFileView(const std::string & path, size_t & size) {
+    size = 0;
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (INVALID_HANDLE_VALUE == file) {
+        RAPID_IMAGE_LOGE("failed to open file %s: error=%lu", path.c_str(), GetLastError());
+        return nullptr;
+    }
+    LARGE_INTEGER fileSize {};
+    void *        view    = nullptr;
+    HANDLE        mapping = nullptr;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if (mapping) {
+        view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+        CloseHandle(mapping); // the view keeps the mapping alive.
+    }
+    CloseHandle(file);
+    if (!view) {
+        RAPID_IMAGE_LOGE("failed to map file %s: error=%lu", path.c_str(), GetLastError());
+        return nullptr;
+    }
+    size = (size_t) fileSize.QuadPart;
+    return view;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        RAPID_IMAGE_LOGE("failed to open file %s: errno=%d", path.c_str(), errno);
+        return nullptr;
+    }
+    struct stat st {};
+    void *      view = MAP_FAILED;
+    if (0 == fstat(fd, &st) && st.st_size > 0) view = mmap(nullptr, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file alive.
+    if (MAP_FAILED == view) {
+        RAPID_IMAGE_LOGE("failed to map file %s: errno=%d", path.c_str(), errno);
+        return nullptr;
+    }
+    size = (size_t) st.st_size;
+    return view;
+#endif
+}
+
+/// Release memory mapped by mapFileView().
+static void unmapFileView(void * view, size_t size) {
+    if (!view) return;
+#ifdef _WIN32
+    (void) size;
+    UnmapViewOfFile(view);
+#else
+    munmap(view, size);
+#endif
+}
+
+/// A read only stream buffer over a memory block. Unlike std::istringstream, it reads the memory in place, w/o copying
+/// it first.
+class MemoryStreamBuf : public std::streambuf {
+public:
+    MemoryStreamBuf(const void * data, size_t size) {
+        auto p = (char *) data;
+        setg(p, p, p + size);
+    }
+
+protected:
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+        if (!(which & std::ios_base::in)) return pos_type(off_type(-1));
+        off_type base = std::ios_base::beg == dir ? 0 : std::ios_base::cur == dir ? gptr() - eback() : egptr() - eback();
+        off_type pos  = base + off;
+        if (pos < 0 || pos > egptr() - eback()) return pos_type(off_type(-1));
+        setg(eback(), eback() + pos, egptr());
+        return pos_type(pos);
+    }
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override { return seekoff(off_type(pos), std::ios_base::beg, which); }
+};
+
+/// A read only stream buffer that returns bytes already read from a stream, then the rest of the stream. It is used
+/// to hand the header bytes back to the codec that recognized them, w/o seeking back. Never reads ahead of the caller.
+class ReplayStreamBuf : public std::streambuf {
+public:
+    ReplayStreamBuf(const void * header, size_t size, std::streambuf * source): _source(source) {
+        auto p = (char *) header;
+        setg(p, p, p + size);
+    }
+
+    /// Number of header bytes not consumed yet.
+    size_t remaining() const { return (size_t) (egptr() - gptr()); }
+
+protected:
+    int_type underflow() override { return _source->sgetc(); }
+
+    int_type uflow() override { return _source->sbumpc(); }
+
+    std::streamsize xsgetn(char * s, std::streamsize n) override {
+        auto replayed = std::min<std::streamsize>(n, egptr() - gptr());
+        if (replayed > 0) {
+            memcpy(s, gptr(), (size_t) replayed);
+            setg(eback(), gptr() + replayed, egptr());
+        }
+        if (replayed == n) return n;
+        return replayed + _source->sgetn(s + replayed, n - replayed);
+    }
+
+private:
+    std::streambuf * _source;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// The built-in thread pool. It has one worker thread less than the hardware threads, since the thread that submits
+/// a batch of jobs works on it too. Threads claim jobs one at a time from a counter shared by the batch, so the
+/// threads that finish early keep taking work off the slower ones until the batch runs dry. A job that submits a
+/// nested batch works on it as well, so nesting can't deadlock, even when all workers are busy.
+class ThreadPool {
+public:
+    /// The pool is never destroyed, so that its workers outlive any static object that may still use it at exit.
+    static ThreadPool & get() {
+        static ThreadPool * pool = new ThreadPool;
+        return *pool;
+    }
+
+    /// Number of threads that can work on a batch, the calling thread included.
+    size_t size() const { return _workers.size() + 1; }
+
+    /// Run job(i) for each i in [0, count) on up to 'threads' threads, the calling thread included. The first
+    /// exception thrown by any job is rethrown after all jobs are done.
+    void run(size_t count, size_t threads, const std::function<void(size_t)> & job) {
+        auto batch = std::make_shared<Batch>(count, threads - 1, job);
+        if (threads <= 1) {
+            batch->work();
+            if (batch->error) std::rethrow_exception(batch->error);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _batches.push_back(batch);
+        }
+        _wakeup.notify_all();
+        batch->work();
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto                         i = std::find(_batches.begin(), _batches.end(), batch);
+            if (i != _batches.end()) _batches.erase(i);
+            _done.wait(lock, [&] { return 0 == batch->active; });
+        }
+        if (batch->error) std::rethrow_exception(batch->error);
+    }
+
+private:
+    struct Batch {
+        const size_t                        count;
+        size_t                              helpers; ///< number of workers that may still join. Guarded by the pool mutex.
+        size_t                              active = 0; ///< number of workers on the batch. Guarded by the pool mutex.
+        const std::function<void(size_t)> & job;
+        std::atomic<size_t>                 next {0};
+        std::exception_ptr                  error;
+        std::mutex                          errorMutex;
+
+        Batch(size_t c, size_t h, const std::function<void(size_t)> & j): count(c), helpers(h), job(j) {}
+
+        void work() {
+            for (size_t i = next++; i < count; i = next++) {
+                try {
+                    job(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (!error) error = std::current_exception();
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread>           _workers;
+    std::deque<std::shared_ptr<Batch>> _batches; ///< batches that could use more workers.
+    std::mutex                         _mutex;
+    std::condition_variable            _wakeup;
+    std::condition_variable            _done;
+    bool                               _stop = false;
+
+    ThreadPool() {
+        auto n = std::max(1u, std::thread::hardware_concurrency()) - 1;
+        _workers.reserve(n);
+        for (size_t i = 0; i < n; ++i) _workers.emplace_back([this] { loop(); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wakeup.notify_all();
+        for (auto & t : _workers) t.join();
+    }
+
+    void loop() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (;;) {
+            _wakeup.wait(lock, [&] { return _stop || !_batches.empty(); });
+            if (_stop) return;
+            auto batch = _batches.front();
+            if (0 == batch->helpers || batch->next >= batch->count) {
+                // the batch is fully staffed or out of jobs. The threads on it finish it without us.
+                _batches.pop_front();
+                continue;
+            }
+            --batch->helpers;
+            ++batch->active;
+            lock.unlock();
+            batch->work();
+            lock.lock();
+            if (0 == --batch->active) _done.notify_all();
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// The executor set by setDefaultExecutor(), or null.
+static std::shared_ptr<const Executor> defaultExecutor(const Executor * newValue = nullptr) {
+    static std::mutex                      mutex;
+    static std::shared_ptr<const Executor> executor;
+    std::lock_guard<std::mutex>            lock(mutex);
+    if (newValue) executor = *newValue ? std::make_shared<const Executor>(*newValue) : nullptr;
+    return executor;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Run job(i) for each i in [0, count). The jobs go to the executor if there's one. Otherwise, 0 threads sends them to
+/// the default executor, or to all threads of the built-in pool if there is no default executor. Any other number runs
+/// them on up to that many threads of the built-in pool (1 being the calling thread alone), and never on more threads
+/// than the pool has. When the work runs on the library's own threads, the first exception thrown by any job is
+/// rethrown on the calling thread, after all jobs are done.
+static void parallelFor(size_t count, size_t threads, const Executor & executor, const std::function<void(size_t)> & job) {
+    if (0 == count) return;
+    if (executor) {
+        executor(count, job);
+        return;
+    }
+    if (0 == threads) {
+        if (auto e = defaultExecutor()) {
+            (*e)(count, job);
+            return;
+        }
+    }
+    auto & pool = ThreadPool::get();
+    pool.run(count, std::min({0 == threads ? pool.size() : threads, pool.size(), count}), job);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Run job(z, y0, y1) over tiles of rows of the plane, with the same threads and executor rules as parallelFor().
+static void parallelForRows(const PlaneDesc & plane, size_t threads, const Executor & executor, const std::function<void(uint32_t z, uint32_t y0, uint32_t y1)> & job) {
+    if (plane.empty()) return;
+    const auto & ld    = plane.format.layoutDesc();
+    uint32_t     rows  = (plane.extent.h + ld.blockHeight - 1) / ld.blockHeight;
+    uint32_t     tile  = std::clamp<uint32_t>((16u << 10) / std::max(1u, plane.pitch), 1, rows);
+    uint32_t     tiles = (rows + tile - 1) / tile;
+    parallelFor((size_t) tiles * plane.extent.d, threads, executor, [&](size_t i) {
+        auto y0 = (uint32_t) (i % tiles) * tile;
+        job((uint32_t) (i / tiles), y0, std::min(y0 + tile, rows));
+    });
 }
 
 static inline void clamp(int & value, int min_, int max_) {
@@ -159,10 +481,456 @@ static inline void clamp(int & value, int min_, int max_) {
 
 } // namespace rii_details
 
+// *********************************************************************************************************************
+// Parallel jobs
+// *********************************************************************************************************************
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+RII_API void setDefaultExecutor(Executor executor) { rii_details::defaultExecutor(&executor); }
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+RII_API void parallelFor(size_t count, const std::function<void(size_t index)> & job, const Executor & executor) {
+    rii_details::parallelFor(count, 0, executor, job);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+RII_API void parallelForRows(const PlaneDesc & plane, const std::function<void(uint32_t z, uint32_t y0, uint32_t y1)> & job, const Executor & executor) {
+    rii_details::parallelForRows(plane, 0, executor, job);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+RII_API void parallelForRows(const ImageDesc & image, const std::function<void(size_t plane, uint32_t z, uint32_t y0, uint32_t y1)> & job,
+                             const Executor & executor) {
+    struct Tile {
+        size_t   plane;
+        uint32_t z, y0, y1;
+    };
+    std::vector<Tile> tiles;
+    for (size_t i = 0; i < image.planes.size(); ++i) {
+        const auto & plane = image.planes[i].desc;
+        if (plane.empty()) continue;
+        const auto & ld   = plane.format.layoutDesc();
+        uint32_t     rows = (plane.extent.h + ld.blockHeight - 1) / ld.blockHeight;
+        uint32_t     tile = std::clamp<uint32_t>((16u << 10) / std::max(1u, plane.pitch), 1, rows);
+        for (uint32_t z = 0; z < plane.extent.d; ++z)
+            for (uint32_t y = 0; y < rows; y += tile) tiles.push_back({i, z, y, std::min(y + tile, rows)});
+    }
+    rii_details::parallelFor(tiles.size(), 0, executor, [&](size_t i) { job(tiles[i].plane, tiles[i].z, tiles[i].y0, tiles[i].y1); });
+}
+
+// *********************************************************************************************************************
+// Allocators
+// *********************************************************************************************************************
+
+namespace rii_details {
+static thread_local Allocator * currentAllocator = nullptr;
+} // namespace rii_details
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+Allocator * Allocator::current() { return rii_details::currentAllocator; }
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+Allocator * Allocator::setCurrent(Allocator * allocator) { return std::exchange(rii_details::currentAllocator, allocator); }
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// The blocks are allocated from the C heap. Allocations are bumped through the last block. Large ones get a block of
+/// their own, inserted before the last one, so that bumping goes on where it was.
+struct ArenaAllocator::Impl {
+    struct Block {
+        uint8_t * base;
+        size_t    size;
+    };
+
+    const size_t       blockSize;
+    std::mutex         mutex;
+    std::vector<Block> blocks;     ///< the last one is the one being bumped through.
+    size_t             offset = 0; ///< bump offset in the last block.
+    size_t             used   = 0;
+
+    Impl(size_t b): blockSize(std::max<size_t>(b, 4096)) {}
+
+    ~Impl() {
+        for (auto & b : blocks) rii_details::afree(b.base);
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+ArenaAllocator::ArenaAllocator(size_t blockSize): _impl(new Impl(blockSize)) {}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+ArenaAllocator::~ArenaAllocator() {}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void * ArenaAllocator::allocate(size_t size, size_t alignment) {
+    std::lock_guard<std::mutex> lock(_impl->mutex);
+    auto &                      blocks = _impl->blocks;
+    if (!blocks.empty()) {
+        auto & b       = blocks.back();
+        auto   address = rii_details::nextMultiple((uintptr_t) b.base + _impl->offset, (uintptr_t) alignment);
+        auto   end     = address - (uintptr_t) b.base + size;
+        if (end <= b.size) {
+            _impl->used += end - _impl->offset;
+            _impl->offset = end;
+            return (void *) address;
+        }
+    }
+
+    // Out of space. Start a new block, or a block of its own for large allocations.
+    bool large     = size > _impl->blockSize / 2 && !blocks.empty();
+    auto blockSize = large ? size : std::max(_impl->blockSize, size);
+    auto base      = (uint8_t *) rii_details::aalloc(std::max<size_t>(alignment, 64), blockSize, nullptr);
+    if (!base) return nullptr;
+    if (large) {
+        blocks.insert(blocks.end() - 1, {base, blockSize});
+    } else {
+        blocks.push_back({base, blockSize});
+        _impl->offset = size;
+    }
+    _impl->used += size;
+    return base;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void ArenaAllocator::reset() {
+    std::lock_guard<std::mutex> lock(_impl->mutex);
+    auto &                      blocks = _impl->blocks;
+    for (size_t i = 1; i < blocks.size(); ++i) rii_details::afree(blocks[i].base);
+    if (!blocks.empty()) blocks.resize(1);
+    _impl->offset = 0;
+    _impl->used   = 0;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+size_t ArenaAllocator::used() const {
+    std::lock_guard<std::mutex> lock(_impl->mutex);
+    return _impl->used;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Size class of a size s, with 4 classes per power of 2: sizes in (2^k, 2^(k+1)] are rounded up to a multiple of
+/// 2^(k-2). The smallest class is 256 bytes.
+struct PoolAllocator::Impl {
+    static constexpr size_t MIN_SIZE = 256;
+
+    struct FreeList {
+        std::mutex          mutex;
+        std::vector<void *> blocks;
+        size_t              classSize = 0;
+    };
+
+    const size_t                maxCachedBytes;
+    const size_t                maxSize;
+    std::atomic<size_t>         cached {0};
+    std::unique_ptr<FreeList[]> lists;
+    size_t                      listCount;
+
+    Impl(size_t maxCached, size_t maxSize_): maxCachedBytes(maxCached), maxSize(std::max(maxSize_, MIN_SIZE)) {
+        size_t dummy;
+        listCount = classOf(maxSize, dummy) + 1;
+        lists.reset(new FreeList[listCount]);
+        for (size_t i = 0; i < listCount; ++i) lists[i].classSize = ((4 + i % 4 + 1) * MIN_SIZE / 8) << (i / 4);
+    }
+
+    ~Impl() { trim(); }
+
+    static size_t classOf(size_t s, size_t & classSize) {
+        s        = std::max(s, MIN_SIZE);
+        size_t k = 0;
+        while (((s - 1) >> (k + 1)) > 0) ++k; // 2^k <= s - 1 < 2^(k+1)
+        size_t step = (size_t) 1 << (k - 2);
+        size_t n    = (s + step - 1) / step; // in [5, 8]
+        classSize   = n * step;
+        return (k - 7) * 4 + (n - 5);
+    }
+
+    void trim() {
+        for (size_t i = 0; i < listCount; ++i) {
+            std::lock_guard<std::mutex> lock(lists[i].mutex);
+            for (auto p : lists[i].blocks) rii_details::afree(p);
+            cached -= lists[i].blocks.size() * lists[i].classSize;
+            lists[i].blocks.clear();
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+PoolAllocator::PoolAllocator(size_t maxCachedBytes, size_t maxSize): _impl(new Impl(maxCachedBytes, maxSize)) {}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+PoolAllocator::~PoolAllocator() {}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void * PoolAllocator::allocate(size_t size, size_t alignment) {
+    if (size > _impl->maxSize) return rii_details::aalloc(alignment, size, nullptr);
+    size_t classSize;
+    auto & list = _impl->lists[Impl::classOf(size, classSize)];
+    {
+        std::lock_guard<std::mutex> lock(list.mutex);
+        // Blocks are allocated with at least 64 bytes alignment. Take one that is aligned enough, from the most
+        // recently freed ones, which are most likely still in cache.
+        for (size_t i = list.blocks.size(); i > 0; --i) {
+            auto p = list.blocks[i - 1];
+            if (0 == (uintptr_t) p % alignment) {
+                list.blocks.erase(list.blocks.begin() + (ptrdiff_t) (i - 1));
+                _impl->cached -= classSize;
+                return p;
+            }
+        }
+    }
+    return rii_details::aalloc(std::max<size_t>(alignment, 64), classSize, nullptr);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void PoolAllocator::deallocate(void * p, size_t size, size_t) {
+    if (size <= _impl->maxSize) {
+        size_t classSize;
+        auto & list = _impl->lists[Impl::classOf(size, classSize)];
+        if (_impl->cached.fetch_add(classSize) + classSize <= _impl->maxCachedBytes) {
+            std::lock_guard<std::mutex> lock(list.mutex);
+            list.blocks.push_back(p);
+            return;
+        }
+        _impl->cached -= classSize;
+    }
+    rii_details::afree(p);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void PoolAllocator::trim() { _impl->trim(); }
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+size_t PoolAllocator::cachedBytes() const { return _impl->cached; }
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void * PageAllocator::allocate(size_t size, size_t alignment) {
+#ifdef _WIN32
+    // VirtualAlloc() aligns to the allocation granularity (64 KB), and can't release part of a reservation.
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    if (alignment > info.dwAllocationGranularity) {
+        RAPID_IMAGE_LOGE("Can't map %zu bytes with %zu bytes alignment.", size, alignment);
+        return nullptr;
+    }
+    auto p = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (!p) RAPID_IMAGE_LOGE("Failed to map %zu bytes: error=%lu", size, GetLastError());
+    return p;
+#else
+    // Huge pages need 2 MB aligned ranges. Map more than asked, then unmap the unaligned head and the tail.
+    constexpr size_t HUGE_PAGE = 2u << 20;
+    size_t           page      = (size_t) sysconf(_SC_PAGESIZE);
+    bool             huge      = _params.hugePages && size >= HUGE_PAGE;
+    if (huge) alignment = std::max(alignment, HUGE_PAGE);
+    size_t extra = alignment > page ? alignment : 0;
+    auto   base  = (uint8_t *) mmap(nullptr, size + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == (void *) base) {
+        RAPID_IMAGE_LOGE("Failed to map %zu bytes: errno=%d", size, errno);
+        return nullptr;
+    }
+    auto p = base;
+    if (extra) {
+        p         = (uint8_t *) rii_details::nextMultiple((uintptr_t) base, (uintptr_t) alignment);
+        auto end  = rii_details::nextMultiple((uintptr_t) p + size, (uintptr_t) page);
+        auto tail = (uintptr_t) base + size + extra;
+        if (p > base) munmap(base, (size_t) (p - base));
+        if (tail > end) munmap((void *) end, (size_t) (tail - end));
+    }
+#ifdef MADV_HUGEPAGE
+    if (huge) madvise(p, size, MADV_HUGEPAGE);
+#else
+    (void) huge;
+#endif
+    // Populate after the trim and the huge page advice, so that only the kept range is faulted in, with huge pages if
+    // it gets them. MAP_POPULATE would fault in the whole oversized mapping, trimmed ends included.
+    if (_params.populate) {
+        bool populated = false;
+#ifdef MADV_POPULATE_WRITE
+        populated = 0 == madvise(p, size, MADV_POPULATE_WRITE); // fails with EINVAL before Linux 5.14.
+#endif
+        if (!populated)
+            for (size_t i = 0; i < size; i += page) ((volatile uint8_t *) p)[i] = 0;
+    }
+    return p;
+#endif
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void PageAllocator::deallocate(void * p, size_t size, size_t) {
+#ifdef _WIN32
+    (void) size;
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    munmap(p, size);
+#endif
+}
+
+namespace rii_details {
+static std::atomic<size_t>          largeThreshold {2u << 20};
+static std::atomic<PageAllocator *> largeAllocator {nullptr};
+
+/// One allocator per combination of parameters, never destroyed, since buffers could be freed after static objects
+/// are destroyed.
+static PageAllocator * pageAllocator(const PageAllocator::Parameters & params) {
+    static PageAllocator * allocators = new PageAllocator[4] {
+        PageAllocator(PageAllocator::Parameters().setHugePages(false).setPopulate(false)),
+        PageAllocator(PageAllocator::Parameters().setHugePages(true).setPopulate(false)),
+        PageAllocator(PageAllocator::Parameters().setHugePages(false).setPopulate(true)),
+        PageAllocator(PageAllocator::Parameters().setHugePages(true).setPopulate(true)),
+    };
+    return &allocators[(params.hugePages ? 1 : 0) + (params.populate ? 2 : 0)];
+}
+} // namespace rii_details
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void PageAllocator::setLargeAllocations(size_t threshold, const Parameters & params) {
+    rii_details::largeAllocator = rii_details::pageAllocator(params);
+    rii_details::largeThreshold = threshold;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+PageAllocator * PageAllocator::large(size_t size) {
+    size_t threshold = rii_details::largeThreshold;
+    if (0 == threshold || size < threshold) return nullptr;
+    auto allocator = rii_details::largeAllocator.load();
+    return allocator ? allocator : rii_details::pageAllocator({});
+}
+
 // *********************************************************************************************************************
 // PixelFormat
 // *********************************************************************************************************************
 
+// ---------------------------------------------------------------------------------------------------------------------
+/// Convert a 32-bit float to a small float that has 5-bit exponent and \p mantissaBits bits of mantissa: half (signed,
+/// 10 bits) and the 11/10-bit unsigned floats of R11G11B10F. Rounds toward zero, which is bit-identical to F16C's
+/// _mm_cvtps_ph(x, _MM_FROUND_TO_ZERO) for half. Too large values go to the max finite value, too small values to
+/// denormals or zero. Unsigned formats clamp negative values to zero and map NaN to all ones.
+static inline uint32_t floatToSmallFloat(float value, uint32_t mantissaBits, bool hasSign) {
+    uint32_t u32;
+    memcpy(&u32, &value, sizeof(u32));
+    uint32_t mantissaMask = (1u << mantissaBits) - 1;
+    uint32_t inf          = 0x1Fu << mantissaBits;
+    uint32_t s            = hasSign ? (u32 >> 31) << (mantissaBits + 5) : 0;
+    uint32_t a            = u32 & 0x7fffffff;
+    // NaN
+    if (a > 0x7f800000) return hasSign ? (s | inf | (1u << (mantissaBits - 1)) | ((a >> (23 - mantissaBits)) & mantissaMask)) : (inf | mantissaMask);
+    // negative values, including -0 and -inf, of unsigned formats.
+    if (!hasSign && (u32 >> 31)) return 0;
+    // infinity
+    if (a == 0x7f800000) return s | inf;
+    // too large to represent: clamp to max finite value.
+    if (a >= (143u << 23)) return s | (inf - 1);
+    // normal number: rebias the exponent and truncate the mantissa.
+    if (a >= (113u << 23)) return s | ((a - (112u << 23)) >> (23 - mantissaBits));
+    // denormal number: shift the mantissa (with the implicit leading 1) into place.
+    uint32_t shift = 136 - mantissaBits - (a >> 23);
+    if (shift >= 24) return s;
+    return s | (((a & 0x7fffff) | 0x800000) >> shift);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Convert a small float (see floatToSmallFloat()) to 32-bit float. Handles denormals, infinity and NaN (quieted, like
+/// F16C's _mm_cvtph_ps does).
+static inline float smallFloatToFloat(uint32_t value, uint32_t mantissaBits, bool hasSign) {
+    uint32_t s = hasSign ? ((value >> (mantissaBits + 5)) & 1) << 31 : 0;
+    uint32_t e = (value >> mantissaBits) & 0x1F;
+    uint32_t m = value & ((1u << mantissaBits) - 1);
+    uint32_t u32;
+    if (0 == e) {
+        // denormal: m * 2^(-14 - mantissaBits)
+        uint32_t scaleBits = (113 - mantissaBits) << 23;
+        float    scale, f;
+        memcpy(&scale, &scaleBits, sizeof(scale));
+        f = (float) m * scale;
+        memcpy(&u32, &f, sizeof(u32));
+        u32 |= s;
+    } else if (31 == e) {
+        u32 = s | 0x7f800000 | (m << (23 - mantissaBits)) | (m ? 0x400000u : 0u);
+    } else {
+        u32 = s | ((e + 112) << 23) | (m << (23 - mantissaBits));
+    }
+    float result;
+    memcpy(&result, &u32, sizeof(result));
+    return result;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// sRGB to linear transfer function.
+static inline float srgbToLinear(float c) { return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f); }
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// linear to sRGB transfer function.
+static inline float linearToSrgb(float c) { return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f; }
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Lookup tables for 8-bit sRGB conversion, built once at first use.
+///
+/// Decoding is a plain 256 entry table. Encoding indexes a table with the exponent and the top 8 mantissa bits of the
+/// linear value. The sRGB curve spans less than one 8-bit code within each of these buckets, so the table stores the
+/// code at the start of the bucket, and one compare against the rounding threshold of the next code finishes the job.
+/// The result is exactly the 8-bit code whose [code - 0.5, code + 0.5) range contains the sRGB encoded value.
+struct SrgbTables {
+    static constexpr uint32_t MIN_BITS = (127u - 13u) << 23; ///< 2^-13. Anything below encodes to 0.
+    static constexpr uint32_t BUCKETS  = 13u << 8;           ///< 13 octaves in [2^-13, 1), 256 buckets each.
+
+    float   toLinear[256];
+    float   thresholds[256]; ///< thresholds[i] is the smallest linear value that encodes to (i + 1).
+    uint8_t buckets[BUCKETS];
+
+    static const SrgbTables & get() {
+        static const SrgbTables tables;
+        return tables;
+    }
+
+    uint8_t encode(float linear) const {
+        if (!(linear > 0.0f)) return 0; // this also catches NaN
+        if (linear >= 1.0f) return 255;
+        uint32_t bits;
+        memcpy(&bits, &linear, sizeof(bits));
+        if (bits < MIN_BITS) return 0;
+        uint32_t code = buckets[(bits - MIN_BITS) >> 15];
+        return (uint8_t) (code + (linear >= thresholds[code] ? 1 : 0));
+    }
+
+private:
+    SrgbTables() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            toLinear[i] = srgbToLinear((float) i / 255.0f);
+            if (i < 255) {
+                double c      = (i + 0.5) / 255.0;
+                thresholds[i] = (float) (c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+            } else {
+                thresholds[i] = 2.0f; // never reached, since encode() returns 255 for anything >= 1.
+            }
+        }
+        for (uint32_t b = 0; b < BUCKETS; ++b) {
+            uint32_t bits = MIN_BITS + (b << 15);
+            float    start;
+            memcpy(&start, &bits, sizeof(start));
+            buckets[b] = (uint8_t) (std::upper_bound(thresholds, thresholds + 255, start) - thresholds);
+        }
+    }
+};
+
 // ---------------------------------------------------------------------------------------------------------------------
 /// Convert a float to one color channel, based on the INITIAL channel format/sign prior to the reconversion
 static inline uint32_t fromFloat(float value, uint32_t width, PixelFormat::Sign sign) {
@@ -175,6 +943,8 @@ static inline uint32_t fromFloat(float value, uint32_t width, PixelFormat::Sign
         return u;
     };
     uint32_t mask = (width < 32) ? ((1u << width) - 1) : (uint32_t) -1;
+    // NaN converts like 0 to all but float channels, since casting it to an integer is undefined.
+    if (PixelFormat::SIGN_FLOAT != sign && std::isnan(value)) value = 0.0f;
     switch (sign) {
     case PixelFormat::SIGN_UNORM:
         if (value < 0.0f)
@@ -188,52 +958,14 @@ static inline uint32_t fromFloat(float value, uint32_t width, PixelFormat::Sign
         // 11 bits    =>                        EEE EEFFFFFF
         // Half bits  =>                   SEEEEEFF FFFFFFFF
         // Float bits => SEEEEEEE EFFFFFFF FFFFFFFF FFFFFFFF
-        // 0x0000001F => 00000000 00000000 00000000 00011111
-        // 0x0000003F => 00000000 00000000 00000000 00111111
-        // 0x000003E0 => 00000000 00000000 00000011 11100000
-        // 0x000007C0 => 00000000 00000000 00000111 11000000
-        // 0x00007C00 => 00000000 00000000 01111100 00000000
-        // 0x000003FF => 00000000 00000000 00000011 11111111
-        // 0x38000000 => 00111000 00000000 00000000 00000000
-        // 0x7f800000 => 01111111 10000000 00000000 00000000
-        // 0x00008000 => 00000000 00000000 10000000 00000000
         if (width == 32) {
             return castFromFloat(value);
         } else if (width == 16) {
-            if (value == 0.0f)
-                return 0u;
-            else if (std::isnan(value))
-                return ~0u;
-            else if (std::isinf(value)) {
-                if (value > 0.0f)
-                    return 0x1Fu << 10u;
-                else
-                    return 0x3Fu << 10u;
-            }
-            uint32_t u32 = castFromFloat(value);
-            return ((u32 >> 16) & 0x8000) |                               // sign
-                   ((((u32 & 0x7f800000) - 0x38000000) >> 13) & 0x7c00) | // exponential
-                   ((u32 >> 13) & 0x03ff);                                // Mantissa
+            return floatToSmallFloat(value, 10, true);
         } else if (width == 11) {
-            if (value == 0.0f)
-                return 0u;
-            else if (std::isnan(value))
-                return ~0u;
-            else if (std::isinf(value))
-                return 0x1Fu << 6u;
-            uint32_t u32 = castFromFloat(value);
-            return ((((u32 & 0x7f800000) - 0x38000000) >> 17) & 0x07c0) | // exponential
-                   ((u32 >> 17) & 0x003f);                                // Mantissa
+            return floatToSmallFloat(value, 6, false);
         } else if (width == 10) {
-            if (value == 0.0f)
-                return 0u;
-            else if (std::isnan(value))
-                return ~0u;
-            else if (std::isinf(value))
-                return 0x1Fu << 5u;
-            uint32_t u32 = castFromFloat(value);
-            return ((((u32 & 0x7f800000) - 0x38000000) >> 18) & 0x03E0) | // exponential
-                   ((u32 >> 18) & 0x001f);                                // Mantissa
+            return floatToSmallFloat(value, 5, false);
         } else {
             RII_THROW("unsupported yet.");
         }
@@ -242,12 +974,28 @@ static inline uint32_t fromFloat(float value, uint32_t width, PixelFormat::Sign
         if (value > (float) mask) return mask;
         return (uint32_t) value;
 
-    case PixelFormat::SIGN_SNORM:
     case PixelFormat::SIGN_GNORM:
+        // The new conversions round to nearest, so that decoding then encoding gives back the same value.
+        if (8 == width) return SrgbTables::get().encode(value);
+        return (uint32_t) (linearToSrgb(std::clamp(value, 0.0f, 1.0f)) * (float) mask + 0.5f);
+
+    case PixelFormat::SIGN_SNORM: {
+        double maxValue = (double) (mask >> 1);
+        return (uint32_t) std::llround(std::clamp((double) value, -1.0, 1.0) * maxValue) & mask;
+    }
+
     case PixelFormat::SIGN_BNORM:
-    case PixelFormat::SIGN_SINT:
-    case PixelFormat::SIGN_GINT:
+        return (uint32_t) std::llround((std::clamp((double) value, -1.0, 1.0) + 1.0) * 0.5 * (double) mask);
+
+    case PixelFormat::SIGN_SINT: {
+        double half = (double) (mask >> 1);
+        return (uint32_t) (int64_t) std::clamp((double) value, -half - 1.0, half) & mask;
+    }
+
     case PixelFormat::SIGN_BINT:
+        return (uint32_t) std::clamp((double) value + (double) (mask >> 1) + 1.0, 0.0, (double) mask);
+
+    case PixelFormat::SIGN_GINT:
     default:
         // not supported yet.
         RII_THROW("unsupported yet.");
@@ -278,31 +1026,16 @@ static inline float toFloat(uint32_t value, uint32_t width, PixelFormat::Sign si
     case PixelFormat::SIGN_FLOAT:
         // 10 bits    =>                         EE EEEFFFFF
         // 11 bits    =>                        EEE EEFFFFFF
-        // 16 bits    =>                   SEEEEEFF FFFFFFFF
+        // Half bits  =>                   SEEEEEFF FFFFFFFF
         // Float bits => SEEEEEEE EFFFFFFF FFFFFFFF FFFFFFFF
-        // 0x0000001F => 00000000 00000000 00000000 00011111
-        // 0x0000003F => 00000000 00000000 00000000 00111111
-        // 0x000003E0 => 00000000 00000000 00000011 11100000
-        // 0x000007C0 => 00000000 00000000 00000111 11000000
-        // 0x00007C00 => 00000000 00000000 01111100 00000000
-        // 0x000003FF => 00000000 00000000 00000011 11111111
-        // 0x38000000 => 00111000 00000000 00000000 00000000
-        // 0x7f800000 => 01111111 10000000 00000000 00000000
-        // 0x00008000 => 00000000 00000000 10000000 00000000
         if (width == 32) {
             return castToFloat(value);
         } else if (width == 16) {
-            uint32_t u32 = ((value & 0x8000) << 16) | (((value & 0x7c00) + 0x1C000) << 13) | // exponential
-                           ((value & 0x03FF) << 13);                                         // mantissa
-            return castToFloat(u32);
+            return smallFloatToFloat(value, 10, true);
         } else if (width == 11) {
-            uint32_t u32 = ((((value & 0x07c0) << 17) + 0x38000000) & 0x7f800000) | // exponential
-                           ((value & 0x003f) << 17);                                // Mantissa
-            return castToFloat(u32);
+            return smallFloatToFloat(value, 6, false);
         } else if (width == 10) {
-            uint32_t u32 = ((((value & 0x03E0) << 18) + 0x38000000) & 0x7f800000) | // exponential
-                           ((value & 0x001f) << 18);                                // Mantissa
-            return castToFloat(u32);
+            return smallFloatToFloat(value, 5, false);
         } else {
             RII_THROW("unsupported yet.");
         }
@@ -310,12 +1043,26 @@ static inline float toFloat(uint32_t value, uint32_t width, PixelFormat::Sign si
     case PixelFormat::SIGN_UINT:
         return (float) value;
 
-    case PixelFormat::SIGN_SNORM:
     case PixelFormat::SIGN_GNORM:
+        if (8 == width) return SrgbTables::get().toLinear[value];
+        return srgbToLinear((float) value / (float) mask);
+
+    case PixelFormat::SIGN_SNORM: {
+        // -2^(n-1) and -2^(n-1) + 1 both map to -1.0
+        auto s = (int32_t) (value << (32 - width)) >> (32 - width);
+        return std::max((float) ((double) s / (double) (mask >> 1)), -1.0f);
+    }
+
     case PixelFormat::SIGN_BNORM:
+        return (float) ((double) value / (double) mask * 2.0 - 1.0);
+
     case PixelFormat::SIGN_SINT:
-    case PixelFormat::SIGN_GINT:
+        return (float) ((int32_t) (value << (32 - width)) >> (32 - width));
+
     case PixelFormat::SIGN_BINT:
+        return (float) ((int64_t) value - (int64_t) (mask >> 1) - 1);
+
+    case PixelFormat::SIGN_GINT:
     default:
         // not supported yet.
         RII_THROW("unsupported yet.");
@@ -338,39 +1085,18 @@ RII_API OnePixel PixelFormat::loadFromFloat4(const Float4 & pixel) const {
 
     OnePixel result = {};
 
-    auto convertToChannel = [&](uint32_t swizzle) {
-        const auto & ch   = ld.channels[swizzle];
-        auto         sign = getSign(*this, swizzle);
-        uint32_t     value;
-        switch (swizzle) {
-        case PixelFormat::SWIZZLE_X:
-            value = fromFloat(pixel.x, ch.bits, sign);
-            break;
-        case PixelFormat::SWIZZLE_Y:
-            value = fromFloat(pixel.y, ch.bits, sign);
-            break;
-        case PixelFormat::SWIZZLE_Z:
-            value = fromFloat(pixel.z, ch.bits, sign);
-            break;
-        case PixelFormat::SWIZZLE_W:
-            value = fromFloat(pixel.w, ch.bits, sign);
-            break;
-        case PixelFormat::SWIZZLE_0:
-            value = 0u;
-            break;
-        case PixelFormat::SWIZZLE_1:
-            value = 1u;
-            break;
-        default:
-            RII_THROW("invalid enumeration.");
-        }
-        result.set(value, ch.shift, ch.bits);
-    };
-
-    convertToChannel(swizzle0);
-    convertToChannel(swizzle1);
-    convertToChannel(swizzle2);
-    convertToChannel(swizzle3);
+    // Swizzle maps pixel channels to float4 components. So here we do the reverse: the channel referenced by swizzleN
+    // gets its value from the Nth component of the input. SWIZZLE_0/1 have no storage in the pixel. Channels that are
+    // referenced more than once (e.g. luminance formats) are written only once, from the first component referencing it.
+    const uint32_t swizzles[] = {swizzle0, swizzle1, swizzle2, swizzle3};
+    uint32_t       written    = 0;
+    for (uint32_t i = 0; i < 4; ++i) {
+        auto swizzle = swizzles[i];
+        if (swizzle > PixelFormat::SWIZZLE_W || (written & (1u << swizzle))) continue;
+        written |= 1u << swizzle;
+        const auto & ch = ld.channels[swizzle];
+        result.set(fromFloat(pixel.f32[i], ch.bits, getSign(*this, swizzle)), ch.shift, ch.bits);
+    }
     return result;
 }
 
@@ -395,27 +1121,9 @@ RII_API Float4 PixelFormat::storeToFloat4(const void * pixel) const {
     return Float4::make(convertChannel(swizzle0), convertChannel(swizzle1), convertChannel(swizzle2), convertChannel(swizzle3));
 }
 
-// ---------------------------------------------------------------------------------------------------------------------
-/// convert single pixel to RGBA8 format.
-static void convertToRGBA8(RGBA8 * result, const PixelFormat::LayoutDesc & ld, const PixelFormat & format, const void * src) {
-    if (PixelFormat::RGBA8() == format) {
-        // shortcut for RGBA8 format.
-        *result = *(const RGBA8 *) src;
-    } else if (1 == ld.blockWidth && 1 == ld.blockHeight) {
-        // this is the general case that could in theory handle any format.
-        auto f4 = format.storeToFloat4(src);
-        *result = RGBA8::makeU8(
-            (uint8_t) std::clamp<uint32_t>((uint32_t) (f4.x * 255.0f), 0, 255), (uint8_t) std::clamp<uint32_t>((uint32_t) (f4.y * 255.0f), 0, 255),
-            (uint8_t) std::clamp<uint32_t>((uint32_t) (f4.z * 255.0f), 0, 255), (uint8_t) std::clamp<uint32_t>((uint32_t) (f4.w * 255.0f), 0, 255));
-    } else {
-        // decompressed format
-        RII_THROW("NOT IMPLEMENTED");
-    }
-}
-
 static inline PixelFormat::Swizzle getSwizzledChannel(const PixelFormat & format, size_t channel) {
     RII_ASSERT(channel < 4, "channel must be [0..3]");
-    return (PixelFormat::Swizzle)(format.u32 << (20 + channel * 3) & 0x7);
+    return (PixelFormat::Swizzle) ((format.u32 >> (20 + channel * 3)) & 0x7);
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -529,8 +1237,19 @@ inline static constexpr PixelFormat DXGI_FORMATS[] = {
     PixelFormat::BGRA_5_5_5_1_UNORM(),     // DXGI_FORMAT_BGRA_5_5_5_1_UNORM      = 86,
     PixelFormat::BGRA_8_8_8_8_UNORM(),     // DXGI_FORMAT_BGRA_8_8_8_8_UNORM      = 87,
     PixelFormat::UNKNOWN(),                // DXGI_FORMAT_BGR_8_8_8X8_UNORM       = 88,
+    PixelFormat::UNKNOWN(),                // DXGI_FORMAT_RGB_10_10_10_XR_BIAS_A2 = 89,
+    PixelFormat::BGRA_8_8_8_8_UINT(),      // DXGI_FORMAT_BGRA_8_8_8_8_UINT       = 90,
+    PixelFormat::UNKNOWN(),                // DXGI_FORMAT_BGRA_8_8_8_8_UNORM_SRGB = 91,
+    PixelFormat::UNKNOWN(),                // DXGI_FORMAT_BGRX_8_8_8_8_UINT       = 92,
+    PixelFormat::UNKNOWN(),                // DXGI_FORMAT_BGRX_8_8_8_8_UNORM_SRGB = 93,
+    PixelFormat::BC6H_UINT(),              // DXGI_FORMAT_BC6H_UINT               = 94,
+    PixelFormat::BC6H_UNORM(),             // DXGI_FORMAT_BC6H_UF16               = 95,
+    PixelFormat::BC6H_SNORM(),             // DXGI_FORMAT_BC6H_SF16               = 96,
+    PixelFormat::BC7_UINT(),               // DXGI_FORMAT_BC7_UINT                = 97,
+    PixelFormat::BC7_UNORM(),              // DXGI_FORMAT_BC7_UNORM               = 98,
+    PixelFormat::BC7_SRGB(),               // DXGI_FORMAT_BC7_UNORM_SRGB          = 99,
 };
-static_assert(std::size(DXGI_FORMATS) == 89);
+static_assert(std::size(DXGI_FORMATS) == 100);
 
 //
 //
@@ -767,272 +1486,4603 @@ RII_API uint32_t PixelFormat::toDXGI() const {
 }
 
 // *********************************************************************************************************************
-// PlaneDesc
+// Pixel conversion kernels
 // *********************************************************************************************************************
 
-RII_API bool PlaneDesc::valid() const {
-    // check format
-    if (!format.valid()) {
-        RAPID_IMAGE_LOGE("invalid format");
-        return false;
+namespace rii_details {
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// @brief A set of functions that convert one row of uncompressed pixels from/to float4 and rgba8.
+///
+/// \p step is the distance in bytes between 2 adjacent pixels on the packed side of the conversion. The float4/rgba8
+/// side is always tightly packed. The format parameter is only used by the generic kernels. The specialized kernels
+/// have it baked in at compile time.
+struct PixelKernels {
+    void (*toFloat4)(const PixelFormat & format, Float4 * dst, const uint8_t * src, size_t count, size_t step);
+    void (*toRGBA8)(const PixelFormat & format, RGBA8 * dst, const uint8_t * src, size_t count, size_t step);
+    void (*fromFloat4)(const PixelFormat & format, uint8_t * dst, const Float4 * src, size_t count, size_t step);
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Quantize a [0, 1] float to 8 bits. Out of range values and NaN are clamped.
+static inline uint8_t quantizeU8(float f) { return (uint8_t) ((f > 0.0f ? (f < 1.0f ? f : 1.0f) : 0.0f) * 255.0f); }
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// The generic kernels that works with any uncompressed format. They go through the per-pixel runtime path.
+struct GenericPixelKernels {
+    static void toFloat4(const PixelFormat & format, Float4 * dst, const uint8_t * src, size_t count, size_t step) {
+        for (size_t i = 0; i < count; ++i, src += step) dst[i] = format.storeToFloat4(src);
     }
 
-    // check dimension
-    if (extent.empty()) {
-        RAPID_IMAGE_LOGE("dimension can't zero!");
-        return false;
+    static void toRGBA8(const PixelFormat & format, RGBA8 * dst, const uint8_t * src, size_t count, size_t step) {
+        for (size_t i = 0; i < count; ++i, src += step) {
+            auto f4 = format.storeToFloat4(src);
+            dst[i]  = RGBA8::makeU8(quantizeU8(f4.x), quantizeU8(f4.y), quantizeU8(f4.z), quantizeU8(f4.w));
+        }
     }
 
-    // check pitches
-    auto & cld             = format.layoutDesc();
-    auto   numBlocksPerRow = (uint32_t) ((extent.w + cld.blockWidth - 1) / cld.blockWidth);
-    auto   numBlocksPerCol = (uint32_t) ((extent.h + cld.blockHeight - 1) / cld.blockHeight);
-    if (step < cld.blockBytes) {
-        RAPID_IMAGE_LOGE("step is too small!");
-        return false;
+    static void fromFloat4(const PixelFormat & format, uint8_t * dst, const Float4 * src, size_t count, size_t step) {
+        auto bytes = format.layoutDesc().blockBytes;
+        for (size_t i = 0; i < count; ++i, dst += step) {
+            auto p = format.loadFromFloat4(src[i]);
+            memcpy(dst, &p, bytes);
+        }
     }
-    if (pitch < numBlocksPerRow * cld.blockBytes) {
-        RAPID_IMAGE_LOGE("pitch is too small!");
-        return false;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Pack the format bit fields into a 32-bit integer in a constexpr friendly way (reading the u32 member of the union is
+/// not allowed in constant expressions). The result equals to PixelFormat::u32.
+static constexpr uint32_t packFormat(const PixelFormat & f) {
+    return (uint32_t) f.layout | ((uint32_t) f.sign0 << 8) | ((uint32_t) f.sign12 << 12) | ((uint32_t) f.sign3 << 16) | ((uint32_t) f.swizzle0 << 20) |
+           ((uint32_t) f.swizzle1 << 23) | ((uint32_t) f.swizzle2 << 26) | ((uint32_t) f.swizzle3 << 29);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Kernels specialized for one (layout, sign, swizzle) combination, packed into FORMAT. Everything about the format is a
+/// compile time constant here, so the per-channel switches in toFloat()/fromFloat() and the swizzle lookup are folded
+/// away by the compiler, leaving only the shifts, masks and arithmetic of the actual conversion. The results are
+/// bit-identical to the generic kernels.
+template<uint32_t FORMAT>
+struct SpecializedPixelKernels {
+    static constexpr uint32_t LAYOUT = FORMAT & 0x7F;
+    static constexpr uint32_t SIGN0  = (FORMAT >> 8) & 0xF;
+    static constexpr uint32_t SIGN12 = (FORMAT >> 12) & 0xF;
+    static constexpr uint32_t SIGN3  = (FORMAT >> 16) & 0xF;
+    static constexpr uint32_t SW0    = (FORMAT >> 20) & 0x7;
+    static constexpr uint32_t SW1    = (FORMAT >> 23) & 0x7;
+    static constexpr uint32_t SW2    = (FORMAT >> 26) & 0x7;
+    static constexpr uint32_t SW3    = (FORMAT >> 29) & 0x7;
+
+    static constexpr PixelFormat::LayoutDesc LD = PixelFormat::LAYOUTS[LAYOUT];
+    static_assert(1 == LD.blockWidth && 1 == LD.blockHeight && LD.blockBytes <= 16, "only uncompressed formats can be specialized.");
+
+    static constexpr PixelFormat::Sign sign(uint32_t channel) { return (PixelFormat::Sign) ((0 == channel) ? SIGN0 : (3 == channel) ? SIGN3 : SIGN12); }
+
+    static constexpr uint32_t mask(uint32_t channel) { return (LD.channels[channel].bits < 32) ? ((1u << LD.channels[channel].bits) - 1) : ~0u; }
+
+    /// Index of the first float4 component that references the channel. -1, if the channel is not referenced at all.
+    static constexpr int source(uint32_t channel) { return (SW0 == channel) ? 0 : (SW1 == channel) ? 1 : (SW2 == channel) ? 2 : (SW3 == channel) ? 3 : -1; }
+
+    template<uint32_t SW>
+    static inline float toFloatChannel(const uint32_t * words) {
+        if constexpr (PixelFormat::SWIZZLE_0 == SW) {
+            return 0.0f;
+        } else if constexpr (PixelFormat::SWIZZLE_1 == SW) {
+            return 1.0f;
+        } else {
+            constexpr auto ch = LD.channels[SW];
+            return toFloat((words[ch.shift / 32] >> (ch.shift % 32)) & mask(SW), ch.bits, sign(SW));
+        }
     }
-    if (slice < numBlocksPerCol * numBlocksPerRow * cld.blockBytes) {
-        RAPID_IMAGE_LOGE("slice is too small!");
-        return false;
+
+    template<uint32_t SW>
+    static inline uint8_t toU8Channel(const uint32_t * words) {
+        if constexpr (PixelFormat::SWIZZLE_0 == SW) {
+            return 0;
+        } else if constexpr (PixelFormat::SWIZZLE_1 == SW) {
+            return 255;
+        } else if constexpr (8 == LD.channels[SW].bits && PixelFormat::SIGN_UNORM == sign(SW)) {
+            // 8-bit unorm channel is copied as is. This is exactly what the float path would produce.
+            return (uint8_t) (words[LD.channels[SW].shift / 32] >> (LD.channels[SW].shift % 32));
+        } else {
+            return quantizeU8(toFloatChannel<SW>(words));
+        }
     }
-    if (size < slice * extent.d) {
-        RAPID_IMAGE_LOGE("size is too small!");
-        return false;
+
+    template<uint32_t CH>
+    static inline void fromFloatChannel(uint32_t * words, const Float4 & f) {
+        if constexpr (CH < LD.numChannels && source(CH) >= 0) {
+            constexpr auto ch = LD.channels[CH];
+            words[ch.shift / 32] |= (fromFloat(f.f32[source(CH)], ch.bits, sign(CH)) & mask(CH)) << (ch.shift % 32);
+        }
     }
 
-    // check alignment
-    if (0 == alignment) {
-        RAPID_IMAGE_LOGE("row alignment can't zero!");
-        return false;
+    static void toFloat4(const PixelFormat &, Float4 * dst, const uint8_t * src, size_t count, size_t step) {
+        for (size_t i = 0; i < count; ++i, src += step) {
+            uint32_t words[4] = {};
+            memcpy(words, src, LD.blockBytes);
+            dst[i] = Float4::make(toFloatChannel<SW0>(words), toFloatChannel<SW1>(words), toFloatChannel<SW2>(words), toFloatChannel<SW3>(words));
+        }
     }
-    if (pitch % alignment) {
-        RAPID_IMAGE_LOGE("Pitch is not aligned to row alignment.");
-        return false;
+
+    static void toRGBA8(const PixelFormat &, RGBA8 * dst, const uint8_t * src, size_t count, size_t step) {
+        for (size_t i = 0; i < count; ++i, src += step) {
+            uint32_t words[4] = {};
+            memcpy(words, src, LD.blockBytes);
+            dst[i] = RGBA8::makeU8(toU8Channel<SW0>(words), toU8Channel<SW1>(words), toU8Channel<SW2>(words), toU8Channel<SW3>(words));
+        }
     }
-    if (slice % alignment) {
-        RAPID_IMAGE_LOGE("Slice is not aligned to the pixel block boundary.");
-        return false;
+
+    static void fromFloat4(const PixelFormat &, uint8_t * dst, const Float4 * src, size_t count, size_t step) {
+        for (size_t i = 0; i < count; ++i, dst += step) {
+            uint32_t words[4] = {};
+            fromFloatChannel<0>(words, src[i]);
+            fromFloatChannel<1>(words, src[i]);
+            fromFloatChannel<2>(words, src[i]);
+            fromFloatChannel<3>(words, src[i]);
+            memcpy(dst, words, LD.blockBytes);
+        }
     }
 
-    // done
-    return true;
-}
+    static constexpr PixelKernels KERNELS = {toFloat4, toRGBA8, fromFloat4};
+};
+
+#if RII_SIMD_SSE
 
 // ---------------------------------------------------------------------------------------------------------------------
-//
-RII_API PlaneDesc PlaneDesc::make(PixelFormat format, const Extent3D & extent, size_t step, size_t pitch, size_t slice, size_t alignment) {
-    if (!format.valid()) {
-        RAPID_IMAGE_LOGE("invalid color format: 0x%X", format.u32);
-        return {};
+/// CPU features that the x64 SIMD kernels care about, beyond the SSE2 baseline. Detected once, at first use.
+struct CpuFeatures {
+    bool ssse3 = false; ///< SSSE3, for byte shuffles.
+    bool avx2  = false; ///< AVX2, with YMM state enabled by the OS.
+    bool f16c  = false; ///< F16C half <-> float conversion, with YMM state enabled by the OS.
+
+    static const CpuFeatures & get() {
+        static const CpuFeatures features = detect();
+        return features;
     }
 
-    PlaneDesc p;
-    p.format   = format;
-    p.extent.w = extent.w ? extent.w : 1;
-    p.extent.h = extent.h ? extent.h : 1;
-    p.extent.d = extent.d ? extent.d : 1;
+private:
+    static void cpuid(uint32_t leaf, uint32_t subLeaf, uint32_t regs[4]) {
+#ifdef _MSC_VER
+        int r[4];
+        __cpuidex(r, (int) leaf, (int) subLeaf);
+        for (int i = 0; i < 4; ++i) regs[i] = (uint32_t) r[i];
+#else
+        __cpuid_count(leaf, subLeaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    }
 
-    p.setSpacing(step, pitch, slice, alignment);
-    RII_ASSERT(p.alignment > 0 && p.step > 0 && p.pitch > 0 && p.slice > 0 && p.size > 0);
+    static uint64_t xgetbv0() {
+#ifdef _MSC_VER
+        return _xgetbv(0);
+#else
+        uint32_t lo, hi;
+        __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        return ((uint64_t) hi << 32) | lo;
+#endif
+    }
 
-    // done
-    RII_ASSERT(p.valid());
-    return p;
+    static CpuFeatures detect() {
+        CpuFeatures result;
+        uint32_t    regs[4];
+        cpuid(0, 0, regs);
+        uint32_t maxLeaf = regs[0];
+        cpuid(1, 0, regs);
+        bool osxsave = 0 != (regs[2] & (1u << 27));
+        bool avx     = 0 != (regs[2] & (1u << 28));
+        bool f16c    = 0 != (regs[2] & (1u << 29));
+        bool ymm     = osxsave && avx && (6 == (xgetbv0() & 6));
+        result.ssse3 = 0 != (regs[2] & (1u << 9));
+        result.f16c  = ymm && f16c;
+        if (maxLeaf >= 7) {
+            cpuid(7, 0, regs);
+            result.avx2 = ymm && 0 != (regs[1] & (1u << 5));
+        }
+        return result;
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Clamp to [0, 1]. NaN becomes 0, same as the scalar code path.
+static inline __m128 sseSaturate(__m128 v) { return _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.0f)); }
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Quantize 4 float4 pixels to 4 RGBA8 pixels, same as quantizeU8().
+static inline __m128i sseQuantizeRGBA8(const Float4 * src) {
+    const __m128 scale = _mm_set1_ps(255.0f);
+    __m128i      p0    = _mm_cvttps_epi32(_mm_mul_ps(sseSaturate(_mm_loadu_ps(src[0].f32)), scale));
+    __m128i      p1    = _mm_cvttps_epi32(_mm_mul_ps(sseSaturate(_mm_loadu_ps(src[1].f32)), scale));
+    __m128i      p2    = _mm_cvttps_epi32(_mm_mul_ps(sseSaturate(_mm_loadu_ps(src[2].f32)), scale));
+    __m128i      p3    = _mm_cvttps_epi32(_mm_mul_ps(sseSaturate(_mm_loadu_ps(src[3].f32)), scale));
+    return _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
-//
-RII_API PlaneDesc & PlaneDesc::setSpacing(size_t step_, size_t pitch_, size_t slice_, size_t alignment_) {
-    RII_REQUIRE(format.valid(), "must call this after setting the pixel format.");
-    const auto & fd = format.layoutDesc();
-    RII_REQUIRE(!extent.empty(), "must call this after setting the plane extent.");
-    auto numBlocksPerRow = (uint32_t) ((extent.w + fd.blockWidth - 1) / fd.blockWidth);
-    auto numBlocksPerCol = (uint32_t) ((extent.h + fd.blockHeight - 1) / fd.blockHeight);
-    alignment            = alignment_ ? (uint32_t) alignment_ : 4;
-    step                 = std::max((uint32_t) step_, (uint32_t) (fd.blockBytes));
-    pitch                = rii_details::nextMultiple(std::max<uint32_t>(step * numBlocksPerRow, (uint32_t) pitch_), alignment);
-    slice                = rii_details::nextMultiple(std::max<uint32_t>(pitch * numBlocksPerCol, (uint32_t) slice_), alignment);
-    size                 = slice * extent.d;
-    return *this;
+/// Convert a row to RGBA8 by converting it to float4 first with TO_FLOAT4, then quantizing it with SSE.
+template<void (*TO_FLOAT4)(const PixelFormat &, Float4 *, const uint8_t *, size_t, size_t)>
+static void sseToRGBA8ViaFloat4(const PixelFormat & format, RGBA8 * dst, const uint8_t * src, size_t count, size_t step) {
+    Float4 buffer[64];
+    while (count > 0) {
+        size_t n = std::min<size_t>(count, std::size(buffer));
+        TO_FLOAT4(format, buffer, src, n, step);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) _mm_storeu_si128((__m128i *) (dst + i), sseQuantizeRGBA8(buffer + i));
+        for (; i < n; ++i) dst[i] = RGBA8::makeU8(quantizeU8(buffer[i].x), quantizeU8(buffer[i].y), quantizeU8(buffer[i].z), quantizeU8(buffer[i].w));
+        dst += n;
+        src += n * step;
+        count -= n;
+    }
 }
 
+#if defined(__GNUC__) || defined(__clang__)
+#define RII_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define RII_TARGET_AVX2  __attribute__((target("avx2")))
+#define RII_TARGET_F16C  __attribute__((target("avx,f16c")))
+#else
+#define RII_TARGET_SSSE3
+#define RII_TARGET_AVX2
+#define RII_TARGET_F16C
+#endif
+
 // ---------------------------------------------------------------------------------------------------------------------
-//
-RII_API std::vector<Float4> PlaneDesc::toFloat4(const void * pixels) const {
-    if (empty()) {
-        RAPID_IMAGE_LOGE("Can't save empty image plane.");
-        return {};
+/// SIMD kernels of RGBA8 and BGRA8 (SWAP_RB = true). Only tightly packed rows are vectorized. Anything else, including
+/// the tail of the row, goes to the scalar kernels of the same format.
+template<uint32_t FORMAT, bool SWAP_RB>
+struct SseRGBA8Kernels {
+    using Scalar = SpecializedPixelKernels<FORMAT>;
+
+    static inline __m128 swapRB(__m128 v) { return SWAP_RB ? _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 1, 2)) : v; }
+
+    static inline __m128i swapRB(__m128i v) {
+        if (!SWAP_RB) return v;
+        const __m128i ga = _mm_set1_epi32((int) 0xFF00FF00);
+        const __m128i b  = _mm_set1_epi32(0xFF);
+        return _mm_or_si128(_mm_and_si128(v, ga), _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 16), b), _mm_slli_epi32(_mm_and_si128(v, b), 16)));
     }
-    auto ld = format.layoutDesc();
-    if (ld.blockWidth > 1 || ld.blockHeight > 1) {
-        RAPID_IMAGE_LOGE("Do not support compressed texture format yet.");
-        return {};
+
+    static void toFloat4(const PixelFormat & format, Float4 * dst, const uint8_t * src, size_t count, size_t step) {
+        size_t i = 0;
+        if (4 == step) {
+            const __m128i zero  = _mm_setzero_si128();
+            const __m128  scale = _mm_set1_ps(255.0f);
+            for (; i + 4 <= count; i += 4) {
+                __m128i v  = _mm_loadu_si128((const __m128i *) (src + i * 4));
+                __m128i lo = _mm_unpacklo_epi8(v, zero);
+                __m128i hi = _mm_unpackhi_epi8(v, zero);
+                // Divide (rather than multiply by the reciprocal) to be bit-identical to the scalar path.
+                _mm_storeu_ps(dst[i + 0].f32, swapRB(_mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale)));
+                _mm_storeu_ps(dst[i + 1].f32, swapRB(_mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale)));
+                _mm_storeu_ps(dst[i + 2].f32, swapRB(_mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale)));
+                _mm_storeu_ps(dst[i + 3].f32, swapRB(_mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale)));
+            }
+        }
+        Scalar::toFloat4(format, dst + i, src + i * step, count - i, step);
     }
-    const uint8_t *     p = (const uint8_t *) pixels;
-    std::vector<Float4> colors;
-    colors.reserve(extent.w * extent.h * extent.d);
-    for (uint32_t z = 0; z < extent.d; ++z) {
-        for (uint32_t y = 0; y < extent.h; ++y) {
-            for (uint32_t x = 0; x < extent.w; ++x) { colors.push_back(format.storeToFloat4(p + pixel(x, y, z))); }
+
+    static void toRGBA8(const PixelFormat & format, RGBA8 * dst, const uint8_t * src, size_t count, size_t step) {
+        size_t i = 0;
+        if (4 == step) {
+            for (; i + 4 <= count; i += 4) _mm_storeu_si128((__m128i *) (dst + i), swapRB(_mm_loadu_si128((const __m128i *) (src + i * 4))));
         }
+        Scalar::toRGBA8(format, dst + i, src + i * step, count - i, step);
     }
-    return colors;
-}
+
+    static void fromFloat4(const PixelFormat & format, uint8_t * dst, const Float4 * src, size_t count, size_t step) {
+        size_t i = 0;
+        if (4 == step) {
+            for (; i + 4 <= count; i += 4) _mm_storeu_si128((__m128i *) (dst + i * 4), swapRB(sseQuantizeRGBA8(src + i)));
+        }
+        Scalar::fromFloat4(format, dst + i * step, src + i, count - i, step);
+    }
+
+    static constexpr PixelKernels KERNELS = {toFloat4, toRGBA8, fromFloat4};
+};
 
 // ---------------------------------------------------------------------------------------------------------------------
-//
-RII_API std::vector<RGBA8> PlaneDesc::toRGBA8(const void * pixels) const {
-    if (empty()) {
-        RAPID_IMAGE_LOGE("Can't save empty image plane.");
-        return {};
+/// AVX2 version of SseRGBA8Kernels: 8 pixels per iteration.
+template<uint32_t FORMAT, bool SWAP_RB>
+struct Avx2RGBA8Kernels {
+    using Sse = SseRGBA8Kernels<FORMAT, SWAP_RB>;
+
+    RII_TARGET_AVX2 static inline __m256 swapRB(__m256 v) { return SWAP_RB ? _mm256_permute_ps(v, _MM_SHUFFLE(3, 0, 1, 2)) : v; }
+
+    RII_TARGET_AVX2 static inline __m256i quantize(const Float4 * src) {
+        const __m256 zero  = _mm256_setzero_ps();
+        const __m256 one   = _mm256_set1_ps(1.0f);
+        const __m256 scale = _mm256_set1_ps(255.0f);
+        __m256i      p[4];
+        for (int k = 0; k < 4; ++k) {
+            __m256 v = swapRB(_mm256_loadu_ps(src[k * 2].f32));
+            p[k]     = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(v, zero), one), scale));
+        }
+        // pack works within each 128-bit lane, so the pixels come out as 0,2,4,6 | 1,3,5,7. Permute them back in order.
+        __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(p[0], p[1]), _mm256_packs_epi32(p[2], p[3]));
+        return _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
     }
-    const uint8_t *    p  = (const uint8_t *) pixels;
-    auto               ld = format.layoutDesc();
-    std::vector<RGBA8> colors;
-    std::vector<RGBA8> block(ld.blockWidth * ld.blockHeight);
 
-    colors.resize(extent.w * extent.h * extent.d);
-    for (uint32_t z = 0; z < extent.d; ++z) {
-        for (uint32_t y = 0; y < extent.h; y += ld.blockHeight) {
-            for (uint32_t x = 0; x < extent.w; x += ld.blockWidth) {
-                // convert the block
-                convertToRGBA8(block.data(), ld, format, p + pixel(x, y, z));
-
-                // copy the block to output buffer
-                uint32_t right  = std::min(x + ld.blockWidth, extent.w);
-                uint32_t bottom = std::min(y + ld.blockHeight, extent.h);
-                for (uint32_t yy = y; yy < bottom; ++yy) {
-                    for (uint32_t xx = x; xx < right; ++xx) {
-                        colors[z * extent.w * extent.h + yy * extent.w + xx] = block[(yy - y) * ld.blockWidth + (xx - x)];
-                    }
+    RII_TARGET_AVX2 static void toFloat4(const PixelFormat & format, Float4 * dst, const uint8_t * src, size_t count, size_t step) {
+        size_t i = 0;
+        if (4 == step) {
+            const __m256 scale = _mm256_set1_ps(255.0f);
+            for (; i + 8 <= count; i += 8) {
+                for (size_t k = 0; k < 8; k += 2) {
+                    __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (src + (i + k) * 4)));
+                    _mm256_storeu_ps(dst[i + k].f32, swapRB(_mm256_div_ps(_mm256_cvtepi32_ps(v), scale)));
                 }
             }
         }
+        Sse::toFloat4(format, dst + i, src + i * step, count - i, step);
+    }
+
+    RII_TARGET_AVX2 static void fromFloat4(const PixelFormat & format, uint8_t * dst, const Float4 * src, size_t count, size_t step) {
+        size_t i = 0;
+        if (4 == step) {
+            for (; i + 8 <= count; i += 8) _mm256_storeu_si256((__m256i *) (dst + i * 4), quantize(src + i));
+        }
+        Sse::fromFloat4(format, dst + i * step, src + i, count - i, step);
     }
-    return colors;
-}
+
+    static constexpr PixelKernels KERNELS = {toFloat4, Sse::toRGBA8, fromFloat4};
+};
 
 // ---------------------------------------------------------------------------------------------------------------------
-//
-RII_API void PlaneDesc::fromFloat4(void * dst, size_t dstSize, size_t dstZ, const void * src) const {
-    if (empty()) {
-        RAPID_IMAGE_LOGE("Can't load data to empty image plane.");
-        return;
+/// SIMD kernels of RGBA_10_10_10_2_UNORM. 4 pixels are decoded into SoA form, then transposed.
+struct SseRGB10A2Kernels {
+    using Scalar = SpecializedPixelKernels<packFormat(PixelFormat::RGBA_10_10_10_2_UNORM())>;
+
+    static void toFloat4(const PixelFormat & format, Float4 * dst, const uint8_t * src, size_t count, size_t step) {
+        size_t i = 0;
+        if (4 == step) {
+            const __m128i mask10 = _mm_set1_epi32(0x3FF);
+            const __m128  scale  = _mm_set1_ps(1023.0f);
+            for (; i + 4 <= count; i += 4) {
+                __m128i v = _mm_loadu_si128((const __m128i *) (src + i * 4));
+                __m128  r = _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(v, mask10)), scale);
+                __m128  g = _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 10), mask10)), scale);
+                __m128  b = _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 20), mask10)), scale);
+                __m128  a = _mm_div_ps(_mm_cvtepi32_ps(_mm_srli_epi32(v, 30)), _mm_set1_ps(3.0f));
+                _MM_TRANSPOSE4_PS(r, g, b, a);
+                _mm_storeu_ps(dst[i + 0].f32, r);
+                _mm_storeu_ps(dst[i + 1].f32, g);
+                _mm_storeu_ps(dst[i + 2].f32, b);
+                _mm_storeu_ps(dst[i + 3].f32, a);
+            }
+        }
+        Scalar::toFloat4(format, dst + i, src + i * step, count - i, step);
     }
-    const Float4 * p  = (const Float4 *) src;
-    auto           ld = format.layoutDesc();
-    if (ld.blockWidth > 1 || ld.blockHeight > 1) {
-        RAPID_IMAGE_LOGE("does not support loading pixel data to compressed image plane.");
-        return;
+
+    static void fromFloat4(const PixelFormat & format, uint8_t * dst, const Float4 * src, size_t count, size_t step) {
+        size_t i = 0;
+        if (4 == step) {
+            const __m128 scale10 = _mm_set1_ps(1023.0f);
+            for (; i + 4 <= count; i += 4) {
+                __m128 r = sseSaturate(_mm_loadu_ps(src[i + 0].f32));
+                __m128 g = sseSaturate(_mm_loadu_ps(src[i + 1].f32));
+                __m128 b = sseSaturate(_mm_loadu_ps(src[i + 2].f32));
+                __m128 a = sseSaturate(_mm_loadu_ps(src[i + 3].f32));
+                _MM_TRANSPOSE4_PS(r, g, b, a);
+                __m128i v = _mm_cvttps_epi32(_mm_mul_ps(r, scale10));
+                v         = _mm_or_si128(v, _mm_slli_epi32(_mm_cvttps_epi32(_mm_mul_ps(g, scale10)), 10));
+                v         = _mm_or_si128(v, _mm_slli_epi32(_mm_cvttps_epi32(_mm_mul_ps(b, scale10)), 20));
+                v         = _mm_or_si128(v, _mm_slli_epi32(_mm_cvttps_epi32(_mm_mul_ps(a, _mm_set1_ps(3.0f))), 30));
+                _mm_storeu_si128((__m128i *) (dst + i * 4), v);
+            }
+        }
+        Scalar::fromFloat4(format, dst + i * step, src + i, count - i, step);
+    }
+
+    static constexpr PixelKernels KERNELS = {toFloat4, sseToRGBA8ViaFloat4<toFloat4>, fromFloat4};
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// AVX2 version of the RGB10A2 decoder: each pixel is broadcast to 4 lanes and shifted by a per-lane amount, so no
+/// transpose is needed.
+struct Avx2RGB10A2Kernels {
+    RII_TARGET_AVX2 static void toFloat4(const PixelFormat & format, Float4 * dst, const uint8_t * src, size_t count, size_t step) {
+        size_t i = 0;
+        if (4 == step) {
+            const __m256i broadcast = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+            const __m256i shifts    = _mm256_setr_epi32(0, 10, 20, 30, 0, 10, 20, 30);
+            const __m256i masks     = _mm256_setr_epi32(0x3FF, 0x3FF, 0x3FF, 3, 0x3FF, 0x3FF, 0x3FF, 3);
+            const __m256  scales    = _mm256_setr_ps(1023.0f, 1023.0f, 1023.0f, 3.0f, 1023.0f, 1023.0f, 1023.0f, 3.0f);
+            for (; i + 2 <= count; i += 2) {
+                __m256i v = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i *) (src + i * 4))), broadcast);
+                v         = _mm256_and_si256(_mm256_srlv_epi32(v, shifts), masks);
+                _mm256_storeu_ps(dst[i].f32, _mm256_div_ps(_mm256_cvtepi32_ps(v), scales));
+            }
+        }
+        SseRGB10A2Kernels::toFloat4(format, dst + i, src + i * step, count - i, step);
+    }
+
+    static constexpr PixelKernels KERNELS = {toFloat4, sseToRGBA8ViaFloat4<toFloat4>, SseRGB10A2Kernels::fromFloat4};
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// SIMD decoder of RGB_11_11_10_FLOAT. The encoder stays scalar: it is rarely used and the clamping rules of the
+/// unsigned small floats make it branchy.
+struct SseR11G11B10FKernels {
+    using Scalar = SpecializedPixelKernels<packFormat(PixelFormat::RGB_11_11_10_FLOAT())>;
+
+    /// Vectorized version of smallFloatToFloat(field, M, false).
+    template<int M>
+    static inline __m128 toFloat(__m128i field) {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i       e    = _mm_srli_epi32(field, M);
+        __m128i       m    = _mm_and_si128(field, _mm_set1_epi32((1 << M) - 1));
+        __m128i       norm = _mm_or_si128(_mm_slli_epi32(_mm_add_epi32(e, _mm_set1_epi32(112)), 23), _mm_slli_epi32(m, 23 - M));
+        __m128i       deno = _mm_castps_si128(_mm_mul_ps(_mm_cvtepi32_ps(m), _mm_castsi128_ps(_mm_set1_epi32((113 - M) << 23))));
+        __m128i       nan  = _mm_andnot_si128(_mm_cmpeq_epi32(m, zero), _mm_set1_epi32(0x400000));
+        __m128i       spec = _mm_or_si128(_mm_or_si128(_mm_set1_epi32(0x7F800000), _mm_slli_epi32(m, 23 - M)), nan);
+        __m128i       isDe = _mm_cmpeq_epi32(e, zero);
+        __m128i       isSp = _mm_cmpeq_epi32(e, _mm_set1_epi32(31));
+        __m128i       r    = _mm_or_si128(_mm_and_si128(isDe, deno), _mm_andnot_si128(isDe, norm));
+        r                  = _mm_or_si128(_mm_and_si128(isSp, spec), _mm_andnot_si128(isSp, r));
+        return _mm_castsi128_ps(r);
+    }
+
+    static void toFloat4(const PixelFormat & format, Float4 * dst, const uint8_t * src, size_t count, size_t step) {
+        size_t i = 0;
+        if (4 == step) {
+            const __m128i mask11 = _mm_set1_epi32(0x7FF);
+            for (; i + 4 <= count; i += 4) {
+                __m128i v = _mm_loadu_si128((const __m128i *) (src + i * 4));
+                __m128  r = toFloat<6>(_mm_and_si128(v, mask11));
+                __m128  g = toFloat<6>(_mm_and_si128(_mm_srli_epi32(v, 11), mask11));
+                __m128  b = toFloat<5>(_mm_srli_epi32(v, 22));
+                __m128  a = _mm_set1_ps(1.0f);
+                _MM_TRANSPOSE4_PS(r, g, b, a);
+                _mm_storeu_ps(dst[i + 0].f32, r);
+                _mm_storeu_ps(dst[i + 1].f32, g);
+                _mm_storeu_ps(dst[i + 2].f32, b);
+                _mm_storeu_ps(dst[i + 3].f32, a);
+            }
+        }
+        Scalar::toFloat4(format, dst + i, src + i * step, count - i, step);
+    }
+
+    static constexpr PixelKernels KERNELS = {toFloat4, sseToRGBA8ViaFloat4<toFloat4>, Scalar::fromFloat4};
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// SIMD kernels of R_32_FLOAT.
+struct SseR32FKernels {
+    using Scalar = SpecializedPixelKernels<packFormat(PixelFormat::R_32_FLOAT())>;
+
+    static void toFloat4(const PixelFormat & format, Float4 * dst, const uint8_t * src, size_t count, size_t step) {
+        size_t i = 0;
+        if (4 == step) {
+            const __m128 x001 = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+            for (; i + 4 <= count; i += 4) {
+                __m128 v = _mm_loadu_ps((const float *) (src + i * 4));
+                _mm_storeu_ps(dst[i + 0].f32, _mm_move_ss(x001, v));
+                _mm_storeu_ps(dst[i + 1].f32, _mm_move_ss(x001, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1))));
+                _mm_storeu_ps(dst[i + 2].f32, _mm_move_ss(x001, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2))));
+                _mm_storeu_ps(dst[i + 3].f32, _mm_move_ss(x001, _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3))));
+            }
+        }
+        Scalar::toFloat4(format, dst + i, src + i * step, count - i, step);
+    }
+
+    static void fromFloat4(const PixelFormat & format, uint8_t * dst, const Float4 * src, size_t count, size_t step) {
+        size_t i = 0;
+        if (4 == step) {
+            for (; i + 4 <= count; i += 4) {
+                __m128 xy01 = _mm_unpacklo_ps(_mm_loadu_ps(src[i + 0].f32), _mm_loadu_ps(src[i + 1].f32));
+                __m128 xy23 = _mm_unpacklo_ps(_mm_loadu_ps(src[i + 2].f32), _mm_loadu_ps(src[i + 3].f32));
+                _mm_storeu_ps((float *) (dst + i * 4), _mm_movelh_ps(xy01, xy23));
+            }
+        }
+        Scalar::fromFloat4(format, dst + i * step, src + i, count - i, step);
+    }
+
+    static constexpr PixelKernels KERNELS = {toFloat4, sseToRGBA8ViaFloat4<toFloat4>, fromFloat4};
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// F16C kernels of RGBA_16_16_16_16_FLOAT. The encoder rounds toward zero to match floatToSmallFloat().
+struct F16cRGBA16FKernels {
+    using Scalar = SpecializedPixelKernels<packFormat(PixelFormat::RGBA_16_16_16_16_FLOAT())>;
+
+    RII_TARGET_F16C static void toFloat4(const PixelFormat & format, Float4 * dst, const uint8_t * src, size_t count, size_t step) {
+        size_t i = 0;
+        if (8 == step) {
+            for (; i + 2 <= count; i += 2) _mm256_storeu_ps(dst[i].f32, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (src + i * 8))));
+        }
+        Scalar::toFloat4(format, dst + i, src + i * step, count - i, step);
+    }
+
+    RII_TARGET_F16C static void fromFloat4(const PixelFormat & format, uint8_t * dst, const Float4 * src, size_t count, size_t step) {
+        size_t i = 0;
+        if (8 == step) {
+            for (; i + 2 <= count; i += 2) _mm_storeu_si128((__m128i *) (dst + i * 8), _mm256_cvtps_ph(_mm256_loadu_ps(src[i].f32), _MM_FROUND_TO_ZERO));
+        }
+        Scalar::fromFloat4(format, dst + i * step, src + i, count - i, step);
+    }
+
+    static constexpr PixelKernels KERNELS = {toFloat4, sseToRGBA8ViaFloat4<toFloat4>, fromFloat4};
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// F16C kernels of RG_16_16_FLOAT.
+struct F16cRG16FKernels {
+    using Scalar = SpecializedPixelKernels<packFormat(PixelFormat::RG_16_16_FLOAT())>;
+
+    RII_TARGET_F16C static void toFloat4(const PixelFormat & format, Float4 * dst, const uint8_t * src, size_t count, size_t step) {
+        size_t i = 0;
+        if (4 == step) {
+            const __m128 zw = _mm_setr_ps(0.0f, 1.0f, 0.0f, 1.0f);
+            for (; i + 2 <= count; i += 2) {
+                __m128 xyxy = _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *) (src + i * 4)));
+                _mm_storeu_ps(dst[i + 0].f32, _mm_movelh_ps(xyxy, zw));
+                _mm_storeu_ps(dst[i + 1].f32, _mm_movehl_ps(zw, xyxy));
+            }
+        }
+        Scalar::toFloat4(format, dst + i, src + i * step, count - i, step);
+    }
+
+    RII_TARGET_F16C static void fromFloat4(const PixelFormat & format, uint8_t * dst, const Float4 * src, size_t count, size_t step) {
+        size_t i = 0;
+        if (4 == step) {
+            for (; i + 2 <= count; i += 2) {
+                __m128 xyxy = _mm_movelh_ps(_mm_loadu_ps(src[i + 0].f32), _mm_loadu_ps(src[i + 1].f32));
+                _mm_storel_epi64((__m128i *) (dst + i * 4), _mm_cvtps_ph(xyxy, _MM_FROUND_TO_ZERO));
+            }
+        }
+        Scalar::fromFloat4(format, dst + i * step, src + i, count - i, step);
     }
-    for (uint32_t y = 0; y < extent.h; ++y) {
-        for (uint32_t x = 0; x < extent.w; ++x) {
-            size_t dstOffset = pixel(x, y, dstZ);
-            if ((dstOffset + ld.blockBytes) > dstSize) {
-                RAPID_IMAGE_LOGE("Destination buffer size (%zu) is not large enough.", dstSize);
-                return;
+
+    static constexpr PixelKernels KERNELS = {toFloat4, sseToRGBA8ViaFloat4<toFloat4>, fromFloat4};
+};
+
+#undef RII_TARGET_AVX2
+#undef RII_TARGET_F16C
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Returns the SIMD kernels of the format that are best for the current CPU, or null if there are none.
+static const PixelKernels * findSimdPixelKernels(const PixelFormat & format) {
+    static const CpuFeatures & cpu = CpuFeatures::get();
+    static const struct {
+        PixelFormat  format;
+        PixelKernels kernels;
+    } TABLE[] = {
+        {PixelFormat::RGBA_8_8_8_8_UNORM(), cpu.avx2 ? Avx2RGBA8Kernels<packFormat(PixelFormat::RGBA_8_8_8_8_UNORM()), false>::KERNELS
+                                                     : SseRGBA8Kernels<packFormat(PixelFormat::RGBA_8_8_8_8_UNORM()), false>::KERNELS},
+        {PixelFormat::BGRA_8_8_8_8_UNORM(), cpu.avx2 ? Avx2RGBA8Kernels<packFormat(PixelFormat::BGRA_8_8_8_8_UNORM()), true>::KERNELS
+                                                     : SseRGBA8Kernels<packFormat(PixelFormat::BGRA_8_8_8_8_UNORM()), true>::KERNELS},
+        {PixelFormat::RGBA_10_10_10_2_UNORM(), cpu.avx2 ? Avx2RGB10A2Kernels::KERNELS : SseRGB10A2Kernels::KERNELS},
+        {PixelFormat::RGB_11_11_10_FLOAT(), SseR11G11B10FKernels::KERNELS},
+        {PixelFormat::R_32_FLOAT(), SseR32FKernels::KERNELS},
+        {PixelFormat::RGBA_16_16_16_16_FLOAT(), cpu.f16c ? F16cRGBA16FKernels::KERNELS : F16cRGBA16FKernels::Scalar::KERNELS},
+        {PixelFormat::RG_16_16_FLOAT(), cpu.f16c ? F16cRG16FKernels::KERNELS : F16cRG16FKernels::Scalar::KERNELS},
+    };
+    for (const auto & s : TABLE) {
+        if (s.format == format) return &s.kernels;
+    }
+    return nullptr;
+}
+
+#elif RII_SIMD_NEON
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// NEON kernels of RGBA8 and BGRA8 (SWAP_RB = true). NEON is always there on arm64, so there's no runtime detection.
+template<uint32_t FORMAT, bool SWAP_RB>
+struct NeonRGBA8Kernels {
+    using Scalar = SpecializedPixelKernels<FORMAT>;
+
+    static inline uint8x16_t swapRB(uint8x16_t v) {
+        static const uint8_t SWAP[16] = {2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15};
+        return SWAP_RB ? vqtbl1q_u8(v, vld1q_u8(SWAP)) : v;
+    }
+
+    static void toFloat4(const PixelFormat & format, Float4 * dst, const uint8_t * src, size_t count, size_t step) {
+        size_t i = 0;
+        if (4 == step) {
+            const float32x4_t scale = vdupq_n_f32(255.0f);
+            for (; i + 4 <= count; i += 4) {
+                uint8x16_t v  = swapRB(vld1q_u8(src + i * 4));
+                uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+                uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+                // Divide (rather than multiply by the reciprocal) to be bit-identical to the scalar path.
+                vst1q_f32(dst[i + 0].f32, vdivq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo))), scale));
+                vst1q_f32(dst[i + 1].f32, vdivq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo))), scale));
+                vst1q_f32(dst[i + 2].f32, vdivq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi))), scale));
+                vst1q_f32(dst[i + 3].f32, vdivq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi))), scale));
             }
-            uint8_t * d    = (uint8_t *) dst + dstOffset;
-            OnePixel  temp = format.loadFromFloat4(*(p + y * extent.w + x));
-            memcpy(d, &temp, ld.blockBytes); // TODO: Can we avoid this memcpy's?
         }
+        Scalar::toFloat4(format, dst + i, src + i * step, count - i, step);
+    }
+
+    static void toRGBA8(const PixelFormat & format, RGBA8 * dst, const uint8_t * src, size_t count, size_t step) {
+        size_t i = 0;
+        if (4 == step) {
+            for (; i + 4 <= count; i += 4) vst1q_u8(dst[i].u8, swapRB(vld1q_u8(src + i * 4)));
+        }
+        Scalar::toRGBA8(format, dst + i, src + i * step, count - i, step);
     }
+
+    static void fromFloat4(const PixelFormat & format, uint8_t * dst, const Float4 * src, size_t count, size_t step) {
+        size_t i = 0;
+        if (4 == step) {
+            const float32x4_t zero  = vdupq_n_f32(0.0f);
+            const float32x4_t one   = vdupq_n_f32(1.0f);
+            const float32x4_t scale = vdupq_n_f32(255.0f);
+            for (; i + 4 <= count; i += 4) {
+                uint32x4_t p[4];
+                // vmaxnmq returns the number when the other operand is NaN, so NaN becomes 0 like the scalar path.
+                for (size_t k = 0; k < 4; ++k) p[k] = vcvtq_u32_f32(vmulq_f32(vminq_f32(vmaxnmq_f32(vld1q_f32(src[i + k].f32), zero), one), scale));
+                uint16x8_t lo = vcombine_u16(vmovn_u32(p[0]), vmovn_u32(p[1]));
+                uint16x8_t hi = vcombine_u16(vmovn_u32(p[2]), vmovn_u32(p[3]));
+                vst1q_u8(dst + i * 4, swapRB(vcombine_u8(vmovn_u16(lo), vmovn_u16(hi))));
+            }
+        }
+        Scalar::fromFloat4(format, dst + i * step, src + i, count - i, step);
+    }
+
+    static constexpr PixelKernels KERNELS = {toFloat4, toRGBA8, fromFloat4};
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// NEON decoders of RGBA_16_16_16_16_FLOAT and RG_16_16_FLOAT. The encoders stay scalar, since vcvt_f16_f32 always
+/// rounds to nearest even, while the scalar path rounds toward zero.
+struct NeonHalfKernels {
+    using ScalarRGBA = SpecializedPixelKernels<packFormat(PixelFormat::RGBA_16_16_16_16_FLOAT())>;
+    using ScalarRG   = SpecializedPixelKernels<packFormat(PixelFormat::RG_16_16_FLOAT())>;
+
+    static void rgbaToFloat4(const PixelFormat & format, Float4 * dst, const uint8_t * src, size_t count, size_t step) {
+        size_t i = 0;
+        if (8 == step) {
+            for (; i < count; ++i) vst1q_f32(dst[i].f32, vcvt_f32_f16(vreinterpret_f16_u8(vld1_u8(src + i * 8))));
+        }
+        ScalarRGBA::toFloat4(format, dst + i, src + i * step, count - i, step);
+    }
+
+    static void rgToFloat4(const PixelFormat & format, Float4 * dst, const uint8_t * src, size_t count, size_t step) {
+        size_t i = 0;
+        if (4 == step) {
+            const float32x2_t zw = vset_lane_f32(1.0f, vdup_n_f32(0.0f), 1);
+            for (; i + 2 <= count; i += 2) {
+                float32x4_t xyxy = vcvt_f32_f16(vreinterpret_f16_u8(vld1_u8(src + i * 4)));
+                vst1q_f32(dst[i + 0].f32, vcombine_f32(vget_low_f32(xyxy), zw));
+                vst1q_f32(dst[i + 1].f32, vcombine_f32(vget_high_f32(xyxy), zw));
+            }
+        }
+        ScalarRG::toFloat4(format, dst + i, src + i * step, count - i, step);
+    }
+
+    static constexpr PixelKernels RGBA = {rgbaToFloat4, ScalarRGBA::toRGBA8, ScalarRGBA::fromFloat4};
+    static constexpr PixelKernels RG   = {rgToFloat4, ScalarRG::toRGBA8, ScalarRG::fromFloat4};
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Returns the SIMD kernels of the format, or null if there are none.
+static const PixelKernels * findSimdPixelKernels(const PixelFormat & format) {
+    static const struct {
+        PixelFormat  format;
+        PixelKernels kernels;
+    } TABLE[] = {
+        {PixelFormat::RGBA_8_8_8_8_UNORM(), NeonRGBA8Kernels<packFormat(PixelFormat::RGBA_8_8_8_8_UNORM()), false>::KERNELS},
+        {PixelFormat::BGRA_8_8_8_8_UNORM(), NeonRGBA8Kernels<packFormat(PixelFormat::BGRA_8_8_8_8_UNORM()), true>::KERNELS},
+        {PixelFormat::RGBA_16_16_16_16_FLOAT(), NeonHalfKernels::RGBA},
+        {PixelFormat::RG_16_16_FLOAT(), NeonHalfKernels::RG},
+    };
+    for (const auto & s : TABLE) {
+        if (s.format == format) return &s.kernels;
+    }
+    return nullptr;
+}
+
+#else
+
+static const PixelKernels * findSimdPixelKernels(const PixelFormat &) { return nullptr; }
+
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Returns the conversion kernels of the format. The hottest formats get SIMD kernels, when available on current CPU.
+/// Other commonly used formats get their specialized kernels. Everything else falls back to the generic kernels.
+static const PixelKernels & findPixelKernels(const PixelFormat & format) {
+#define RII_SPECIALIZED_PIXEL_KERNELS(name) {PixelFormat::name(), SpecializedPixelKernels<packFormat(PixelFormat::name())>::KERNELS}
+    static const struct {
+        PixelFormat  format;
+        PixelKernels kernels;
+    } SPECIALIZED[] = {
+        RII_SPECIALIZED_PIXEL_KERNELS(RGBA_8_8_8_8_UNORM),     RII_SPECIALIZED_PIXEL_KERNELS(BGRA_8_8_8_8_UNORM),
+        RII_SPECIALIZED_PIXEL_KERNELS(RGBX_8_8_8_8_UNORM),     RII_SPECIALIZED_PIXEL_KERNELS(BGRX_8_8_8_8_UNORM),
+        RII_SPECIALIZED_PIXEL_KERNELS(RGBA_8_8_8_8_UINT),      RII_SPECIALIZED_PIXEL_KERNELS(RGB_8_8_8_UNORM),
+        RII_SPECIALIZED_PIXEL_KERNELS(RG_8_8_UNORM),           RII_SPECIALIZED_PIXEL_KERNELS(R_8_UNORM),
+        RII_SPECIALIZED_PIXEL_KERNELS(L_8_UNORM),              RII_SPECIALIZED_PIXEL_KERNELS(RGBA_10_10_10_2_UNORM),
+        RII_SPECIALIZED_PIXEL_KERNELS(RGB_11_11_10_FLOAT),     RII_SPECIALIZED_PIXEL_KERNELS(RGBA_16_16_16_16_UNORM),
+        RII_SPECIALIZED_PIXEL_KERNELS(RG_16_16_UNORM),         RII_SPECIALIZED_PIXEL_KERNELS(R_16_UNORM),
+        RII_SPECIALIZED_PIXEL_KERNELS(RGBA_16_16_16_16_FLOAT), RII_SPECIALIZED_PIXEL_KERNELS(RG_16_16_FLOAT),
+        RII_SPECIALIZED_PIXEL_KERNELS(R_16_FLOAT),             RII_SPECIALIZED_PIXEL_KERNELS(RGBA_32_32_32_32_FLOAT),
+        RII_SPECIALIZED_PIXEL_KERNELS(RGB_32_32_32_FLOAT),     RII_SPECIALIZED_PIXEL_KERNELS(RG_32_32_FLOAT),
+        RII_SPECIALIZED_PIXEL_KERNELS(R_32_FLOAT),             RII_SPECIALIZED_PIXEL_KERNELS(RGBA_8_8_8_8_SRGB),
+        RII_SPECIALIZED_PIXEL_KERNELS(RGB_8_8_8_SRGB),         RII_SPECIALIZED_PIXEL_KERNELS(RGBA_8_8_8_8_SNORM),
+        RII_SPECIALIZED_PIXEL_KERNELS(RG_8_8_SNORM),           RII_SPECIALIZED_PIXEL_KERNELS(RG_16_16_SNORM),
+    };
+#undef RII_SPECIALIZED_PIXEL_KERNELS
+    static const PixelKernels GENERIC = {GenericPixelKernels::toFloat4, GenericPixelKernels::toRGBA8, GenericPixelKernels::fromFloat4};
+
+    RII_ASSERT(packFormat(format) == format.u32);
+    if (auto simd = findSimdPixelKernels(format)) return *simd;
+    for (const auto & s : SPECIALIZED) {
+        if (s.format == format) return s.kernels;
+    }
+    return GENERIC;
+}
+
+} // namespace rii_details
+
+// *********************************************************************************************************************
+// Block compressed formats
+// *********************************************************************************************************************
+
+namespace rii_details {
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Max number of texels in one block of any compressed layout (ASTC 12x12).
+static constexpr size_t MAX_BLOCK_TEXELS = 12 * 12;
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Decode one block of a compressed layout into texels, row by row, 8 bits per channel, in the storage channel order of
+/// the layout (i.e. before the format swizzle is applied). Signed channels hold int8 values.
+using DecodeBlockFunc = void (*)(const uint8_t * src, uint8_t (*texels)[4]);
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Build the 4 entry palette of a BC1 color block, as RGBA8 words. Interpolated colors are rounded to nearest. BC2 and
+/// BC3 always use the 4 color mode.
+static inline void bc1Palette(const uint8_t * src, bool fourColorsOnly, uint32_t palette[4]) {
+    uint32_t c0 = src[0] | ((uint32_t) src[1] << 8);
+    uint32_t c1 = src[2] | ((uint32_t) src[3] << 8);
+    auto     expand = [](uint32_t c, uint32_t rgb[3]) {
+        rgb[0] = ((c >> 11) << 3) | (c >> 13);
+        rgb[1] = (((c >> 5) & 0x3f) << 2) | ((c >> 9) & 0x3);
+        rgb[2] = ((c & 0x1f) << 3) | ((c >> 2) & 0x7);
+    };
+    uint32_t e0[3], e1[3];
+    expand(c0, e0);
+    expand(c1, e1);
+    uint8_t p[4][4];
+    for (int i = 0; i < 3; ++i) {
+        p[0][i] = (uint8_t) e0[i];
+        p[1][i] = (uint8_t) e1[i];
+        if (c0 > c1 || fourColorsOnly) {
+            p[2][i] = (uint8_t) ((2 * e0[i] + e1[i] + 1) / 3);
+            p[3][i] = (uint8_t) ((e0[i] + 2 * e1[i] + 1) / 3);
+        } else {
+            p[2][i] = (uint8_t) ((e0[i] + e1[i] + 1) / 2);
+            p[3][i] = 0; // transparent black
+        }
+    }
+    p[0][3] = p[1][3] = p[2][3] = 255;
+    p[3][3]                     = (c0 > c1 || fourColorsOnly) ? 255 : 0;
+    memcpy(palette, p, sizeof(p));
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Look up the 16 2-bit indices of a BC1 color block in its palette.
+static void bc1LookupScalar(const uint32_t palette[4], const uint8_t * indices, uint8_t (*texels)[4]) {
+    uint32_t bits = indices[0] | ((uint32_t) indices[1] << 8) | ((uint32_t) indices[2] << 16) | ((uint32_t) indices[3] << 24);
+    for (int i = 0; i < 16; ++i, bits >>= 2) memcpy(texels[i], &palette[bits & 3], 4);
+}
+
+#if RII_SIMD_SSE
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// pshufb masks that pick the palette entries of 4 texels, for every possible index byte (one row of a BC1 block).
+struct Bc1ShuffleMasks {
+    alignas(16) uint8_t masks[256][16];
+
+    static const Bc1ShuffleMasks & get() {
+        static const Bc1ShuffleMasks instance;
+        return instance;
+    }
+
+private:
+    Bc1ShuffleMasks() {
+        for (uint32_t b = 0; b < 256; ++b)
+            for (uint32_t x = 0; x < 4; ++x)
+                for (uint32_t c = 0; c < 4; ++c) masks[b][x * 4 + c] = (uint8_t) (((b >> (x * 2)) & 3) * 4 + c);
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Same as bc1LookupScalar(), one row of 4 texels per shuffle.
+RII_TARGET_SSSE3 static void bc1LookupSsse3(const uint32_t palette[4], const uint8_t * indices, uint8_t (*texels)[4]) {
+    const auto & masks = Bc1ShuffleMasks::get().masks;
+    __m128i      p     = _mm_loadu_si128((const __m128i *) palette);
+    for (int y = 0; y < 4; ++y) _mm_storeu_si128((__m128i *) texels[y * 4], _mm_shuffle_epi8(p, _mm_load_si128((const __m128i *) masks[indices[y]])));
+}
+
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Build the 8 entry palette of a BC4 channel block (also used by BC3 alpha and BC5) from its 2 endpoint bytes.
+/// Interpolated values are rounded to nearest, half away from zero. Signed endpoints are clamped to [-127, 127].
+template<bool SIGNED>
+static inline void bc4Palette(uint8_t e0, uint8_t e1, int palette[8]) {
+    auto divide = [](int n, int d) { return n >= 0 ? (n + d / 2) / d : -((d / 2 - n) / d); };
+    int r0 = SIGNED ? (int) (int8_t) e0 : (int) e0;
+    int r1 = SIGNED ? (int) (int8_t) e1 : (int) e1;
+    int a0 = std::max(r0, -127);
+    int a1 = std::max(r1, -127);
+    palette[0] = a0;
+    palette[1] = a1;
+    if (r0 > r1) { // the mode is picked before clamping.
+        for (int i = 1; i < 7; ++i) palette[i + 1] = divide((7 - i) * a0 + i * a1, 7);
+    } else {
+        for (int i = 1; i < 5; ++i) palette[i + 1] = divide((5 - i) * a0 + i * a1, 5);
+        palette[6] = SIGNED ? -127 : 0;
+        palette[7] = SIGNED ? 127 : 255;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Decode a BC4 channel block (also used by BC3 alpha and BC5) into one channel of the texels.
+template<bool SIGNED>
+static inline void bc4Channel(const uint8_t * src, uint8_t (*texels)[4], int channel) {
+    int palette[8];
+    bc4Palette<SIGNED>(src[0], src[1], palette);
+    uint64_t bits = 0;
+    for (int i = 0; i < 6; ++i) bits |= (uint64_t) src[2 + i] << (i * 8);
+    for (int i = 0; i < 16; ++i, bits >>= 3) texels[i][channel] = (uint8_t) palette[bits & 7];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Block decoders of BC1 to BC5. LOOKUP is the BC1 palette lookup to use.
+template<void (*LOOKUP)(const uint32_t *, const uint8_t *, uint8_t (*)[4])>
+struct BcBlockDecoders {
+    static void bc1(const uint8_t * src, uint8_t (*texels)[4]) {
+        uint32_t palette[4];
+        bc1Palette(src, false, palette);
+        LOOKUP(palette, src + 4, texels);
+    }
+
+    static void bc2(const uint8_t * src, uint8_t (*texels)[4]) {
+        uint32_t palette[4];
+        bc1Palette(src + 8, true, palette);
+        LOOKUP(palette, src + 12, texels);
+        for (int i = 0; i < 16; ++i) texels[i][3] = (uint8_t) (((src[i / 2] >> ((i % 2) * 4)) & 0xf) * 17);
+    }
+
+    static void bc3(const uint8_t * src, uint8_t (*texels)[4]) {
+        uint32_t palette[4];
+        bc1Palette(src + 8, true, palette);
+        LOOKUP(palette, src + 12, texels);
+        bc4Channel<false>(src, texels, 3);
+    }
+
+    template<bool SIGNED>
+    static void bc4(const uint8_t * src, uint8_t (*texels)[4]) {
+        memset(texels, 0, 16 * 4);
+        bc4Channel<SIGNED>(src, texels, 0);
+    }
+
+    template<bool SIGNED>
+    static void bc5(const uint8_t * src, uint8_t (*texels)[4]) {
+        memset(texels, 0, 16 * 4);
+        bc4Channel<SIGNED>(src, texels, 0);
+        bc4Channel<SIGNED>(src + 8, texels, 1);
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Reads the bit fields of a 128-bit block, least significant bit first.
+class BlockBits {
+public:
+    explicit BlockBits(const uint8_t * src) {
+        memcpy(&_lo, src, 8);
+        memcpy(&_hi, src + 8, 8);
+    }
+
+    /// Read up to 32 bits.
+    uint32_t read(uint32_t count) {
+        if (0 == count) return 0;
+        auto result = (uint32_t) (_lo & ((1ull << count) - 1));
+        _lo         = (_lo >> count) | (_hi << (64 - count));
+        _hi >>= count;
+        return result;
+    }
+
+    /// The next 64 bits, without consuming them.
+    uint64_t peek() const { return _lo; }
+
+private:
+    uint64_t _lo, _hi;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Subset of each texel in the 64 2-subset partitions of BC6H and BC7, one bit per texel.
+static constexpr uint16_t BC_PARTITIONS_2[64] = {
+    0xcccc, 0x8888, 0xeeee, 0xecc8, 0xc880, 0xfeec, 0xfec8, 0xec80, 0xc800, 0xffec, 0xfe80, 0xe800, 0xffe8, 0xff00, 0xfff0, 0xf000,
+    0xf710, 0x008e, 0x7100, 0x08ce, 0x008c, 0x7310, 0x3100, 0x8cce, 0x088c, 0x3110, 0x6666, 0x366c, 0x17e8, 0x0ff0, 0x718e, 0x399c,
+    0xaaaa, 0xf0f0, 0x5a5a, 0x33cc, 0x3c3c, 0x55aa, 0x9696, 0xa55a, 0x73ce, 0x13c8, 0x324c, 0x3bdc, 0x6996, 0xc33c, 0x9966, 0x0660,
+    0x0272, 0x04e4, 0x4e40, 0x2720, 0xc936, 0x936c, 0x39c6, 0x639c, 0x9336, 0x9cc6, 0x817e, 0xe718, 0xccf0, 0x0fcc, 0x7744, 0xee22,
+};
+
+/// Anchor texel of the 2nd subset of the 2-subset partitions.
+static constexpr uint8_t BC_ANCHORS_2[64] = {
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 2,  8, 2,  2, 8, 8,  15, 2,  8,  2, 2,  8,  8,  2,  2,
+    15, 15, 6,  8,  2,  8,  15, 15, 2,  8,  2, 2,  2, 15, 15, 6,  6,  2,  6, 8,  15, 15, 2,  2,  15, 15, 15, 15, 15, 2,  2, 15,
+};
+
+/// Subset of each texel in the 64 3-subset partitions of BC7, 2 bits per texel.
+static constexpr uint32_t BC7_PARTITIONS_3[64] = {
+    0xaa685050, 0x6a5a5040, 0x5a5a4200, 0x5450a0a8, 0xa5a50000, 0xa0a05050, 0x5555a0a0, 0x5a5a5050, 0xaa550000, 0xaa555500, 0xaaaa5500,
+    0x90909090, 0x94949494, 0xa4a4a4a4, 0xa9a59450, 0x2a0a4250, 0xa5945040, 0x0a425054, 0xa5a5a500, 0x55a0a0a0, 0xa8a85454, 0x6a6a4040,
+    0xa4a45000, 0x1a1a0500, 0x0050a4a4, 0xaaa59090, 0x14696914, 0x69691400, 0xa08585a0, 0xaa821414, 0x50a4a450, 0x6a5a0200, 0xa9a58000,
+    0x5090a0a8, 0xa8a09050, 0x24242424, 0x00aa5500, 0x24924924, 0x24499224, 0x50a50a50, 0x500aa550, 0xaaaa4444, 0x66660000, 0xa5a0a5a0,
+    0x50a050a0, 0x69286928, 0x44aaaa44, 0x66666600, 0xaa444444, 0x54a854a8, 0x95809580, 0x96969600, 0xa85454a8, 0x80959580, 0xaa141414,
+    0x96960000, 0xaaaa1414, 0xa05050a0, 0xa0a5a5a0, 0x96000000, 0x40804080, 0xa9a8a9a8, 0xaaaaaa44, 0x2a4a5254,
+};
+
+/// Anchor texels of the 2nd and 3rd subsets of the 3-subset partitions.
+static constexpr uint8_t BC7_ANCHORS_3[2][64] = {
+    {3, 3, 15, 15, 8, 3, 15, 15, 8, 8, 6, 6, 6, 5, 3, 3, 3, 3, 8, 15, 3, 3, 6, 10, 5, 8, 8, 6, 8, 5, 15, 15,
+     8, 15, 3, 5, 6, 10, 8, 15, 15, 3, 15, 5, 15, 15, 15, 15, 3, 15, 5, 5, 5, 8, 5, 10, 5, 10, 8, 13, 15, 12, 3, 3},
+    {15, 8, 8, 3, 15, 15, 3, 8, 15, 15, 15, 15, 15, 15, 15, 8, 15, 8, 15, 3, 15, 8, 15, 8, 3, 15, 6, 10, 15, 15, 10, 8,
+     15, 3, 15, 10, 10, 8, 9, 10, 6, 15, 8, 15, 3, 6, 6, 8, 15, 3, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 3, 15, 15, 8},
+};
+
+/// Interpolation weights of 2, 3 and 4 bit indices, out of 64.
+static constexpr uint8_t BC_WEIGHTS[5][16] = {
+    {},
+    {},
+    {0, 21, 43, 64},
+    {0, 9, 18, 27, 37, 46, 55, 64},
+    {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64},
+};
+
+/// Subset of the texel in a BC7 partition of 1, 2 or 3 subsets.
+static inline uint32_t bc7Subset(uint32_t subsets, uint32_t partition, uint32_t texel) {
+    return 1 == subsets ? 0 : (2 == subsets ? (BC_PARTITIONS_2[partition] >> texel) & 1 : (BC7_PARTITIONS_3[partition] >> (texel * 2)) & 3);
+}
+
+/// Anchor texel of a subset of a BC7 partition. The 1st subset always anchors at texel 0.
+static inline uint32_t bc7Anchor(uint32_t subsets, uint32_t partition, uint32_t subset) {
+    if (0 == subset) return 0;
+    return 2 == subsets ? BC_ANCHORS_2[partition] : BC7_ANCHORS_3[subset - 1][partition];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Bit layout of one of the 8 BC7 modes.
+struct Bc7Mode {
+    uint8_t subsets, partitionBits, rotationBits, indexSelectionBits, colorBits, alphaBits, endpointPBits, sharedPBits, indexBits, index2Bits;
+};
+
+static constexpr Bc7Mode BC7_MODES[8] = {
+    {3, 4, 0, 0, 4, 0, 1, 0, 3, 0}, {2, 6, 0, 0, 6, 0, 0, 1, 3, 0}, {3, 6, 0, 0, 5, 0, 0, 0, 2, 0}, {2, 6, 0, 0, 7, 0, 1, 0, 2, 0},
+    {1, 0, 2, 1, 5, 6, 0, 0, 2, 3}, {1, 0, 2, 0, 7, 8, 0, 0, 2, 2}, {1, 0, 0, 0, 7, 7, 1, 0, 4, 0}, {2, 6, 0, 0, 5, 5, 1, 0, 2, 0},
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Decode a BC7 block of the given mode. Every mode is its own instance, so all field widths are compile time constants.
+template<int MODE>
+static void bc7Block(const uint8_t * src, uint8_t (*texels)[4]) {
+    constexpr Bc7Mode  m         = BC7_MODES[MODE];
+    constexpr uint32_t endpoints = m.subsets * 2u;
+    BlockBits          bits(src);
+    bits.read(MODE + 1);
+    uint32_t partition = bits.read(m.partitionBits);
+    uint32_t rotation  = bits.read(m.rotationBits);
+    uint32_t selection = bits.read(m.indexSelectionBits);
+
+    // end points, channel by channel, then the p-bits.
+    uint32_t ep[6][4];
+    for (uint32_t c = 0; c < 3; ++c)
+        for (uint32_t e = 0; e < endpoints; ++e) ep[e][c] = bits.read(m.colorBits);
+    for (uint32_t e = 0; e < endpoints; ++e) ep[e][3] = bits.read(m.alphaBits);
+    uint32_t pbits[6] = {};
+    for (uint32_t e = 0; e < endpoints * m.endpointPBits; ++e) pbits[e] = bits.read(1);
+    for (uint32_t s = 0; s < m.subsets * m.sharedPBits; ++s) pbits[s * 2] = pbits[s * 2 + 1] = bits.read(1);
+    constexpr uint32_t pbitCount = m.endpointPBits | m.sharedPBits;
+    uint8_t            colors[6][4];
+    for (uint32_t e = 0; e < endpoints; ++e) {
+        for (uint32_t c = 0; c < 4; ++c) {
+            uint32_t n = (c < 3 ? m.colorBits : m.alphaBits);
+            if (0 == n) {
+                colors[e][c] = 255;
+                continue;
+            }
+            uint32_t v = (ep[e][c] << pbitCount) | pbits[e] * pbitCount;
+            n += pbitCount;
+            v <<= 8 - n;
+            colors[e][c] = (uint8_t) (v | (v >> n));
+        }
+    }
+
+    // palette of each subset. Modes 4 and 5 have a 2nd palette for their 2nd set of indices.
+    auto    lerp = [](const uint8_t * e0, const uint8_t * e1, uint32_t w, uint8_t * result) {
+        for (uint32_t c = 0; c < 4; ++c) result[c] = (uint8_t) (((64 - w) * e0[c] + w * e1[c] + 32) >> 6);
+    };
+    uint8_t palette[3][16][4], palette2[8][4];
+    for (uint32_t s = 0; s < m.subsets; ++s)
+        for (uint32_t k = 0; k < (1u << m.indexBits); ++k) lerp(colors[s * 2], colors[s * 2 + 1], BC_WEIGHTS[m.indexBits][k], palette[s][k]);
+    for (uint32_t k = 0; k < (m.index2Bits ? 1u << m.index2Bits : 0u); ++k) lerp(colors[0], colors[1], BC_WEIGHTS[m.index2Bits][k], palette2[k]);
+
+    // indices, at most 63 bits per set. Anchor texels drop the top bit.
+    uint32_t a1       = 1 == m.subsets ? 16 : (2 == m.subsets ? BC_ANCHORS_2[partition] : BC7_ANCHORS_3[0][partition]);
+    uint32_t a2       = 3 == m.subsets ? BC7_ANCHORS_3[1][partition] : 16;
+    uint64_t indices  = bits.peek();
+    uint64_t indices2 = 0;
+    if (m.index2Bits) {
+        bits.read(16u * m.indexBits - 1);
+        indices2 = bits.peek();
+    }
+    for (uint32_t i = 0; i < 16; ++i) {
+        uint32_t        s      = bc7Subset(m.subsets, partition, i);
+        uint32_t        offset = i * m.indexBits - (i > 0 ? 1 : 0) - (i > a1 ? 1 : 0) - (i > a2 ? 1 : 0);
+        uint32_t        width  = m.indexBits - (0 == i || a1 == i || a2 == i ? 1 : 0);
+        const uint8_t * p      = palette[s][(indices >> offset) & ((1u << width) - 1)];
+        if (!m.index2Bits) {
+            memcpy(texels[i], p, 4);
+            continue;
+        }
+        // mode 4 can swap the color and alpha indices, and modes 4 and 5 can rotate alpha into a color channel.
+        const uint8_t * q     = palette2[(indices2 >> (i * m.index2Bits - (i > 0 ? 1 : 0))) & ((1u << (m.index2Bits - (0 == i ? 1 : 0))) - 1)];
+        const uint8_t * color = selection ? q : p;
+        const uint8_t * alpha = selection ? p : q;
+        texels[i][0]          = color[0];
+        texels[i][1]          = color[1];
+        texels[i][2]          = color[2];
+        texels[i][3]          = alpha[3];
+        if (rotation) std::swap(texels[i][3], texels[i][rotation - 1]);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Decode a BC7 block. Blocks without a valid mode decode to transparent black.
+static void bc7(const uint8_t * src, uint8_t (*texels)[4]) {
+    static constexpr DecodeBlockFunc MODES[] = {bc7Block<0>, bc7Block<1>, bc7Block<2>, bc7Block<3>,
+                                                bc7Block<4>, bc7Block<5>, bc7Block<6>, bc7Block<7>};
+    for (int i = 0; i < 8; ++i) {
+        if (src[0] & (1 << i)) return MODES[i](src, texels);
+    }
+    memset(texels, 0, 16 * 4);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Decode one block of a compressed HDR layout into float texels, row by row, in the storage channel order.
+using DecodeFloatBlockFunc = void (*)(const uint8_t * src, float (*texels)[4]);
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Bit layout of one of the 14 BC6H modes. The header is a list of runs of end point bits, each written as "field[a:b]"
+/// in the format spec: the first bit in the block goes to bit b of the field, the last to bit a (a < b means reversed).
+struct Bc6hMode {
+    enum Field : uint8_t { RW, GW, BW, RX, GX, BX, RY, GY, BY, RZ, GZ, BZ, D, END };
+
+    struct Run {
+        uint8_t field = END, a = 0, b = 0;
+    };
+
+    uint8_t modeBits, subsets, transformed, endpointBits, deltaBits[3];
+    Run     runs[24];
+};
+
+#define RII_BC6H_COMMON_10 {Bc6hMode::RW, 9, 0}, {Bc6hMode::GW, 9, 0}, {Bc6hMode::BW, 9, 0}
+static constexpr Bc6hMode BC6H_MODES[14] = {
+    {2, 2, 1, 10, {5, 5, 5}, {{Bc6hMode::GY, 4, 4}, {Bc6hMode::BY, 4, 4}, {Bc6hMode::BZ, 4, 4}, RII_BC6H_COMMON_10, {Bc6hMode::RX, 4, 0},
+                              {Bc6hMode::GZ, 4, 4}, {Bc6hMode::GY, 3, 0}, {Bc6hMode::GX, 4, 0}, {Bc6hMode::BZ, 0, 0}, {Bc6hMode::GZ, 3, 0},
+                              {Bc6hMode::BX, 4, 0}, {Bc6hMode::BZ, 1, 1}, {Bc6hMode::BY, 3, 0}, {Bc6hMode::RY, 4, 0}, {Bc6hMode::BZ, 2, 2},
+                              {Bc6hMode::RZ, 4, 0}, {Bc6hMode::BZ, 3, 3}, {Bc6hMode::D, 4, 0}}},
+    {2, 2, 1, 7, {6, 6, 6}, {{Bc6hMode::GY, 5, 5}, {Bc6hMode::GZ, 4, 4}, {Bc6hMode::GZ, 5, 5}, {Bc6hMode::RW, 6, 0}, {Bc6hMode::BZ, 0, 0},
+                             {Bc6hMode::BZ, 1, 1}, {Bc6hMode::BY, 4, 4}, {Bc6hMode::GW, 6, 0}, {Bc6hMode::BY, 5, 5}, {Bc6hMode::BZ, 2, 2},
+                             {Bc6hMode::GY, 4, 4}, {Bc6hMode::BW, 6, 0}, {Bc6hMode::BZ, 3, 3}, {Bc6hMode::BZ, 5, 5}, {Bc6hMode::BZ, 4, 4},
+                             {Bc6hMode::RX, 5, 0}, {Bc6hMode::GY, 3, 0}, {Bc6hMode::GX, 5, 0}, {Bc6hMode::GZ, 3, 0}, {Bc6hMode::BX, 5, 0},
+                             {Bc6hMode::BY, 3, 0}, {Bc6hMode::RY, 5, 0}, {Bc6hMode::RZ, 5, 0}, {Bc6hMode::D, 4, 0}}},
+    {5, 2, 1, 11, {5, 4, 4}, {RII_BC6H_COMMON_10, {Bc6hMode::RX, 4, 0}, {Bc6hMode::RW, 10, 10}, {Bc6hMode::GY, 3, 0}, {Bc6hMode::GX, 3, 0},
+                              {Bc6hMode::GW, 10, 10}, {Bc6hMode::BZ, 0, 0}, {Bc6hMode::GZ, 3, 0}, {Bc6hMode::BX, 3, 0}, {Bc6hMode::BW, 10, 10},
+                              {Bc6hMode::BZ, 1, 1}, {Bc6hMode::BY, 3, 0}, {Bc6hMode::RY, 4, 0}, {Bc6hMode::BZ, 2, 2}, {Bc6hMode::RZ, 4, 0},
+                              {Bc6hMode::BZ, 3, 3}, {Bc6hMode::D, 4, 0}}},
+    {5, 2, 1, 11, {4, 5, 4}, {RII_BC6H_COMMON_10, {Bc6hMode::RX, 3, 0}, {Bc6hMode::RW, 10, 10}, {Bc6hMode::GZ, 4, 4}, {Bc6hMode::GY, 3, 0},
+                              {Bc6hMode::GX, 4, 0}, {Bc6hMode::GW, 10, 10}, {Bc6hMode::GZ, 3, 0}, {Bc6hMode::BX, 3, 0}, {Bc6hMode::BW, 10, 10},
+                              {Bc6hMode::BZ, 1, 1}, {Bc6hMode::BY, 3, 0}, {Bc6hMode::RY, 3, 0}, {Bc6hMode::BZ, 0, 0}, {Bc6hMode::BZ, 2, 2},
+                              {Bc6hMode::RZ, 3, 0}, {Bc6hMode::GY, 4, 4}, {Bc6hMode::BZ, 3, 3}, {Bc6hMode::D, 4, 0}}},
+    {5, 2, 1, 11, {4, 4, 5}, {RII_BC6H_COMMON_10, {Bc6hMode::RX, 3, 0}, {Bc6hMode::RW, 10, 10}, {Bc6hMode::BY, 4, 4}, {Bc6hMode::GY, 3, 0},
+                              {Bc6hMode::GX, 3, 0}, {Bc6hMode::GW, 10, 10}, {Bc6hMode::BZ, 0, 0}, {Bc6hMode::GZ, 3, 0}, {Bc6hMode::BX, 4, 0},
+                              {Bc6hMode::BW, 10, 10}, {Bc6hMode::BY, 3, 0}, {Bc6hMode::RY, 3, 0}, {Bc6hMode::BZ, 1, 1}, {Bc6hMode::BZ, 2, 2},
+                              {Bc6hMode::RZ, 3, 0}, {Bc6hMode::BZ, 4, 4}, {Bc6hMode::BZ, 3, 3}, {Bc6hMode::D, 4, 0}}},
+    {5, 2, 1, 9, {5, 5, 5}, {{Bc6hMode::RW, 8, 0}, {Bc6hMode::BY, 4, 4}, {Bc6hMode::GW, 8, 0}, {Bc6hMode::GY, 4, 4}, {Bc6hMode::BW, 8, 0},
+                             {Bc6hMode::BZ, 4, 4}, {Bc6hMode::RX, 4, 0}, {Bc6hMode::GZ, 4, 4}, {Bc6hMode::GY, 3, 0}, {Bc6hMode::GX, 4, 0},
+                             {Bc6hMode::BZ, 0, 0}, {Bc6hMode::GZ, 3, 0}, {Bc6hMode::BX, 4, 0}, {Bc6hMode::BZ, 1, 1}, {Bc6hMode::BY, 3, 0},
+                             {Bc6hMode::RY, 4, 0}, {Bc6hMode::BZ, 2, 2}, {Bc6hMode::RZ, 4, 0}, {Bc6hMode::BZ, 3, 3}, {Bc6hMode::D, 4, 0}}},
+    {5, 2, 1, 8, {6, 5, 5}, {{Bc6hMode::RW, 7, 0}, {Bc6hMode::GZ, 4, 4}, {Bc6hMode::BY, 4, 4}, {Bc6hMode::GW, 7, 0}, {Bc6hMode::BZ, 2, 2},
+                             {Bc6hMode::GY, 4, 4}, {Bc6hMode::BW, 7, 0}, {Bc6hMode::BZ, 3, 3}, {Bc6hMode::BZ, 4, 4}, {Bc6hMode::RX, 5, 0},
+                             {Bc6hMode::GY, 3, 0}, {Bc6hMode::GX, 4, 0}, {Bc6hMode::BZ, 0, 0}, {Bc6hMode::GZ, 3, 0}, {Bc6hMode::BX, 4, 0},
+                             {Bc6hMode::BZ, 1, 1}, {Bc6hMode::BY, 3, 0}, {Bc6hMode::RY, 5, 0}, {Bc6hMode::RZ, 5, 0}, {Bc6hMode::D, 4, 0}}},
+    {5, 2, 1, 8, {5, 6, 5}, {{Bc6hMode::RW, 7, 0}, {Bc6hMode::BZ, 0, 0}, {Bc6hMode::BY, 4, 4}, {Bc6hMode::GW, 7, 0}, {Bc6hMode::GY, 5, 5},
+                             {Bc6hMode::GY, 4, 4}, {Bc6hMode::BW, 7, 0}, {Bc6hMode::GZ, 5, 5}, {Bc6hMode::BZ, 4, 4}, {Bc6hMode::RX, 4, 0},
+                             {Bc6hMode::GZ, 4, 4}, {Bc6hMode::GY, 3, 0}, {Bc6hMode::GX, 5, 0}, {Bc6hMode::GZ, 3, 0}, {Bc6hMode::BX, 4, 0},
+                             {Bc6hMode::BZ, 1, 1}, {Bc6hMode::BY, 3, 0}, {Bc6hMode::RY, 4, 0}, {Bc6hMode::BZ, 2, 2}, {Bc6hMode::RZ, 4, 0},
+                             {Bc6hMode::BZ, 3, 3}, {Bc6hMode::D, 4, 0}}},
+    {5, 2, 1, 8, {5, 5, 6}, {{Bc6hMode::RW, 7, 0}, {Bc6hMode::BZ, 1, 1}, {Bc6hMode::BY, 4, 4}, {Bc6hMode::GW, 7, 0}, {Bc6hMode::BY, 5, 5},
+                             {Bc6hMode::GY, 4, 4}, {Bc6hMode::BW, 7, 0}, {Bc6hMode::BZ, 5, 5}, {Bc6hMode::BZ, 4, 4}, {Bc6hMode::RX, 4, 0},
+                             {Bc6hMode::GZ, 4, 4}, {Bc6hMode::GY, 3, 0}, {Bc6hMode::GX, 4, 0}, {Bc6hMode::BZ, 0, 0}, {Bc6hMode::GZ, 3, 0},
+                             {Bc6hMode::BX, 5, 0}, {Bc6hMode::BY, 3, 0}, {Bc6hMode::RY, 4, 0}, {Bc6hMode::BZ, 2, 2}, {Bc6hMode::RZ, 4, 0},
+                             {Bc6hMode::BZ, 3, 3}, {Bc6hMode::D, 4, 0}}},
+    {5, 2, 0, 6, {6, 6, 6}, {{Bc6hMode::RW, 5, 0}, {Bc6hMode::GZ, 4, 4}, {Bc6hMode::BZ, 0, 0}, {Bc6hMode::BZ, 1, 1}, {Bc6hMode::BY, 4, 4},
+                             {Bc6hMode::GW, 5, 0}, {Bc6hMode::GY, 5, 5}, {Bc6hMode::BY, 5, 5}, {Bc6hMode::BZ, 2, 2}, {Bc6hMode::GY, 4, 4},
+                             {Bc6hMode::BW, 5, 0}, {Bc6hMode::GZ, 5, 5}, {Bc6hMode::BZ, 3, 3}, {Bc6hMode::BZ, 5, 5}, {Bc6hMode::BZ, 4, 4},
+                             {Bc6hMode::RX, 5, 0}, {Bc6hMode::GY, 3, 0}, {Bc6hMode::GX, 5, 0}, {Bc6hMode::GZ, 3, 0}, {Bc6hMode::BX, 5, 0},
+                             {Bc6hMode::BY, 3, 0}, {Bc6hMode::RY, 5, 0}, {Bc6hMode::RZ, 5, 0}, {Bc6hMode::D, 4, 0}}},
+    {5, 1, 0, 10, {10, 10, 10}, {RII_BC6H_COMMON_10, {Bc6hMode::RX, 9, 0}, {Bc6hMode::GX, 9, 0}, {Bc6hMode::BX, 9, 0}}},
+    {5, 1, 1, 11, {9, 9, 9}, {RII_BC6H_COMMON_10, {Bc6hMode::RX, 8, 0}, {Bc6hMode::RW, 10, 10}, {Bc6hMode::GX, 8, 0}, {Bc6hMode::GW, 10, 10},
+                              {Bc6hMode::BX, 8, 0}, {Bc6hMode::BW, 10, 10}}},
+    {5, 1, 1, 12, {8, 8, 8}, {RII_BC6H_COMMON_10, {Bc6hMode::RX, 7, 0}, {Bc6hMode::RW, 10, 11}, {Bc6hMode::GX, 7, 0}, {Bc6hMode::GW, 10, 11},
+                              {Bc6hMode::BX, 7, 0}, {Bc6hMode::BW, 10, 11}}},
+    {5, 1, 1, 16, {4, 4, 4}, {RII_BC6H_COMMON_10, {Bc6hMode::RX, 3, 0}, {Bc6hMode::RW, 10, 15}, {Bc6hMode::GX, 3, 0}, {Bc6hMode::GW, 10, 15},
+                              {Bc6hMode::BX, 3, 0}, {Bc6hMode::BW, 10, 15}}},
+};
+#undef RII_BC6H_COMMON_10
+
+/// BC6H mode of each 5-bit mode value, or -1 if reserved. Values ending with 00 or 01 are the 2-bit modes 0 and 1.
+static constexpr int8_t BC6H_MODE_INDEX[32] = {0,  1, 2, 10, 0, 1, 3, 11, 0, 1, 4, 12, 0, 1, 5, 13,
+                                               0,  1, 6, -1, 0, 1, 7, -1, 0, 1, 8, -1, 0, 1, 9, -1};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Decode a BC6H block of the given mode into float texels.
+template<int MODE, bool SIGNED>
+static void bc6hBlock(const uint8_t * src, float (*texels)[4]) {
+    constexpr Bc6hMode m = BC6H_MODES[MODE];
+    BlockBits          bits(src);
+    bits.read(m.modeBits);
+
+    // gather the end point fields.
+    int32_t fields[13] = {};
+    for (const auto & run : m.runs) {
+        if (Bc6hMode::END == run.field) break;
+        if (run.a >= run.b) {
+            fields[run.field] |= (int32_t) (bits.read(run.a - run.b + 1u) << run.b);
+        } else {
+            for (int b = run.b; b >= run.a; --b) fields[run.field] |= (int32_t) (bits.read(1) << b);
+        }
+    }
+
+    // sign extend and undo the delta transform, then unquantize to 16 bits (or 15 bits + sign).
+    auto               signExtend = [](int32_t v, uint32_t n) { return ((v & ((1 << n) - 1)) ^ (1 << (n - 1))) - (1 << (n - 1)); };
+    constexpr uint32_t endpoints  = m.subsets * 2u;
+    constexpr uint32_t epb        = m.endpointBits;
+    int32_t            ep[4][3];
+    for (uint32_t c = 0; c < 3; ++c) {
+        ep[0][c] = SIGNED ? signExtend(fields[c], epb) : fields[c];
+        for (uint32_t e = 1; e < endpoints; ++e) {
+            int32_t v = fields[e * 3 + c];
+            if (m.transformed || SIGNED) v = signExtend(v, m.deltaBits[c]);
+            if (m.transformed) {
+                v = (ep[0][c] + v) & ((1 << epb) - 1);
+                if (SIGNED) v = signExtend(v, epb);
+            }
+            ep[e][c] = v;
+        }
+        for (uint32_t e = 0; e < endpoints; ++e) {
+            int32_t v = ep[e][c];
+            if (!SIGNED) {
+                if (epb < 15) v = (0 == v) ? 0 : (((1 << epb) - 1) == v ? 0xffff : ((v << 16) + 0x8000) >> epb);
+            } else if (epb < 16) {
+                int32_t a = v < 0 ? -v : v;
+                a         = (0 == a) ? 0 : (a >= (1 << (epb - 1)) - 1 ? 0x7fff : ((a << 15) + 0x4000) >> (epb - 1));
+                v         = v < 0 ? -a : a;
+            }
+            ep[e][c] = v;
+        }
+    }
+
+    // interpolate the palette of each subset and scale it to half float bits. The result is never inf or NaN, so normal
+    // halves are rebased into floats by adding to the exponent. Denormal ones are converted from int instead of through
+    // a denormal float, which would take the slow path of the FPU.
+    constexpr uint32_t ib = 2 == m.subsets ? 3u : 4u;
+    float              palette[2][16][4];
+    for (uint32_t s = 0; s < m.subsets; ++s) {
+        for (uint32_t k = 0; k < (1u << ib); ++k) {
+            int32_t w = BC_WEIGHTS[ib][k];
+            for (uint32_t c = 0; c < 3; ++c) {
+                int32_t  v         = ((64 - w) * ep[s * 2][c] + w * ep[s * 2 + 1][c] + 32) >> 6;
+                uint32_t magnitude = SIGNED ? (uint32_t) (((v < 0 ? -v : v) * 31) >> 5) : (uint32_t) ((v * 31) >> 6);
+                uint32_t u32       = (magnitude << 13) + (112u << 23);
+                float    f;
+                memcpy(&f, &u32, sizeof(f));
+                if (magnitude < 0x400) f = (float) magnitude * 5.9604644775390625e-8f; // 2^-24
+                palette[s][k][c] = SIGNED && v < 0 ? -f : f;
+            }
+            palette[s][k][3] = 1.0f;
+        }
+    }
+
+    // indices are the last 63 bits. Anchor texels drop the top bit.
+    uint32_t partition = (uint32_t) fields[Bc6hMode::D];
+    uint32_t anchor    = 2 == m.subsets ? BC_ANCHORS_2[partition] : 16;
+    uint64_t indices   = bits.peek();
+    for (uint32_t i = 0; i < 16; ++i) {
+        uint32_t s      = 2 == m.subsets ? (BC_PARTITIONS_2[partition] >> i) & 1 : 0;
+        uint32_t offset = i * ib - (i > 0 ? 1 : 0) - (i > anchor ? 1 : 0);
+        uint32_t width  = ib - (0 == i || anchor == i ? 1 : 0);
+        memcpy(texels[i], palette[s][(indices >> offset) & ((1u << width) - 1)], sizeof(texels[i]));
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Decode a BC6H block. Reserved modes decode to black.
+template<bool SIGNED>
+static void bc6h(const uint8_t * src, float (*texels)[4]) {
+    static constexpr DecodeFloatBlockFunc MODES[] = {bc6hBlock<0, SIGNED>,  bc6hBlock<1, SIGNED>,  bc6hBlock<2, SIGNED>, bc6hBlock<3, SIGNED>,
+                                                     bc6hBlock<4, SIGNED>,  bc6hBlock<5, SIGNED>,  bc6hBlock<6, SIGNED>, bc6hBlock<7, SIGNED>,
+                                                     bc6hBlock<8, SIGNED>,  bc6hBlock<9, SIGNED>,  bc6hBlock<10, SIGNED>, bc6hBlock<11, SIGNED>,
+                                                     bc6hBlock<12, SIGNED>, bc6hBlock<13, SIGNED>};
+    int mode = BC6H_MODE_INDEX[src[0] & 0x1f];
+    if (mode >= 0) return MODES[mode](src, texels);
+    for (uint32_t i = 0; i < 16; ++i) {
+        texels[i][0] = texels[i][1] = texels[i][2] = 0.0f;
+        texels[i][3]                               = 1.0f;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// ETC blocks are stored as big endian 64-bit words.
+static inline uint64_t etcLoad(const uint8_t * src) {
+    uint64_t w = 0;
+    for (int i = 0; i < 8; ++i) w = (w << 8) | src[i];
+    return w;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Intensity modifiers of the individual and differential modes, per table and 2-bit texel index.
+static constexpr int ETC_MODIFIERS[8][4] = {{2, 8, -2, -8},     {5, 17, -5, -17},   {9, 29, -9, -29},   {13, 42, -13, -42},
+                                            {18, 60, -18, -60}, {24, 80, -24, -80}, {33, 106, -33, -106}, {47, 183, -47, -183}};
+
+/// Distances of the T and H modes.
+static constexpr int ETC_DISTANCES[8] = {3, 6, 11, 16, 23, 32, 41, 64};
+
+/// Alpha modifiers of EAC, per table and 3-bit texel index.
+static constexpr int EAC_MODIFIERS[16][8] = {
+    {-3, -6, -9, -15, 2, 5, 8, 14}, {-3, -7, -10, -13, 2, 6, 9, 12}, {-2, -5, -8, -13, 1, 4, 7, 12}, {-2, -4, -6, -13, 1, 3, 5, 12},
+    {-3, -6, -8, -12, 2, 5, 7, 11}, {-3, -7, -9, -11, 2, 6, 8, 10},  {-4, -7, -8, -11, 3, 6, 7, 10}, {-3, -5, -8, -11, 2, 4, 7, 10},
+    {-2, -6, -8, -10, 1, 5, 7, 9},  {-2, -5, -8, -10, 1, 4, 7, 9},   {-2, -4, -8, -10, 1, 3, 7, 9},  {-2, -5, -7, -10, 1, 4, 6, 9},
+    {-3, -4, -7, -10, 2, 3, 6, 9},  {-1, -2, -3, -10, 0, 1, 2, 9},   {-4, -6, -8, -9, 3, 5, 7, 8},   {-3, -5, -7, -9, 2, 4, 6, 8}};
+
+static inline int etcClamp(int v) { return v < 0 ? 0 : (v > 255 ? 255 : v); }
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Decode the RGB part of an ETC2 block: the individual and differential modes of ETC1, plus the T, H and planar modes
+/// that ETC2 hides in the overflowing base colors of the differential mode. Alpha is left untouched.
+static void etc2Color(const uint8_t * src, uint8_t (*texels)[4]) {
+    uint64_t w    = etcLoad(src);
+    auto     bits = [w](uint32_t high, uint32_t count) { return (int) ((w >> (high + 1 - count)) & ((1u << count) - 1)); };
+    auto     ext5 = [](int v) { return (v << 3) | (v >> 2); };
+
+    // texels are stored in column major order: index i is texel (i / 4, i % 4), with its MSB at bit 16 + i.
+    auto index = [w](uint32_t x, uint32_t y) { return (uint32_t) (((w >> (x * 4 + y + 15)) & 2) | ((w >> (x * 4 + y)) & 1)); };
+
+    auto paint = [&](const int colors[4][3]) {
+        for (uint32_t y = 0; y < 4; ++y)
+            for (uint32_t x = 0; x < 4; ++x)
+                for (int c = 0; c < 3; ++c) texels[y * 4 + x][c] = (uint8_t) colors[index(x, y)][c];
+    };
+
+    int base[2][3];
+    if (bits(33, 1)) {
+        int r = bits(63, 5), g = bits(55, 5), b = bits(47, 5);
+        int dr = r + ((bits(58, 3) ^ 4) - 4), dg = g + ((bits(50, 3) ^ 4) - 4), db = b + ((bits(42, 3) ^ 4) - 4);
+        if (dr < 0 || dr > 31) {
+            // T mode: one single color, and a line of 3 colors around the other.
+            int c1[3] = {bits(60, 2) << 2 | bits(57, 2), bits(55, 4), bits(51, 4)};
+            int c2[3] = {bits(47, 4), bits(43, 4), bits(39, 4)};
+            int d     = ETC_DISTANCES[bits(35, 2) << 1 | bits(32, 1)];
+            int colors[4][3];
+            for (int c = 0; c < 3; ++c) {
+                colors[0][c] = c1[c] * 17;
+                colors[1][c] = etcClamp(c2[c] * 17 + d);
+                colors[2][c] = c2[c] * 17;
+                colors[3][c] = etcClamp(c2[c] * 17 - d);
+            }
+            return paint(colors);
+        }
+        if (dg < 0 || dg > 31) {
+            // H mode: two lines of 2 colors. The order of the base colors is the lowest bit of the distance index.
+            int c1[3] = {bits(62, 4), bits(58, 3) << 1 | bits(52, 1), bits(51, 1) << 3 | bits(49, 3)};
+            int c2[3] = {bits(46, 4), bits(42, 4), bits(38, 4)};
+            int order = (c1[0] << 8 | c1[1] << 4 | c1[2]) >= (c2[0] << 8 | c2[1] << 4 | c2[2]) ? 1 : 0;
+            int d     = ETC_DISTANCES[bits(34, 1) << 2 | bits(32, 1) << 1 | order];
+            int colors[4][3];
+            for (int c = 0; c < 3; ++c) {
+                colors[0][c] = etcClamp(c1[c] * 17 + d);
+                colors[1][c] = etcClamp(c1[c] * 17 - d);
+                colors[2][c] = etcClamp(c2[c] * 17 + d);
+                colors[3][c] = etcClamp(c2[c] * 17 - d);
+            }
+            return paint(colors);
+        }
+        if (db < 0 || db > 31) {
+            // planar mode: colors at (0, 0), (4, 0) and (0, 4), interpolated over the block.
+            auto ext6 = [](int v) { return (v << 2) | (v >> 4); };
+            auto ext7 = [](int v) { return (v << 1) | (v >> 6); };
+            int  o[3] = {ext6(bits(62, 6)), ext7(bits(56, 1) << 6 | bits(54, 6)),
+                         ext6(bits(48, 1) << 5 | bits(44, 2) << 3 | bits(41, 2) << 1 | bits(39, 1))};
+            int  h[3] = {ext6(bits(38, 5) << 1 | bits(32, 1)), ext7(bits(31, 7)), ext6(bits(24, 6))};
+            int  v[3] = {ext6(bits(18, 6)), ext7(bits(12, 7)), ext6(bits(5, 6))};
+            for (int y = 0; y < 4; ++y)
+                for (int x = 0; x < 4; ++x)
+                    for (int c = 0; c < 3; ++c) texels[y * 4 + x][c] = (uint8_t) etcClamp((x * (h[c] - o[c]) + y * (v[c] - o[c]) + 4 * o[c] + 2) >> 2);
+            return;
+        }
+        // differential mode: 5-bit base color, plus a 3-bit signed delta for the 2nd sub-block.
+        base[0][0] = ext5(r), base[0][1] = ext5(g), base[0][2] = ext5(b);
+        base[1][0] = ext5(dr), base[1][1] = ext5(dg), base[1][2] = ext5(db);
+    } else {
+        // individual mode: 4-bit base colors.
+        for (int c = 0; c < 3; ++c) {
+            base[0][c] = bits(63 - c * 8, 4) * 17;
+            base[1][c] = bits(59 - c * 8, 4) * 17;
+        }
+    }
+    // the flip bit picks 2 sub-blocks of 4x2 texels, stacked vertically, instead of 2x4 side by side.
+    int  tables[2] = {bits(39, 3), bits(36, 3)};
+    bool flip      = bits(32, 1);
+    for (uint32_t y = 0; y < 4; ++y) {
+        for (uint32_t x = 0; x < 4; ++x) {
+            uint32_t s = flip ? y / 2 : x / 2;
+            int      m = ETC_MODIFIERS[tables[s]][index(x, y)];
+            for (int c = 0; c < 3; ++c) texels[y * 4 + x][c] = (uint8_t) etcClamp(base[s][c] + m);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Decode an EAC block of 8-bit alpha.
+static void eacAlpha(const uint8_t * src, uint8_t (*texels)[4]) {
+    uint64_t     w    = etcLoad(src);
+    int          base = (int) (w >> 56), multiplier = (int) (w >> 52) & 0xf;
+    const auto & m    = EAC_MODIFIERS[(w >> 48) & 0xf];
+    // 3-bit indices, in column major order from bit 47 down.
+    for (uint32_t i = 0; i < 16; ++i) texels[(i % 4) * 4 + i / 4][3] = (uint8_t) etcClamp(base + m[(w >> (45 - i * 3)) & 7] * multiplier);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Decode an ETC2 RGB block.
+static void etc2(const uint8_t * src, uint8_t (*texels)[4]) {
+    etc2Color(src, texels);
+    for (uint32_t i = 0; i < 16; ++i) texels[i][3] = 255;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Decode an ETC2 RGBA block: EAC alpha, followed by ETC2 RGB.
+static void etc2Eac(const uint8_t * src, uint8_t (*texels)[4]) {
+    etc2Color(src + 8, texels);
+    eacAlpha(src, texels);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// The 128 bits of an ASTC block, for random access reads. Weights are read from the bit-reversed block.
+class AstcBits {
+public:
+    explicit AstcBits(const uint8_t * src) {
+        memcpy(&_lo, src, 8);
+        memcpy(&_hi, src + 8, 8);
+    }
+
+    /// Read up to 32 bits from the bit offset.
+    uint32_t get(uint32_t offset, uint32_t count) const {
+        if (0 == count) return 0;
+        uint64_t v = offset >= 64 ? _hi >> (offset - 64) : (_lo >> offset) | (offset ? _hi << (64 - offset) : 0);
+        return (uint32_t) (v & ((1ull << count) - 1));
+    }
+
+    /// The block with the order of all 128 bits reversed.
+    AstcBits reversed() const {
+        auto reverse = [](uint64_t v) {
+            v = ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
+            v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+            v = ((v >> 4) & 0x0f0f0f0f0f0f0f0full) | ((v & 0x0f0f0f0f0f0f0f0full) << 4);
+            v = ((v >> 8) & 0x00ff00ff00ff00ffull) | ((v & 0x00ff00ff00ff00ffull) << 8);
+            v = ((v >> 16) & 0x0000ffff0000ffffull) | ((v & 0x0000ffff0000ffffull) << 16);
+            return (v >> 32) | (v << 32);
+        };
+        AstcBits r = *this;
+        r._lo      = reverse(_hi);
+        r._hi      = reverse(_lo);
+        return r;
+    }
+
+private:
+    uint64_t _lo, _hi;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Trits, quints and bits of each range of the ASTC integer sequence encoding: 2, 3, 4, 5, 6, 8, 10, 12, 16, 20, 24,
+/// 32, 40, 48, 64, 80, 96, 128, 160, 192 and 256 values. Weights use the first 12 of them.
+struct AstcRange {
+    uint8_t trits, quints, bits;
+};
+
+static constexpr AstcRange ASTC_RANGES[21] = {
+    {0, 0, 1}, {1, 0, 0}, {0, 0, 2}, {0, 1, 0}, {1, 0, 1}, {0, 0, 3}, {0, 1, 1}, {1, 0, 2}, {0, 0, 4}, {0, 1, 2}, {1, 0, 3},
+    {0, 0, 5}, {0, 1, 3}, {1, 0, 4}, {0, 0, 6}, {0, 1, 4}, {1, 0, 5}, {0, 0, 7}, {0, 1, 5}, {1, 0, 6}, {0, 0, 8},
+};
+
+/// Number of bits that 'count' values of the range take in the integer sequence encoding.
+static inline uint32_t astcSequenceBits(uint32_t count, uint32_t range) {
+    const auto & r = ASTC_RANGES[range];
+    return count * r.bits + (r.trits ? (8 * count + 4) / 5 : 0) + (r.quints ? (7 * count + 2) / 3 : 0);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Weight grid and weight range of one of the 2048 ASTC block modes, regardless of the block footprint.
+struct AstcBlockMode {
+    uint8_t gridWidth, gridHeight;
+    uint8_t dualPlane;
+    uint8_t range;      ///< weight range, index into ASTC_RANGES.
+    uint8_t weightBits; ///< bits of all weights of the block. 0 if the mode is reserved or has too many or too few.
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Lookup tables of the ASTC decoder that don't depend on the block footprint. Built once at first use.
+struct AstcTables {
+    uint8_t       trits[256][5];  ///< the 5 trits packed in 8 bits.
+    uint8_t       quints[128][3]; ///< the 3 quints packed in 7 bits.
+    uint8_t       colors[21][256] = {}; ///< unquantized color values of each range, 0 to 255.
+    uint8_t       weights[12][32]; ///< unquantized weights of each range, 0 to 64.
+    AstcBlockMode modes[2048];
+
+    static const AstcTables & get() {
+        static const AstcTables instance;
+        return instance;
+    }
+
+private:
+    AstcTables() {
+        for (uint32_t t = 0; t < 256; ++t) {
+            auto     bit = [&](uint32_t v, uint32_t i) { return (v >> i) & 1; };
+            uint32_t c, t3, t4;
+            if (7 == ((t >> 2) & 7)) {
+                c  = ((t >> 5) << 2) | (t & 3);
+                t3 = t4 = 2;
+            } else {
+                c  = t & 0x1f;
+                t4 = 3 == ((t >> 5) & 3) ? 2 : bit(t, 7);
+                t3 = 3 == ((t >> 5) & 3) ? bit(t, 7) : (t >> 5) & 3;
+            }
+            uint32_t t0, t1, t2;
+            if (3 == (c & 3)) {
+                t2 = 2;
+                t1 = bit(c, 4);
+                t0 = (bit(c, 3) << 1) | (bit(c, 2) & ~bit(c, 3) & 1);
+            } else if (3 == ((c >> 2) & 3)) {
+                t2 = t1 = 2;
+                t0 = c & 3;
+            } else {
+                t2 = bit(c, 4);
+                t1 = (c >> 2) & 3;
+                t0 = (bit(c, 1) << 1) | (bit(c, 0) & ~bit(c, 1) & 1);
+            }
+            const uint32_t v[] = {t0, t1, t2, t3, t4};
+            for (uint32_t i = 0; i < 5; ++i) trits[t][i] = (uint8_t) v[i];
+        }
+        for (uint32_t q = 0; q < 128; ++q) {
+            auto     bit = [&](uint32_t v, uint32_t i) { return (v >> i) & 1; };
+            uint32_t q0, q1, q2;
+            if (3 == ((q >> 1) & 3) && 0 == ((q >> 5) & 3)) {
+                q2 = (bit(q, 0) << 2) | ((bit(q, 4) & ~bit(q, 0) & 1) << 1) | (bit(q, 3) & ~bit(q, 0) & 1);
+                q1 = q0 = 4;
+            } else {
+                uint32_t c;
+                if (3 == ((q >> 1) & 3)) {
+                    q2 = 4;
+                    c  = (((q >> 3) & 3) << 3) | ((~(q >> 5) & 3) << 1) | bit(q, 0);
+                } else {
+                    q2 = (q >> 5) & 3;
+                    c  = q & 0x1f;
+                }
+                if (5 == (c & 7)) {
+                    q1 = 4;
+                    q0 = (c >> 3) & 3;
+                } else {
+                    q1 = (c >> 3) & 3;
+                    q0 = c & 7;
+                }
+            }
+            quints[q][0] = (uint8_t) q0;
+            quints[q][1] = (uint8_t) q1;
+            quints[q][2] = (uint8_t) q2;
+        }
+
+        // unquantization. Plain bits are replicated. The trit or quint digit is scaled by C, and each bit of the value
+        // above bit 0 is spread over the bits of B, as laid out in the spec. Bit 0 flips the result around the middle.
+        struct Scale {
+            uint16_t c, b[5];
+        };
+        static constexpr Scale COLOR_TRITS[6]  = {{204, {}},
+                                                  {93, {0x116}},
+                                                  {44, {0x085, 0x10a}},
+                                                  {22, {0x041, 0x082, 0x104}},
+                                                  {11, {0x020, 0x040, 0x081, 0x102}},
+                                                  {5, {0x010, 0x020, 0x040, 0x080, 0x101}}};
+        static constexpr Scale COLOR_QUINTS[5] = {
+            {113, {}}, {54, {0x10c}}, {26, {0x082, 0x105}}, {13, {0x040, 0x081, 0x102}}, {6, {0x020, 0x040, 0x080, 0x101}}};
+        static constexpr Scale WEIGHT_TRITS[3] = {{50, {}}, {23, {0x45}}, {11, {0x21, 0x42}}};
+        static constexpr Scale WEIGHT_QUINTS[2] = {{28, {}}, {13, {0x42}}};
+        auto                   unquantize = [](const AstcRange & r, uint32_t value, uint32_t outBits, const Scale * tritScales, const Scale * quintScales) {
+            if (!r.trits && !r.quints) {
+                uint32_t v = 0;
+                for (int shift = (int) (outBits - r.bits); shift > -(int) r.bits; shift -= r.bits) v |= shift >= 0 ? value << shift : value >> -shift;
+                return v;
+            }
+            const Scale & scale = r.trits ? tritScales[r.bits - 1] : quintScales[r.bits - 1];
+            uint32_t      a     = (value & 1) ? (2u << outBits) - 1 : 0;
+            uint32_t      t     = (value >> r.bits) * scale.c;
+            for (uint32_t i = 1; i < r.bits; ++i) t += ((value >> i) & 1) * scale.b[i - 1];
+            return (a & (1u << (outBits - 1))) | ((t ^ a) >> 2);
+        };
+        // color values always have 6 levels or more.
+        for (uint32_t range = 4; range < 21; ++range) {
+            const auto & r      = ASTC_RANGES[range];
+            uint32_t     levels = (r.trits ? 3u : r.quints ? 5u : 1u) << r.bits;
+            for (uint32_t v = 0; v < levels; ++v) colors[range][v] = (uint8_t) unquantize(r, v, 8, COLOR_TRITS, COLOR_QUINTS);
+        }
+        // weights of trits and quints without bits take fixed values. Weights above 32 are moved up to reach 64.
+        static constexpr uint8_t THIRDS[3] = {0, 32, 63}, FIFTHS[5] = {0, 16, 32, 47, 63};
+        for (uint32_t range = 0; range < 12; ++range) {
+            const auto & r = ASTC_RANGES[range];
+            for (uint32_t v = 0; v < ((r.trits ? 3u : r.quints ? 5u : 1u) << r.bits); ++v) {
+                uint32_t w = 0 != r.bits ? unquantize(r, v, 6, WEIGHT_TRITS, WEIGHT_QUINTS) : r.trits ? THIRDS[v] : FIFTHS[v];
+                weights[range][v] = (uint8_t) (w > 32 ? w + 1 : w);
+            }
+        }
+
+        // block modes of 2D blocks.
+        for (uint32_t m = 0; m < 2048; ++m) {
+            modes[m]     = {};
+            uint32_t r   = (m >> 4) & 1;
+            uint32_t h   = (m >> 9) & 1;
+            uint32_t d   = (m >> 10) & 1;
+            uint32_t a   = (m >> 5) & 3;
+            uint32_t b   = (m >> 7) & 3;
+            uint32_t w = 0, g = 0;
+            if (m & 3) {
+                r |= (m & 3) << 1;
+                switch ((m >> 2) & 3) {
+                case 0: w = b + 4, g = a + 2; break;
+                case 1: w = b + 8, g = a + 2; break;
+                case 2: w = a + 2, g = b + 8; break;
+                default:
+                    b &= 1;
+                    if (m & 0x100) w = b + 2, g = a + 2;
+                    else w = a + 2, g = b + 6;
+                    break;
+                }
+            } else {
+                r |= ((m >> 2) & 3) << 1;
+                if (0 == ((m >> 2) & 3)) continue;
+                b = (m >> 9) & 3;
+                switch ((m >> 7) & 3) {
+                case 0: w = 12, g = a + 2; break;
+                case 1: w = a + 2, g = 12; break;
+                case 2: w = a + 6, g = b + 6, d = h = 0; break;
+                default:
+                    if (a > 1) continue;
+                    w = a ? 10 : 6, g = a ? 6 : 10;
+                    break;
+                }
+            }
+            uint32_t count = w * g * (d + 1);
+            uint32_t range = r - 2 + 6 * h;
+            uint32_t bits  = astcSequenceBits(count, range);
+            if (count > 64 || bits < 24 || bits > 96) continue;
+            modes[m] = {(uint8_t) w, (uint8_t) g, (uint8_t) d, (uint8_t) range, (uint8_t) bits};
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Partition of a texel, by the hash function of the ASTC spec.
+static uint32_t astcPartition(uint32_t seed, uint32_t x, uint32_t y, uint32_t partitions, bool smallBlock) {
+    if (smallBlock) x <<= 1, y <<= 1;
+    seed += (partitions - 1) * 1024;
+    uint32_t p = seed;
+    p ^= p >> 15;
+    p -= p << 17;
+    p += p << 7;
+    p += p << 4;
+    p ^= p >> 5;
+    p += p << 16;
+    p ^= p >> 7;
+    p ^= p >> 3;
+    p ^= p << 6;
+    p ^= p >> 17;
+    uint32_t s[8];
+    for (uint32_t i = 0; i < 8; ++i) s[i] = (p >> (i * 4)) & 0xf;
+    for (auto & v : s) v *= v;
+    uint32_t sh1 = (seed & 1) ? ((seed & 2) ? 4 : 5) : (3 == partitions ? 6 : 5);
+    uint32_t sh2 = (seed & 1) ? (3 == partitions ? 6 : 5) : ((seed & 2) ? 4 : 5);
+    for (uint32_t i = 0; i < 8; ++i) s[i] >>= (i & 1) ? sh2 : sh1;
+    uint32_t a = (s[0] * x + s[1] * y + (p >> 14)) & 0x3f;
+    uint32_t b = (s[2] * x + s[3] * y + (p >> 10)) & 0x3f;
+    uint32_t c = partitions < 3 ? 0 : (s[4] * x + s[5] * y + (p >> 6)) & 0x3f;
+    uint32_t d = partitions < 4 ? 0 : (s[6] * x + s[7] * y + (p >> 2)) & 0x3f;
+    if (a >= b && a >= c && a >= d) return 0;
+    if (b >= c && b >= d) return 1;
+    return c >= d ? 2 : 3;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Partitions and weight grid infill of one ASTC footprint, shared by all blocks of it. Built once at first use of each
+/// footprint.
+struct AstcFootprint {
+    /// Bilinear infill of a texel from its 4 closest grid weights.
+    struct Infill {
+        uint8_t index[4];
+        uint8_t factor[4]; ///< out of 16.
+    };
+
+    uint32_t             width, height, texels;
+    std::vector<uint8_t> partitions; ///< [partitions - 2][seed][texel]
+    std::vector<Infill>  infills;    ///< texels of each weight grid that fits in the footprint.
+    uint32_t             grids[13][13] = {}; ///< [grid width][grid height], offset of the grid in infills.
+
+    template<uint32_t W, uint32_t H>
+    static const AstcFootprint & get() {
+        static const AstcFootprint instance(W, H);
+        return instance;
+    }
+
+    const uint8_t * partitionsOf(uint32_t count, uint32_t seed) const { return partitions.data() + ((count - 2) * 1024 + seed) * texels; }
+
+private:
+    AstcFootprint(uint32_t w, uint32_t h): width(w), height(h), texels(w * h) {
+        partitions.resize(3 * 1024 * texels);
+        for (uint32_t count = 2; count <= 4; ++count)
+            for (uint32_t seed = 0; seed < 1024; ++seed) {
+                uint8_t * p = partitions.data() + ((count - 2) * 1024 + seed) * texels;
+                for (uint32_t i = 0; i < texels; ++i) p[i] = (uint8_t) astcPartition(seed, i % w, i / w, count, texels < 31);
+            }
+        uint32_t ds = (1024 + w / 2) / (w - 1);
+        uint32_t dt = (1024 + h / 2) / (h - 1);
+        for (uint32_t gw = 2; gw <= w; ++gw)
+            for (uint32_t gh = 2; gh <= h; ++gh) {
+                grids[gw][gh] = (uint32_t) infills.size();
+                for (uint32_t i = 0; i < texels; ++i) {
+                    uint32_t gs = (ds * (i % w) * (gw - 1) + 32) >> 6;
+                    uint32_t gt = (dt * (i / w) * (gh - 1) + 32) >> 6;
+                    uint32_t fs = gs & 0xf, ft = gt & 0xf;
+                    uint32_t v  = (gs >> 4) + (gt >> 4) * gw;
+                    uint32_t f3 = (fs * ft + 8) >> 4;
+                    // weights that are off the grid have no effect, so they point to a valid one.
+                    uint32_t last = gw * gh - 1;
+                    Infill   t;
+                    t.index[0]  = (uint8_t) v;
+                    t.index[1]  = (uint8_t) std::min(v + 1, last);
+                    t.index[2]  = (uint8_t) std::min(v + gw, last);
+                    t.index[3]  = (uint8_t) std::min(v + gw + 1, last);
+                    t.factor[0] = (uint8_t) (16 - fs - ft + f3);
+                    t.factor[1] = (uint8_t) (fs - f3);
+                    t.factor[2] = (uint8_t) (ft - f3);
+                    t.factor[3] = (uint8_t) f3;
+                    infills.push_back(t);
+                }
+            }
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Decode 'count' values of the integer sequence encoding that starts at bit 'offset'. Trits come in blocks of 5 values
+/// in 8 bits, quints in blocks of 3 values in 7 bits, interleaved with the plain bits of the values.
+static void astcDecodeSequence(const AstcBits & bits, uint32_t offset, uint32_t count, uint32_t range, uint8_t * values) {
+    static constexpr uint8_t TRIT_BITS[5] = {2, 2, 1, 2, 1}, QUINT_BITS[3] = {3, 2, 2};
+    const auto &             r            = ASTC_RANGES[range];
+    const auto &             tables       = AstcTables::get();
+    uint32_t                 group        = r.trits ? 5 : r.quints ? 3 : 1;
+    for (uint32_t i = 0; i < count; i += group) {
+        uint32_t m[5], packed = 0, shift = 0;
+        uint32_t n = std::min(group, count - i);
+        for (uint32_t j = 0; j < n; ++j) {
+            m[j] = bits.get(offset, r.bits);
+            offset += r.bits;
+            uint32_t extra = r.trits ? TRIT_BITS[j] : r.quints ? QUINT_BITS[j] : 0;
+            packed |= bits.get(offset, extra) << shift;
+            offset += extra;
+            shift += extra;
+        }
+        for (uint32_t j = 0; j < n; ++j) {
+            uint32_t digit = r.trits ? tables.trits[packed][j] : r.quints ? tables.quints[packed][j] : 0;
+            values[i + j]  = (uint8_t) ((digit << r.bits) | m[j]);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// true, if the color endpoint mode has HDR end points.
+static inline bool astcIsHdr(uint32_t cem) { return 2 == cem || 3 == cem || 7 == cem || 11 == cem || 14 == cem || 15 == cem; }
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Unpack the 12-bit HDR RGB end points of endpoint modes 11, 14 and 15.
+static void astcHdrRgb(const int * v, int e[2][4]) {
+    int major = ((v[4] & 0x80) >> 7) | ((v[5] & 0x80) >> 6);
+    if (3 == major) {
+        const int c[2][3] = {{v[0] << 4, v[2] << 4, (v[4] & 0x7f) << 5}, {v[1] << 4, v[3] << 4, (v[5] & 0x7f) << 5}};
+        for (uint32_t i = 0; i < 2; ++i)
+            for (uint32_t k = 0; k < 3; ++k) e[i][k] = c[i][k];
+        return;
+    }
+    int mode = ((v[1] & 0x80) >> 7) | ((v[2] & 0x80) >> 6) | ((v[3] & 0x80) >> 5);
+    int a    = v[0] | ((v[1] & 0x40) << 2);
+    int b0 = v[2] & 0x3f, b1 = v[3] & 0x3f, c = v[1] & 0x3f, d0 = v[4] & 0x1f, d1 = v[5] & 0x1f;
+    int x0 = (v[2] >> 6) & 1, x1 = (v[3] >> 6) & 1, x2 = (v[4] >> 6) & 1, x3 = (v[5] >> 6) & 1, x4 = (v[4] >> 5) & 1, x5 = (v[5] >> 5) & 1;
+    // the 6 bits above move around, depending on the mode.
+    int one = 1 << mode;
+    if (one & 0xa4) a |= x0 << 9;
+    if (one & 0x08) a |= x2 << 9;
+    if (one & 0x50) a |= (x4 << 9) | (x5 << 10);
+    if (one & 0xa0) a |= x1 << 10;
+    if (one & 0xc0) a |= x2 << 11;
+    if (one & 0x04) c |= x1 << 6;
+    if (one & 0xe8) c |= x3 << 6;
+    if (one & 0x20) c |= x2 << 7;
+    if (one & 0x5b) b0 |= x0 << 6, b1 |= x1 << 6;
+    if (one & 0x12) b0 |= x2 << 7, b1 |= x3 << 7;
+    if (one & 0xaf) d0 |= x4 << 5, d1 |= x5 << 5;
+    if (one & 0x05) d0 |= x2 << 6, d1 |= x3 << 6;
+    static constexpr int D_BITS[8] = {7, 6, 7, 6, 5, 6, 5, 6};
+    int                  sign      = 1 << (D_BITS[mode] - 1);
+    d0                             = (d0 ^ sign) - sign;
+    d1                             = (d1 ^ sign) - sign;
+    int shift                      = (mode >> 1) ^ 3;
+    a <<= shift, b0 <<= shift, b1 <<= shift, c <<= shift;
+    d0 *= 1 << shift, d1 *= 1 << shift;
+    int rgb[2][3] = {{a - c, a - b0 - c - d0, a - b1 - c - d1}, {a, a - b0, a - b1}};
+    for (auto & x : rgb) {
+        if (1 == major) std::swap(x[0], x[1]);
+        if (2 == major) std::swap(x[0], x[2]);
+    }
+    for (uint32_t i = 0; i < 2; ++i)
+        for (uint32_t k = 0; k < 3; ++k) e[i][k] = std::clamp(rgb[i][k], 0, 0xfff);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Unpack the 12-bit HDR RGB end points of endpoint mode 7: a base color and a scale that is subtracted from it.
+static void astcHdrRgbScale(const int * v, int e[2][4]) {
+    int bits  = ((v[0] & 0xc0) >> 6) | ((v[1] & 0x80) >> 5) | ((v[2] & 0x80) >> 4);
+    int major = 0, mode = 5;
+    if (0xc != (bits & 0xc)) major = bits >> 2, mode = bits & 3;
+    else if (0xf != bits) major = bits & 3, mode = 4;
+    int r = v[0] & 0x3f, g = v[1] & 0x1f, b = v[2] & 0x1f, s = v[3] & 0x1f;
+    int x0 = (v[1] >> 6) & 1, x1 = (v[1] >> 5) & 1, x2 = (v[2] >> 6) & 1, x3 = (v[2] >> 5) & 1;
+    int x4 = (v[3] >> 7) & 1, x5 = (v[3] >> 6) & 1, x6 = (v[3] >> 5) & 1;
+    // the 7 bits above move around, depending on the mode.
+    int one = 1 << mode;
+    if (one & 0x30) g |= x0 << 6, b |= x2 << 6;
+    if (one & 0x3a) g |= x1 << 5, b |= x3 << 5;
+    if (one & 0x3d) s |= x6 << 5;
+    if (one & 0x2d) s |= x5 << 6;
+    if (one & 0x04) s |= x4 << 7;
+    if (one & 0x3b) r |= x4 << 6;
+    if (one & 0x04) r |= x3 << 6;
+    if (one & 0x10) r |= x5 << 7;
+    if (one & 0x0f) r |= x2 << 7;
+    if (one & 0x05) r |= (x1 << 8) | (x0 << 9);
+    if (one & 0x0a) r |= x0 << 8;
+    if (one & 0x02) r |= (x6 << 9) | (x5 << 10);
+    if (one & 0x01) r |= x3 << 10;
+    static constexpr int SHIFTS[6] = {1, 1, 2, 3, 4, 5};
+    r <<= SHIFTS[mode], g <<= SHIFTS[mode], b <<= SHIFTS[mode], s <<= SHIFTS[mode];
+    // all but mode 5 store green and blue as differences to red.
+    if (5 != mode) g = r - g, b = r - b;
+    if (1 == major) std::swap(r, g);
+    if (2 == major) std::swap(r, b);
+    const int rgb[2][3] = {{r - s, g - s, b - s}, {r, g, b}};
+    for (uint32_t i = 0; i < 2; ++i)
+        for (uint32_t k = 0; k < 3; ++k) e[i][k] = std::clamp(rgb[i][k], 0, 0xfff);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Unpack the color end points of one partition to 16-bit values. LDR channels are UNORM16, HDR ones are the
+/// logarithmic values that are interpolated before they are converted to half floats.
+/// \param v     The unquantized color values of the partition, 0 to 255.
+/// \param hdr   Gets which channels are HDR.
+static void astcEndpoints(uint32_t cem, const uint8_t * values, bool srgb, int32_t e[2][4], bool hdr[4]) {
+    int v[8];
+    for (uint32_t i = 0; i < (cem >> 2) * 2 + 2; ++i) v[i] = values[i];
+    // moves the top bit of b into a, which becomes a signed 6-bit offset.
+    auto transfer = [](int & a, int & b) {
+        b = (b >> 1) | (a & 0x80);
+        a = (a >> 1) & 0x3f;
+        if (a & 0x20) a -= 0x40;
+    };
+    auto contract = [](int * c) {
+        c[0] = (c[0] + c[2]) >> 1;
+        c[1] = (c[1] + c[2]) >> 1;
+    };
+    int c[2][4] = {{0, 0, 0, 255}, {0, 0, 0, 255}};
+    switch (cem) {
+    case 0: // luminance
+        c[0][0] = c[0][1] = c[0][2] = v[0];
+        c[1][0] = c[1][1] = c[1][2] = v[1];
+        break;
+    case 1: { // luminance, base + offset
+        int l0  = (v[0] >> 2) | (v[1] & 0xc0);
+        c[0][0] = c[0][1] = c[0][2] = l0;
+        c[1][0] = c[1][1] = c[1][2] = std::min(l0 + (v[1] & 0x3f), 255);
+        break;
+    }
+    case 4: // luminance + alpha
+        c[0][0] = c[0][1] = c[0][2] = v[0];
+        c[1][0] = c[1][1] = c[1][2] = v[1];
+        c[0][3]                     = v[2];
+        c[1][3]                     = v[3];
+        break;
+    case 5: // luminance + alpha, base + offset
+        transfer(v[1], v[0]);
+        transfer(v[3], v[2]);
+        c[0][0] = c[0][1] = c[0][2] = v[0];
+        c[1][0] = c[1][1] = c[1][2] = v[0] + v[1];
+        c[0][3]                     = v[2];
+        c[1][3]                     = v[2] + v[3];
+        break;
+    case 6:  // RGB, scaled
+    case 10: // RGB, scaled, + 2 alpha
+        for (uint32_t k = 0; k < 3; ++k) {
+            c[0][k] = (v[k] * v[3]) >> 8;
+            c[1][k] = v[k];
+        }
+        if (10 == cem) c[0][3] = v[4], c[1][3] = v[5];
+        break;
+    case 8:    // RGB
+    case 12: { // RGBA
+        int a0 = 12 == cem ? v[6] : 255, a1 = 12 == cem ? v[7] : 255;
+        if (v[1] + v[3] + v[5] >= v[0] + v[2] + v[4]) {
+            const int x[2][4] = {{v[0], v[2], v[4], a0}, {v[1], v[3], v[5], a1}};
+            memcpy(c, x, sizeof(c));
+        } else {
+            // blue contraction: the end points are swapped, and red and green are stored relative to blue.
+            const int x[2][4] = {{v[1], v[3], v[5], a1}, {v[0], v[2], v[4], a0}};
+            memcpy(c, x, sizeof(c));
+            contract(c[0]);
+            contract(c[1]);
+        }
+        break;
+    }
+    case 9:    // RGB, base + offset
+    case 13: { // RGBA, base + offset
+        uint32_t n = 13 == cem ? 4 : 3;
+        for (uint32_t k = 0; k < n; ++k) {
+            transfer(v[k * 2 + 1], v[k * 2]);
+            c[0][k] = v[k * 2];
+            c[1][k] = v[k * 2] + v[k * 2 + 1];
+        }
+        if (v[1] + v[3] + v[5] < 0) {
+            std::swap(c[0], c[1]);
+            contract(c[0]);
+            contract(c[1]);
+        }
+        break;
+    }
+    case 2: { // HDR luminance, large range
+        int y0 = v[1] >= v[0] ? v[0] << 4 : (v[1] << 4) + 8;
+        int y1 = v[1] >= v[0] ? v[1] << 4 : (v[0] << 4) - 8;
+        c[0][0] = c[0][1] = c[0][2] = y0;
+        c[1][0] = c[1][1] = c[1][2] = y1;
+        break;
+    }
+    case 3: { // HDR luminance, small range
+        bool wide = 0 != (v[0] & 0x80);
+        int  y0   = wide ? ((v[1] & 0xe0) << 4) | ((v[0] & 0x7f) << 2) : ((v[1] & 0xf0) << 4) | ((v[0] & 0x7f) << 1);
+        int  d    = wide ? (v[1] & 0x1f) << 2 : (v[1] & 0x0f) << 1;
+        c[0][0] = c[0][1] = c[0][2] = y0;
+        c[1][0] = c[1][1] = c[1][2] = std::min(y0 + d, 0xfff);
+        break;
+    }
+    case 7: // HDR RGB, base + scale
+        astcHdrRgbScale(v, c);
+        break;
+    case 11: // HDR RGB
+    case 14: // HDR RGB + LDR alpha
+    case 15: // HDR RGB + HDR alpha
+        astcHdrRgb(v, c);
+        if (14 == cem) c[0][3] = v[6], c[1][3] = v[7];
+        if (15 == cem) {
+            int mode = ((v[6] >> 7) & 1) | ((v[7] >> 6) & 2);
+            int a0 = v[6] & 0x7f, a1 = v[7] & 0x7f;
+            if (3 == mode) {
+                a0 <<= 5, a1 <<= 5;
+            } else {
+                a0 |= (a1 << (mode + 1)) & 0x780;
+                a1 &= 0x3f >> mode;
+                a1 = (a1 ^ (0x20 >> mode)) - (0x20 >> mode);
+                a0 <<= 4 - mode;
+                a1 = std::clamp(a0 + a1 * (1 << (4 - mode)), 0, 0xfff);
+            }
+            c[0][3] = a0, c[1][3] = a1;
+        }
+        break;
+    default:
+        break;
+    }
+
+    // LDR values are expanded to 16 bits; sRGB ones keep the 8 bits at the top, so they convert exactly. 12-bit HDR
+    // values get 4 more bits. The alpha of HDR modes is 1.0 (0x780), unless the mode has its own.
+    bool rgbHdr = astcIsHdr(cem), alphaHdr = rgbHdr && 14 != cem;
+    for (uint32_t k = 0; k < 4; ++k) {
+        hdr[k] = 3 == k ? alphaHdr : rgbHdr;
+        for (uint32_t i = 0; i < 2; ++i) {
+            int x = c[i][k];
+            if (3 == k && alphaHdr && 15 != cem) x = 0x780;
+            if (hdr[k]) e[i][k] = x << 4;
+            else {
+                x       = std::clamp(x, 0, 255);
+                e[i][k] = (x << 8) | (srgb ? 0x80 : x);
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Decode an ASTC block of the footprint. T is uint8_t for the LDR formats, which keep the top 8 bits of the UNORM16
+/// results like the decode_unorm8 mode of GPUs. T is float for the HDR (SFLOAT) formats, which decode LDR channels to
+/// UNORM16 / 65535, and HDR ones to half floats. Illegal blocks, and the partitions with HDR end points of LDR formats,
+/// decode to the error color: opaque magenta.
+template<typename T>
+static void astcBlock(const AstcFootprint & fp, const uint8_t * src, bool srgb, T (*texels)[4]) {
+    constexpr bool HDR    = std::is_same<T, float>::value;
+    const auto &   tables = AstcTables::get();
+    AstcBits       bits(src);
+    auto           error = [&]() {
+        for (uint32_t i = 0; i < fp.texels; ++i) {
+            texels[i][0] = texels[i][2] = texels[i][3] = HDR ? (T) 1 : (T) 255;
+            texels[i][1]                               = 0;
+        }
+    };
+    auto ldr = [&](uint32_t c) -> T { return HDR ? (T) ((float) c / 65535.0f) : (T) (c >> 8); };
+
+    // void extent blocks have one color, as UNORM16 or half floats.
+    uint32_t blockMode = bits.get(0, 11);
+    if (0x1fc == (blockMode & 0x1ff)) {
+        bool     hdr = 0 != (blockMode & 0x200);
+        uint32_t s0 = bits.get(12, 13), s1 = bits.get(25, 13), t0 = bits.get(38, 13), t1 = bits.get(51, 13);
+        if (hdr && !HDR) return error();
+        if (0x1fff != (s0 & s1 & t0 & t1) && (s0 >= s1 || t0 >= t1)) return error();
+        T color[4];
+        for (uint32_t c = 0; c < 4; ++c) {
+            uint32_t v = bits.get(64 + c * 16, 16);
+            color[c]   = hdr ? (T) smallFloatToFloat(v, 10, true) : ldr(v);
+        }
+        for (uint32_t i = 0; i < fp.texels; ++i) memcpy(texels[i], color, sizeof(color));
+        return;
+    }
+
+    const auto & mode       = tables.modes[blockMode];
+    uint32_t     partitions = bits.get(11, 2) + 1;
+    if (0 == mode.weightBits || mode.gridWidth > fp.width || mode.gridHeight > fp.height || (mode.dualPlane && 4 == partitions)) return error();
+
+    // color endpoint modes. When partitions have different ones, the bits that don't fit in the header are stored
+    // below the weights, then the channel of the 2nd weight plane below them.
+    uint32_t        below = 128 - mode.weightBits, colorStart = 17;
+    uint32_t        cems[4];
+    const uint8_t * partitionOf = nullptr;
+    if (1 == partitions) {
+        cems[0] = bits.get(13, 4);
+    } else {
+        partitionOf  = fp.partitionsOf(partitions, bits.get(13, 10));
+        colorStart   = 29;
+        uint32_t cem = bits.get(23, 6);
+        if (0 == (cem & 3)) {
+            for (uint32_t p = 0; p < partitions; ++p) cems[p] = cem >> 2;
+        } else {
+            uint32_t extra = 3 * partitions - 4;
+            uint32_t base  = (cem & 3) - 1;
+            below -= extra;
+            cem = (cem >> 2) | (bits.get(below, extra) << 4);
+            for (uint32_t p = 0; p < partitions; ++p) cems[p] = ((base + ((cem >> p) & 1)) << 2) | ((cem >> (partitions + p * 2)) & 3);
+        }
+    }
+    uint32_t plane2 = 4;
+    if (mode.dualPlane) {
+        below -= 2;
+        plane2 = bits.get(below, 2);
+    }
+
+    // color values take the largest range that fits in the bits between the header and the weights.
+    uint32_t count = 0;
+    for (uint32_t p = 0; p < partitions; ++p) count += (cems[p] >> 2) * 2 + 2;
+    if (count > 18 || below < colorStart) return error();
+    uint32_t range = 20;
+    while (range >= 4 && astcSequenceBits(count, range) > below - colorStart) --range;
+    if (range < 4) return error();
+    uint8_t values[18];
+    int32_t endpoints[4][2][4];
+    bool    hdr[4][4];
+    astcDecodeSequence(bits, colorStart, count, range, values);
+    for (uint32_t p = 0, offset = 0; p < partitions; offset += (cems[p] >> 2) * 2 + 2, ++p) {
+        for (uint32_t i = 0; i < (cems[p] >> 2) * 2 + 2; ++i) values[offset + i] = tables.colors[range][values[offset + i]];
+        astcEndpoints(cems[p], values + offset, srgb, endpoints[p], hdr[p]);
+        if (!HDR && astcIsHdr(cems[p])) {
+            // HDR partitions of LDR formats have the error color.
+            static constexpr int32_t MAGENTA[2][4] = {{0xffff, 0, 0xffff, 0xffff}, {0xffff, 0, 0xffff, 0xffff}};
+            memcpy(endpoints[p], MAGENTA, sizeof(MAGENTA));
+        }
+    }
+
+    // weights, from the top of the block down, interleaved by plane. The grid is infilled to the texels.
+    uint32_t planes = mode.dualPlane + 1u;
+    uint8_t  weights[64];
+    astcDecodeSequence(bits.reversed(), 0, mode.gridWidth * mode.gridHeight * planes, mode.range, weights);
+    for (uint32_t i = 0; i < mode.gridWidth * mode.gridHeight * planes; ++i) weights[i] = tables.weights[mode.range][weights[i]];
+    const AstcFootprint::Infill * infill = fp.infills.data() + fp.grids[mode.gridWidth][mode.gridHeight];
+    for (uint32_t i = 0; i < fp.texels; ++i) {
+        const auto & f = infill[i];
+        uint32_t     w[2];
+        for (uint32_t k = 0; k < planes; ++k) {
+            w[k] = (weights[f.index[0] * planes + k] * f.factor[0] + weights[f.index[1] * planes + k] * f.factor[1] +
+                    weights[f.index[2] * planes + k] * f.factor[2] + weights[f.index[3] * planes + k] * f.factor[3] + 8) >> 4;
+        }
+        uint32_t p = partitionOf ? partitionOf[i] : 0;
+        for (uint32_t c = 0; c < 4; ++c) {
+            uint32_t x = c == plane2 ? w[1] : w[0];
+            auto     v = (uint32_t) ((endpoints[p][0][c] * (int32_t) (64 - x) + endpoints[p][1][c] * (int32_t) x + 32) >> 6);
+            if (!HDR || !hdr[p][c]) {
+                texels[i][c] = ldr(v);
+                continue;
+            }
+            // logarithmic value to half: the top 5 bits are the exponent, the mantissa is mapped piecewise linearly.
+            uint32_t m   = v & 0x7ff;
+            uint32_t mt  = m < 512 ? 3 * m : m < 1536 ? 4 * m - 512 : 5 * m - 2048;
+            texels[i][c] = (T) smallFloatToFloat(std::min(((v >> 11) << 10) | (mt >> 3), 0x7bffu), 10, true);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// ASTC block decoders of each footprint.
+template<uint32_t W, uint32_t H, bool SRGB>
+static void astcLdr(const uint8_t * src, uint8_t (*texels)[4]) {
+    astcBlock(AstcFootprint::get<W, H>(), src, SRGB, texels);
+}
+
+template<uint32_t W, uint32_t H>
+static void astcHdr(const uint8_t * src, float (*texels)[4]) {
+    astcBlock(AstcFootprint::get<W, H>(), src, false, texels);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// ASTC block decoders of the LDR (UNORM and sRGB) and HDR (SFLOAT) formats, in the order of the ASTC layouts.
+struct AstcDecoders {
+    DecodeBlockFunc      unorm, srgb;
+    DecodeFloatBlockFunc sfloat;
+};
+
+static constexpr AstcDecoders ASTC_DECODERS[] = {
+    {astcLdr<4, 4, false>, astcLdr<4, 4, true>, astcHdr<4, 4>},       {astcLdr<5, 4, false>, astcLdr<5, 4, true>, astcHdr<5, 4>},
+    {astcLdr<5, 5, false>, astcLdr<5, 5, true>, astcHdr<5, 5>},       {astcLdr<6, 5, false>, astcLdr<6, 5, true>, astcHdr<6, 5>},
+    {astcLdr<6, 6, false>, astcLdr<6, 6, true>, astcHdr<6, 6>},       {astcLdr<8, 5, false>, astcLdr<8, 5, true>, astcHdr<8, 5>},
+    {astcLdr<8, 6, false>, astcLdr<8, 6, true>, astcHdr<8, 6>},       {astcLdr<8, 8, false>, astcLdr<8, 8, true>, astcHdr<8, 8>},
+    {astcLdr<10, 5, false>, astcLdr<10, 5, true>, astcHdr<10, 5>},    {astcLdr<10, 6, false>, astcLdr<10, 6, true>, astcHdr<10, 6>},
+    {astcLdr<10, 8, false>, astcLdr<10, 8, true>, astcHdr<10, 8>},    {astcLdr<10, 10, false>, astcLdr<10, 10, true>, astcHdr<10, 10>},
+    {astcLdr<12, 10, false>, astcLdr<12, 10, true>, astcHdr<12, 10>}, {astcLdr<12, 12, false>, astcLdr<12, 12, true>, astcHdr<12, 12>},
+};
+static_assert(std::size(ASTC_DECODERS) == PixelFormat::LAST_ASTC_LAYOUT - PixelFormat::FIRST_ASTC_LAYOUT + 1);
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Returns the block decoder of the format, or null if the layout can't be decoded (yet).
+static DecodeBlockFunc findBlockDecoder(const PixelFormat & format) {
+#if RII_SIMD_SSE
+    if (CpuFeatures::get().ssse3) {
+        using D = BcBlockDecoders<bc1LookupSsse3>;
+        bool  s = PixelFormat::SIGN_SNORM == format.sign0 || PixelFormat::SIGN_SINT == format.sign0;
+        switch (format.layout) {
+        case PixelFormat::LAYOUT_BC1:
+            return D::bc1;
+        case PixelFormat::LAYOUT_BC2:
+            return D::bc2;
+        case PixelFormat::LAYOUT_BC3:
+            return D::bc3;
+        case PixelFormat::LAYOUT_BC4:
+            return s ? D::bc4<true> : D::bc4<false>;
+        case PixelFormat::LAYOUT_BC5:
+            return s ? D::bc5<true> : D::bc5<false>;
+        default:
+            break;
+        }
+    }
+#endif
+    using D = BcBlockDecoders<bc1LookupScalar>;
+    bool  s = PixelFormat::SIGN_SNORM == format.sign0 || PixelFormat::SIGN_SINT == format.sign0;
+    switch (format.layout) {
+    case PixelFormat::LAYOUT_BC1:
+        return D::bc1;
+    case PixelFormat::LAYOUT_BC2:
+        return D::bc2;
+    case PixelFormat::LAYOUT_BC3:
+        return D::bc3;
+    case PixelFormat::LAYOUT_BC4:
+        return s ? D::bc4<true> : D::bc4<false>;
+    case PixelFormat::LAYOUT_BC5:
+        return s ? D::bc5<true> : D::bc5<false>;
+    case PixelFormat::LAYOUT_BC7:
+        return bc7;
+    case PixelFormat::LAYOUT_ETC2:
+        return etc2;
+    case PixelFormat::LAYOUT_ETC2_EAC:
+        return etc2Eac;
+    default:
+        break;
+    }
+    if (format.layout < PixelFormat::FIRST_ASTC_LAYOUT || format.layout > PixelFormat::LAST_ASTC_LAYOUT) return nullptr;
+    if (PixelFormat::SIGN_FLOAT == format.sign0) return nullptr;
+    const auto & astc = ASTC_DECODERS[format.layout - PixelFormat::FIRST_ASTC_LAYOUT];
+    return PixelFormat::SIGN_GNORM == format.sign0 ? astc.srgb : astc.unorm;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Returns the float block decoder of the format, or null if the layout isn't a HDR one.
+static DecodeFloatBlockFunc findFloatBlockDecoder(const PixelFormat & format) {
+    if (format.layout >= PixelFormat::FIRST_ASTC_LAYOUT && format.layout <= PixelFormat::LAST_ASTC_LAYOUT && PixelFormat::SIGN_FLOAT == format.sign0)
+        return ASTC_DECODERS[format.layout - PixelFormat::FIRST_ASTC_LAYOUT].sfloat;
+    if (PixelFormat::LAYOUT_BC6H != format.layout) return nullptr;
+    bool s = PixelFormat::SIGN_SNORM == format.sign0 || PixelFormat::SIGN_SINT == format.sign0;
+    return s ? bc6h<true> : bc6h<false>;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Decodes rows of blocks of a compressed format straight into a tightly packed RGBA8 or float4 image. Swizzle and
+/// per channel sign conversion are folded into 256 entry tables, so they cost one lookup per channel. HDR layouts are
+/// decoded to float texels, which only go through the swizzle.
+class BlockDecoder {
+public:
+    explicit BlockDecoder(const PixelFormat & format): _decode(findBlockDecoder(format)), _decodeFloat(findFloatBlockDecoder(format)) {
+        const auto & ld = format.layoutDesc();
+        _bw             = ld.blockWidth;
+        _bh             = ld.blockHeight;
+        RII_ASSERT((size_t) _bw * _bh <= MAX_BLOCK_TEXELS);
+        _identity = true;
+        for (size_t c = 0; c < 4; ++c) {
+            auto swizzle    = getSwizzledChannel(format, c);
+            bool constant   = swizzle > PixelFormat::SWIZZLE_W;
+            auto sign       = constant ? PixelFormat::SIGN_UNORM : getSign(format, swizzle);
+            _source[c]      = constant ? 0 : (uint8_t) swizzle;
+            _floatSource[c] = constant ? (PixelFormat::SWIZZLE_1 == swizzle ? 5 : 4) : (uint8_t) swizzle;
+            if (_decodeFloat) continue; // HDR texels don't go through the 8-bit tables.
+            for (uint32_t v = 0; v < 256; ++v) {
+                _float[c][v] = constant ? (PixelFormat::SWIZZLE_1 == swizzle ? 1.0f : 0.0f) : toFloat(v, 8, sign);
+                _u8[c][v]    = quantizeU8(_float[c][v]);
+            }
+            // BC1 alpha channel might be dropped by the XYZ1 swizzle. Every other channel must pass through as is.
+            if (!(c == swizzle && PixelFormat::SIGN_UNORM == sign) && !(3 == c && PixelFormat::SWIZZLE_1 == swizzle)) _identity = false;
+        }
+        _forceOpaque = PixelFormat::SWIZZLE_1 == format.swizzle3;
+    }
+
+    /// false, if the layout can't be decoded (yet).
+    bool valid() const { return nullptr != _decode || nullptr != _decodeFloat; }
+
+    /// Decode one row of blocks, i.e. up to blockHeight rows of texels.
+    /// \param dst   Points to the first texel of the row, in a tightly packed image that is 'width' texels wide.
+    /// \param rows  Number of texel rows to write. Less than the block height at the bottom of the image.
+    template<typename T>
+    void decodeRow(T * dst, uint32_t width, uint32_t rows, const uint8_t * src, size_t step) const {
+        if (_decodeFloat) {
+            float texels[MAX_BLOCK_TEXELS][4];
+            for (uint32_t x = 0; x < width; x += _bw, src += step) {
+                _decodeFloat(src, texels);
+                uint32_t cols = std::min(_bw, width - x);
+                for (uint32_t y = 0; y < rows; ++y) store(dst + (size_t) y * width + x, texels + y * _bw, cols);
+            }
+            return;
+        }
+        uint8_t texels[MAX_BLOCK_TEXELS][4];
+        for (uint32_t x = 0; x < width; x += _bw, src += step) {
+            _decode(src, texels);
+            uint32_t cols = std::min(_bw, width - x);
+            for (uint32_t y = 0; y < rows; ++y) store(dst + (size_t) y * width + x, texels + y * _bw, cols);
+        }
+    }
+
+private:
+    DecodeBlockFunc      _decode;
+    DecodeFloatBlockFunc _decodeFloat;
+    uint32_t             _bw, _bh;
+    bool                 _identity;       ///< texels can be copied to RGBA8 as is.
+    bool                 _forceOpaque;    ///< alpha is forced to 1 by the swizzle.
+    uint8_t              _source[4];      ///< storage channel of each output channel.
+    uint8_t              _floatSource[4]; ///< same as _source, with 4 and 5 picking constant 0 and 1.
+    float                _float[4][256];
+    uint8_t              _u8[4][256];
+
+    void store(RGBA8 * dst, const uint8_t (*texels)[4], uint32_t count) const {
+        if (_identity) {
+            memcpy(dst, texels, count * 4);
+            if (_forceOpaque)
+                for (uint32_t i = 0; i < count; ++i) dst[i].a = 255;
+            return;
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+            dst[i] = RGBA8::makeU8(_u8[0][texels[i][_source[0]]], _u8[1][texels[i][_source[1]]], _u8[2][texels[i][_source[2]]],
+                                   _u8[3][texels[i][_source[3]]]);
+        }
+    }
+
+    void store(Float4 * dst, const uint8_t (*texels)[4], uint32_t count) const {
+        for (uint32_t i = 0; i < count; ++i) {
+            dst[i] = Float4::make(_float[0][texels[i][_source[0]]], _float[1][texels[i][_source[1]]], _float[2][texels[i][_source[2]]],
+                                  _float[3][texels[i][_source[3]]]);
+        }
+    }
+
+    void store(Float4 * dst, const float (*texels)[4], uint32_t count) const {
+        for (uint32_t i = 0; i < count; ++i) {
+            const float v[6] = {texels[i][0], texels[i][1], texels[i][2], texels[i][3], 0.0f, 1.0f};
+            dst[i]           = Float4::make(v[_floatSource[0]], v[_floatSource[1]], v[_floatSource[2]], v[_floatSource[3]]);
+        }
+    }
+
+    void store(RGBA8 * dst, const float (*texels)[4], uint32_t count) const {
+        for (uint32_t i = 0; i < count; ++i) {
+            Float4 f;
+            store(&f, texels + i, 1);
+            dst[i] = RGBA8::makeU8(quantizeU8(f.x), quantizeU8(f.y), quantizeU8(f.z), quantizeU8(f.w));
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Decode a compressed plane into a tightly packed image, rows of blocks in parallel. See parallelFor() for threads and
+/// executor.
+template<typename T>
+static void decodeCompressedPlane(const BlockDecoder & decoder, const PlaneDesc & plane, const uint8_t * pixels, T * dst, size_t threads = 0,
+                                  const Executor & executor = {}) {
+    const auto & ld = plane.format.layoutDesc();
+    const auto & e  = plane.extent;
+    parallelForRows(plane, threads, executor, [&](uint32_t z, uint32_t y0, uint32_t y1) {
+        for (uint32_t y = y0 * ld.blockHeight; y < std::min(y1 * ld.blockHeight, e.h); y += ld.blockHeight) {
+            decoder.decodeRow(dst + ((size_t) z * e.h + y) * e.w, e.w, std::min<uint32_t>(ld.blockHeight, e.h - y), pixels + plane.pixel(0, y, z), plane.step);
+        }
+    });
+}
+
+} // namespace rii_details
+
+// *********************************************************************************************************************
+// Block compression
+// *********************************************************************************************************************
+
+namespace rii_details {
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// How hard the block encoders search, resolved from PlaneDesc::CompressParameters.
+struct EncodeEffort {
+    bool     quality;       ///< the QUALITY preset.
+    uint32_t bc7Modes;      ///< bit mask of the BC7 modes to try.
+    uint32_t bc7Partitions; ///< number of partitions of each BC7 mode with 2 or 3 subsets that get a full fit.
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Encode 16 texels into one 4x4 block. The texels are in the same form DecodeBlockFunc produces: row by row, 8 bits
+/// per channel, in the storage channel order of the layout. Signed channels hold int8 values.
+using EncodeBlockFunc = void (*)(const uint8_t (*texels)[4], uint8_t * dst, const EncodeEffort & effort);
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// 4 floats, in one SSE register when available. Only what the BC1 cluster fit needs.
+struct Vec4f {
+#if RII_SIMD_SSE
+    __m128 v;
+
+    static Vec4f make(float x, float y, float z, float w) { return {_mm_setr_ps(x, y, z, w)}; }
+    static Vec4f splat(float f) { return {_mm_set1_ps(f)}; }
+
+    Vec4f operator+(const Vec4f & b) const { return {_mm_add_ps(v, b.v)}; }
+    Vec4f operator-(const Vec4f & b) const { return {_mm_sub_ps(v, b.v)}; }
+    Vec4f operator*(const Vec4f & b) const { return {_mm_mul_ps(v, b.v)}; }
+    Vec4f clamp(const Vec4f & lo, const Vec4f & hi) const { return {_mm_min_ps(_mm_max_ps(v, lo.v), hi.v)}; }
+    Vec4f round() const { return {_mm_cvtepi32_ps(_mm_cvtps_epi32(v))}; }
+
+    /// x + y + z
+    float sum3() const {
+        float f[4];
+        _mm_storeu_ps(f, v);
+        return f[0] + f[1] + f[2];
+    }
+#else
+    float v[4];
+
+    static Vec4f make(float x, float y, float z, float w) { return {{x, y, z, w}}; }
+    static Vec4f splat(float f) { return {{f, f, f, f}}; }
+
+    Vec4f operator+(const Vec4f & b) const { return {{v[0] + b.v[0], v[1] + b.v[1], v[2] + b.v[2], v[3] + b.v[3]}}; }
+    Vec4f operator-(const Vec4f & b) const { return {{v[0] - b.v[0], v[1] - b.v[1], v[2] - b.v[2], v[3] - b.v[3]}}; }
+    Vec4f operator*(const Vec4f & b) const { return {{v[0] * b.v[0], v[1] * b.v[1], v[2] * b.v[2], v[3] * b.v[3]}}; }
+    Vec4f clamp(const Vec4f & lo, const Vec4f & hi) const {
+        Vec4f r;
+        for (int i = 0; i < 4; ++i) r.v[i] = std::min(std::max(v[i], lo.v[i]), hi.v[i]);
+        return r;
+    }
+    Vec4f round() const { return {{std::nearbyint(v[0]), std::nearbyint(v[1]), std::nearbyint(v[2]), std::nearbyint(v[3])}}; }
+
+    /// x + y + z
+    float sum3() const { return v[0] + v[1] + v[2]; }
+#endif
+};
+
+#if RII_SIMD_SSE
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Pick the palette entry nearest (in RGB) to each of the 16 texels, lowest index first on ties. Returns the squared
+/// error summed over the texels whose bit is set in 'mask', and the 2-bit indices in 'indices'. 4 texels at a time, with
+/// SSE2, which is part of x64, so there's no runtime check.
+static uint32_t bc1Select(const uint8_t (*texels)[4], const uint32_t palette[4], uint32_t mask, uint32_t & indices) {
+    const __m128i rgb  = _mm_set1_epi32(0x00ffffff);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i       p[4];
+    for (int k = 0; k < 4; ++k) p[k] = _mm_unpacklo_epi8(_mm_and_si128(_mm_set1_epi32((int) palette[k]), rgb), zero);
+    uint32_t error = 0;
+    indices        = 0;
+    for (uint32_t row = 0; row < 4; ++row) {
+        __m128i t     = _mm_and_si128(_mm_loadu_si128((const __m128i *) texels[row * 4]), rgb);
+        __m128i lo    = _mm_unpacklo_epi8(t, zero);
+        __m128i hi    = _mm_unpackhi_epi8(t, zero);
+        __m128i best  = zero;
+        __m128i index = zero;
+        for (int k = 0; k < 4; ++k) {
+            // squared distances of the 4 texels: madd sums R and G, B and A (which is 0) of each texel, then the
+            // shuffles pair them up.
+            __m128i dl = _mm_sub_epi16(lo, p[k]);
+            __m128i dh = _mm_sub_epi16(hi, p[k]);
+            __m128  sl = _mm_castsi128_ps(_mm_madd_epi16(dl, dl));
+            __m128  sh = _mm_castsi128_ps(_mm_madd_epi16(dh, dh));
+            __m128i d  = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(sl, sh, _MM_SHUFFLE(2, 0, 2, 0))),
+                                       _mm_castps_si128(_mm_shuffle_ps(sl, sh, _MM_SHUFFLE(3, 1, 3, 1))));
+            if (0 == k) {
+                best = d;
+                continue;
+            }
+            __m128i less = _mm_cmplt_epi32(d, best);
+            best         = _mm_or_si128(_mm_and_si128(less, d), _mm_andnot_si128(less, best));
+            index        = _mm_or_si128(_mm_and_si128(less, _mm_set1_epi32(k)), _mm_andnot_si128(less, index));
+        }
+        uint32_t e[4], i[4];
+        _mm_storeu_si128((__m128i *) e, best);
+        _mm_storeu_si128((__m128i *) i, index);
+        for (uint32_t x = 0; x < 4; ++x) {
+            if ((mask >> (row * 4 + x)) & 1) error += e[x];
+            indices |= i[x] << ((row * 4 + x) * 2);
+        }
+    }
+    return error;
+}
+
+#else
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Same as above, one texel at a time.
+static uint32_t bc1Select(const uint8_t (*texels)[4], const uint32_t palette[4], uint32_t mask, uint32_t & indices) {
+    uint8_t p[4][4];
+    memcpy(p, palette, sizeof(p));
+    uint32_t error = 0;
+    indices        = 0;
+    for (uint32_t i = 0; i < 16; ++i) {
+        uint32_t best = UINT32_MAX, index = 0;
+        for (uint32_t k = 0; k < 4; ++k) {
+            uint32_t d = 0;
+            for (int c = 0; c < 3; ++c) d += (uint32_t) ((texels[i][c] - p[k][c]) * (texels[i][c] - p[k][c]));
+            if (d < best) best = d, index = k;
+        }
+        if ((mask >> i) & 1) error += best;
+        indices |= index << (i * 2);
+    }
+    return error;
+}
+
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Endpoints that reproduce each 8-bit value best with a single interpolated BC1 color: entry 2 of the 4 color mode, or
+/// the middle entry of the 3 color mode. For 5 and 6 bit channels. Built once at first use.
+struct Bc1SolidTables {
+    uint8_t endpoints[2][2][256][2]; ///< [3 color mode][6 bits][value] -> quantized endpoint 0 and 1.
+
+    static const Bc1SolidTables & get() {
+        static const Bc1SolidTables instance;
+        return instance;
+    }
+
+private:
+    Bc1SolidTables() {
+        for (int three = 0; three < 2; ++three) {
+            for (int six = 0; six < 2; ++six) {
+                int  max    = six ? 63 : 31;
+                auto expand = [&](int c) { return six ? (c << 2) | (c >> 4) : (c << 3) | (c >> 2); };
+                for (int v = 0; v < 256; ++v) {
+                    int best = INT_MAX;
+                    for (int e0 = 0; e0 <= max; ++e0) {
+                        for (int e1 = 0; e1 <= max; ++e1) {
+                            int a = expand(e0), b = expand(e1);
+                            int d = std::abs((three ? (a + b + 1) / 2 : (2 * a + b + 1) / 3) - v);
+                            if (d >= best) continue;
+                            best                        = d;
+                            endpoints[three][six][v][0] = (uint8_t) e0;
+                            endpoints[three][six][v][1] = (uint8_t) e1;
+                        }
+                    }
+                }
+            }
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Search for the best color block of BC1 (also the color half of BC2 and BC3). Every candidate pair of endpoints is
+/// scored with the exact palette the decoder builds, and the best block so far is kept.
+struct Bc1Search {
+    const uint8_t (*texels)[4];
+    uint32_t mask;                  ///< bit i is set, if texel i counts toward the error.
+    uint32_t transparent;           ///< texels that must pick the transparent black of the 3 color mode.
+    bool     fourColorsOnly;        ///< BC2 and BC3 color blocks always use the 4 color mode.
+    bool     alpha;                 ///< black of the 3 color mode is transparent, so opaque texels can't pick it.
+    uint32_t error     = UINT32_MAX;
+    uint32_t endpoints = 0;         ///< endpoint 0 in the low 16 bits, endpoint 1 in the high 16 bits.
+    uint32_t indices   = 0;
+
+    /// Quantize a color in [0, 255] to 565.
+    static uint32_t pack565(const Vec4f & c) {
+        float f[4];
+        memcpy(f, &c, sizeof(f));
+        auto q = [](float v, float max) { return (uint32_t) (std::min(std::max(v, 0.0f), 255.0f) * max / 255.0f + 0.5f); };
+        return (q(f[0], 31.0f) << 11) | (q(f[1], 63.0f) << 5) | q(f[2], 31.0f);
+    }
+
+    /// true, if the best block so far uses the 3 color mode.
+    bool threeColors() const { return !fourColorsOnly && (endpoints & 0xffff) <= (endpoints >> 16); }
+
+    /// Try the endpoints in the 4 color mode, or in the 3 color mode if 'three'. They are swapped as the mode requires.
+    /// Equal endpoints always decode in 3 color mode, which is fine: the first 3 entries are all the same color then.
+    void tryEndpoints(uint32_t c0, uint32_t c1, bool three) {
+        if (fourColorsOnly) three = false;
+        if (three ? c0 > c1 : c0 < c1) std::swap(c0, c1);
+        uint8_t  bytes[4] = {(uint8_t) c0, (uint8_t) (c0 >> 8), (uint8_t) c1, (uint8_t) (c1 >> 8)};
+        uint32_t palette[4];
+        bc1Palette(bytes, fourColorsOnly, palette);
+        bool threeMode = !fourColorsOnly && c0 <= c1;
+        if (threeMode && alpha) palette[3] = palette[0];
+        uint32_t selected;
+        uint32_t e = bc1Select(texels, palette, mask, selected);
+        if (threeMode) {
+            for (uint32_t i = 0; i < 16; ++i) {
+                if ((transparent >> i) & 1) selected |= 3u << (i * 2);
+            }
+        } else if (transparent) {
+            return; // the 4 color mode has no transparent entry.
+        }
+        if (e >= error) return;
+        error     = e;
+        endpoints = c0 | (c1 << 16);
+        indices   = selected;
+    }
+
+    void tryEndpoints(const Vec4f & a, const Vec4f & b, bool three) { tryEndpoints(pack565(a), pack565(b), three); }
+
+    /// Least squares endpoints for the indices of the best block so far: the endpoints that minimize the error, if the
+    /// texels kept their palette entries.
+    void refine() {
+        // weights of endpoint 0 per index, in units of 1/3 in the 4 color mode, and 1/2 in the 3 color mode.
+        static const int WEIGHTS[2][4] = {{3, 0, 2, 1}, {2, 0, 1, 0}};
+        bool             three         = threeColors();
+        int              unit          = three ? 2 : 3;
+        int              aa = 0, bb = 0, ab = 0, ax[3] = {}, bx[3] = {};
+        for (uint32_t i = 0; i < 16; ++i) {
+            uint32_t k = (indices >> (i * 2)) & 3;
+            if (!((mask >> i) & 1) || (three && 3 == k)) continue;
+            int a = WEIGHTS[three][k], b = unit - a;
+            aa += a * a, bb += b * b, ab += a * b;
+            for (int c = 0; c < 3; ++c) ax[c] += a * texels[i][c], bx[c] += b * texels[i][c];
+        }
+        int det = aa * bb - ab * ab;
+        if (det <= 0) return; // all texels picked the same entry.
+        float f = (float) unit / (float) det;
+        float e[2][3];
+        for (int c = 0; c < 3; ++c) {
+            e[0][c] = (float) (ax[c] * bb - bx[c] * ab) * f;
+            e[1][c] = (float) (bx[c] * aa - ax[c] * ab) * f;
+        }
+        tryEndpoints(Vec4f::make(e[0][0], e[0][1], e[0][2], 0.0f), Vec4f::make(e[1][0], e[1][1], e[1][2], 0.0f), three);
+    }
+
+    /// Store the best block.
+    void store(uint8_t * dst) const {
+        for (int i = 0; i < 4; ++i) {
+            dst[i]     = (uint8_t) (endpoints >> (i * 8));
+            dst[i + 4] = (uint8_t) (indices >> (i * 8));
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Cluster fit: with the points sorted along the principal axis, every ordered split of them over the palette entries
+/// is scored with its closed form least squares endpoints, snapped to the 565 grid. R, G and B of both endpoints are
+/// solved and scored together, one SIMD register each.
+/// \param three  Split over the 3 entries of the 3 color mode, instead of the 4 of the 4 color mode.
+/// \return false, if every split is degenerate.
+static bool bc1ClusterFit(const Vec4f * points, uint32_t count, bool three, Vec4f & bestA, Vec4f & bestB) {
+    const Vec4f zero  = Vec4f::splat(0.0f);
+    const Vec4f one   = Vec4f::splat(255.0f);
+    const Vec4f grid  = Vec4f::make(31.0f / 255.0f, 63.0f / 255.0f, 31.0f / 255.0f, 0.0f);
+    const Vec4f inv   = Vec4f::make(255.0f / 31.0f, 255.0f / 63.0f, 255.0f / 31.0f, 0.0f);
+    const Vec4f two   = Vec4f::splat(2.0f);
+    Vec4f       total = zero;
+    for (uint32_t i = 0; i < count; ++i) total = total + points[i];
+
+    // ax and bx are the sums of the points weighted by their share of endpoint a and b. Since the 2 shares add up to 1,
+    // bx = total - ax. The sum of squared points is the same for every split, so it's left out of the error.
+    float best  = FLT_MAX;
+    auto  solve = [&](float aa, float bb, float ab, const Vec4f & ax) {
+        float det = aa * bb - ab * ab;
+        if (det < 1e-3f) return;
+        Vec4f bx = total - ax;
+        Vec4f f  = Vec4f::splat(1.0f / det);
+        Vec4f a  = ((ax * Vec4f::splat(bb) - bx * Vec4f::splat(ab)) * f).clamp(zero, one);
+        Vec4f b  = ((bx * Vec4f::splat(aa) - ax * Vec4f::splat(ab)) * f).clamp(zero, one);
+        a        = (a * grid).round() * inv;
+        b        = (b * grid).round() * inv;
+        Vec4f e  = a * a * Vec4f::splat(aa) + b * b * Vec4f::splat(bb) + two * (a * b * Vec4f::splat(ab) - a * ax - b * bx);
+        float s  = e.sum3();
+        if (s >= best) return;
+        best  = s;
+        bestA = a;
+        bestB = b;
+    };
+
+    // clusters are [0, i), [i, j), [j, k) and [k, count), from endpoint a to endpoint b.
+    const Vec4f w2 = Vec4f::splat(2.0f / 3.0f), w1 = Vec4f::splat(1.0f / 3.0f), half = Vec4f::splat(0.5f);
+    Vec4f       x0 = zero;
+    for (uint32_t i = 0; i <= count; ++i) {
+        Vec4f x1 = zero;
+        for (uint32_t j = i; j <= count; ++j) {
+            if (three) {
+                float n0 = (float) i, n1 = (float) (j - i), n2 = (float) (count - j);
+                solve(n0 + n1 * 0.25f, n2 + n1 * 0.25f, n1 * 0.25f, x0 + x1 * half);
+            } else {
+                Vec4f x2 = zero;
+                for (uint32_t k = j; k <= count; ++k) {
+                    float n0 = (float) i, n1 = (float) (j - i), n2 = (float) (k - j), n3 = (float) (count - k);
+                    solve(n0 + (n1 * 4.0f + n2) / 9.0f, n3 + (n2 * 4.0f + n1) / 9.0f, (n1 + n2) * 2.0f / 9.0f, x0 + x1 * w2 + x2 * w1);
+                    if (k < count) x2 = x2 + points[k];
+                }
+            }
+            if (j < count) x1 = x1 + points[j];
+        }
+        if (i < count) x0 = x0 + points[i];
+    }
+    return best < FLT_MAX;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Encode the color block of BC1, BC2 or BC3.
+/// \param transparent    Texels that must be transparent. Non zero forces the 3 color mode.
+/// \param fourColorsOnly true for BC2 and BC3.
+/// \param alpha          true, if the alpha of the format is used, so the 3 color mode black is transparent.
+static void bc1EncodeColor(const uint8_t (*texels)[4], uint32_t transparent, bool fourColorsOnly, bool alpha, bool quality, uint8_t * dst) {
+    Bc1Search s {texels, 0xffffu & ~transparent, transparent, fourColorsOnly, alpha};
+    bool      allowFour  = 0 == transparent;
+    bool      allowThree = !fourColorsOnly && (!allowFour || quality);
+
+    // gather the texels that count, with the integer sums needed for their mean and covariance.
+    uint8_t  order[16];
+    uint32_t count  = 0;
+    int      sum[3] = {}, sum2[6] = {};
+    bool     solid  = true;
+    for (uint8_t i = 0; i < 16; ++i) {
+        if (!((s.mask >> i) & 1)) continue;
+        const auto & x = texels[i];
+        if (count && memcmp(x, texels[order[0]], 3)) solid = false;
+        order[count++] = i;
+        sum[0] += x[0], sum[1] += x[1], sum[2] += x[2];
+        sum2[0] += x[0] * x[0], sum2[1] += x[0] * x[1], sum2[2] += x[0] * x[2];
+        sum2[3] += x[1] * x[1], sum2[4] += x[1] * x[2], sum2[5] += x[2] * x[2];
+    }
+    if (0 == count) {
+        s.tryEndpoints(0, 0, true);
+        s.store(dst);
+        return;
+    }
+
+    // a single color is matched (almost) exactly by one interpolated entry.
+    if (solid) {
+        const auto & t = Bc1SolidTables::get().endpoints;
+        const auto & c = texels[order[0]];
+        for (int three = allowFour ? 0 : 1; three <= (allowThree ? 1 : 0); ++three) {
+            const auto & r = t[three][0][c[0]];
+            const auto & g = t[three][1][c[1]];
+            const auto & b = t[three][0][c[2]];
+            s.tryEndpoints(((uint32_t) r[0] << 11) | ((uint32_t) g[0] << 5) | b[0], ((uint32_t) r[1] << 11) | ((uint32_t) g[1] << 5) | b[1], 0 != three);
+        }
+        s.store(dst);
+        return;
+    }
+
+    // principal axis of the colors, by power iteration on their covariance.
+    float n       = (float) count;
+    float mean[3] = {(float) sum[0] / n, (float) sum[1] / n, (float) sum[2] / n};
+    float cov[6];
+    for (int i = 0, a = 0; a < 3; ++a)
+        for (int b = a; b < 3; ++b, ++i) cov[i] = (float) sum2[i] - (float) sum[a] * mean[b];
+    float axis[3] = {1.0f, 1.0f, 1.0f};
+    for (int iteration = 0; iteration < 8; ++iteration) {
+        float v[3] = {cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2], cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                      cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]};
+        float m    = std::max(std::abs(v[0]), std::max(std::abs(v[1]), std::abs(v[2])));
+        if (m < 1e-6f) {
+            // (1, 1, 1) is orthogonal to the axis. Start over from the row of the largest variance instead.
+            int k   = cov[3] > cov[0] ? (cov[5] > cov[3] ? 2 : 1) : (cov[5] > cov[0] ? 2 : 0);
+            axis[0] = 0 == k ? 1.0f : 0.0f, axis[1] = 1 == k ? 1.0f : 0.0f, axis[2] = 2 == k ? 1.0f : 0.0f;
+            continue;
+        }
+        m = 1.0f / m;
+        for (int a = 0; a < 3; ++a) axis[a] = v[a] * m;
+    }
+
+    // range fit: the extent of the colors along the axis.
+    float t[16], lo = FLT_MAX, hi = -FLT_MAX;
+    for (uint32_t i = 0; i < count; ++i) {
+        const auto & x = texels[order[i]];
+        t[i]           = x[0] * axis[0] + x[1] * axis[1] + x[2] * axis[2];
+        lo             = std::min(lo, t[i]);
+        hi             = std::max(hi, t[i]);
+    }
+    float center    = mean[0] * axis[0] + mean[1] * axis[1] + mean[2] * axis[2];
+    float scale     = 1.0f / (axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    auto  origin    = Vec4f::make(mean[0], mean[1], mean[2], 0.0f);
+    auto  direction = Vec4f::make(axis[0], axis[1], axis[2], 0.0f);
+    auto  a         = origin + direction * Vec4f::splat((hi - center) * scale);
+    auto  b         = origin + direction * Vec4f::splat((lo - center) * scale);
+    if (allowFour) s.tryEndpoints(a, b, false);
+    if (allowThree) s.tryEndpoints(a, b, true);
+
+    // cluster fit, over the colors sorted along the axis.
+    if (quality) {
+        uint32_t sorted[16];
+        for (uint32_t i = 0; i < count; ++i) sorted[i] = i;
+        std::sort(sorted, sorted + count, [&](uint32_t x, uint32_t y) { return t[x] > t[y]; });
+        Vec4f points[16];
+        for (uint32_t i = 0; i < count; ++i) {
+            const auto & x = texels[order[sorted[i]]];
+            points[i]      = Vec4f::make(x[0], x[1], x[2], 0.0f);
+        }
+        if (allowFour && bc1ClusterFit(points, count, false, a, b)) s.tryEndpoints(a, b, false);
+        if (allowThree && bc1ClusterFit(points, count, true, a, b)) s.tryEndpoints(a, b, true);
+    }
+
+    // then polish the best endpoints with least squares.
+    for (int i = quality ? 2 : 1; i > 0 && s.error > 0; --i) s.refine();
+    s.store(dst);
+}
+
+#if RII_SIMD_SSE
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Pick the palette entry nearest to each of the 16 values, lowest index first on ties. Values and palette entries are
+/// biased to be non negative. Returns the squared error, and the 3-bit indices in 'indices'. All 16 values at once.
+static uint32_t bc4Select(const uint8_t values[16], const uint8_t palette[8], uint64_t & indices) {
+    __m128i v     = _mm_loadu_si128((const __m128i *) values);
+    __m128i best  = _mm_set1_epi8(-1);
+    __m128i index = _mm_setzero_si128();
+    for (int k = 0; k < 8; ++k) {
+        __m128i p    = _mm_set1_epi8((char) palette[k]);
+        __m128i d    = _mm_or_si128(_mm_subs_epu8(v, p), _mm_subs_epu8(p, v));
+        __m128i m    = _mm_min_epu8(d, best);
+        __m128i less = _mm_andnot_si128(_mm_cmpeq_epi8(m, best), _mm_set1_epi8(-1));
+        best         = m;
+        index        = _mm_or_si128(_mm_and_si128(less, _mm_set1_epi8((char) k)), _mm_andnot_si128(less, index));
+    }
+    __m128i lo  = _mm_unpacklo_epi8(best, _mm_setzero_si128());
+    __m128i hi  = _mm_unpackhi_epi8(best, _mm_setzero_si128());
+    __m128i sum = _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));
+    sum         = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum         = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    uint8_t i[16];
+    _mm_storeu_si128((__m128i *) i, index);
+    indices = 0;
+    for (int t = 0; t < 16; ++t) indices |= (uint64_t) i[t] << (t * 3);
+    return (uint32_t) _mm_cvtsi128_si32(sum);
+}
+
+#else
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Same as above, one value at a time.
+static uint32_t bc4Select(const uint8_t values[16], const uint8_t palette[8], uint64_t & indices) {
+    uint32_t error = 0;
+    indices        = 0;
+    for (uint32_t i = 0; i < 16; ++i) {
+        uint32_t best = UINT32_MAX, index = 0;
+        for (uint32_t k = 0; k < 8; ++k) {
+            auto d = (uint32_t) std::abs(values[i] - palette[k]);
+            if (d < best) best = d, index = k;
+        }
+        error += best * best;
+        indices |= (uint64_t) index << (i * 3);
+    }
+    return error;
+}
+
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Encode one channel of the texels as a BC4 channel block (also used by BC3 alpha and BC5).
+template<bool SIGNED>
+static void bc4EncodeChannel(const uint8_t (*texels)[4], int channel, bool quality, uint8_t * dst) {
+    constexpr int MIN = SIGNED ? -127 : 0;
+    constexpr int MAX = SIGNED ? 127 : 255;
+    uint8_t       values[16];
+    int           lo  = MAX, hi = MIN, lo6 = MAX, hi6 = MIN; // lo6 and hi6 leave out MIN and MAX, which the 6 value mode has.
+    for (int i = 0; i < 16; ++i) {
+        int v     = SIGNED ? std::max((int) (int8_t) texels[i][channel], -127) : (int) texels[i][channel];
+        values[i] = (uint8_t) (v - MIN);
+        lo        = std::min(lo, v);
+        hi        = std::max(hi, v);
+        if (MIN != v && MAX != v) lo6 = std::min(lo6, v), hi6 = std::max(hi6, v);
+    }
+
+    uint32_t best = UINT32_MAX;
+    auto     test = [&](int e0, int e1) {
+        if (e0 < MIN || e0 > MAX || e1 < MIN || e1 > MAX) return;
+        int     palette[8];
+        uint8_t biased[8];
+        bc4Palette<SIGNED>((uint8_t) e0, (uint8_t) e1, palette);
+        for (int k = 0; k < 8; ++k) biased[k] = (uint8_t) (palette[k] - MIN);
+        uint64_t indices;
+        uint32_t error = bc4Select(values, biased, indices);
+        if (error >= best) return;
+        best   = error;
+        dst[0] = (uint8_t) e0;
+        dst[1] = (uint8_t) e1;
+        for (int i = 0; i < 6; ++i) dst[2 + i] = (uint8_t) (indices >> (i * 8));
+    };
+
+    // 8 value mode over the full range, and the 6 value mode if the extremes can be left to its MIN and MAX entries.
+    test(hi, lo);
+    if (lo6 <= hi6 && (MIN == lo || MAX == hi)) test(lo6, hi6);
+    if (quality && best > 0) {
+        if (lo6 > hi6) lo6 = lo, hi6 = hi;
+        for (int d0 = -2; d0 <= 2; ++d0) {
+            for (int d1 = -2; d1 <= 2; ++d1) {
+                if (hi + d0 > lo + d1) test(hi + d0, lo + d1);
+                if (lo6 + d0 <= hi6 + d1) test(lo6 + d0, hi6 + d1);
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Writes the bit fields of a 128-bit block, least significant bit first. The inverse of BlockBits.
+class BlockBitsWriter {
+public:
+    explicit BlockBitsWriter(uint8_t * dst): _dst(dst) { memset(dst, 0, 16); }
+
+    void write(uint32_t value, uint32_t count) {
+        for (uint32_t i = 0; i < count; ++i, ++_offset) _dst[_offset / 8] |= (uint8_t) (((value >> i) & 1) << (_offset % 8));
+    }
+
+private:
+    uint8_t * _dst;
+    uint32_t  _offset = 0;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Texels of each subset of the BC7 partitions, one bit per texel. Built once at first use.
+struct Bc7SubsetMasks {
+    uint16_t masks[3][64][3] = {}; ///< [subsets - 1][partition][subset]
+
+    static const Bc7SubsetMasks & get() {
+        static const Bc7SubsetMasks instance;
+        return instance;
+    }
+
+private:
+    Bc7SubsetMasks() {
+        for (uint32_t subsets = 1; subsets <= 3; ++subsets)
+            for (uint32_t p = 0; p < 64; ++p)
+                for (uint32_t i = 0; i < 16; ++i) masks[subsets - 1][p][bc7Subset(subsets, p, i)] |= (uint16_t) (1u << i);
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Mode 5 color end points that reproduce each 8-bit value with index 1, for solid BC7 blocks. Built once at first use.
+struct Bc7SolidTable {
+    uint8_t endpoints[256][2];
+
+    static const Bc7SolidTable & get() {
+        static const Bc7SolidTable instance;
+        return instance;
+    }
+
+private:
+    Bc7SolidTable() {
+        auto expand = [](int c) { return (c << 1) | (c >> 6); };
+        for (int v = 0; v < 256; ++v) {
+            int best = INT_MAX;
+            for (int e0 = 0; e0 < 128 && best > 0; ++e0) {
+                for (int e1 = 0; e1 < 128; ++e1) {
+                    int d = std::abs((((64 - 21) * expand(e0) + 21 * expand(e1) + 32) >> 6) - v);
+                    if (d >= best) continue;
+                    best            = d;
+                    endpoints[v][0] = (uint8_t) e0;
+                    endpoints[v][1] = (uint8_t) e1;
+                }
+            }
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Sums of the channels of some texels and of their pairwise products: all it takes for their mean and covariance.
+struct Bc7Moments {
+    /// Sums of the 4 channels, sums of the products rr, rg, rb, ra, gg, gb, ga, bb, ba and aa, then the number of
+    /// texels. Padded to 16, so that the compiler can vectorize the sums.
+    int values[16] = {};
+
+    int count() const { return values[14]; }
+
+    /// Index of the product of channel a and b in values.
+    static int product(uint32_t a, uint32_t b) {
+        static constexpr int8_t INDICES[4][4] = {{4, 5, 6, 7}, {5, 8, 9, 10}, {6, 9, 11, 12}, {7, 10, 12, 13}};
+        return INDICES[a][b];
+    }
+
+    Bc7Moments() = default;
+
+    /// Moments of a single texel.
+    explicit Bc7Moments(const uint8_t * t) {
+        values[14] = 1;
+        for (uint32_t a = 0; a < 4; ++a) {
+            values[a] = t[a];
+            for (uint32_t b = a; b < 4; ++b) values[product(a, b)] = t[a] * t[b];
+        }
+    }
+
+    Bc7Moments(const uint8_t (*texels)[4], uint32_t mask) {
+        for (uint32_t i = 0; i < 16; ++i) {
+            if (mask & (1u << i)) *this += Bc7Moments(texels[i]);
+        }
+    }
+
+    Bc7Moments & operator+=(const Bc7Moments & rhs) {
+        for (int k = 0; k < 16; ++k) values[k] += rhs.values[k];
+        return *this;
+    }
+
+    Bc7Moments operator-(const Bc7Moments & rhs) const {
+        Bc7Moments r = *this;
+        for (int k = 0; k < 16; ++k) r.values[k] -= rhs.values[k];
+        return r;
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Mean and principal axis of channels [c0, c1) of some texels, plus the sum of the squared distances of the texels to
+/// that axis: the error that no pair of end points can get below.
+struct Bc7Stats {
+    float mean[4]  = {};
+    float axis[4]  = {};
+    float residual = 0;
+
+    Bc7Stats(const Bc7Moments & m, uint32_t c0, uint32_t c1) {
+        if (0 == m.count()) return;
+        float n = (float) m.count();
+        for (uint32_t c = c0; c < c1; ++c) mean[c] = (float) m.values[c] / n;
+        float    cov[4][4] = {}, trace = 0;
+        uint32_t largest   = c0;
+        for (uint32_t a = c0; a < c1; ++a) {
+            for (uint32_t b = a; b < c1; ++b) cov[a][b] = cov[b][a] = (float) m.values[Bc7Moments::product(a, b)] - (float) m.values[a] * mean[b];
+            trace += cov[a][a];
+            if (cov[a][a] > cov[largest][largest]) largest = a;
+        }
+        if (trace <= 0) return; // all texels are the same.
+
+        // power iteration, from the channel of the largest variance.
+        for (uint32_t c = c0; c < c1; ++c) axis[c] = cov[largest][c];
+        float lambda = 0;
+        for (int i = 0; i < 8; ++i) {
+            float next[4] = {}, length = 0;
+            for (uint32_t a = c0; a < c1; ++a) {
+                for (uint32_t b = c0; b < c1; ++b) next[a] += cov[a][b] * axis[b];
+                length += next[a] * next[a];
+            }
+            length = std::sqrt(length);
+            if (length <= 0) break;
+            for (uint32_t c = c0; c < c1; ++c) axis[c] = next[c] / length;
+            lambda = length;
+        }
+        residual = std::max(trace - lambda, 0.0f);
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// How the texels of one BC7 subset are fit: a range of channels that share one set of indices. Modes 4 and 5 fit
+/// their color and their alpha separately, as if they were 2 subsets of the same texels.
+struct Bc7FitSpec {
+    uint32_t c0, c1;    ///< channels [c0, c1).
+    uint32_t bits;      ///< end point bits per channel, not counting the p-bit.
+    uint32_t pbits;     ///< 0: no p-bit; 1: one p-bit per end point; 2: one p-bit shared by both end points.
+    uint32_t indexBits; ///< 2, 3 or 4.
+};
+
+/// Quantized end points and indices of one subset.
+struct Bc7Fit {
+    uint32_t error           = UINT32_MAX;
+    uint8_t  endpoints[2][4] = {}; ///< without the p-bit.
+    uint8_t  pbits[2]        = {};
+    uint8_t  indices[16]     = {}; ///< per texel of the block. Only the ones of the subset are meaningful.
+
+    /// Swap the end points if the index of the anchor texel has its top bit set, so that the bit can be left out.
+    void fixAnchor(uint32_t anchor, uint32_t mask, uint32_t indexBits) {
+        uint32_t max = (1u << indexBits) - 1;
+        if (indices[anchor] <= max / 2) return;
+        std::swap(endpoints[0], endpoints[1]);
+        std::swap(pbits[0], pbits[1]);
+        for (uint32_t i = 0; i < 16; ++i) {
+            if (mask & (1u << i)) indices[i] = (uint8_t) (max - indices[i]);
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Fits the end points of one subset: the extent of the texels along their principal axis first, then least squares
+/// end points for the resulting indices. Each candidate is scored with the exact palette the decoder builds.
+struct Bc7Subset {
+    const uint8_t (*texels)[4];
+    uint32_t   mask;
+    Bc7FitSpec spec;
+    bool       exhaustive; ///< test every palette entry for each texel, instead of the ones next to its projection.
+
+    /// \param limit  Candidates with this much error or more are dropped. If none is better, the error of the result is
+    ///               left at the limit.
+    Bc7Fit fit(uint32_t refinements, uint32_t limit) const {
+        Bc7Fit best;
+        best.error = limit;
+        Bc7Stats s(Bc7Moments(texels, mask), spec.c0, spec.c1);
+        float    tmin = 0, tmax = 0;
+        for (uint32_t i = 0; i < 16; ++i) {
+            if (!(mask & (1u << i))) continue;
+            float t = 0;
+            for (uint32_t c = spec.c0; c < spec.c1; ++c) t += (texels[i][c] - s.mean[c]) * s.axis[c];
+            tmin = std::min(tmin, t);
+            tmax = std::max(tmax, t);
+        }
+        float ends[2][4] = {};
+        for (uint32_t c = spec.c0; c < spec.c1; ++c) {
+            ends[0][c] = s.mean[c] + s.axis[c] * tmin;
+            ends[1][c] = s.mean[c] + s.axis[c] * tmax;
+        }
+        evaluate(ends, best);
+        for (uint32_t r = 0; r < refinements && best.error > 0 && best.error < limit; ++r) {
+            uint32_t before = best.error;
+            if (!leastSquares(best, ends)) break;
+            evaluate(ends, best);
+            if (best.error >= before) break;
+        }
+        return best;
+    }
+
+private:
+    /// Quantize one channel of an end point to 'bits' bits plus the p-bit (if any), and expand it back to 8 bits like
+    /// the decoder does.
+    int quantize(float v, uint32_t pbit, uint8_t & q) const {
+        uint32_t pc    = spec.pbits ? 1 : 0;
+        uint32_t total = spec.bits + pc;
+        float    full  = std::min(std::max(v, 0.0f), 255.0f) * (float) ((1u << total) - 1) / 255.0f;
+        int      i     = (int) ((pc ? (full - (float) pbit) * 0.5f : full) + 0.5f);
+        clamp(i, 0, (1 << spec.bits) - 1);
+        uint32_t e = (((uint32_t) i << pc) | pbit) << (8 - total);
+        q          = (uint8_t) i;
+        return (int) (e | (e >> total));
+    }
+
+    /// Squared error of an end point quantized with the p-bit.
+    uint32_t quantizationError(const float * end, uint32_t pbit) const {
+        float error = 0;
+        for (uint32_t c = spec.c0; c < spec.c1; ++c) {
+            uint8_t q;
+            float   d = (float) quantize(end[c], pbit, q) - end[c];
+            error += d * d;
+        }
+        return (uint32_t) error;
+    }
+
+    /// Try the end points with the p-bits that fit them best. Exhaustive searches try every combination instead.
+    void evaluate(const float (*ends)[4], Bc7Fit & best) const {
+        if (0 == spec.pbits) return evaluate(ends, 0, 0, best);
+        if (exhaustive) {
+            if (1 == spec.pbits) {
+                for (uint32_t p = 0; p < 4; ++p) evaluate(ends, p & 1, p >> 1, best);
+            } else {
+                evaluate(ends, 0, 0, best);
+                evaluate(ends, 1, 1, best);
+            }
+            return;
+        }
+        uint32_t e00 = quantizationError(ends[0], 0), e01 = quantizationError(ends[0], 1);
+        uint32_t e10 = quantizationError(ends[1], 0), e11 = quantizationError(ends[1], 1);
+        if (1 == spec.pbits) {
+            evaluate(ends, e01 < e00 ? 1 : 0, e11 < e10 ? 1 : 0, best);
+        } else {
+            uint32_t p = e01 + e11 < e00 + e10 ? 1 : 0;
+            evaluate(ends, p, p, best);
+        }
+    }
+
+    void evaluate(const float (*ends)[4], uint32_t p0, uint32_t p1, Bc7Fit & best) const {
+        Bc7Fit f;
+        int    colors[2][4] = {};
+        f.pbits[0]          = (uint8_t) p0;
+        f.pbits[1]          = (uint8_t) p1;
+        for (uint32_t e = 0; e < 2; ++e)
+            for (uint32_t c = spec.c0; c < spec.c1; ++c) colors[e][c] = quantize(ends[e][c], f.pbits[e], f.endpoints[e][c]);
+
+        int      palette[16][4];
+        uint32_t count = 1u << spec.indexBits;
+        for (uint32_t k = 0; k < count; ++k) {
+            int w = BC_WEIGHTS[spec.indexBits][k];
+            for (uint32_t c = spec.c0; c < spec.c1; ++c) palette[k][c] = ((64 - w) * colors[0][c] + w * colors[1][c] + 32) >> 6;
+        }
+
+        // the index nearest to the projection of a texel on the end points is the best one, give or take one.
+        int axis[4] = {}, length2 = 0;
+        for (uint32_t c = spec.c0; c < spec.c1; ++c) {
+            axis[c] = colors[1][c] - colors[0][c];
+            length2 += axis[c] * axis[c];
+        }
+        uint32_t error = 0;
+        for (uint32_t i = 0; i < 16; ++i) {
+            if (!(mask & (1u << i))) continue;
+            int first = 0, last = 0 == length2 ? 0 : (int) count - 1;
+            if (!exhaustive && length2 > 0) {
+                int dot = 0;
+                for (uint32_t c = spec.c0; c < spec.c1; ++c) dot += (texels[i][c] - colors[0][c]) * axis[c];
+                int k = (int) ((float) dot * (float) (count - 1) / (float) length2 + 0.5f);
+                clamp(k, 0, (int) count - 1);
+                first = std::max(k - 1, 0);
+                last  = std::min(k + 1, (int) count - 1);
+            }
+            uint32_t nearest = UINT32_MAX;
+            for (int k = first; k <= last; ++k) {
+                uint32_t d = 0;
+                for (uint32_t c = spec.c0; c < spec.c1; ++c) {
+                    int diff = texels[i][c] - palette[k][c];
+                    d += (uint32_t) (diff * diff);
+                }
+                if (d >= nearest) continue;
+                nearest      = d;
+                f.indices[i] = (uint8_t) k;
+            }
+            error += nearest;
+            if (error >= best.error) return;
+        }
+        f.error = error;
+        best    = f;
+    }
+
+    /// Least squares end points for the indices of the fit. False, if the indices don't pin them down.
+    bool leastSquares(const Bc7Fit & f, float (*ends)[4]) const {
+        float aa = 0, ab = 0, bb = 0, ax[4] = {}, bx[4] = {};
+        for (uint32_t i = 0; i < 16; ++i) {
+            if (!(mask & (1u << i))) continue;
+            float b = BC_WEIGHTS[spec.indexBits][f.indices[i]] / 64.0f;
+            float a = 1.0f - b;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (uint32_t c = spec.c0; c < spec.c1; ++c) {
+                ax[c] += a * texels[i][c];
+                bx[c] += b * texels[i][c];
+            }
+        }
+        float det = aa * bb - ab * ab;
+        if (det < 1e-4f) return false;
+        for (uint32_t c = spec.c0; c < spec.c1; ++c) {
+            ends[0][c] = (bb * ax[c] - ab * bx[c]) / det;
+            ends[1][c] = (aa * bx[c] - ab * ax[c]) / det;
+        }
+        return true;
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Search for the best BC7 block. Solid blocks take a constant path. Otherwise, modes are pruned up front by what the
+/// texels need: modes 0 to 3 can't do alpha, and partitions gain nothing when the texels are already close to a line.
+/// The partitions of the remaining modes are ranked by the variance they leave off their principal axes, so only the
+/// best few get a full fit. Every candidate drops out as soon as its error reaches the best one so far.
+class Bc7Search {
+public:
+    Bc7Search(const uint8_t (*texels)[4], const EncodeEffort & effort, uint8_t * dst): _texels(texels), _effort(effort), _dst(dst) {}
+
+    void encode() {
+        bool solid = true, opaque = true;
+        for (uint32_t i = 0; i < 16; ++i) {
+            solid  = solid && 0 == memcmp(_texels[i], _texels[0], 4);
+            opaque = opaque && 255 == _texels[i][3];
+        }
+        if (solid && (_effort.bc7Modes & 0x20)) return encodeSolid();
+
+        // Errors are summed over the 16 texels. FAST stops at about one step of error per texel, and leaves out the
+        // partitions sooner when the texels are close to a line.
+        float    linear = _effort.quality ? 32.0f : 128.0f;
+        uint32_t modes  = _effort.bc7Modes;
+        _goodEnough     = _effort.quality ? 0 : 16;
+        if (!opaque) modes &= ~0x0fu;
+        if ((modes & ~0x8fu) && Bc7Stats(Bc7Moments(_texels, 0xffff), 0, 4).residual < linear) modes &= ~0x8fu;
+        if (0 == modes) modes = 0x40; // mode 6 can encode anything.
+
+        // single subset modes first. They are the cheapest, and set the bar for the others to beat early. For opaque
+        // blocks, modes 4 and 5 are only worth it over mode 6 with one of the color channels rotated into their separate
+        // alpha, which is left to QUALITY.
+        if (modes & 0x40) tryPartition(6, 0);
+        for (uint32_t mode = 4; mode < 6; ++mode) {
+            bool skipPlain = opaque && (modes & 0x40);
+            if (!(modes & (1u << mode)) || (skipPlain && !_effort.quality)) continue;
+            uint32_t rotations  = _effort.quality ? 4 : 1;
+            uint32_t selections = 4 == mode && _effort.quality ? 2 : 1;
+            for (uint32_t r = skipPlain ? 1 : 0; r < rotations; ++r)
+                for (uint32_t s = 0; s < selections; ++s) tryTwoIndexSets(mode, r, s);
+        }
+        if (_bestError <= _goodEnough) return;
+
+        // then the best estimated partitions of the 2 and 3 subset modes.
+        float estimates[64];
+        if (modes & 0x8a) {
+            estimatePartitions(2, estimates);
+            for (uint32_t mode : {1u, 3u, 7u}) {
+                if (modes & (1u << mode)) tryBestPartitions(mode, estimates);
+            }
+        }
+        if (modes & 0x05) {
+            estimatePartitions(3, estimates);
+            for (uint32_t mode : {0u, 2u}) {
+                if (modes & (1u << mode)) tryBestPartitions(mode, estimates);
+            }
+        }
+    }
+
+private:
+    const uint8_t (*_texels)[4];
+    const EncodeEffort & _effort;
+    uint8_t *            _dst;
+    uint32_t             _bestError  = UINT32_MAX;
+    uint32_t             _goodEnough = 0;
+
+    /// Mode 5 reproduces any color: the table gives color end points for index 1, and alpha is stored as is.
+    void encodeSolid() {
+        const auto &    table = Bc7SolidTable::get();
+        BlockBitsWriter w(_dst);
+        w.write(1u << 5, 6);
+        w.write(0, 2);
+        for (uint32_t c = 0; c < 3; ++c)
+            for (uint32_t e = 0; e < 2; ++e) w.write(table.endpoints[_texels[0][c]][e], 7);
+        for (uint32_t e = 0; e < 2; ++e) w.write(_texels[0][3], 8);
+        for (uint32_t i = 0; i < 16; ++i) w.write(1, 0 == i ? 1 : 2);
+        for (uint32_t i = 0; i < 16; ++i) w.write(0, 0 == i ? 1 : 2);
+        _bestError = 0;
+    }
+
+    /// Estimate the error of the partitions of 2 or 3 subsets by the variance that their subsets leave off their
+    /// principal axes. The axes of the subsets are rarely far from the one of the whole block, so one power iteration
+    /// from it is enough to tell the partitions apart.
+    void estimatePartitions(uint32_t subsets, float estimates[64]) const {
+        // moments of every combination of texels within each row, so the moments of a subset take 4 sums, not 16.
+        Bc7Moments rows[4][16], all;
+        for (uint32_t r = 0; r < 4; ++r) {
+            for (uint32_t b = 0; b < 4; ++b) {
+                Bc7Moments texel(_texels[r * 4 + b]);
+                for (uint32_t m = 0; m < (1u << b); ++m) (rows[r][m | (1u << b)] = rows[r][m]) += texel;
+            }
+            all += rows[r][15];
+        }
+        Bc7Stats      whole(all, 0, 4);
+        const float * axis = whole.axis;
+        for (uint32_t p = 0; p < 64; ++p) {
+            const uint16_t * masks = Bc7SubsetMasks::get().masks[subsets - 1][p];
+            Bc7Moments       m[3];
+            for (uint32_t s = 0; s + 1 < subsets; ++s)
+                for (uint32_t r = 0; r < 4; ++r) m[s] += rows[r][(masks[s] >> (r * 4)) & 15];
+            m[subsets - 1] = 2 == subsets ? all - m[0] : all - m[0] - m[1];
+            estimates[p]   = 0;
+            for (uint32_t s = 0; s < subsets; ++s) {
+                if (0 == m[s].count()) continue;
+                const int * v = m[s].values;
+                float       n = (float) m[s].count();
+                float       c[4][4], trace = 0, length = 0;
+                for (uint32_t x = 0; x < 4; ++x) {
+                    for (uint32_t y = x; y < 4; ++y) c[x][y] = c[y][x] = (float) v[Bc7Moments::product(x, y)] - (float) v[x] * (float) v[y] / n;
+                    trace += c[x][x];
+                }
+                for (uint32_t x = 0; x < 4; ++x) {
+                    float d = c[x][0] * axis[0] + c[x][1] * axis[1] + c[x][2] * axis[2] + c[x][3] * axis[3];
+                    length += d * d;
+                }
+                estimates[p] += std::max(trace - std::sqrt(length), 0.0f);
+            }
+        }
+    }
+
+    /// Try the partitions of the mode with the lowest estimated errors, best first.
+    void tryBestPartitions(uint32_t mode, const float estimates[64]) {
+        uint8_t  order[64];
+        uint32_t count  = 1u << BC7_MODES[mode].partitionBits;
+        uint32_t n      = std::min(_effort.bc7Partitions, count);
+        auto     better = [&](uint8_t a, uint8_t b) { return estimates[a] < estimates[b] || (estimates[a] == estimates[b] && a < b); };
+        for (uint32_t p = 0; p < count; ++p) order[p] = (uint8_t) p;
+        std::partial_sort(order, order + n, order + count, better);
+        for (uint32_t i = 0; i < n && _bestError > _goodEnough; ++i) tryPartition(mode, order[i]);
+    }
+
+    /// Modes with one set of indices for all channels: everything but 4 and 5.
+    void tryPartition(uint32_t mode, uint32_t partition) {
+        const auto & m = BC7_MODES[mode];
+        Bc7FitSpec   spec {0, m.alphaBits ? 4u : 3u, m.colorBits, m.endpointPBits ? 1u : (m.sharedPBits ? 2u : 0u), m.indexBits};
+        const auto & masks = Bc7SubsetMasks::get().masks[m.subsets - 1][partition];
+        Bc7Fit   fits[3];
+        uint32_t total = 0;
+        for (uint32_t s = 0; s < m.subsets; ++s) {
+            fits[s] = Bc7Subset {_texels, masks[s], spec, _effort.quality}.fit(_effort.quality ? 2 : 1, _bestError - total);
+            total += fits[s].error;
+            if (total >= _bestError) return;
+        }
+        _bestError = total;
+
+        BlockBitsWriter w(_dst);
+        w.write(1u << mode, mode + 1);
+        w.write(partition, m.partitionBits);
+        for (uint32_t s = 0; s < m.subsets; ++s) fits[s].fixAnchor(bc7Anchor(m.subsets, partition, s), masks[s], m.indexBits);
+        for (uint32_t c = 0; c < 4; ++c)
+            for (uint32_t s = 0; s < m.subsets; ++s)
+                for (uint32_t e = 0; e < 2; ++e) w.write(fits[s].endpoints[e][c], c < 3 ? m.colorBits : m.alphaBits);
+        for (uint32_t s = 0; s < m.subsets; ++s) {
+            for (uint32_t e = 0; e < 2 * m.endpointPBits; ++e) w.write(fits[s].pbits[e], 1);
+            if (m.sharedPBits) w.write(fits[s].pbits[0], 1);
+        }
+        for (uint32_t i = 0; i < 16; ++i) {
+            uint32_t s = bc7Subset(m.subsets, partition, i);
+            w.write(fits[s].indices[i], m.indexBits - (bc7Anchor(m.subsets, partition, s) == i ? 1 : 0));
+        }
+    }
+
+    /// Modes 4 and 5: color and alpha have their own indices, optionally with a color channel rotated into alpha.
+    void tryTwoIndexSets(uint32_t mode, uint32_t rotation, uint32_t selection) {
+        const auto & m = BC7_MODES[mode];
+        uint8_t      rotated[16][4];
+        memcpy(rotated, _texels, sizeof(rotated));
+        if (rotation) {
+            for (auto & t : rotated) std::swap(t[3], t[rotation - 1]);
+        }
+        uint32_t colorIndexBits = selection ? m.index2Bits : m.indexBits;
+        uint32_t alphaIndexBits = selection ? m.indexBits : m.index2Bits;
+        uint32_t refinements    = _effort.quality ? 2 : 1;
+        Bc7Fit   color          = Bc7Subset {rotated, 0xffff, {0, 3, m.colorBits, 0, colorIndexBits}, _effort.quality}.fit(refinements, _bestError);
+        if (color.error >= _bestError) return;
+        Bc7Fit alpha = Bc7Subset {rotated, 0xffff, {3, 4, m.alphaBits, 0, alphaIndexBits}, _effort.quality}.fit(refinements, _bestError - color.error);
+        if (color.error + alpha.error >= _bestError) return;
+        _bestError = color.error + alpha.error;
+
+        color.fixAnchor(0, 0xffff, colorIndexBits);
+        alpha.fixAnchor(0, 0xffff, alphaIndexBits);
+        BlockBitsWriter w(_dst);
+        w.write(1u << mode, mode + 1);
+        w.write(rotation, m.rotationBits);
+        w.write(selection, m.indexSelectionBits);
+        for (uint32_t c = 0; c < 3; ++c)
+            for (uint32_t e = 0; e < 2; ++e) w.write(color.endpoints[e][c], m.colorBits);
+        for (uint32_t e = 0; e < 2; ++e) w.write(alpha.endpoints[e][3], m.alphaBits);
+        const auto & first  = selection ? alpha : color;
+        const auto & second = selection ? color : alpha;
+        for (uint32_t i = 0; i < 16; ++i) w.write(first.indices[i], m.indexBits - (0 == i ? 1 : 0));
+        for (uint32_t i = 0; i < 16; ++i) w.write(second.indices[i], m.index2Bits - (0 == i ? 1 : 0));
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Encode a BC7 block (BC7_SRGB is the same, the conversion to sRGB happens before).
+static void bc7EncodeBlock(const uint8_t (*texels)[4], uint8_t * dst, const EncodeEffort & effort) { Bc7Search(texels, effort, dst).encode(); }
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// ETC blocks are stored as big endian 64-bit words.
+static inline void etcStore(uint8_t * dst, uint64_t w) {
+    for (int i = 7; i >= 0; --i, w >>= 8) dst[i] = (uint8_t) w;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// 2-bit index 's' of texel 'i' (in column major order) of the modes other than planar.
+static inline uint64_t etcIndex(uint32_t i, uint32_t s) { return (uint64_t) (s >> 1) << (16 + i) | (uint64_t) (s & 1) << i; }
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Set the free bits of the 5-bit base color channel at bit 'high', and of the 3-bit delta right below it, so that
+/// their sum overflows and the block leaves the differential mode. The 2 low bits of both carry data of the T, H and
+/// planar modes.
+static inline uint64_t etcOverflow(uint64_t w, uint32_t high) {
+    uint32_t v = (uint32_t) (w >> (high - 4)) & 3, u = (uint32_t) (w >> (high - 7)) & 3;
+    return v + u >= 4 ? w | (7ull << (high - 2)) : w | (1ull << (high - 5)); // 28 + v + u > 31, or v + u - 4 < 0.
+}
+
+/// Set the free top bit of the 5-bit base color channel at bit 'high', so that it doesn't overflow, whatever the sign
+/// of the delta is.
+static inline uint64_t etcNoOverflow(uint64_t w, uint32_t high) { return w | (((w >> (high - 5)) & 1) << high); }
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// ETC2 RGB block encoder. Every mode is fit to the texels and scored by its sum of squared RGB errors. The best one
+/// wins. The FAST preset fits the individual and differential modes around the average colors of the sub-blocks, the
+/// planar mode with least squares, and the T and H modes around 2 clusters of the texels. The QUALITY preset then
+/// walks the base colors of each mode, one step of one channel at a time, for as long as the error goes down.
+class Etc2Search {
+public:
+    Etc2Search(const uint8_t (*texels)[4], bool quality): _quality(quality) {
+        for (uint32_t i = 0; i < 16; ++i)
+            for (int c = 0; c < 3; ++c) _texels[i][c] = texels[(i % 4) * 4 + i / 4][c];
+    }
+
+    uint64_t encode() {
+        // the individual mode rarely beats the finer base colors of the differential mode, unless they are too far
+        // apart for the delta. FAST only tries it then.
+        for (uint32_t flip = 0; flip < 2; ++flip) {
+            if (subblocks(flip, true) || _quality) subblocks(flip, false);
+        }
+        if (_error > 0) planar();
+        if (_error > 0) paintModes();
+        return _block;
+    }
+
+private:
+    int      _texels[16][3]; ///< in the column major order of the block.
+    bool     _quality;
+    uint64_t _block = 0;
+    uint32_t _error = UINT32_MAX;
+
+    static uint32_t sq(int v) { return (uint32_t) (v * v); }
+
+    void offer(uint64_t block, uint32_t error) {
+        if (error >= _error) return;
+        _block = block;
+        _error = error;
+    }
+
+    /// Best table, out of the bit mask 'tables', and indices of the texels of a sub-block around a base color. Returns
+    /// the squared error, which is 'limit' or more if no table beats it.
+    uint32_t fitSubblock(const uint8_t * members, const int base[3], uint32_t tables, uint32_t limit, uint32_t & table, uint32_t indices[8]) const {
+        // the modifier m adds 3m^2 - 2m * (sum of p - base) to the squared error of texel p, as long as no channel clamps.
+        int      sums[8];
+        uint32_t error0 = 0;
+        for (uint32_t k = 0; k < 8; ++k) {
+            const int * p = _texels[members[k]];
+            sums[k]       = p[0] - base[0] + p[1] - base[1] + p[2] - base[2];
+            error0 += sq(p[0] - base[0]) + sq(p[1] - base[1]) + sq(p[2] - base[2]);
+        }
+        int      lo = std::min({base[0], base[1], base[2]}), hi = std::max({base[0], base[1], base[2]});
+        uint32_t best = limit;
+        for (uint32_t t = 0; t < 8; ++t) {
+            if (0 == ((tables >> t) & 1)) continue;
+            const auto & m     = ETC_MODIFIERS[t];
+            uint32_t     error = 0, selected[8];
+            if (lo - m[1] >= 0 && hi + m[1] <= 255) {
+                int delta = 0;
+                for (uint32_t k = 0; k < 8; ++k) {
+                    int e = INT_MAX;
+                    for (uint32_t s = 0; s < 4; ++s) {
+                        int d = 3 * m[s] * m[s] - 2 * m[s] * sums[k];
+                        if (d < e) e = d, selected[k] = s;
+                    }
+                    delta += e;
+                }
+                error = (uint32_t) ((int) error0 + delta);
+            } else {
+                int colors[4][3];
+                for (uint32_t s = 0; s < 4; ++s)
+                    for (int c = 0; c < 3; ++c) colors[s][c] = etcClamp(base[c] + m[s]);
+                error = selectColors(colors, members, 8, best, selected);
+            }
+            if (error >= best) continue;
+            best  = error;
+            table = t;
+            memcpy(indices, selected, sizeof(selected));
+        }
+        return best;
+    }
+
+    /// Pick the nearest of 4 colors for each of 'count' texels. Returns the squared error, which is 'limit' or more if
+    /// it can't beat it.
+    uint32_t selectColors(const int colors[4][3], const uint8_t * members, uint32_t count, uint32_t limit, uint32_t * indices) const {
+        uint32_t error = 0;
+        for (uint32_t k = 0; k < count && error < limit; ++k) {
+            const int * p = _texels[members[k]];
+            uint32_t    e = UINT32_MAX;
+            for (uint32_t s = 0; s < 4; ++s) {
+                uint32_t d = sq(colors[s][0] - p[0]) + sq(colors[s][1] - p[1]) + sq(colors[s][2] - p[2]);
+                if (d < e) e = d, indices[k] = s;
+            }
+            error += e;
+        }
+        return error;
+    }
+
+    /// The individual (4-bit base colors) or differential (5-bit base color and 3-bit delta) mode, with the sub-blocks
+    /// side by side, or stacked when flipped. Returns true, if the delta had to be clamped.
+    bool subblocks(uint32_t flip, bool differential) {
+        static constexpr uint8_t MEMBERS[2][2][8] = {{{0, 1, 2, 3, 4, 5, 6, 7}, {8, 9, 10, 11, 12, 13, 14, 15}},
+                                                     {{0, 1, 4, 5, 8, 9, 12, 13}, {2, 3, 6, 7, 10, 11, 14, 15}}};
+        const auto & members = MEMBERS[flip];
+        const int    maxQ    = differential ? 31 : 15;
+        auto         expand  = [differential](const int q[3], int base[3]) {
+            for (int c = 0; c < 3; ++c) base[c] = differential ? (q[c] << 3) | (q[c] >> 2) : q[c] * 17;
+        };
+
+        int q[2][3];
+        for (uint32_t s = 0; s < 2; ++s) {
+            for (int c = 0; c < 3; ++c) {
+                int sum = 0;
+                for (auto m : members[s]) sum += _texels[m][c];
+                q[s][c] = (int) ((float) sum / 8.0f * (float) maxQ / 255.0f + 0.5f);
+            }
+        }
+        bool clamped = false;
+        if (differential) {
+            for (int c = 0; c < 3; ++c) {
+                int delta = std::min(std::max(q[1][c] - q[0][c], -4), 3);
+                clamped |= delta != q[1][c] - q[0][c];
+                q[1][c] = q[0][c] + delta;
+            }
+        }
+
+        uint32_t error[2], table[2], indices[2][8];
+        for (uint32_t s = 0; s < 2; ++s) {
+            int base[3];
+            expand(q[s], base);
+            error[s] = fitSubblock(members[s], base, 0xff, UINT32_MAX, table[s], indices[s]);
+        }
+
+        // the walk keeps the tables, which are searched again when it ends.
+        for (bool improved = _quality; improved;) {
+            improved = false;
+            for (uint32_t s = 0; s < 2; ++s) {
+                for (int c = 0; c < 3; ++c) {
+                    for (int step = -1; step <= 1; step += 2) {
+                        int n[3] = {q[s][0], q[s][1], q[s][2]};
+                        n[c] += step;
+                        if (n[c] < 0 || n[c] > maxQ) continue;
+                        int delta = s ? n[c] - q[0][c] : q[1][c] - n[c];
+                        if (differential && (delta < -4 || delta > 3)) continue;
+                        int base[3];
+                        expand(n, base);
+                        uint32_t selected[8];
+                        uint32_t e = fitSubblock(members[s], base, 1u << table[s], error[s], table[s], selected);
+                        if (e >= error[s]) continue;
+                        memcpy(q[s], n, sizeof(n));
+                        memcpy(indices[s], selected, sizeof(selected));
+                        error[s] = e;
+                        improved = true;
+                    }
+                }
+            }
+            if (improved) continue;
+            for (uint32_t s = 0; s < 2; ++s) {
+                int base[3];
+                expand(q[s], base);
+                uint32_t e = fitSubblock(members[s], base, 0xff, error[s], table[s], indices[s]);
+                if (e < error[s]) error[s] = e, improved = true;
+            }
+        }
+
+        uint64_t w = (uint64_t) table[0] << 37 | (uint64_t) table[1] << 34 | (uint64_t) flip << 32;
+        for (int c = 0; c < 3; ++c) {
+            if (differential)
+                w |= (uint64_t) q[0][c] << (59 - c * 8) | (uint64_t) ((q[1][c] - q[0][c]) & 7) << (56 - c * 8);
+            else
+                w |= (uint64_t) q[0][c] << (60 - c * 8) | (uint64_t) q[1][c] << (56 - c * 8);
+        }
+        if (differential) w |= 1ull << 33;
+        for (uint32_t s = 0; s < 2; ++s)
+            for (uint32_t k = 0; k < 8; ++k) w |= etcIndex(members[s][k], indices[s][k]);
+        offer(w, error[0] + error[1]);
+        return clamped;
+    }
+
+    /// Squared error of one channel of the planar mode. q holds the quantized colors at (0, 0), (4, 0) and (0, 4).
+    uint32_t planarError(int c, const int q[3]) const {
+        int o[3];
+        for (int k = 0; k < 3; ++k) o[k] = 1 == c ? (q[k] << 1) | (q[k] >> 6) : (q[k] << 2) | (q[k] >> 4);
+        uint32_t error = 0;
+        for (int i = 0; i < 16; ++i) {
+            int x = i / 4, y = i % 4;
+            error += sq(etcClamp((x * (o[1] - o[0]) + y * (o[2] - o[0]) + 4 * o[0] + 2) >> 2) - _texels[i][c]);
+        }
+        return error;
+    }
+
+    /// The planar mode. Channels are independent, and fit with least squares: the x and y terms of the plane are
+    /// orthogonal over the 4x4 texels, so each comes from its own dot product.
+    void planar() {
+        int      q[3][3];
+        uint32_t error = 0;
+        for (int c = 0; c < 3; ++c) {
+            float sum = 0.0f, sx = 0.0f, sy = 0.0f;
+            for (int i = 0; i < 16; ++i) {
+                auto p = (float) _texels[i][c];
+                sum += p;
+                sx += ((float) (i / 4) - 1.5f) * p;
+                sy += ((float) (i % 4) - 1.5f) * p;
+            }
+            float dx = sx / 20.0f, dy = sy / 20.0f, o = sum / 16.0f - 1.5f * (dx + dy);
+            float colors[3] = {o, o + 4.0f * dx, o + 4.0f * dy};
+            int   maxQ      = 1 == c ? 127 : 63;
+            for (int k = 0; k < 3; ++k) q[c][k] = std::min(std::max((int) std::lround(colors[k] * (float) maxQ / 255.0f), 0), maxQ);
+            uint32_t e = planarError(c, q[c]);
+            for (bool improved = _quality; improved;) {
+                improved = false;
+                for (int k = 0; k < 3; ++k) {
+                    for (int step = -1; step <= 1; step += 2) {
+                        int n[3] = {q[c][0], q[c][1], q[c][2]};
+                        n[k] += step;
+                        if (n[k] < 0 || n[k] > maxQ) continue;
+                        uint32_t ne = planarError(c, n);
+                        if (ne >= e) continue;
+                        memcpy(q[c], n, sizeof(n));
+                        e        = ne;
+                        improved = true;
+                    }
+                }
+            }
+            error += e;
+        }
+        uint64_t w = (uint64_t) q[0][0] << 57 | (uint64_t) (q[1][0] >> 6) << 56 | (uint64_t) (q[1][0] & 0x3f) << 49 | (uint64_t) (q[2][0] >> 5) << 48 |
+                     (uint64_t) ((q[2][0] >> 3) & 3) << 43 | (uint64_t) ((q[2][0] >> 1) & 3) << 40 | (uint64_t) (q[2][0] & 1) << 39 |
+                     (uint64_t) (q[0][1] >> 1) << 34 | 1ull << 33 | (uint64_t) (q[0][1] & 1) << 32 | (uint64_t) q[1][1] << 25 | (uint64_t) q[2][1] << 19 |
+                     (uint64_t) q[0][2] << 13 | (uint64_t) q[1][2] << 6 | (uint64_t) q[2][2];
+        offer(etcNoOverflow(etcNoOverflow(etcOverflow(w, 47), 55), 63), error);
+    }
+
+    /// Best distance, out of the bit mask 'distances', of the T or H mode for the 4-bit base colors. Returns the
+    /// squared error, which is 'limit' or more if no distance beats it.
+    uint32_t fitPaint(bool h, const int c[2][3], uint32_t distances, uint32_t limit, uint32_t & distance, uint32_t indices[16]) const {
+        static constexpr uint8_t ALL[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+        // H mode can't have even distances when both base colors are the same, since the order of the base colors
+        // is the lowest bit of the distance index.
+        if (h && c[0][0] == c[1][0] && c[0][1] == c[1][1] && c[0][2] == c[1][2]) distances &= 0xaa;
+        uint32_t best = limit;
+        for (uint32_t d = 0; d < 8; ++d) {
+            if (0 == ((distances >> d) & 1)) continue;
+            int colors[4][3];
+            for (int k = 0; k < 3; ++k) {
+                int a = c[0][k] * 17, b = c[1][k] * 17, dd = ETC_DISTANCES[d];
+                colors[0][k] = h ? etcClamp(a + dd) : a;
+                colors[1][k] = h ? etcClamp(a - dd) : etcClamp(b + dd);
+                colors[2][k] = h ? etcClamp(b + dd) : b;
+                colors[3][k] = etcClamp(b - dd);
+            }
+            uint32_t selected[16];
+            uint32_t e = selectColors(colors, ALL, 16, best, selected);
+            if (e >= best) continue;
+            best     = e;
+            distance = d;
+            memcpy(indices, selected, sizeof(selected));
+        }
+        return best;
+    }
+
+    /// The T and H modes, with base colors from 2 clusters of the texels. T mode tries either cluster as the single
+    /// paint color.
+    void paintModes() {
+        // seed the clusters with the 2 texels farthest apart, then refine them with a few rounds of k-means.
+        uint32_t far = 0, seeds[2] = {0, 0};
+        for (uint32_t i = 0; i < 16; ++i)
+            for (uint32_t j = i + 1; j < 16; ++j) {
+                uint32_t d = sq(_texels[i][0] - _texels[j][0]) + sq(_texels[i][1] - _texels[j][1]) + sq(_texels[i][2] - _texels[j][2]);
+                if (d > far) far = d, seeds[0] = i, seeds[1] = j;
+            }
+        float means[2][3];
+        for (int k = 0; k < 2; ++k)
+            for (int c = 0; c < 3; ++c) means[k][c] = (float) _texels[seeds[k]][c];
+        for (int round = 0; round < 3; ++round) {
+            float sums[2][3] = {}, counts[2] = {};
+            for (uint32_t i = 0; i < 16; ++i) {
+                float d[2];
+                for (int k = 0; k < 2; ++k) {
+                    d[k] = 0.0f;
+                    for (int c = 0; c < 3; ++c) d[k] += ((float) _texels[i][c] - means[k][c]) * ((float) _texels[i][c] - means[k][c]);
+                }
+                int k = d[1] < d[0] ? 1 : 0;
+                for (int c = 0; c < 3; ++c) sums[k][c] += (float) _texels[i][c];
+                counts[k] += 1.0f;
+            }
+            for (int k = 0; k < 2; ++k)
+                for (int c = 0; c < 3; ++c)
+                    if (counts[k] > 0.0f) means[k][c] = sums[k][c] / counts[k];
+        }
+
+        for (int mode = 0; mode < 3; ++mode) {
+            bool h = 2 == mode;
+            int  c[2][3];
+            for (int k = 0; k < 2; ++k)
+                for (int ch = 0; ch < 3; ++ch) c[k][ch] = (int) (means[k ^ (1 == mode)][ch] * 15.0f / 255.0f + 0.5f);
+            // FAST only keeps the modes that beat the best block so far.
+            uint32_t distance = 0, indices[16];
+            uint32_t error    = fitPaint(h, c, 0xff, _quality ? UINT32_MAX : _error, distance, indices);
+            if (error >= (_quality ? UINT32_MAX : _error)) continue;
+            // the walk keeps the distance, which is searched again when it ends.
+            for (bool improved = _quality; improved;) {
+                improved = false;
+                for (int k = 0; k < 2; ++k) {
+                    for (int ch = 0; ch < 3; ++ch) {
+                        for (int step = -1; step <= 1; step += 2) {
+                            int n[2][3];
+                            memcpy(n, c, sizeof(n));
+                            n[k][ch] += step;
+                            if (n[k][ch] < 0 || n[k][ch] > 15) continue;
+                            // neighbor distances are tried along with each step, since the best one moves with the colors.
+                            uint32_t selected[16];
+                            uint32_t e = fitPaint(h, n, (7u << distance >> 1) & 0xff, error, distance, selected);
+                            if (e >= error) continue;
+                            memcpy(c, n, sizeof(n));
+                            memcpy(indices, selected, sizeof(selected));
+                            error    = e;
+                            improved = true;
+                        }
+                    }
+                }
+                if (improved) continue;
+                uint32_t e = fitPaint(h, c, 0xff, error, distance, indices);
+                if (e < error) error = e, improved = true;
+            }
+            if (error >= _error) continue;
+            uint64_t w;
+            if (h) {
+                // the lowest bit of the distance index is whether the 1st base color is the larger one. Swapping the base
+                // colors swaps the paint colors of the 2 pairs too.
+                bool larger = (c[0][0] << 8 | c[0][1] << 4 | c[0][2]) >= (c[1][0] << 8 | c[1][1] << 4 | c[1][2]);
+                if (larger != (1 == (distance & 1))) {
+                    std::swap(c[0], c[1]);
+                    for (auto & i : indices) i ^= 2;
+                }
+                w = (uint64_t) c[0][0] << 59 | (uint64_t) (c[0][1] >> 1) << 56 | (uint64_t) (c[0][1] & 1) << 52 | (uint64_t) (c[0][2] >> 3) << 51 |
+                    (uint64_t) (c[0][2] & 7) << 47 | (uint64_t) c[1][0] << 43 | (uint64_t) c[1][1] << 39 | (uint64_t) c[1][2] << 35 |
+                    (uint64_t) (distance >> 2) << 34 | 1ull << 33 | (uint64_t) ((distance >> 1) & 1) << 32;
+                w = etcNoOverflow(etcOverflow(w, 55), 63);
+            } else {
+                w = (uint64_t) (c[0][0] >> 2) << 59 | (uint64_t) (c[0][0] & 3) << 56 | (uint64_t) c[0][1] << 52 | (uint64_t) c[0][2] << 48 |
+                    (uint64_t) c[1][0] << 44 | (uint64_t) c[1][1] << 40 | (uint64_t) c[1][2] << 36 | (uint64_t) (distance >> 1) << 34 | 1ull << 33 |
+                    (uint64_t) (distance & 1) << 32;
+                w = etcOverflow(w, 63);
+            }
+            for (uint32_t i = 0; i < 16; ++i) w |= etcIndex(i, indices[i]);
+            offer(w, error);
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Encode 8-bit alpha to an EAC block. Every table is tried, with the multiplier and base value that stretch it over
+/// the range of the alpha values. The QUALITY preset searches around them too.
+static void eacEncodeAlpha(const uint8_t (*texels)[4], bool quality, uint8_t * dst) {
+    int a[16], lo = 255, hi = 0;
+    for (uint32_t i = 0; i < 16; ++i) {
+        a[i] = texels[(i % 4) * 4 + i / 4][3];
+        lo   = std::min(lo, a[i]);
+        hi   = std::max(hi, a[i]);
+    }
+    // table 13 has a modifier of 0.
+    uint64_t best      = (uint64_t) lo << 56 | 1ull << 52 | 13ull << 48 | 0x924924924924ull;
+    uint32_t bestError = lo == hi ? 0 : UINT32_MAX;
+    for (int t = 0; t < 16 && bestError > 0; ++t) {
+        const auto & m      = EAC_MODIFIERS[t];
+        float        scale  = (float) (hi - lo) / (float) (m[7] - m[3]);
+        int          first  = std::min(std::max((int) std::lround(scale), 1), 15);
+        int          radius = quality ? 1 : 0;
+        for (int multiplier = std::max(first - radius, 1); multiplier <= std::min(first + radius, 15); ++multiplier) {
+            int center = (int) std::lround((float) (lo + hi) * 0.5f - (float) (m[3] + m[7]) * (float) multiplier * 0.5f);
+            for (int base = std::max(center - radius * 2, 0); base <= std::min(center + radius * 2, 255); ++base) {
+                int values[8];
+                for (uint32_t s = 0; s < 8; ++s) values[s] = etcClamp(base + m[s] * multiplier);
+                uint64_t w     = (uint64_t) base << 56 | (uint64_t) multiplier << 52 | (uint64_t) t << 48;
+                uint32_t error = 0;
+                for (uint32_t i = 0; i < 16 && error < bestError; ++i) {
+                    uint32_t e = UINT32_MAX, index = 0;
+                    for (uint32_t s = 0; s < 8; ++s) {
+                        int      d  = values[s] - a[i];
+                        uint32_t dd = (uint32_t) (d * d);
+                        if (dd < e) e = dd, index = s;
+                    }
+                    error += e;
+                    w |= (uint64_t) index << (45 - i * 3);
+                }
+                if (error >= bestError) continue;
+                best      = w;
+                bestError = error;
+            }
+        }
+    }
+    etcStore(dst, best);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Encode an ETC2 RGB block (ETC2_SRGB is the same, the conversion to sRGB happens before).
+static void etc2EncodeBlock(const uint8_t (*texels)[4], uint8_t * dst, const EncodeEffort & effort) {
+    etcStore(dst, Etc2Search(texels, effort.quality).encode());
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Encode an ETC2 RGBA block: EAC alpha, followed by ETC2 RGB.
+static void etc2EacEncodeBlock(const uint8_t (*texels)[4], uint8_t * dst, const EncodeEffort & effort) {
+    eacEncodeAlpha(texels, effort.quality, dst);
+    etcStore(dst + 8, Etc2Search(texels, effort.quality).encode());
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Block encoders of BC1 to BC5.
+struct BcBlockEncoders {
+    /// BC1 with the alpha dropped by the swizzle.
+    static void bc1(const uint8_t (*texels)[4], uint8_t * dst, const EncodeEffort & effort) { bc1EncodeColor(texels, 0, false, false, effort.quality, dst); }
+
+    /// BC1 with 1-bit alpha: texels with alpha below one half are transparent.
+    static void bc1a(const uint8_t (*texels)[4], uint8_t * dst, const EncodeEffort & effort) {
+        uint32_t transparent = 0;
+        for (uint32_t i = 0; i < 16; ++i) {
+            if (texels[i][3] < 128) transparent |= 1u << i;
+        }
+        bc1EncodeColor(texels, transparent, false, true, effort.quality, dst);
+    }
+
+    static void bc2(const uint8_t (*texels)[4], uint8_t * dst, const EncodeEffort & effort) {
+        memset(dst, 0, 8);
+        for (int i = 0; i < 16; ++i) dst[i / 2] |= (uint8_t) (((texels[i][3] + 8) / 17) << ((i % 2) * 4));
+        bc1EncodeColor(texels, 0, true, false, effort.quality, dst + 8);
+    }
+
+    static void bc3(const uint8_t (*texels)[4], uint8_t * dst, const EncodeEffort & effort) {
+        bc4EncodeChannel<false>(texels, 3, effort.quality, dst);
+        bc1EncodeColor(texels, 0, true, false, effort.quality, dst + 8);
+    }
+
+    template<bool SIGNED>
+    static void bc4(const uint8_t (*texels)[4], uint8_t * dst, const EncodeEffort & effort) {
+        bc4EncodeChannel<SIGNED>(texels, 0, effort.quality, dst);
+    }
+
+    template<bool SIGNED>
+    static void bc5(const uint8_t (*texels)[4], uint8_t * dst, const EncodeEffort & effort) {
+        bc4EncodeChannel<SIGNED>(texels, 0, effort.quality, dst);
+        bc4EncodeChannel<SIGNED>(texels, 1, effort.quality, dst + 8);
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Returns the block encoder of the format, or null if the layout can't be encoded (yet).
+static EncodeBlockFunc findBlockEncoder(const PixelFormat & format) {
+    using E = BcBlockEncoders;
+    bool  s = PixelFormat::SIGN_SNORM == format.sign0 || PixelFormat::SIGN_SINT == format.sign0;
+    switch (format.layout) {
+    case PixelFormat::LAYOUT_BC1:
+        return PixelFormat::SWIZZLE_1 == format.swizzle3 ? E::bc1 : E::bc1a;
+    case PixelFormat::LAYOUT_BC2:
+        return E::bc2;
+    case PixelFormat::LAYOUT_BC3:
+        return E::bc3;
+    case PixelFormat::LAYOUT_BC4:
+        return s ? E::bc4<true> : E::bc4<false>;
+    case PixelFormat::LAYOUT_BC5:
+        return s ? E::bc5<true> : E::bc5<false>;
+    case PixelFormat::LAYOUT_BC7:
+        return bc7EncodeBlock;
+    case PixelFormat::LAYOUT_ETC2:
+        return etc2EncodeBlock;
+    case PixelFormat::LAYOUT_ETC2_EAC:
+        return etc2EacEncodeBlock;
+    default:
+        return nullptr;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// The inverse of BlockDecoder: takes rows of float texels, undoes the swizzle of the format, quantizes each storage
+/// channel to 8 bits per its sign, then encodes block by block.
+class BlockEncoder {
+public:
+    BlockEncoder(const PixelFormat & format, const PlaneDesc::CompressParameters & params): _encode(findBlockEncoder(format)) {
+        bool quality = PlaneDesc::CompressParameters::QUALITY == params.preset;
+        _effort      = {quality, params.bc7Modes & 0xffu, std::min(params.bc7Partitions, 64u)};
+        if (0 == _effort.bc7Modes) _effort.bc7Modes = quality ? 0xffu : 0xfau;
+        if (0 == _effort.bc7Partitions) _effort.bc7Partitions = quality ? 8u : 1u;
+        // BC7 blocks cost about 2 orders of magnitude more than the others, so they are scheduled in finer tiles.
+        _blocksPerTile = PixelFormat::LAYOUT_BC7 == format.layout ? 16u : 256u;
+        for (size_t s = 0; s < 4; ++s) {
+            _source[s] = -1;
+            _sign[s]   = getSign(format, s);
+        }
+        for (size_t c = 0; c < 4; ++c) {
+            auto swizzle = getSwizzledChannel(format, c);
+            if (swizzle <= PixelFormat::SWIZZLE_W && _source[swizzle] < 0) _source[swizzle] = (int8_t) c;
+        }
+    }
+
+    /// false, if the layout can't be encoded (yet).
+    bool valid() const { return nullptr != _encode; }
+
+    /// Minimal number of blocks to encode per job, to amortize the scheduling cost.
+    uint32_t blocksPerTile() const { return _blocksPerTile; }
+
+    /// Encode one row of blocks.
+    /// \param rows  4 rows of 'width' texels. Rows past the bottom of the image should repeat the last one. Likewise,
+    ///              texels past the right edge repeat the last column.
+    void encodeRow(uint8_t * dst, size_t step, const Float4 * const rows[4], uint32_t width) const {
+        uint8_t texels[16][4];
+        for (uint32_t x = 0; x < width; x += 4, dst += step) {
+            for (uint32_t i = 0; i < 16; ++i) {
+                const auto & f = rows[i / 4][std::min(x + i % 4, width - 1)];
+                for (int s = 0; s < 4; ++s) texels[i][s] = _source[s] < 0 ? (3 == s ? 255 : 0) : quantize(f.f32[_source[s]], _sign[s]);
+            }
+            _encode(texels, dst, _effort);
+        }
+    }
+
+private:
+    EncodeBlockFunc   _encode;
+    EncodeEffort      _effort;
+    uint32_t          _blocksPerTile;
+    int8_t            _source[4]; ///< output channel that feeds each storage channel, or -1 for none.
+    PixelFormat::Sign _sign[4];   ///< sign of each storage channel.
+
+    static uint8_t quantize(float v, PixelFormat::Sign sign) {
+        auto saturate = [](float f, float lo, float hi) { return f > lo ? (f < hi ? f : hi) : lo; }; // NaN goes to lo.
+        switch (sign) {
+        case PixelFormat::SIGN_GNORM:
+            return SrgbTables::get().encode(v);
+        case PixelFormat::SIGN_SNORM:
+            return (uint8_t) (int8_t) std::lround(saturate(v, -1.0f, 1.0f) * 127.0f);
+        case PixelFormat::SIGN_UINT:
+            return (uint8_t) (saturate(v, 0.0f, 255.0f) + 0.5f);
+        case PixelFormat::SIGN_SINT:
+            return (uint8_t) (int8_t) std::lround(saturate(v, -127.0f, 127.0f));
+        default:
+            return (uint8_t) (saturate(v, 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// One plane to compress. Pixel pointers point to the first pixel of the plane.
+struct CompressTarget {
+    const PlaneDesc & src;
+    const uint8_t *   srcPixels;
+    const PlaneDesc & dst;
+    uint8_t *         dstPixels;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Compress planes of any format that PlaneDesc::toFloat4() reads into block compressed planes of the same extent. Rows
+/// of blocks of all planes are split into tiles, which are encoded in parallel.
+/// \return false, if a source plane can't be decoded.
+static bool compressPlanes(const BlockEncoder & encoder, const std::vector<CompressTarget> & targets, const PlaneDesc::CompressParameters & params) {
+    // compressed sources are decoded up front, on the threads of the parameters. The others are converted right before
+    // encoding, 4 rows at a time.
+    std::vector<std::vector<Float4>> decoded(targets.size());
+    for (size_t i = 0; i < targets.size(); ++i) {
+        const auto & src = targets[i].src;
+        const auto & ld  = src.format.layoutDesc();
+        if (1 == ld.blockWidth && 1 == ld.blockHeight) continue;
+        BlockDecoder decoder(src.format);
+        if (!decoder.valid()) {
+            RAPID_IMAGE_LOGE("Decoding %s is not supported yet.", src.format.toString().c_str());
+            return false;
+        }
+        decoded[i].resize((size_t) src.extent.w * src.extent.h * src.extent.d);
+        decodeCompressedPlane(decoder, src, targets[i].srcPixels, decoded[i].data(), params.threads, params.executor);
+    }
+
+    // Tiles should be large enough to amortize the scheduling cost, while small enough to keep all threads busy even
+    // when the small mipmap levels are the only ones left. Every block is encoded independently of the others, so the
+    // result doesn't depend on how the tiles end up spread over the threads.
+    struct Tile {
+        size_t   target;
+        uint32_t z, y0, y1; // y0 and y1 are in unit of block rows.
+    };
+    std::vector<Tile> tiles;
+    for (size_t i = 0; i < targets.size(); ++i) {
+        const auto & e           = targets[i].src.extent;
+        uint32_t     blockRows   = (e.h + 3) / 4;
+        uint32_t     rowsPerTile = std::max(1u, encoder.blocksPerTile() / ((e.w + 3) / 4));
+        for (uint32_t z = 0; z < e.d; ++z) {
+            for (uint32_t y = 0; y < blockRows; y += rowsPerTile) tiles.push_back({i, z, y, std::min(y + rowsPerTile, blockRows)});
+        }
+    }
+
+    parallelFor(tiles.size(), params.threads, params.executor, [&](size_t job) {
+        const auto & tile = tiles[job];
+        const auto & t    = targets[tile.target];
+        const auto & e    = t.src.extent;
+        const auto & d    = decoded[tile.target];
+
+        // the scratch rows are reused across tiles, to avoid paying for allocation per tile.
+        thread_local std::vector<Float4> scratch;
+        if (scratch.size() < (size_t) e.w * 4) scratch.resize((size_t) e.w * 4);
+
+        for (uint32_t by = tile.y0; by < tile.y1; ++by) {
+            const Float4 * rows[4];
+            for (uint32_t r = 0; r < 4; ++r) {
+                uint32_t y = std::min(by * 4 + r, e.h - 1);
+                if (!d.empty()) {
+                    rows[r] = d.data() + ((size_t) tile.z * e.h + y) * e.w;
+                } else if (y < by * 4 + r) {
+                    rows[r] = rows[r - 1]; // past the bottom edge.
+                } else {
+                    findPixelKernels(t.src.format).toFloat4(t.src.format, scratch.data() + r * e.w, t.srcPixels + t.src.pixel(0, y, tile.z), e.w, t.src.step);
+                    rows[r] = scratch.data() + r * e.w;
+                }
+            }
+            encoder.encodeRow(t.dstPixels + t.dst.pixel(0, by * 4, tile.z), t.dst.step, rows, e.w);
+        }
+    });
+    return true;
+}
+
+} // namespace rii_details
+
+// *********************************************************************************************************************
+// PlaneDesc
+// *********************************************************************************************************************
+
+RII_API bool PlaneDesc::valid() const {
+    // check format
+    if (!format.valid()) {
+        RAPID_IMAGE_LOGE("invalid format");
+        return false;
+    }
+
+    // check dimension
+    if (extent.empty()) {
+        RAPID_IMAGE_LOGE("dimension can't zero!");
+        return false;
+    }
+
+    // check pitches
+    auto & cld             = format.layoutDesc();
+    auto   numBlocksPerRow = (uint32_t) ((extent.w + cld.blockWidth - 1) / cld.blockWidth);
+    auto   numBlocksPerCol = (uint32_t) ((extent.h + cld.blockHeight - 1) / cld.blockHeight);
+    if (step < cld.blockBytes) {
+        RAPID_IMAGE_LOGE("step is too small!");
+        return false;
+    }
+    if (pitch < numBlocksPerRow * cld.blockBytes) {
+        RAPID_IMAGE_LOGE("pitch is too small!");
+        return false;
+    }
+    if (slice < numBlocksPerCol * numBlocksPerRow * cld.blockBytes) {
+        RAPID_IMAGE_LOGE("slice is too small!");
+        return false;
+    }
+    if (size < slice * extent.d) {
+        RAPID_IMAGE_LOGE("size is too small!");
+        return false;
+    }
+
+    // check alignment
+    if (0 == alignment) {
+        RAPID_IMAGE_LOGE("row alignment can't zero!");
+        return false;
+    }
+    if (pitch % alignment) {
+        RAPID_IMAGE_LOGE("Pitch is not aligned to row alignment.");
+        return false;
+    }
+    if (slice % alignment) {
+        RAPID_IMAGE_LOGE("Slice is not aligned to the pixel block boundary.");
+        return false;
+    }
+
+    // done
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+RII_API PlaneDesc PlaneDesc::make(PixelFormat format, const Extent3D & extent, size_t step, size_t pitch, size_t slice, size_t alignment) {
+    if (!format.valid()) {
+        RAPID_IMAGE_LOGE("invalid color format: 0x%X", format.u32);
+        return {};
+    }
+
+    PlaneDesc p;
+    p.format   = format;
+    p.extent.w = extent.w ? extent.w : 1;
+    p.extent.h = extent.h ? extent.h : 1;
+    p.extent.d = extent.d ? extent.d : 1;
+
+    p.setSpacing(step, pitch, slice, alignment);
+    RII_ASSERT(p.alignment > 0 && p.step > 0 && p.pitch > 0 && p.slice > 0 && p.size > 0);
+
+    // done
+    RII_ASSERT(p.valid());
+    return p;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+RII_API PlaneDesc & PlaneDesc::setSpacing(size_t step_, size_t pitch_, size_t slice_, size_t alignment_) {
+    RII_REQUIRE(format.valid(), "must call this after setting the pixel format.");
+    const auto & fd = format.layoutDesc();
+    RII_REQUIRE(!extent.empty(), "must call this after setting the plane extent.");
+    auto numBlocksPerRow = (uint32_t) ((extent.w + fd.blockWidth - 1) / fd.blockWidth);
+    auto numBlocksPerCol = (uint32_t) ((extent.h + fd.blockHeight - 1) / fd.blockHeight);
+    alignment            = alignment_ ? (uint32_t) alignment_ : 4;
+    step                 = std::max((uint32_t) step_, (uint32_t) (fd.blockBytes));
+    pitch                = rii_details::nextMultiple(std::max<uint32_t>(step * numBlocksPerRow, (uint32_t) pitch_), alignment);
+    slice                = rii_details::nextMultiple(std::max<uint32_t>(pitch * numBlocksPerCol, (uint32_t) slice_), alignment);
+    size                 = slice * extent.d;
+    return *this;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+RII_API std::vector<Float4> PlaneDesc::toFloat4(const void * pixels) const {
+    if (empty()) {
+        RAPID_IMAGE_LOGE("Can't save empty image plane.");
+        return {};
+    }
+    auto ld = format.layoutDesc();
+    if (ld.blockWidth > 1 || ld.blockHeight > 1) {
+        rii_details::BlockDecoder decoder(format);
+        if (!decoder.valid()) {
+            RAPID_IMAGE_LOGE("Decoding %s is not supported yet.", format.toString().c_str());
+            return {};
+        }
+        std::vector<Float4> colors(extent.w * extent.h * extent.d);
+        rii_details::decodeCompressedPlane(decoder, *this, (const uint8_t *) pixels, colors.data());
+        return colors;
+    }
+    const uint8_t *     p       = (const uint8_t *) pixels;
+    const auto &        kernels = rii_details::findPixelKernels(format);
+    std::vector<Float4> colors(extent.w * extent.h * extent.d);
+    parallelForRows(*this, [&](uint32_t z, uint32_t y0, uint32_t y1) {
+        for (uint32_t y = y0; y < y1; ++y) {
+            kernels.toFloat4(format, colors.data() + ((size_t) z * extent.h + y) * extent.w, p + pixel(0, y, z), extent.w, step);
+        }
+    });
+    return colors;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+RII_API std::vector<RGBA8> PlaneDesc::toRGBA8(const void * pixels) const {
+    if (empty()) {
+        RAPID_IMAGE_LOGE("Can't save empty image plane.");
+        return {};
+    }
+    const uint8_t *    p  = (const uint8_t *) pixels;
+    auto               ld = format.layoutDesc();
+    std::vector<RGBA8> colors;
+    colors.resize(extent.w * extent.h * extent.d);
+
+    // uncompressed format is converted row by row, in tiles of rows in parallel.
+    if (1 == ld.blockWidth && 1 == ld.blockHeight) {
+        const auto & kernels = rii_details::findPixelKernels(format);
+        parallelForRows(*this, [&](uint32_t z, uint32_t y0, uint32_t y1) {
+            for (uint32_t y = y0; y < y1; ++y) {
+                kernels.toRGBA8(format, colors.data() + ((size_t) z * extent.h + y) * extent.w, p + pixel(0, y, z), extent.w, step);
+            }
+        });
+        return colors;
+    }
+
+    // compressed format is decoded a row of blocks at a time, straight into the output buffer.
+    rii_details::BlockDecoder decoder(format);
+    if (!decoder.valid()) RII_THROW("Decoding %s is not supported yet.", format.toString().c_str());
+    rii_details::decodeCompressedPlane(decoder, *this, p, colors.data());
+    return colors;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+RII_API void PlaneDesc::fromFloat4(void * dst, size_t dstSize, size_t dstZ, const void * src) const {
+    if (empty()) {
+        RAPID_IMAGE_LOGE("Can't load data to empty image plane.");
+        return;
+    }
+    const Float4 * p  = (const Float4 *) src;
+    auto           ld = format.layoutDesc();
+    if (ld.blockWidth > 1 || ld.blockHeight > 1) {
+        RAPID_IMAGE_LOGE("does not support loading pixel data to compressed image plane.");
+        return;
+    }
+    // Find the rows that fit in the destination buffer first, then convert them in tiles of rows in parallel.
+    const auto & kernels = rii_details::findPixelKernels(format);
+    uint32_t     rows    = extent.h;
+    while (rows > 0 && pixel(0, rows - 1, dstZ) + (extent.w - 1) * step + ld.blockBytes > dstSize) --rows;
+    uint32_t tile = std::max(1u, (16u << 10) / std::max(1u, pitch));
+    rii_details::parallelFor((rows + tile - 1) / tile, 0, {}, [&](size_t i) {
+        for (size_t y = i * tile; y < std::min<size_t>(rows, (i + 1) * tile); ++y) {
+            kernels.fromFloat4(format, (uint8_t *) dst + pixel(0, y, dstZ), p + y * extent.w, extent.w, step);
+        }
+    });
+    if (rows < extent.h) RAPID_IMAGE_LOGE("Destination buffer size (%zu) is not large enough.", dstSize);
+}
+
+namespace rii_details {
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Source pixels of one destination pixel along one axis of a box filtered mipmap, and their weights. When the source
+/// size is odd (2n + 1), each destination pixel covers 2 + 1/n source pixels, so it takes 3 taps weighted by how much
+/// each source pixel is covered (polyphase box filter). All weights are exact powers of 2 for the even case, so that it
+/// gives exactly the same result as averaging the pixels.
+struct BoxTaps {
+    uint32_t first;
+    uint32_t count;
+    float    weights[3];
+
+    static BoxTaps make(uint32_t srcSize, uint32_t dstSize, uint32_t i) {
+        if (srcSize == dstSize) return {i, 1, {1.0f, 0.0f, 0.0f}};
+        if (srcSize == dstSize * 2) return {i * 2, 2, {0.5f, 0.5f, 0.0f}};
+        RII_ASSERT(srcSize == dstSize * 2 + 1);
+        float scale = 1.0f / (float) srcSize;
+        return {i * 2, 3, {(float) (dstSize - i) * scale, (float) dstSize * scale, (float) (i + 1) * scale}};
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Generate rows [y0, y1) of slice z of a mipmap level from the previous level, using box filter. Each dimension of
+/// the source could be twice the destination, twice plus one (odd size), or 1.
+static void generateMipmapRows(uint8_t * dstData, const PlaneDesc & dst, const uint8_t * srcData, const PlaneDesc & src, size_t z, size_t y0, size_t y1) {
+    std::vector<BoxTaps> xTaps(dst.extent.w);
+    for (uint32_t x = 0; x < dst.extent.w; ++x) xTaps[x] = BoxTaps::make(src.extent.w, dst.extent.w, x);
+    auto zTaps = BoxTaps::make(src.extent.d, dst.extent.d, (uint32_t) z);
+
+    // Work row by row: convert the source rows to float, accumulate them with their weights, then store back.
+    const auto &        srcKernels = findPixelKernels(src.format);
+    const auto &        dstKernels = findPixelKernels(dst.format);
+    std::vector<Float4> srcRow(src.extent.w);
+    std::vector<Float4> dstRow(dst.extent.w);
+    for (size_t y = y0; y < y1; ++y) {
+        auto yTaps = BoxTaps::make(src.extent.h, dst.extent.h, (uint32_t) y);
+        std::fill(dstRow.begin(), dstRow.end(), Float4 {{0.0f, 0.0f, 0.0f, 0.0f}});
+        for (uint32_t k = 0; k < zTaps.count; ++k) {
+            for (uint32_t j = 0; j < yTaps.count; ++j) {
+                float weight = zTaps.weights[k] * yTaps.weights[j];
+                srcKernels.toFloat4(src.format, srcRow.data(), srcData + src.pixel(0, yTaps.first + j, zTaps.first + k), src.extent.w, src.step);
+                if (src.extent.w == dst.extent.w * 2) {
+                    // fast path for the common even case.
+                    float w = 0.5f * weight;
+                    for (size_t x = 0; x < dst.extent.w; ++x) {
+                        Float4 v0 = srcRow[x * 2], v1 = srcRow[x * 2 + 1];
+                        v0 *= w;
+                        v1 *= w;
+                        dstRow[x] += v0;
+                        dstRow[x] += v1;
+                    }
+                    continue;
+                }
+                for (size_t x = 0; x < dst.extent.w; ++x) {
+                    const auto & t = xTaps[x];
+                    for (uint32_t i = 0; i < t.count; ++i) {
+                        Float4 v = srcRow[t.first + i];
+                        v *= t.weights[i] * weight;
+                        dstRow[x] += v;
+                    }
+                }
+            }
+        }
+        dstKernels.fromFloat4(dst.format, dstData + dst.pixel(0, y, z), dstRow.data(), dst.extent.w, dst.step);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Box filter a float image of extent [w, h, d] down by [sx, sy, sz]. Pixels of each block are summed in the same
+/// order as generateMipmapRows() does, so both produce identical results for float formats. Scaling by a power of 2 is
+/// exact, so it does not matter that generateMipmapRows() scales each pixel before summing.
+static void downsampleBox(Float4 * dst, const Float4 * src, uint32_t w, uint32_t h, uint32_t d, uint32_t sx, uint32_t sy, uint32_t sz) {
+    uint32_t dw = w / sx, dh = h / sy, dd = d / sz;
+    float    scale = 1.0f / (float) (sx * sy * sz);
+    if (2 == sx && 2 == sy && 1 == sz) {
+        // fast path for the most common 2D case.
+        for (uint32_t z = 0; z < dd; ++z) {
+            for (uint32_t y = 0; y < dh; ++y) {
+                const Float4 * r0 = src + ((size_t) z * h + y * 2) * w;
+                const Float4 * r1 = r0 + w;
+                Float4 *       o  = dst + ((size_t) z * dh + y) * dw;
+                for (uint32_t x = 0; x < dw; ++x, r0 += 2, r1 += 2) {
+                    Float4 sum = r0[0];
+                    sum += r0[1];
+                    sum += r1[0];
+                    sum += r1[1];
+                    sum *= scale;
+                    o[x] = sum;
+                }
+            }
+        }
+        return;
+    }
+    for (uint32_t z = 0; z < dd; ++z) {
+        for (uint32_t y = 0; y < dh; ++y) {
+            for (uint32_t x = 0; x < dw; ++x) {
+                Float4 sum {{0.0f, 0.0f, 0.0f, 0.0f}};
+                for (uint32_t k = 0; k < sz; ++k) {
+                    for (uint32_t j = 0; j < sy; ++j) {
+                        const Float4 * row = src + ((size_t) (z * sz + k) * h + y * sy + j) * w + x * sx;
+                        for (uint32_t i = 0; i < sx; ++i) sum += row[i];
+                    }
+                }
+                sum *= scale;
+                dst[((size_t) z * dh + y) * dw + x] = sum;
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Weights of one dimension of a separable downsampling filter, precomputed for a pair of source and destination sizes.
+/// Each destination pixel is the weighted sum of 'taps' source pixels. Source indices are already clamped to the edge.
+struct FilterKernel1D {
+    uint32_t              taps = 0;
+    std::vector<uint32_t> indices; ///< source pixel index of each weight. taps * destination size in total.
+    std::vector<float>    weights; ///< weights of each destination pixel sum up to 1.
+
+    static FilterKernel1D make(PlaneDesc::GenerateMipmapsParameters::Filter filter, uint32_t srcSize, uint32_t dstSize) {
+        using Parameters = PlaneDesc::GenerateMipmapsParameters;
+
+        auto sinc = [](double x) {
+            if (std::abs(x) < 1e-9) return 1.0;
+            x *= 3.14159265358979323846;
+            return std::sin(x) / x;
+        };
+
+        // zeroth order modified Bessel function of the first kind.
+        auto besselI0 = [](double x) {
+            double sum = 1.0, term = 1.0, q = x * x / 4.0;
+            for (int k = 1; k < 64 && term > sum * 1e-12; ++k) {
+                term *= q / ((double) k * (double) k);
+                sum += term;
+            }
+            return sum;
+        };
+
+        // Filter radius in destination pixels. The windowed sinc filters are evaluated at the center of each source
+        // pixel. The box filter uses the exact overlap of each source pixel with the destination pixel instead.
+        const double radius = (Parameters::BOX == filter) ? 0.5 : 3.0;
+        auto         weight = [&](double x) {
+            x = std::abs(x);
+            if (x >= radius) return 0.0;
+            if (Parameters::LANCZOS == filter) return sinc(x) * sinc(x / radius);
+            const double alpha = 4.0, r = x / radius;
+            return sinc(x) * besselI0(alpha * std::sqrt(1.0 - r * r)) / besselI0(alpha);
+        };
+
+        FilterKernel1D k;
+        double         scale = (double) srcSize / (double) dstSize;
+        double         reach = radius * scale; // filter radius in source pixels.
+        k.taps               = (uint32_t) std::ceil(reach * 2.0) + 1;
+        k.indices.resize((size_t) k.taps * dstSize);
+        k.weights.resize((size_t) k.taps * dstSize);
+        std::vector<double> w;
+        for (uint32_t x = 0; x < dstSize; ++x) {
+            uint32_t * indices = &k.indices[(size_t) x * k.taps];
+            float *    weights = &k.weights[(size_t) x * k.taps];
+            double     center  = ((double) x + 0.5) * scale;
+            auto       lo      = (int64_t) std::floor(center - reach);
+            auto       hi      = (int64_t) std::ceil(center + reach);
+            double     sum     = 0.0;
+            uint32_t   n       = 0;
+            w.clear();
+            for (int64_t i = lo; i < hi && n < k.taps; ++i) {
+                double wi;
+                if (Parameters::BOX == filter) {
+                    wi = std::min((double) i + 1.0, center + reach) - std::max((double) i, center - reach);
+                } else {
+                    wi = weight(((double) i + 0.5 - center) / scale);
+                }
+                if (wi == 0.0) continue;
+                indices[n] = (uint32_t) std::clamp<int64_t>(i, 0, (int64_t) srcSize - 1);
+                w.push_back(wi);
+                sum += wi;
+                ++n;
+            }
+            for (uint32_t i = 0; i < k.taps; ++i) {
+                if (i < n) {
+                    weights[i] = (float) (w[i] / sum);
+                } else {
+                    // unused taps: zero weight, pointing to a valid pixel.
+                    indices[i] = indices[0];
+                    weights[i] = 0.0f;
+                }
+            }
+        }
+        return k;
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Apply the 1D filter kernel along one axis (0 = x, 1 = y, 2 = z) of a float volume. dst has the same extent as src,
+/// except along the axis, where it has dstSize pixels.
+static void applyFilterKernel(Float4 * dst, const Float4 * src, const Extent3D & se, uint32_t axis, const FilterKernel1D & k, uint32_t dstSize,
+                              const PlaneDesc::GenerateMipmapsParameters & params) {
+    // View the volume as [outer][axis][inner], so that all 3 axes are handled the same way.
+    size_t srcSize = (0 == axis) ? se.w : (1 == axis) ? se.h : se.d;
+    size_t inner   = (0 == axis) ? 1 : (1 == axis) ? se.w : (size_t) se.w * se.h;
+    size_t outer   = (size_t) se.w * se.h * se.d / (srcSize * inner);
+    size_t lines   = outer * dstSize;
+    size_t chunk   = std::max<size_t>(1, 16 * 1024 / (inner * k.taps));
+    parallelFor((lines + chunk - 1) / chunk, params.threads, params.executor, [&](size_t job) {
+        for (size_t line = job * chunk; line < std::min(lines, (job + 1) * chunk); ++line) {
+            size_t         o       = line / dstSize, j = line % dstSize;
+            Float4 *       out     = dst + line * inner;
+            const Float4 * in      = src + o * srcSize * inner;
+            const auto *   indices = &k.indices[j * k.taps];
+            const auto *   weights = &k.weights[j * k.taps];
+            std::fill_n(out, inner, Float4 {{0.0f, 0.0f, 0.0f, 0.0f}});
+            for (uint32_t t = 0; t < k.taps; ++t) {
+                if (0.0f == weights[t]) continue;
+                const Float4 * row = in + indices[t] * inner;
+                for (size_t i = 0; i < inner; ++i) {
+                    Float4 v = row[i];
+                    v *= weights[t];
+                    out[i] += v;
+                }
+            }
+        }
+    });
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Decode (or encode) all pixels of a plane from (to) a tightly packed float buffer, in parallel. Optionally convert
+/// RGB channels between sRGB and linear space along the way. sRGB formats are skipped here, since their pixel kernels
+/// already convert to (from) linear space.
+static void convertPlane(const ImageDesc::PlaneWithOffset & p, uint8_t * pixels, Float4 * floats, bool decode, bool gammaCorrect,
+                         const PlaneDesc::GenerateMipmapsParameters & params) {
+    if (PixelFormat::SIGN_GNORM == p.desc.format.sign0) gammaCorrect = false;
+    const auto & e       = p.desc.extent;
+    const auto & kernels = findPixelKernels(p.desc.format);
+    size_t       rows    = (size_t) e.h * e.d;
+    size_t       chunk   = std::max<size_t>(1, 16 * 1024 / e.w);
+    parallelFor((rows + chunk - 1) / chunk, params.threads, params.executor, [&](size_t job) {
+        std::vector<Float4> temp(gammaCorrect && !decode ? e.w : 0);
+        for (size_t row = job * chunk; row < std::min(rows, (job + 1) * chunk); ++row) {
+            Float4 *  f = floats + row * e.w;
+            uint8_t * q = pixels + p.pixel(0, row % e.h, row / e.h);
+            if (decode) {
+                kernels.toFloat4(p.desc.format, f, q, e.w, p.desc.step);
+                if (gammaCorrect) {
+                    for (uint32_t x = 0; x < e.w; ++x) f[x] = Float4::make(srgbToLinear(f[x].x), srgbToLinear(f[x].y), srgbToLinear(f[x].z), f[x].w);
+                }
+            } else if (gammaCorrect) {
+                for (uint32_t x = 0; x < e.w; ++x) temp[x] = Float4::make(linearToSrgb(f[x].x), linearToSrgb(f[x].y), linearToSrgb(f[x].z), f[x].w);
+                kernels.fromFloat4(p.desc.format, q, temp.data(), e.w, p.desc.step);
+            } else {
+                kernels.fromFloat4(p.desc.format, q, f, e.w, p.desc.step);
+            }
+        }
+    });
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Count how many levels, starting from l0, are exactly half of the previous one (or stay at 1) in every dimension.
+/// The tiled passes of the fused mipmap generator require this, so that source tiles map to whole destination tiles.
+static size_t countHalvingLevels(const ImageDesc & desc, size_t l0) {
+    auto   halves = [](uint32_t s, uint32_t d) { return s == d * 2 || (1 == s && 1 == d); };
+    size_t count  = 0;
+    for (size_t l = l0 + 1; l < desc.levels; ++l, ++count) {
+        const auto & s = desc.planes[desc.index(0, 0, l - 1)].desc.extent;
+        const auto & d = desc.planes[desc.index(0, 0, l)].desc.extent;
+        if (!halves(s.w, d.w) || !halves(s.h, d.h) || !halves(s.d, d.d)) break;
+    }
+    return count;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Generate mipmaps through a float working pyramid, so that the pixels are decoded once and every level is quantized
+/// exactly once.
+///
+/// The work is done in passes. Each pass cuts its source level into tiles that are 64 rows tall for 2D (16 rows by 16
+/// slices for 3D), and as wide as a 1MB float4 buffer allows. Every tile is reduced through as many levels as its
+/// height allows while it is still in cache. The last level of a pass is also kept in float to feed the next pass.
+/// Tiles of all faces and ranks run in parallel.
+///
+/// A level that is not exactly half of the previous one (odd size) can't be tiled that way. It is generated from the
+/// whole previous level in float, with the separable polyphase box filter, then the tiled passes continue from it.
+static void generateFusedMipmaps(const ImageDesc & desc, uint8_t * pixels, const PlaneDesc::GenerateMipmapsParameters & params) {
+    constexpr uint32_t MAX_TILE_PIXELS = 64 * 1024;
+
+    // A chain is the mipmap chain of one face of one rank.
+    const size_t                     chains = (size_t) desc.ranks * desc.faces;
+    std::vector<std::vector<Float4>> carry(chains), next(chains);
+    auto                             extent = [&](size_t l) -> const Extent3D & { return desc.planes[desc.index(0, 0, l)].desc.extent; };
+    auto                             plane  = [&](size_t c, size_t l) -> const ImageDesc::PlaneWithOffset & {
+        return desc.planes[desc.index(c / desc.faces, c % desc.faces, l)];
+    };
+    for (size_t l0 = 0; l0 + 1 < desc.levels;) {
+        const auto & se      = extent(l0);
+        size_t       halving = countHalvingLevels(desc, l0);
+        if (0 == halving) {
+            const auto &   de         = extent(l0 + 1);
+            uint32_t       srcSize[3] = {se.w, se.h, se.d}, dstSize[3] = {de.w, de.h, de.d};
+            FilterKernel1D kernels[3];
+            for (uint32_t a = 0; a < 3; ++a) {
+                if (srcSize[a] != dstSize[a]) kernels[a] = FilterKernel1D::make(PlaneDesc::GenerateMipmapsParameters::BOX, srcSize[a], dstSize[a]);
+            }
+            std::vector<Float4> temp;
+            for (size_t c = 0; c < chains; ++c) {
+                if (0 == l0) {
+                    carry[c].resize((size_t) se.w * se.h * se.d);
+                    convertPlane(plane(c, 0), pixels, carry[c].data(), true, false, params);
+                }
+                auto e = se;
+                for (uint32_t a = 0; a < 3; ++a) {
+                    if (0 == kernels[a].taps) continue;
+                    auto n                              = e;
+                    (0 == a ? n.w : 1 == a ? n.h : n.d) = dstSize[a];
+                    temp.resize((size_t) n.w * n.h * n.d);
+                    applyFilterKernel(temp.data(), carry[c].data(), e, a, kernels[a], dstSize[a], params);
+                    std::swap(carry[c], temp);
+                    e = n;
+                }
+                convertPlane(plane(c, l0 + 1), pixels, carry[c].data(), false, false, params);
+            }
+            ++l0;
+            continue;
+        }
+
+        // determine the tile size and the levels covered by this pass.
+        uint32_t dims = (se.w > 1 ? 1u : 0u) + (se.h > 1 ? 1u : 0u) + (se.d > 1 ? 1u : 0u);
+        auto     k    = std::min<size_t>(dims >= 3 ? 4 : dims == 2 ? 6 : 12, halving);
+        uint32_t     t    = 1u << k;
+        uint32_t     th = std::min(t, se.h), td = std::min(t, se.d);
+        uint32_t     tw = std::min(se.w, std::max(t, MAX_TILE_PIXELS / (th * td)));
+        uint32_t     nx = (se.w + tw - 1) / tw, ny = se.h / th, nz = se.d / td; // the last column of tiles could be narrower.
+        size_t       l1   = l0 + k;
+        bool         more = l1 + 1 < desc.levels;
+        const auto & le   = extent(l1);
+        if (more) {
+            for (auto & n : next) n.resize((size_t) le.w * le.h * le.d);
+        }
+
+        size_t tilesPerChain = (size_t) nx * ny * nz;
+        parallelFor(chains * tilesPerChain, params.threads, params.executor, [&](size_t job) {
+            size_t   c = job / tilesPerChain, i = job % tilesPerChain;
+            uint32_t x0 = (uint32_t) (i % nx) * tw, y0 = (uint32_t) (i / nx % ny) * th, z0 = (uint32_t) (i / nx / ny) * td;
+            uint32_t cw = std::min(tw, se.w - x0);
+
+            // The scratch buffers are reused across tiles, to avoid paying for allocation and page faults per tile.
+            thread_local std::vector<Float4> scratchA, scratchB;
+            if (scratchA.size() < (size_t) tw * th * td) {
+                scratchA.resize((size_t) tw * th * td);
+                scratchB.resize((size_t) tw * th * td);
+            }
+            Float4 * a = scratchA.data();
+            Float4 * b = scratchB.data();
+
+            // load the source tile: decode from the base map on the first pass, or copy from the float carry over.
+            if (0 == l0) {
+                const auto & p       = plane(c, 0);
+                const auto & kernels = findPixelKernels(p.desc.format);
+                for (uint32_t z = 0; z < td; ++z) {
+                    for (uint32_t y = 0; y < th; ++y) {
+                        kernels.toFloat4(p.desc.format, a + ((size_t) z * th + y) * cw, pixels + p.pixel(x0, y0 + y, z0 + z), cw, p.desc.step);
+                    }
+                }
+            } else {
+                for (uint32_t z = 0; z < td; ++z) {
+                    for (uint32_t y = 0; y < th; ++y) {
+                        std::copy_n(carry[c].data() + ((size_t) (z0 + z) * se.h + y0 + y) * se.w + x0, cw, a + ((size_t) z * th + y) * cw);
+                    }
+                }
+            }
+
+            // reduce the tile level by level, quantizing each level once.
+            uint32_t w = cw, h = th, d = td, ox = x0, oy = y0, oz = z0;
+            for (size_t l = l0 + 1; l <= l1; ++l) {
+                const auto & pe = extent(l - 1);
+                const auto & de = extent(l);
+                uint32_t     sx = pe.w / de.w, sy = pe.h / de.h, sz = pe.d / de.d;
+                downsampleBox(b, a, w, h, d, sx, sy, sz);
+                std::swap(a, b);
+                w /= sx, h /= sy, d /= sz, ox /= sx, oy /= sy, oz /= sz;
+                const auto & p       = plane(c, l);
+                const auto & kernels = findPixelKernels(p.desc.format);
+                for (uint32_t z = 0; z < d; ++z) {
+                    for (uint32_t y = 0; y < h; ++y) {
+                        kernels.fromFloat4(p.desc.format, pixels + p.pixel(ox, oy + y, oz + z), a + ((size_t) z * h + y) * w, w, p.desc.step);
+                    }
+                }
+            }
+
+            // keep the last level in float for the next pass.
+            if (more) {
+                for (uint32_t z = 0; z < d; ++z) {
+                    for (uint32_t y = 0; y < h; ++y) {
+                        std::copy_n(a + ((size_t) z * h + y) * w, w, next[c].data() + ((size_t) (oz + z) * le.h + oy + y) * le.w + ox);
+                    }
+                }
+            }
+        });
+        std::swap(carry, next);
+        l0 = l1;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Generate mipmaps with a separable filter: every level is made from the previous one with a horizontal, a vertical
+/// and (for 3D) a depth pass over float pixels. Filter weights are computed once per level and axis, and shared by all
+/// faces and ranks. When fused, the previous level is kept in float, so each level is quantized once. Otherwise, it is
+/// decoded back from the quantized pixels. Faces and ranks are processed one after another, while each pass is split
+/// into row tiles that run in parallel. This keeps the memory footprint to about 3 float copies of one base map.
+static void generateFilteredMipmaps(const ImageDesc & desc, uint8_t * pixels, const PlaneDesc::GenerateMipmapsParameters & params) {
+    auto extent = [&](size_t l) -> const Extent3D & { return desc.planes[desc.index(0, 0, l)].desc.extent; };
+
+    // precompute the filter weights.
+    std::vector<std::array<FilterKernel1D, 3>> kernels(desc.levels);
+    for (size_t l = 1; l < desc.levels; ++l) {
+        const auto & se = extent(l - 1);
+        const auto & de = extent(l);
+        if (se.w != de.w) kernels[l][0] = FilterKernel1D::make(params.filter, se.w, de.w);
+        if (se.h != de.h) kernels[l][1] = FilterKernel1D::make(params.filter, se.h, de.h);
+        if (se.d != de.d) kernels[l][2] = FilterKernel1D::make(params.filter, se.d, de.d);
+    }
+
+    std::vector<Float4> cur, tmp;
+    for (size_t r = 0; r < desc.ranks; ++r) {
+        for (size_t f = 0; f < desc.faces; ++f) {
+            for (size_t l = 1; l < desc.levels; ++l) {
+                auto se = extent(l - 1);
+                if (1 == l || !params.fused) {
+                    cur.resize((size_t) se.w * se.h * se.d);
+                    convertPlane(desc.planes[desc.index(r, f, l - 1)], pixels, cur.data(), true, params.gammaCorrect, params);
+                }
+                const auto & de = extent(l);
+                uint32_t     dstSizes[] = {de.w, de.h, de.d};
+                for (uint32_t axis = 0; axis < 3; ++axis) {
+                    if (0 == kernels[l][axis].taps) continue;
+                    auto e = se;
+                    (0 == axis ? e.w : 1 == axis ? e.h : e.d) = dstSizes[axis];
+                    tmp.resize((size_t) e.w * e.h * e.d);
+                    applyFilterKernel(tmp.data(), cur.data(), se, axis, kernels[l][axis], dstSizes[axis], params);
+                    std::swap(cur, tmp);
+                    se = e;
+                }
+                convertPlane(desc.planes[desc.index(r, f, l)], pixels, cur.data(), false, params.gammaCorrect, params);
+            }
+        }
+    }
+}
+
+} // namespace rii_details
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+RII_API Image PlaneDesc::generateMipmaps(const void * pixels, size_t maxLevels) const {
+    return generateMipmaps(pixels, GenerateMipmapsParameters {}.setMaxLevels(maxLevels));
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 //
-RII_API Image PlaneDesc::generateMipmaps(const void * pixels, size_t maxLevels) const {
-    struct Local {
-        // static int imax(int a, int b) {
-        //     if (a > b) return a;
-        //     return b;
-        // }
-
-        // static int imin(int a, int b) {
-        //     if (a < b) return a;
-        //     return b;
-        // }
-
-        // static float lerp(float v0, float v1) { return 0.5f * v0 + 0.5f * v1; }
-
-        // static float4 lerpPixel(const float4 & p0, const float4 & p1) {
-        //     float4 result;
-        //     result.x = lerp(p0.x, p1.x);
-        //     result.y = lerp(p0.y, p1.y);
-        //     result.z = lerp(p0.z, p1.z);
-        //     result.w = lerp(p0.w, p1.w);
-        //     return result;
-        // }
-
-        static void generateMipmap(uint8_t * data, const PlaneDesc & src, const PlaneDesc & dst) {
-            RII_ASSERT(src.extent.w == 1 || src.extent.w == dst.extent.w * 2);
-            RII_ASSERT(src.extent.h == 1 || src.extent.h == dst.extent.h * 2);
-            RII_ASSERT(src.extent.d == 1 || src.extent.d == dst.extent.d * 2);
-            auto sx = src.extent.w / dst.extent.w;
-            auto sy = src.extent.h / dst.extent.h;
-            auto sz = src.extent.d / dst.extent.d;
-            auto pc = sx * sy * sz;                       // pixel count
-            auto ps = src.format.layoutDesc().blockBytes; // pixel size
-            RII_ASSERT(pc <= 8);
-            RII_ASSERT(ps <= sizeof(OnePixel));
-            for (size_t z = 0; z < dst.extent.d; ++z) {
-                for (size_t y = 0; y < dst.extent.h; ++y) {
-                    for (size_t x = 0; x < dst.extent.w; ++x) {
-                        // [x * sx, y * sy, z * sz] defines the corner pixel in the source image
-                        // [sx, sy, sz] defines the extent of the pixel block in the source image
-                        Float4 sum = {{0.0f, 0.0f, 0.0f, 0.0f}};
-                        for (size_t i = 0; i < pc; ++i) {
-                            auto xx = x * sx + i % sx;
-                            auto yy = y * sy + (i / sx) % sy;
-                            auto zz = z * sz + i / (sx * sy);
-                            sum += src.format.storeToFloat4(data + src.pixel(xx, yy, zz));
-                        }
-                        sum *= 1.0f / (float) pc;
-                        auto avg = dst.format.loadFromFloat4(sum);
-                        memcpy(data + dst.pixel(x, y, z), &avg, ps);
-                    }
-                }
-            }
-            // float widthDivisor  = static_cast<float>(imax(static_cast<int>(dstWidth) - 1, 1));
-            // float heightDivisor = static_cast<float>(imax(static_cast<int>(dstHeight) - 1, 1));
-            // for (int i = 0; i < static_cast<int>(dstHeight); ++i) {
-            //     int y0 = static_cast<int>(i * (static_cast<int>(srcHeight) - 1) / heightDivisor);
-            //     int y1 = imin(y0 + 1, static_cast<int>(srcHeight) - 1);
-            //     for (int j = 0; j < static_cast<int>(dstWidth); ++j) {
-            //         int    x0               = static_cast<int>(j * (static_cast<int>(srcWidth) - 1) / widthDivisor);
-            //         int    x1               = imin(x0 + 1, static_cast<int>(srcWidth) - 1);
-            //         float4 p0               = src[(srcWidth * y0) + x0];m
-            //         float4 p1               = src[(srcWidth * y0) + x1];
-            //         float4 p2               = src[(srcWidth * y1) + x0];
-            //         float4 p3               = src[(srcWidth * y1) + x1];
-            //         float4 v0               = lerpPixel(p0, p1);
-            //         float4 v1               = lerpPixel(p2, p3);
-            //         float4 pixel            = lerpPixel(v0, v1);
-            //         dst[(dstWidth * i) + j] = pixel;
-            //     }
-            // }
-        }
-    };
+RII_API Image PlaneDesc::generateMipmaps(const void * pixels, const GenerateMipmapsParameters & params) const {
+    const auto & ld = format.layoutDesc();
+    if (ld.blockWidth > 1 || ld.blockHeight > 1) {
+        RAPID_IMAGE_LOGE("Can't generate mipmaps for compressed format %s.", format.toString().c_str());
+        return {};
+    }
 
     // create the result image
-    Image        result = Image(ImageDesc {}.reset(PlaneDesc::make(format, extent), 1, maxLevels));
+    Allocator::Scope scope(params.allocator ? params.allocator : Allocator::current());
+    Image            result = Image(ImageDesc {}.reset(PlaneDesc::make(format, extent), 1, 1, params.maxLevels));
     const auto & desc   = result.desc();
 
-    // Copy data into the base map of the result image.
-    memcpy(result.data() + desc.planes[0].offset, pixels, desc.planes[0].desc.size);
+    // Copy data into the base map of the result image. The result might have different pitch than this plane.
+    const auto & base = desc.planes[0];
+    copyContent(base.desc, result.data() + base.offset, 0, 0, 0, *this, pixels, 0, 0, 0, extent.w, extent.h, extent.d);
 
-    for (size_t i = 0; i < desc.planes.size(); ++i) {
-        auto [r, f, l] = desc.coord3(i);
-        if (0 == l) continue; // skip the base map.
-        const auto & src = desc.planes[desc.index(r, f, l - 1)].desc;
-        const auto & dst = desc.planes[i].desc;
-        Local::generateMipmap(result.data(), src, dst);
-    }
+    // then generate the rest of the mipmap chain.
+    desc.generateMipmaps(result.data(), params);
+    return result;
+}
 
+// ---------------------------------------------------------------------------------------------------------------------
+//
+RII_API Image PlaneDesc::compress(const void * pixels, PixelFormat format_) const { return compress(pixels, format_, CompressParameters {}); }
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+RII_API Image PlaneDesc::compress(const void * pixels, PixelFormat format_, const CompressParameters & params) const {
+    if (empty() || !pixels) return {};
+    rii_details::BlockEncoder encoder(format_, params);
+    if (!encoder.valid()) {
+        RAPID_IMAGE_LOGE("Compressing to %s is not supported yet.", format_.toString().c_str());
+        return {};
+    }
+    Image        result = Image(ImageDesc::make(PlaneDesc::make(format_, extent)));
+    const auto & dst    = result.desc().planes[0];
+    if (!rii_details::compressPlanes(encoder, {{*this, (const uint8_t *) pixels, dst.desc, result.data() + dst.offset}}, params)) return {};
     return result;
 }
 
@@ -1119,14 +6169,17 @@ void PlaneDesc::copyContent(const PlaneDesc & dstDesc, void * dstData, int dstX,
     sz2 = sz1 + (dz2 - dz1);
     RII_ASSERT(sx1 < sx2 && sy1 < sy2 && sz1 < sz2);
 
-    // copy the content row by row.
+    // copy the content row by row, in tiles of rows in parallel.
     size_t rowLength = (size_t) (sx2 - sx1) * srcLayout.blockBytes;
-    auto   nz        = sz2 - sz1;
-    auto   ny        = sy2 - sy1;
+    size_t ny        = (size_t) (sy2 - sy1);
+    size_t rows      = ny * (size_t) (sz2 - sz1);
+    size_t tile      = std::max<size_t>(1, (16u << 10) / rowLength);
     auto   bw        = dstLayout.blockWidth;
     auto   bh        = dstLayout.blockHeight;
-    for (int z = 0; z < nz; ++z) {
-        for (int y = 0; y < ny; ++y) {
+    rii_details::parallelFor((rows + tile - 1) / tile, 0, {}, [&](size_t i) {
+        for (size_t r = i * tile; r < std::min(rows, (i + 1) * tile); ++r) {
+            auto z         = (int) (r / ny);
+            auto y         = (int) (r % ny);
             auto srcOffset = srcDesc.pixel(((size_t) sx1 * bw), ((size_t) (y + sy1) * bh), (size_t) (z + sz1));
             auto dstOffset = dstDesc.pixel(((size_t) dx1 * bw), ((size_t) (y + dy1) * bh), (size_t) (z + dz1));
             RII_ASSERT(srcOffset <= srcDesc.size);
@@ -1137,7 +6190,7 @@ void PlaneDesc::copyContent(const PlaneDesc & dstDesc, void * dstData, int dstX,
             auto s = ((uint8_t *) srcData) + srcOffset;
             memcpy(d, s, rowLength);
         }
-    }
+    });
 }
 
 // *********************************************************************************************************************
@@ -1170,8 +6223,83 @@ struct RILHeaderV1 {
 
     bool empty() const { return 0 == size || 0 == ranks || 0 == faces || 0 == levels; }
 };
+
+/// V2 pads the pixel array to payloadAlignment bytes from the start of the file (4KB by default), so it can be mapped
+/// into memory or read with direct I/O in place. It also records the checksum of the pixel array.
+struct RILHeaderV2 {
+    uint32_t headerSize       = sizeof(RILHeaderV2);
+    uint32_t planeDescSize    = sizeof(ImageDesc::PlaneWithOffset);
+    uint32_t offset           = sizeof(RILFileTag) + sizeof(RILHeaderV2); ///< offset to the plane array
+    uint32_t ranks            = 0;
+    uint32_t faces            = 0;
+    uint32_t levels           = 0;
+    uint32_t alignment        = 0;
+    uint32_t payloadAlignment = 0; ///< alignment of the pixel array in the file.
+    uint64_t payloadOffset    = 0; ///< offset to the pixel array, from the start of the file.
+    uint64_t size             = 0; ///< total size of the pixel array.
+    uint64_t checksum         = 0; ///< XXH64 hash (seed = 0) of the pixel array.
+
+    bool valid() const {
+        return headerSize == sizeof(RILHeaderV2) && planeDescSize == sizeof(ImageDesc::PlaneWithOffset) &&
+               offset == (sizeof(RILFileTag) + sizeof(RILHeaderV2)) && payloadAlignment > 0 && 0 == (payloadOffset % payloadAlignment) &&
+               payloadOffset >= offset + (uint64_t) ranks * faces * levels * planeDescSize;
+    }
+
+    bool empty() const { return 0 == size || 0 == ranks || 0 == faces || 0 == levels; }
+};
 #pragma pack(pop)
 
+// ---------------------------------------------------------------------------------------------------------------------
+/// XXH64 hash of a memory block. See https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+static uint64_t xxh64(const void * data, size_t size, uint64_t seed = 0) {
+    constexpr uint64_t P1 = 11400714785074694791ull, P2 = 14029467366897019727ull, P3 = 1609587929392839161ull;
+    constexpr uint64_t P4 = 9650029242287828579ull, P5 = 2870177450012600261ull;
+
+    auto rotl   = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto read64 = [](const uint8_t * p) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        return v;
+    };
+    auto read32 = [](const uint8_t * p) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return v;
+    };
+    auto round = [&](uint64_t acc, uint64_t input) { return rotl(acc + input * P2, 31) * P1; };
+    auto merge = [&](uint64_t acc, uint64_t v) { return (acc ^ round(0, v)) * P1 + P4; };
+
+    auto     p   = (const uint8_t *) data;
+    auto     end = p + size;
+    uint64_t h;
+    if (size >= 32) {
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+    } else {
+        h = seed + P5;
+    }
+    h += (uint64_t) size;
+    for (; p + 8 <= end; p += 8) h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+    if (p + 4 <= end) {
+        h = rotl(h ^ (read32(p) * P1), 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; ++p) h = rotl(h ^ (*p * P5), 11) * P1;
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 //
 bool checkedRead(std::istream & stream, const char * name, const char * action, void * buffer, size_t size) {
@@ -1184,62 +6312,197 @@ bool checkedRead(std::istream & stream, const char * name, const char * action,
 };
 
 // ---------------------------------------------------------------------------------------------------------------------
-//
-ImageDesc::AlignedUniquePtr ImageDesc::loadFromRIL(std::istream & stream, const char * name) {
-    if (!stream) {
-        RAPID_IMAGE_LOGE("failed to load DDS image from stream (%s): stream is in good state.", name);
-        return {};
+/// Read the image descriptor (header and plane array) of a RIL file of specific version. The file tag is read already.
+template<typename HEADER>
+static bool readRILHeader(std::istream & stream, const char * name, HEADER & header, ImageDesc & result) {
+    if (!checkedRead(stream, name, "read header", &header, sizeof(header))) return false;
+    if (!header.valid()) {
+        RAPID_IMAGE_LOGE("failed to read image from stream (%s): Invalid file header.", name);
+        return false;
+    }
+    if (header.empty()) {
+        RAPID_IMAGE_LOGE("failed to read image from stream (%s): empty image.", name);
+        return false;
     }
+    // read image descriptor
+    ImageDesc desc;
+    desc.ranks     = header.ranks;
+    desc.faces     = header.faces;
+    desc.levels    = header.levels;
+    desc.size      = header.size;
+    desc.alignment = header.alignment;
+    desc.planes    = std::vector<ImageDesc::PlaneWithOffset>(header.ranks * header.faces * header.levels);
+    if (!checkedRead(stream, name, "read image planes", desc.planes.data(), desc.planes.size() * sizeof(ImageDesc::PlaneWithOffset))) return false;
+    if (!desc.valid()) {
+        RAPID_IMAGE_LOGE("failed to read image from stream (%s): Invalid image descriptor.", name);
+        return false;
+    }
+    result = std::move(desc);
+    return true;
+}
 
+// ---------------------------------------------------------------------------------------------------------------------
+/// Read file tag, header and plane array of a RIL file. On success, the stream is left at the start of the pixel array.
+/// \param version  Returns the file version.
+/// \param checksum Returns the checksum of the pixel array. Only V2 files have it.
+static bool readRILDesc(std::istream & stream, const char * name, ImageDesc & result, uint32_t & version, uint64_t & checksum) {
     // read file tag
     RILFileTag tag;
-    if (!checkedRead(stream, name, "read image tag", &tag, sizeof(tag))) return {};
+    if (!checkedRead(stream, name, "read image tag", &tag, sizeof(tag))) return false;
     if (!tag.valid()) {
         RAPID_IMAGE_LOGE("failed to read image from stream (%s): Invalid file tag. The stream is probably not a RIL file.", name);
-        return {};
+        return false;
     }
+    version  = tag.version;
+    checksum = 0;
 
     // check file version
     if (1 == tag.version) {
-        // read V1 file
         RILHeaderV1 header;
-        if (!checkedRead(stream, name, "read V1 header", &header, sizeof(header))) return {};
-        if (!header.valid()) {
-            RAPID_IMAGE_LOGE("failed to read image from stream (%s): Invalid file header.", name);
-            return {};
-        }
-        if (header.empty()) {
-            RAPID_IMAGE_LOGE("failed to read image from stream (%s): empty image.", name);
-            return {};
-        }
-        // read image descriptor
-        ImageDesc desc;
-        desc.ranks     = header.ranks;
-        desc.faces     = header.faces;
-        desc.levels    = header.levels;
-        desc.size      = header.size;
-        desc.alignment = header.alignment;
-        desc.planes    = std::vector<ImageDesc::PlaneWithOffset>(header.ranks * header.faces * header.levels);
-        if (!checkedRead(stream, name, "read image planes", desc.planes.data(), desc.planes.size() * sizeof(ImageDesc::PlaneWithOffset))) return {};
-        if (!desc.valid()) {
-            RAPID_IMAGE_LOGE("failed to read image from stream (%s): Invalid image descriptor.", name);
-            return {};
+        return readRILHeader(stream, name, header, result);
+    } else if (2 == tag.version) {
+        RILHeaderV2 header;
+        if (!readRILHeader(stream, name, header, result)) return false;
+        // skip the padding in front of the pixel array.
+        auto padding = header.payloadOffset - header.offset - result.planes.size() * sizeof(ImageDesc::PlaneWithOffset);
+        if (padding > 0 && !stream.ignore((std::streamsize) padding)) {
+            RAPID_IMAGE_LOGE("Failed to skip payload padding from stream (%s): stream is not in good state.", name);
+            return false;
         }
-        // read pixel array
-        auto pixels = AlignedUniquePtr((uint8_t *) rii_details::aalloc(header.alignment, desc.size));
-        if (!checkedRead(stream, name, "read pixels", pixels.get(), desc.size)) return {};
-        // done
-        *this = std::move(desc);
-        return pixels;
+        checksum = header.checksum;
+        return true;
     } else {
         RAPID_IMAGE_LOGE("failed to read image from stream (%s): unsupported file version %u.", name, tag.version);
+        return false;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+ImageDesc::AlignedUniquePtr ImageDesc::loadFromRIL(std::istream & stream, const char * name) {
+    if (!stream) {
+        RAPID_IMAGE_LOGE("failed to load DDS image from stream (%s): stream is in good state.", name);
+        return {};
+    }
+
+    ImageDesc desc;
+    uint32_t  version;
+    uint64_t  checksum;
+    if (!readRILDesc(stream, name, desc, version, checksum)) return {};
+
+    // read pixel array
+    auto pixels = AlignedUniquePtr((uint8_t *) rii_details::aalloc(desc.alignment, desc.size));
+    if (!checkedRead(stream, name, "read pixels", pixels.get(), desc.size)) return {};
+    if (version >= 2 && checksum != xxh64(pixels.get(), desc.size)) {
+        RAPID_IMAGE_LOGE("failed to read image from stream (%s): checksum mismatch. The pixel array is corrupted.", name);
+        return {};
+    }
+
+    // done
+    *this = std::move(desc);
+    return pixels;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+bool ImageDesc::loadRILHeader(std::istream & stream, uint64_t & payload, const char * name) {
+    if (!name || !name[0]) name = "<unnamed>";
+    if (!stream) {
+        RAPID_IMAGE_LOGE("failed to load RIL image header from stream (%s): stream is not in good state.", name);
+        return false;
+    }
+    ImageDesc desc;
+    uint32_t  version;
+    uint64_t  checksum;
+    if (!readRILDesc(stream, name, desc, version, checksum)) return false;
+    auto position = stream.tellg();
+    if (std::streampos(-1) == position) {
+        RAPID_IMAGE_LOGE("failed to load RIL image header from stream (%s): can't tell the position of the pixel array.", name);
+        return false;
+    }
+    payload = (uint64_t) position;
+    *this   = std::move(desc);
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+bool ImageDesc::readRILPlane(std::istream & stream, uint64_t payload, const PlaneCoord & p, void * pixels) const {
+    if (!pixels) return false;
+    if (p.rank >= ranks || p.face >= faces || p.level >= levels) {
+        RAPID_IMAGE_LOGE("failed to read image plane: plane (rank %zu, face %zu, level %zu) is out of range (%u ranks, %u faces, %u levels).", p.rank,
+                         p.face, p.level, ranks, faces, levels);
+        return false;
+    }
+    const auto & plane = planes[index(p)];
+    stream.clear();
+    stream.seekg((std::streamoff) (payload + plane.offset), std::ios::beg);
+    return checkedRead(stream, "<unnamed>", "read image plane", pixels, plane.desc.size);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+ImageDesc::AlignedUniquePtr ImageDesc::loadRILLevels(std::istream & stream, size_t firstLevel, size_t levelCount, const char * name) {
+    if (!name || !name[0]) name = "<unnamed>";
+    ImageDesc file;
+    uint64_t  payload;
+    if (!file.loadRILHeader(stream, payload, name)) return {};
+    if (firstLevel >= file.levels) {
+        RAPID_IMAGE_LOGE("failed to load levels of image %s: first level %zu is out of range (%u levels).", name, firstLevel, file.levels);
         return {};
     }
+    if (0 == levelCount || firstLevel + levelCount > file.levels) levelCount = file.levels - firstLevel;
+
+    // Build the descriptor of the sub image. Planes keep their layout and their relative order in the file, so that
+    // neighboring planes in the file can be fetched with a single read.
+    ImageDesc desc;
+    desc.ranks     = file.ranks;
+    desc.faces     = file.faces;
+    desc.levels    = (uint32_t) levelCount;
+    desc.alignment = file.alignment;
+    desc.planes.resize((size_t) desc.ranks * desc.faces * desc.levels);
+    std::vector<std::pair<size_t, size_t>> order; // (file plane index, sub image plane index), sorted by file offset.
+    for (uint32_t r = 0; r < desc.ranks; ++r) {
+        for (uint32_t f = 0; f < desc.faces; ++f) {
+            for (size_t l = 0; l < levelCount; ++l) order.emplace_back(file.index(r, f, firstLevel + l), desc.index(r, f, l));
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](const auto & a, const auto & b) { return file.planes[a.first].offset < file.planes[b.first].offset; });
+    for (const auto & [src, dst] : order) {
+        desc.planes[dst].desc   = file.planes[src].desc;
+        desc.planes[dst].offset = rii_details::nextMultiple<size_t>(desc.size, desc.alignment);
+        desc.size               = desc.planes[dst].offset + file.planes[src].desc.size;
+    }
+    RII_ASSERT(desc.valid());
+
+    // Read the planes with positioned reads. Planes with the same spacing in both the file and the sub image are merged
+    // into one read.
+    auto pixels = AlignedUniquePtr((uint8_t *) rii_details::aalloc(desc.alignment, desc.size));
+    if (!pixels) return {};
+    for (size_t i = 0; i < order.size();) {
+        const auto & first = order[i];
+        size_t       j     = i + 1;
+        uint64_t     end   = desc.planes[first.second].offset + desc.planes[first.second].desc.size;
+        for (; j < order.size(); ++j) {
+            const auto & prev = order[j - 1], & next = order[j];
+            if (file.planes[next.first].offset - file.planes[prev.first].offset != desc.planes[next.second].offset - desc.planes[prev.second].offset) break;
+            end = desc.planes[next.second].offset + desc.planes[next.second].desc.size;
+        }
+        auto begin = desc.planes[first.second].offset;
+        stream.clear();
+        stream.seekg((std::streamoff) (payload + file.planes[first.first].offset), std::ios::beg);
+        if (!checkedRead(stream, name, "read image planes", pixels.get() + begin, (size_t) (end - begin))) return {};
+        i = j;
+    }
+
+    // done
+    *this = std::move(desc);
+    return pixels;
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 //
-static void saveToRIL(const ImageDesc & desc, std::ostream & stream, const void * pixels) {
+static void saveToRIL(const ImageDesc & desc, std::ostream & stream, const void * pixels, size_t payloadAlignment) {
     if (desc.empty() || !desc.valid()) { RII_THROW("Can't save empty or invalid image."); }
     if (!stream) { RII_THROW("failed to write image to stream: stream is not good."); }
     if (!pixels) { RII_THROW("failed to write image to stream: pixel array is null."); }
@@ -1247,21 +6510,28 @@ static void saveToRIL(const ImageDesc & desc, std::ostream & stream, const void
     auto planeArraySize = desc.planes.size() * sizeof(desc.planes[0]);
 
     // write file tag
-    RILFileTag tag(1);
+    RILFileTag tag(2);
     stream.write((const char *) &tag, sizeof(tag));
 
-    // write file header
-    RILHeaderV1 header;
-    header.size      = desc.size;
-    header.ranks     = desc.ranks;
-    header.faces     = desc.faces;
-    header.levels    = desc.levels;
-    header.alignment = desc.alignment;
+    // write file header. The pixel array is aligned to both the requested alignment and the image alignment.
+    RILHeaderV2 header;
+    header.size             = desc.size;
+    header.ranks            = desc.ranks;
+    header.faces            = desc.faces;
+    header.levels           = desc.levels;
+    header.alignment        = desc.alignment;
+    header.payloadAlignment = (uint32_t) std::lcm(std::max<size_t>(1, payloadAlignment), std::max<size_t>(1, desc.alignment));
+    header.payloadOffset    = rii_details::nextMultiple<uint64_t>(header.offset + planeArraySize, header.payloadAlignment);
+    header.checksum         = xxh64(pixels, desc.size);
     stream.write((const char *) &header, sizeof(header));
 
     // write plane array
     stream.write((const char *) desc.planes.data(), (std::streamsize) planeArraySize);
 
+    // write padding
+    std::vector<char> padding((size_t) (header.payloadOffset - header.offset - planeArraySize), 0);
+    stream.write(padding.data(), (std::streamsize) padding.size());
+
     // write pixel array
     stream.write((const char *) pixels, (std::streamsize) desc.size);
 }
@@ -1468,35 +6738,38 @@ static PixelFormat getPixelFormatFromDDPF(const DDPixelFormat & ddpf) {
 
 // ---------------------------------------------------------------------------------------------------------------------
 //
-ImageDesc::AlignedUniquePtr ImageDesc::loadFromDDS(std::istream & stream, const char * name) {
+/// Read headers of a DDS file. On success, the stream is left at the start of the pixel array.
+/// \param bgr2rgb Returns true if the pixels are stored as BGRX and need their red and blue channels swapped.
+static bool readDDSDesc(std::istream & stream, const char * name, ImageDesc & result, bool & bgr2rgb) {
     // read file header
     DDSFileHeader header;
-    if (!checkedRead(stream, name, "read DDS header", &header, sizeof(header))) return {};
+    if (!checkedRead(stream, name, "read DDS header", &header, sizeof(header))) return false;
     constexpr uint32_t required_flags = DDS_DDSD_WIDTH | DDS_DDSD_HEIGHT;
     if (required_flags != (required_flags & header.flags)) {
         RAPID_IMAGE_LOGE("failed to load DDS image from input stream (%s): damage DDS header!", name);
-        return {};
+        return false;
     }
     if (DDS_DDPF_PALETTEINDEXED8 & header.ddpf.flags) {
         RAPID_IMAGE_LOGE("failed to load DDS image from input stream (%s): do not support palette format!", name);
-        return {};
+        return false;
     }
 
     // get image format
-    PixelFormat format;
-    if (MAKE_FOURCC('D', 'X', '1', '0') == header.ddpf.fourcc) {
+    PixelFormat   format;
+    DDSHeaderDX10 dx10 {};
+    bool          hasDX10 = MAKE_FOURCC('D', 'X', '1', '0') == header.ddpf.fourcc;
+    if (hasDX10) {
         // read DX10 info
-        DDSHeaderDX10 dx10;
-        if (!checkedRead(stream, name, "read DX10 info", &dx10, sizeof(dx10))) return {};
+        if (!checkedRead(stream, name, "read DX10 info", &dx10, sizeof(dx10))) return false;
         format = PixelFormat::fromDXGI(dx10.format);
-        if (!format.valid()) return {};
+        if (!format.valid()) return false;
     } else {
         format = getPixelFormatFromDDPF(header.ddpf);
-        if (!format.valid()) return {};
+        if (!format.valid()) return false;
     }
 
     // BGRX_8888 format is not compatible with D3D10/D3D11 hardware. So we need to convert it to RGB format.
-    bool bgr2rgb = false;
+    bgr2rgb = false;
     if (PixelFormat::LAYOUT_8_8_8_8 == format.layout && PixelFormat::SWIZZLE_Z == format.swizzle0 && PixelFormat::SWIZZLE_Y == format.swizzle1 &&
         PixelFormat::SWIZZLE_X == format.swizzle2) {
         format.swizzle0 = PixelFormat::SWIZZLE_X;
@@ -1505,9 +6778,13 @@ ImageDesc::AlignedUniquePtr ImageDesc::loadFromDDS(std::istream & stream, const
         bgr2rgb         = true;
     }
 
-    // check image dimension (TODO: array texture)
-    uint32_t layers = 0;
-    if (DDS_DDSD_DEPTH & header.flags && DDS_CAPS_COMPLEX & header.caps && DDS_CAPS2_VOLUME & header.caps2) {
+    // check image dimension
+    uint32_t arraySize = 1;
+    uint32_t layers    = 0;
+    if (hasDX10) {
+        arraySize = std::max(1u, dx10.arraySize);
+        layers = (dx10.miscFlag & 0x4) ? 6 : 1; // D3D10_RESOURCE_MISC_TEXTURECUBE
+    } else if (DDS_DDSD_DEPTH & header.flags && DDS_CAPS_COMPLEX & header.caps && DDS_CAPS2_VOLUME & header.caps2) {
         layers = 1; // volume texture
     } else if (DDS_CAPS_COMPLEX & header.caps && DDS_CAPS2_CUBEMAP & header.caps2 &&
                DDS_CAPS2_CUBEMAP_ALLFACES == (header.caps2 & DDS_CAPS2_CUBEMAP_ALLFACES)) {
@@ -1516,7 +6793,7 @@ ImageDesc::AlignedUniquePtr ImageDesc::loadFromDDS(std::istream & stream, const
         layers = 1; // 2D texture
     } else {
         RAPID_IMAGE_LOGE("failed to load DDS image from input stream (%s): Fail to detect image face count!", name);
-        return {};
+        return false;
     }
     uint32_t width  = header.width;
     uint32_t height = header.height;
@@ -1527,9 +6804,22 @@ ImageDesc::AlignedUniquePtr ImageDesc::loadFromDDS(std::istream & stream, const
     uint32_t mipLevels = hasMipmap ? header.mipCount : 1;
     if (0 == mipLevels) mipLevels = 1;
 
-    // Now we have everything we need to create the image descriptor. Note that DDS image's pixel data is always aligned to 4 bytes.
-    auto desc = ImageDesc::make(PlaneDesc::make(format, {width, height, depth}), 1, layers, mipLevels, ImageDesc::FACE_MAJOR, 4);
-    RII_ASSERT(desc.valid());
+    // Now we have everything we need to create the image descriptor. Rows of uncompressed DDS pixels are byte packed:
+    // (width * bitsPerPixel + 7) / 8 bytes each, with no padding between rows or planes.
+    const auto & ld        = format.layoutDesc();
+    size_t       alignment = (ld.blockWidth > 1 || ld.blockHeight > 1) ? 4 : 1;
+    auto         base      = PlaneDesc::make(format, {width, height, depth}, 0, 0, 0, alignment);
+    result                 = ImageDesc::make(base, arraySize, layers, mipLevels, ImageDesc::FACE_MAJOR, alignment);
+    RII_ASSERT(result.valid());
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+ImageDesc::AlignedUniquePtr ImageDesc::loadFromDDS(std::istream & stream, const char * name) {
+    ImageDesc desc;
+    bool      bgr2rgb;
+    if (!readDDSDesc(stream, name, desc, bgr2rgb)) return {};
 
     // Read pixel data
     auto pixels = AlignedUniquePtr((uint8_t *) rii_details::aalloc(desc.alignment, desc.size));
@@ -1537,9 +6827,14 @@ ImageDesc::AlignedUniquePtr ImageDesc::loadFromDDS(std::istream & stream, const
 
     // bgr -> rgb
     if (bgr2rgb) {
-        auto   p          = pixels.get();
-        size_t pixelCount = desc.size / 4;
-        for (uint32_t i = 0; i < pixelCount; ++i, p += 4) { std::swap(p[0], p[2]); }
+        auto p = pixels.get();
+        parallelForRows(desc, [&](size_t plane, uint32_t z, uint32_t y0, uint32_t y1) {
+            const auto & pd = desc.planes[plane];
+            for (uint32_t y = y0; y < y1; ++y) {
+                auto row = p + pd.pixel(0, y, z);
+                for (uint32_t x = 0; x < pd.desc.extent.w; ++x, row += pd.desc.step) std::swap(row[0], row[2]);
+            }
+        });
     }
 
     // done
@@ -1548,10 +6843,115 @@ ImageDesc::AlignedUniquePtr ImageDesc::loadFromDDS(std::istream & stream, const
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
-//
-static void saveToDDS(const ImageDesc &, std::ostream &, const void *) {
-    //
-    RII_REQUIRE(false, "not implemented yet.");
+/// Find the legacy pixel format structure of the format. Only the plain RGB, luminance and alpha formats are written
+/// with legacy header, since they are understood by every DDS reader. Everything else is written with DX10 header.
+static const DDPixelFormat * getDDPFFromPixelFormat(PixelFormat format) {
+    for (const auto & d : s_ddpfDescTable) {
+        if (d.format != format) continue;
+        if (0 == (d.ddpf.flags & ~(DDS_DDPF_RGB | DDS_DDPF_LUMINANCE | DDS_DDPF_ALPHA | DDS_DDPF_ALPHAPIXELS))) return &d.ddpf;
+    }
+    return nullptr;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Write DDS header, then every plane in DDS order (rank, then face, then level). Rows are written straight from the
+/// pixel array, byte packed with no padding, which is the pitch DDS readers expect of uncompressed data. Planes that are
+/// packed the same way as in the file are written with one call.
+static void saveToDDS(const ImageDesc & desc, std::ostream & stream, const void * pixels) {
+    if (desc.empty() || !desc.valid()) { RII_THROW("Can't save empty or invalid image."); }
+    if (!stream) { RII_THROW("failed to write image to stream: stream is not good."); }
+    if (!pixels) { RII_THROW("failed to write image to stream: pixel array is null."); }
+
+    const auto & base = desc.plane();
+    const auto & ld   = base.format.layoutDesc();
+    bool         cube = 6 == desc.faces;
+
+    // Legacy header can't store arrays. Faces other than cube map's 6 are stored as array elements too.
+    const DDPixelFormat * ddpf  = (1 == desc.ranks && (1 == desc.faces || cube)) ? getDDPFFromPixelFormat(base.format) : nullptr;
+    uint32_t              dxgi  = ddpf ? 0 : base.format.toDXGI();
+    bool                  dx10  = nullptr == ddpf;
+    auto                  bytes = [&](const PlaneDesc & p) { return (uint32_t) ((p.extent.w + ld.blockWidth - 1) / ld.blockWidth) * ld.blockBytes; };
+    if (dx10 && 0 == dxgi) { RII_THROW("failed to write image to DDS stream: pixel format %s is not supported by DDS.", base.format.toString().c_str()); }
+
+    // write file header
+    DDSFileHeader header {};
+    header.magic  = MAKE_FOURCC('D', 'D', 'S', ' ');
+    header.size   = sizeof(DDSFileHeader) - sizeof(header.magic);
+    header.flags  = DDS_DDSD_CAPS | DDS_DDSD_HEIGHT | DDS_DDSD_WIDTH | DDS_DDSD_PIXELFORMAT;
+    header.height = base.extent.h;
+    header.width  = base.extent.w;
+    if (ld.blockWidth > 1 || ld.blockHeight > 1) {
+        header.flags |= 0x00080000; // DDSD_LINEARSIZE
+        header.pitchOrLinearSize = bytes(base) * ((base.extent.h + ld.blockHeight - 1) / ld.blockHeight);
+    } else {
+        header.flags |= 0x00000008; // DDSD_PITCH
+        header.pitchOrLinearSize = bytes(base);
+    }
+    header.caps = DDS_CAPS_TEXTURE;
+    if (base.extent.d > 1) {
+        header.flags |= DDS_DDSD_DEPTH;
+        header.depth = base.extent.d;
+        header.caps |= DDS_CAPS_COMPLEX;
+        header.caps2 |= DDS_CAPS2_VOLUME;
+    }
+    if (desc.levels > 1) {
+        header.flags |= DDS_DDSD_MIPMAPCOUNT;
+        header.mipCount = desc.levels;
+        header.caps |= DDS_CAPS_COMPLEX | DDS_CAPS_MIPMAP;
+    }
+    if (cube) {
+        header.caps |= DDS_CAPS_COMPLEX;
+        header.caps2 |= DDS_CAPS2_CUBEMAP | DDS_CAPS2_CUBEMAP_ALLFACES;
+    }
+    if (ddpf) {
+        header.ddpf = *ddpf;
+    } else {
+        header.ddpf.size   = DDS_DDPF_SIZE;
+        header.ddpf.flags  = DDS_DDPF_FOURCC;
+        header.ddpf.fourcc = MAKE_FOURCC('D', 'X', '1', '0');
+    }
+    stream.write((const char *) &header, sizeof(header));
+
+    // write DX10 header
+    if (dx10) {
+        DDSHeaderDX10 h10 {};
+        h10.format    = dxgi;
+        h10.dimension = base.extent.d > 1 ? DDSHeaderDX10::TEXTURE3D : (1 == base.extent.h && !cube) ? DDSHeaderDX10::TEXTURE1D : DDSHeaderDX10::TEXTURE2D;
+        h10.miscFlag  = cube ? 0x4 : 0; // D3D10_RESOURCE_MISC_TEXTURECUBE
+        h10.arraySize = cube ? desc.ranks : desc.ranks * desc.faces;
+        stream.write((const char *) &h10, sizeof(h10));
+    }
+
+    // write pixels
+    auto              src = (const uint8_t *) pixels;
+    std::vector<char> row; // only used by planes with gaps between pixels.
+    for (uint32_t r = 0; r < desc.ranks; ++r) {
+        for (uint32_t f = 0; f < desc.faces; ++f) {
+            for (uint32_t l = 0; l < desc.levels; ++l) {
+                const auto & p         = desc.planes[desc.index(r, f, l)];
+                auto         rowBytes = bytes(p.desc);
+                auto         rows     = (p.desc.extent.h + ld.blockHeight - 1) / ld.blockHeight;
+                auto         plane    = src + p.offset;
+                if (p.desc.step == ld.blockBytes && p.desc.pitch == rowBytes && p.desc.slice == rowBytes * rows) {
+                    stream.write((const char *) plane, (std::streamsize) p.desc.size);
+                    continue;
+                }
+                for (uint32_t z = 0; z < p.desc.extent.d; ++z) {
+                    for (uint32_t y = 0; y < rows; ++y) {
+                        auto line = plane + z * p.desc.slice + y * p.desc.pitch;
+                        if (p.desc.step == ld.blockBytes) {
+                            stream.write((const char *) line, rowBytes);
+                        } else {
+                            row.resize(rowBytes);
+                            for (uint32_t x = 0; x < rowBytes / ld.blockBytes; ++x) memcpy(&row[x * ld.blockBytes], line + x * p.desc.step, ld.blockBytes);
+                            stream.write(row.data(), rowBytes);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    if (!stream) { RII_THROW("failed to write image to DDS stream: stream is not good."); }
 }
 
 // *********************************************************************************************************************
@@ -1704,7 +7104,7 @@ ImageDesc & ImageDesc::reset(const PlaneDesc & baseMap, size_t arrayLength_, siz
                 if (mip.desc.extent.w > 1) mip.desc.extent.w >>= 1;
                 if (mip.desc.extent.h > 1) mip.desc.extent.h >>= 1;
                 if (mip.desc.extent.d > 1) mip.desc.extent.d >>= 1;
-                mip.desc = PlaneDesc::make(mip.desc.format, mip.desc.extent, mip.desc.step, 0, 0);
+                mip.desc = PlaneDesc::make(mip.desc.format, mip.desc.extent, mip.desc.step, 0, 0, mip.desc.alignment);
             }
         }
     } else {
@@ -1721,123 +7121,414 @@ ImageDesc & ImageDesc::reset(const PlaneDesc & baseMap, size_t arrayLength_, siz
                     if (mip.desc.extent.w > 1) mip.desc.extent.w >>= 1;
                     if (mip.desc.extent.h > 1) mip.desc.extent.h >>= 1;
                     if (mip.desc.extent.d > 1) mip.desc.extent.d >>= 1;
-                    mip.desc = PlaneDesc::make(mip.desc.format, mip.desc.extent, mip.desc.step, 0, 0);
+                    mip.desc = PlaneDesc::make(mip.desc.format, mip.desc.extent, mip.desc.step, 0, 0, mip.desc.alignment);
                 }
             }
         }
     }
 
-    size = offset;
+    size = offset;
+
+    // done
+    RII_ASSERT(valid());
+    return *this;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+ImageDesc & ImageDesc::set2D(PixelFormat format, size_t width, size_t height, size_t levels_, ConstructionOrder order, size_t planeOffsetAlignment) {
+    auto baseMap = PlaneDesc::make(format, {(uint32_t) width, (uint32_t) height, 1});
+    return reset(baseMap, 1, 1, levels_, order, planeOffsetAlignment);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+ImageDesc & ImageDesc::setCube(PixelFormat format, size_t width, size_t levels_, ConstructionOrder order, size_t planeOffsetAlignment) {
+    auto baseMap = PlaneDesc::make(format, {(uint32_t) width, (uint32_t) width, 1});
+    return reset(baseMap, 1, 6, levels_, order, planeOffsetAlignment);
+}
+
+namespace rii_details {
+
+/// Read the leading bytes of a stream once, and find the codec that recognizes them. The codec then reads the image
+/// from replay, which gives the header bytes back in front of the rest of the stream.
+struct CodecDispatch {
+    uint8_t                           header[ImageCodec::MAX_HEADER_SIZE];
+    size_t                            headerSize;
+    std::shared_ptr<const ImageCodec> codec;
+    ReplayStreamBuf                   buf;
+    std::istream                      replay;
+
+    CodecDispatch(std::istream & source, const char * name)
+        : headerSize((size_t) source.read((char *) header, sizeof(header)).gcount()), codec(ImageCodec::detect(header, headerSize)),
+          buf(header, headerSize, source.rdbuf()), replay(&buf) {
+        if (!codec) RAPID_IMAGE_LOGE("failed to read image %s from stream: unsupported/unrecognized file format.", name);
+    }
+
+    /// Pass read errors back to the source stream. When the image is shorter than the header, leave the source right
+    /// after it, if the source can seek.
+    void finish(std::istream & source, bool succeeded) {
+        if (!replay) source.setstate(std::ios::failbit);
+        if (succeeded && buf.remaining()) {
+            source.clear();
+            if (!source.seekg(-(std::streamoff) buf.remaining(), std::ios::cur)) source.clear();
+        }
+    }
+};
+
+} // namespace rii_details
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+ImageDesc::AlignedUniquePtr ImageDesc::load(std::istream & stream, const char * name) {
+    if (!name || !name[0]) name = "<unnamed>";
+
+    if (!stream) {
+        RAPID_IMAGE_LOGE("failed to load image %s from istream: the input stream is not in good state.", name);
+        return {};
+    }
+
+    // The stream is read once and never seeked back. See ImageCodec.
+    rii_details::CodecDispatch dispatch(stream, name);
+    if (!dispatch.codec) return {};
+    ImageDesc desc;
+    auto      pixels = dispatch.codec->load(desc, dispatch.replay, name);
+    dispatch.finish(stream, !!pixels);
+    if (!pixels) return {};
+    *this = std::move(desc);
+    return pixels;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+bool ImageDesc::probe(std::istream & stream, const char * name) {
+    if (!name || !name[0]) name = "<unnamed>";
+
+    if (!stream) {
+        RAPID_IMAGE_LOGE("failed to probe image %s from istream: the input stream is not in good state.", name);
+        return false;
+    }
+
+    rii_details::CodecDispatch dispatch(stream, name);
+    if (!dispatch.codec) return false;
+    ImageDesc desc;
+    bool      succeeded;
+    if (dispatch.codec->probe) {
+        succeeded = dispatch.codec->probe(desc, dispatch.replay, name);
+    } else {
+        // The codec can't read its header alone. Load the whole image then.
+        succeeded = !!dispatch.codec->load(desc, dispatch.replay, name);
+    }
+    dispatch.finish(stream, false);
+    if (!succeeded) return false;
+    *this = std::move(desc);
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+bool ImageDesc::probe(const void * data, size_t size_, const char * name) {
+    if (!data || !size_) return false;
+    rii_details::MemoryStreamBuf buf(data, size_);
+    std::istream                 stream(&buf);
+    return probe(stream, name);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+bool ImageDesc::probe(const std::string & path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        RAPID_IMAGE_LOGE("Failed to open image file %s : errno=%d", path.c_str(), errno);
+        return false;
+    }
+    return probe(file, path.c_str());
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+std::vector<ImageCodec> ImageCodec::builtIns() {
+    std::vector<ImageCodec> codecs;
+
+#ifdef STBI_INCLUDE_STB_IMAGE_H
+    // stb_image.h sniffs the formats by itself. So it takes anything that no other codec claims.
+    ImageCodec stb;
+    stb.name       = "stb_image";
+    stb.extensions = {".png", ".jpg", ".jpeg", ".bmp", ".tga", ".gif", ".psd", ".hdr", ".pic", ".pnm"};
+    stb.match      = [](const uint8_t *, size_t) { return true; };
+    stbi_io_callbacks io = {};
+    io.read              = [](void * user, char * data, int size_) -> int {
+        auto fp = (std::istream *) user;
+        fp->read(data, size_);
+        return (int) fp->gcount();
+    };
+    io.skip = [](void * user, int n) {
+        auto fp = (std::istream *) user;
+        fp->ignore(n);
+    };
+    io.eof = [](void * user) -> int {
+        auto fp = (std::istream *) user;
+        return fp->eof();
+    };
+    stb.load = [io](ImageDesc & desc, std::istream & stream, const char *) -> ImageDesc::AlignedUniquePtr {
+        int  x, y, n;
+        auto data = stbi_load_from_callbacks(&io, &stream, &x, &y, &n, 4); // TODO: hdr/grayscale support
+        if (!data) return {};
+        desc = ImageDesc::make(PlaneDesc::make(PixelFormat::RGBA_8_8_8_8_UNORM(), {(uint32_t) x, (uint32_t) y}));
+        RII_ASSERT(desc.valid());
+
+        // copy pixel data to memory aligned buffer
+        auto pixels = ImageDesc::AlignedUniquePtr((uint8_t *) rii_details::aalloc(desc.alignment, desc.size));
+        memcpy(pixels.get(), data, desc.size);
+        stbi_image_free(data);
+        return pixels;
+    };
+    stb.probe = [io](ImageDesc & desc, std::istream & stream, const char *) {
+        int x, y, n;
+        if (!stbi_info_from_callbacks(&io, &stream, &x, &y, &n)) return false;
+        desc = ImageDesc::make(PlaneDesc::make(PixelFormat::RGBA_8_8_8_8_UNORM(), {(uint32_t) x, (uint32_t) y})); // load() always returns RGBA8.
+        return true;
+    };
+    codecs.push_back(std::move(stb));
+#endif
+
+    ImageCodec dds;
+    dds.name       = "dds";
+    dds.extensions = {".dds"};
+    dds.match      = [](const uint8_t * header, size_t size) { return size >= 4 && 0 == memcmp(header, "DDS ", 4); };
+    dds.load       = [](ImageDesc & desc, std::istream & stream, const char * name) { return desc.loadFromDDS(stream, name); };
+    dds.probe      = [](ImageDesc & desc, std::istream & stream, const char * name) {
+        bool bgr2rgb;
+        return readDDSDesc(stream, name, desc, bgr2rgb);
+    };
+    dds.save       = [](const ImageDesc & desc, std::ostream & stream, const void * pixels) { saveToDDS(desc, stream, pixels); };
+    codecs.push_back(std::move(dds));
+
+    ImageCodec ril;
+    ril.name       = "ril";
+    ril.extensions = {".ril"};
+    ril.match      = [](const uint8_t * header, size_t size) {
+        RILFileTag tag;
+        if (size < sizeof(tag)) return false;
+        memcpy((void *) &tag, header, sizeof(tag));
+        return tag.valid();
+    };
+    ril.load  = [](ImageDesc & desc, std::istream & stream, const char * name) { return desc.loadFromRIL(stream, name); };
+    ril.probe = [](ImageDesc & desc, std::istream & stream, const char * name) {
+        uint32_t version;
+        uint64_t checksum;
+        return readRILDesc(stream, name, desc, version, checksum);
+    };
+    ril.save = [](const ImageDesc & desc, std::ostream & stream, const void * pixels) {
+        saveToRIL(desc, stream, pixels, ImageDesc::SaveToStreamParameters().payloadAlignment);
+    };
+    codecs.push_back(std::move(ril));
+
+    return codecs;
+}
+
+namespace rii_details {
+
+/// All registered codecs. The latest one is matched first.
+struct CodecRegistry {
+    std::mutex                                     mutex;
+    std::vector<std::shared_ptr<const ImageCodec>> codecs;
+    std::vector<std::shared_ptr<const ImageCodec>> builtIns; ///< the codecs the registry starts with. Never modified after that.
+
+    template<typename PREDICATE>
+    std::shared_ptr<const ImageCodec> find(PREDICATE predicate) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = codecs.rbegin(); it != codecs.rend(); ++it) {
+            if (predicate(**it)) return *it;
+        }
+        return {};
+    }
+};
+
+} // namespace rii_details
 
-    // done
-    RII_ASSERT(valid());
-    return *this;
+// ---------------------------------------------------------------------------------------------------------------------
+//
+static rii_details::CodecRegistry & codecRegistry() {
+    static rii_details::CodecRegistry * registry = [] {
+        auto r = new rii_details::CodecRegistry(); // never deleted, so it can be used while other statics are destroyed.
+        for (auto & c : ImageCodec::builtIns()) r->codecs.push_back(std::make_shared<const ImageCodec>(std::move(c)));
+        r->builtIns = r->codecs;
+        return r;
+    }();
+    return *registry;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Return the codec if it can save, and isn't one the registry started with. ImageDesc::save() writes the built-in
+/// formats by itself, since their codecs can't take the save parameters.
+static std::shared_ptr<const ImageCodec> customSaver(std::shared_ptr<const ImageCodec> codec) {
+    if (!codec || !codec->save) return {};
+    const auto & builtIns = codecRegistry().builtIns;
+    if (std::find(builtIns.begin(), builtIns.end(), codec) != builtIns.end()) return {};
+    return codec;
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 //
-ImageDesc & ImageDesc::set2D(PixelFormat format, size_t width, size_t height, size_t levels_, ConstructionOrder order, size_t planeOffsetAlignment) {
-    auto baseMap = PlaneDesc::make(format, {(uint32_t) width, (uint32_t) height, 1});
-    return reset(baseMap, 1, 1, levels_, order, planeOffsetAlignment);
+void ImageCodec::registerCodec(ImageCodec codec) {
+    if (!codec.match || !codec.load) RII_THROW("codec %s must have both match() and load() functions.", codec.name.c_str());
+    auto &                      r = codecRegistry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.codecs.erase(std::remove_if(r.codecs.begin(), r.codecs.end(), [&](const auto & c) { return c->name == codec.name; }), r.codecs.end());
+    r.codecs.push_back(std::make_shared<const ImageCodec>(std::move(codec)));
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 //
-ImageDesc & ImageDesc::setCube(PixelFormat format, size_t width, size_t levels_, ConstructionOrder order, size_t planeOffsetAlignment) {
-    auto baseMap = PlaneDesc::make(format, {(uint32_t) width, (uint32_t) width, 1});
-    return reset(baseMap, 1, 6, levels_, order, planeOffsetAlignment);
+std::shared_ptr<const ImageCodec> ImageCodec::find(const std::string & name) {
+    return codecRegistry().find([&](const ImageCodec & c) { return c.name == name; });
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 //
-ImageDesc::AlignedUniquePtr ImageDesc::load(std::istream & stream, const char * name) {
-    if (!name || !name[0]) name = "<unnamed>";
+std::shared_ptr<const ImageCodec> ImageCodec::findByExtension(const std::string & extension) {
+    return codecRegistry().find([&](const ImageCodec & c) { return std::find(c.extensions.begin(), c.extensions.end(), extension) != c.extensions.end(); });
+}
 
-    if (!stream) {
-        RAPID_IMAGE_LOGE("failed to load image %s from istream: the input stream is not in good state.", name);
+// ---------------------------------------------------------------------------------------------------------------------
+//
+std::shared_ptr<const ImageCodec> ImageCodec::detect(const void * header, size_t size) {
+    if (!header) size = 0;
+    size = std::min(size, MAX_HEADER_SIZE);
+    return codecRegistry().find([&](const ImageCodec & c) { return c.match((const uint8_t *) header, size); });
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+ImageDesc::AlignedUniquePtr ImageDesc::load(const void * data_, size_t size_, const char * name) {
+    if (!data_ || !size_) {
+        RAPID_IMAGE_LOGW("load image (%s) from null or zero size data returns empty image.", name ? name : "unnamed");
         return {};
     }
+    rii_details::MemoryStreamBuf buf(data_, size_);
+    std::istream                 stream(&buf);
+    return load(stream, name);
+}
 
-    // store current stream position
-    auto begin = stream.tellg();
-
-    // check if the file is RIL or not.
-    RILFileTag rilTag;
-    if (checkedRead(stream, name, "read RIL image tag", &rilTag, sizeof(rilTag)) && rilTag.valid()) {
-        stream.seekg(begin, std::ios::beg);
-        return loadFromRIL(stream, name);
+// ---------------------------------------------------------------------------------------------------------------------
+//
+bool ImageDesc::generateMipmaps(void * pixels, const PlaneDesc::GenerateMipmapsParameters & params) const {
+    if (empty() || !pixels) return false;
+    for (const auto & p : planes) {
+        const auto & ld = p.desc.format.layoutDesc();
+        if (ld.blockWidth > 1 || ld.blockHeight > 1) {
+            RAPID_IMAGE_LOGE("Can't generate mipmaps for compressed format %s.", p.desc.format.toString().c_str());
+            return false;
+        }
     }
 
-    // try read as DDS
-    uint32_t ddsTag = 0;
-    stream.seekg(begin, std::ios::beg);
-    if (checkedRead(stream, name, "read DDS image tag", &ddsTag, sizeof(ddsTag)) && 0x20534444 == ddsTag) {
-        stream.seekg(begin, std::ios::beg);
-        return loadFromDDS(stream, name);
+    auto bytes = (uint8_t *) pixels;
+    if (PlaneDesc::GenerateMipmapsParameters::BOX != params.filter || params.gammaCorrect) {
+        rii_details::generateFilteredMipmaps(*this, bytes, params);
+        return true;
+    }
+    if (params.fused) {
+        rii_details::generateFusedMipmaps(*this, bytes, params);
+        return true;
     }
 
-#ifdef STBI_INCLUDE_STB_IMAGE_H
-    // try load using stb_image.h
-    {
-        stream.seekg(begin, std::ios::beg);
-        stbi_io_callbacks io = {};
-        io.read              = [](void * user, char * data, int size_) -> int {
-            auto fp = (std::istream *) user;
-            fp->read(data, size_);
-            return (int) fp->gcount();
-        };
-        io.skip = [](void * user, int n) {
-            auto fp = (std::istream *) user;
-            fp->seekg(n, std::ios::cur);
-        };
-        io.eof = [](void * user) -> int {
-            auto fp = (std::istream *) user;
-            return fp->eof();
-        };
-        int  x, y, n;
-        auto data = stbi_load_from_callbacks(&io, &stream, &x, &y, &n, 4); // TODO: hdr/grayscale support
-        if (data) {
-            auto desc = ImageDesc::make(PlaneDesc::make(PixelFormat::RGBA_8_8_8_8_UNORM(), {(uint32_t) x, (uint32_t) y}));
-            RII_ASSERT(desc.valid());
-
-            // copy pixel data to memory aligned buffer
-            auto pixels = AlignedUniquePtr((uint8_t *) rii_details::aalloc(desc.alignment, desc.size));
-            memcpy(pixels.get(), data, desc.size);
-            stbi_image_free(data);
-
-            // done
-            *this = std::move(desc);
-            return pixels;
+    // Each level is split into tiles of rows. Tiles should be large enough to amortize the scheduling cost, while small
+    // enough to keep all threads busy even when there are only a few faces and ranks.
+    constexpr size_t MIN_PIXELS_PER_TILE = 16 * 1024;
+    struct Tile {
+        size_t   dst, src; // plane indices
+        uint32_t z, y0, y1;
+    };
+    std::vector<Tile> tiles;
+    for (size_t l = 1; l < levels; ++l) {
+        tiles.clear();
+        for (size_t r = 0; r < ranks; ++r) {
+            for (size_t f = 0; f < faces; ++f) {
+                auto         dst         = index(r, f, l);
+                const auto & e           = planes[dst].desc.extent;
+                auto         rowsPerTile = (uint32_t) std::max<size_t>(1, MIN_PIXELS_PER_TILE / e.w);
+                for (uint32_t z = 0; z < e.d; ++z) {
+                    for (uint32_t y = 0; y < e.h; y += rowsPerTile) tiles.push_back({dst, index(r, f, l - 1), z, y, std::min(y + rowsPerTile, e.h)});
+                }
+            }
         }
+        rii_details::parallelFor(tiles.size(), params.threads, params.executor, [&](size_t i) {
+            const auto & t   = tiles[i];
+            const auto & dst = planes[t.dst];
+            const auto & src = planes[t.src];
+            rii_details::generateMipmapRows(bytes + dst.offset, dst.desc, bytes + src.offset, src.desc, t.z, t.y0, t.y1);
+        });
     }
-#else
-    // TODO: remind user to include stb_image.h
-#endif
-
-    // Have tried everything w/o luck.
-    RAPID_IMAGE_LOGE("failed to read image %s from stream: unsupported/unrecognized file format.", name);
-    return {};
+    return true;
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 //
-ImageDesc::AlignedUniquePtr ImageDesc::load(const void * data_, size_t size_, const char * name) {
-    if (!data_ || !size_) {
-        RAPID_IMAGE_LOGW("load image (%s) from null or zero size data returns empty image.", name ? name : "unnamed");
+RII_API Image ImageDesc::compress(const void * pixels, PixelFormat format_, const PlaneDesc::CompressParameters & params) const {
+    if (empty() || !pixels) return {};
+    rii_details::BlockEncoder encoder(format_, params);
+    if (!encoder.valid()) {
+        RAPID_IMAGE_LOGE("Compressing to %s is not supported yet.", format_.toString().c_str());
         return {};
     }
-    auto str = std::string((const char *) data_, size_);
-    auto iss = std::istringstream(str);
-    return load(iss, name);
+
+    // keep the plane order of this image: with MIP_MAJOR, face 1 of level 0 comes before level 1 of face 0.
+    auto order  = (faces > 1 && levels > 1 && planes[index(0, 1, 0)].offset < planes[index(0, 0, 1)].offset) ? MIP_MAJOR : FACE_MAJOR;
+    auto result = Image(ImageDesc::make(PlaneDesc::make(format_, planes[0].desc.extent), ranks, faces, levels, order));
+
+    // 8-byte blocks leave padding between the small planes. Clear it, so that the same pixels always give the same bits.
+    memset(result.data(), 0, result.size());
+
+    // then compress all planes in one go.
+    std::vector<rii_details::CompressTarget> targets;
+    targets.reserve(planes.size());
+    for (size_t i = 0; i < planes.size(); ++i) {
+        const auto & src = planes[i];
+        const auto & dst = result.desc().planes[i];
+        if (src.desc.extent != dst.desc.extent) {
+            RAPID_IMAGE_LOGE("Can't compress plane %zu: its extent doesn't follow the mipmap chain of the base map.", i);
+            return {};
+        }
+        targets.push_back({src.desc, (const uint8_t *) pixels + src.offset, dst.desc, result.data() + dst.offset});
+    }
+    if (!rii_details::compressPlanes(encoder, targets, params)) return {};
+    return result;
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 //
 void ImageDesc::save(const SaveToStreamParameters & params, std::ostream & stream, const void * pixels) const {
     if (!stream) { RII_THROW("failed to save image to stream: the output stream is not in good state."); }
+
+    // a codec registered in place of a built-in one saves the format instead.
+    std::shared_ptr<const ImageCodec> codec;
+    switch (params.format) {
+    case RIL:
+        codec = ImageCodec::find("ril");
+        break;
+    case DDS:
+        codec = ImageCodec::find("dds");
+        break;
+    case JPG:
+        codec = ImageCodec::findByExtension(".jpg");
+        break;
+    case PNG:
+        codec = ImageCodec::findByExtension(".png");
+        break;
+    case BMP:
+        codec = ImageCodec::findByExtension(".bmp");
+        break;
+    }
+    if (auto custom = customSaver(codec)) {
+        custom->save(*this, stream, pixels);
+        if (!stream) { RII_THROW("failed to save image to stream: the output stream is not in good state."); }
+        return;
+    }
+
     switch (params.format) {
     case RIL:
-        saveToRIL(*this, stream, pixels);
+        saveToRIL(*this, stream, pixels, params.payloadAlignment);
         break;
     case DDS:
         saveToDDS(*this, stream, pixels);
@@ -1893,7 +7584,12 @@ void ImageDesc::save(const std::string & filename, const void * pixels) const {
     // determine file format from file extension
     auto ext = std::filesystem::path(filename).extension().string();
     std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return (char) tolower(c); });
-    if (".ril" == ext) {
+    if (auto codec = customSaver(ImageCodec::findByExtension(ext))) {
+        // a registered codec, including one that replaces a built-in format.
+        auto file = openFileStream();
+        codec->save(*this, file, pixels);
+        if (!file) { RII_THROW("failed to save image to file %s.", filename.c_str()); }
+    } else if (".ril" == ext) {
         auto file = openFileStream();
         save({RIL}, file, pixels);
     } else if (".dds" == ext) {
@@ -1945,7 +7641,12 @@ Image::Image(const ImageDesc & desc, const void * initialContent, size_t initial
 // ---------------------------------------------------------------------------------------------------------------------
 //
 void Image::clear() {
-    rii_details::afree(_proxy.data);
+    if (mapped()) {
+        rii_details::unmapFileView(_mapping.base, _mapping.size);
+        _mapping = {};
+    } else {
+        rii_details::afree(_proxy.data);
+    }
     _proxy.data = nullptr;
     _proxy.desc = {};
     RII_ASSERT(empty());
@@ -1955,7 +7656,12 @@ void Image::clear() {
 //
 bool Image::construct(const void * initialContent, size_t initialContentSizeInbytes) {
     // clear old image data.
-    rii_details::afree(_proxy.data);
+    if (mapped()) {
+        rii_details::unmapFileView(_mapping.base, _mapping.size);
+        _mapping = {};
+    } else {
+        rii_details::afree(_proxy.data);
+    }
     _proxy.data = nullptr;
 
     // deal with empty image
@@ -2009,6 +7715,469 @@ Image Image::load(const void * data, size_t size, const char * name) {
     return r;
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+//
+ImageProxy ImageProxy::view(const void * data, size_t size, const char * name) {
+    if (!name || !name[0]) name = "<unnamed>";
+    if (!data) return {};
+
+    // Parse the header in place, to find where the pixel array is.
+    rii_details::MemoryStreamBuf buf(data, size);
+    std::istream                 stream(&buf);
+    RILFileTag                   tag;
+    if (!stream.read((char *) &tag, sizeof(tag)) || !tag.valid()) return {};
+    ImageProxy r;
+    uint32_t   version;
+    uint64_t   checksum;
+    stream.seekg(0, std::ios::beg);
+    if (!readRILDesc(stream, name, r.desc, version, checksum)) return {};
+    auto offset = (size_t) stream.tellg();
+    if (size < offset || size - offset < r.desc.size) {
+        RAPID_IMAGE_LOGE("failed to view image %s: the pixel array is truncated.", name);
+        return {};
+    }
+    auto pixels = (uint8_t *) data + offset;
+    if (0 != ((uintptr_t) pixels % std::max<uintptr_t>(1, r.desc.alignment))) return {};
+    r.data = pixels;
+    return r;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+Image Image::loadRILLevels(std::istream & stream, size_t firstLevel, size_t levelCount, const char * name) {
+    Image r;
+    auto  pixels = r._proxy.desc.loadRILLevels(stream, firstLevel, levelCount, name);
+    if (!pixels) return {};
+    r._proxy.data = pixels.release();
+    return r;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+Image Image::mapFile(const std::string & path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        RAPID_IMAGE_LOGE("Failed to open image file %s : errno=%d", path.c_str(), errno);
+        return {};
+    }
+
+    // Non-RIL files need decoding anyway. Just load them.
+    RILFileTag tag;
+    if (!file.read((char *) &tag, sizeof(tag)) || !tag.valid()) {
+        file.clear();
+        file.seekg(0, std::ios::beg);
+        return load(file, path.c_str());
+    }
+
+    // Read the image descriptor, to find where the pixel array is.
+    ImageDesc desc;
+    uint32_t  version;
+    uint64_t  checksum;
+    file.seekg(0, std::ios::beg);
+    if (!readRILDesc(file, path.c_str(), desc, version, checksum)) return {};
+    auto offset = (size_t) file.tellg();
+
+    Mapping mapping;
+    auto    base = (uint8_t *) rii_details::mapFileView(path, mapping.size);
+    if (!base) return {};
+    mapping.base = base;
+    if (mapping.size < offset + desc.size) {
+        RAPID_IMAGE_LOGE("failed to map image file %s: the file is truncated.", path.c_str());
+        rii_details::unmapFileView(mapping.base, mapping.size);
+        return {};
+    }
+    if (0 != ((uintptr_t) (base + offset) % std::max<uintptr_t>(1, desc.alignment))) {
+        // The file view is page aligned, but the pixel array in the file might not be aligned to image alignment.
+        RAPID_IMAGE_LOGW("pixel array of image file %s is not aligned to %u bytes. Load it instead of mapping it.", path.c_str(), desc.alignment);
+        Image r(desc, base + offset, desc.size);
+        rii_details::unmapFileView(mapping.base, mapping.size);
+        return r;
+    }
+
+    Image r;
+    r._proxy.desc = std::move(desc);
+    r._proxy.data = base + offset;
+    r._mapping    = mapping;
+    return r;
+}
+
+// *********************************************************************************************************************
+// ImageLoader
+// *********************************************************************************************************************
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Loads go through 2 queues. I/O threads take files off the read queue, wait for room in the in-flight budget, read
+/// them whole, then put them on the decode queue, where in-memory images are queued directly. Decoder threads parse
+/// the buffers in place, give the budget back, then call the callbacks. Every load ends on a decoder thread, failed
+/// ones included, so that the budget and the pending count are given back in one place.
+struct ImageLoader::Impl {
+    struct Request {
+        std::string                          path;               ///< empty for in-memory images.
+        const void *                         data     = nullptr; ///< the image in memory, or the file content.
+        size_t                               size     = 0;       ///< size of data.
+        size_t                               reserved = 0;       ///< bytes taken from the in-flight budget.
+        std::unique_ptr<uint8_t[]>           buffer;             ///< the file content.
+        std::string                          name;
+        Callback                             callback;
+        std::shared_ptr<std::promise<Image>> promise; ///< set instead of the callback by the loads that return a future.
+        std::exception_ptr                   error;   ///< the exception thrown while reading or decoding, if any.
+    };
+
+    Parameters               params;
+    std::mutex               mutex;
+    std::condition_variable  readable;  ///< signaled when a file is queued, or when stopping.
+    std::condition_variable  decodable; ///< signaled when a buffer is queued, or when stopping.
+    std::condition_variable  budget;    ///< signaled when bytes in flight go down.
+    std::condition_variable  idle;      ///< signaled when all loads are done.
+    std::deque<Request>      reads;
+    std::deque<Request>      decodes;
+    size_t                   bytesInFlight = 0;
+    size_t                   pending       = 0; ///< number of loads queued but not done.
+    bool                     stop          = false;
+    std::vector<std::thread> threads;
+
+    Impl(const Parameters & p): params(p) {
+        size_t io      = std::max<size_t>(1, params.ioThreads);
+        size_t decoder = params.decodeThreads ? params.decodeThreads : std::max(1u, std::thread::hardware_concurrency());
+        threads.reserve(io + decoder);
+        for (size_t i = 0; i < io; ++i) threads.emplace_back([this] { readLoop(); });
+        for (size_t i = 0; i < decoder; ++i) threads.emplace_back([this] { decodeLoop(); });
+    }
+
+    ~Impl() {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        readable.notify_all();
+        decodable.notify_all();
+        for (auto & t : threads) t.join();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [&] { return 0 == pending; });
+    }
+
+    void queue(Request && r) {
+        bool read = !r.path.empty();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            (read ? reads : decodes).push_back(std::move(r));
+            ++pending; // after the push, which may throw.
+        }
+        (read ? readable : decodable).notify_one();
+    }
+
+    void readLoop() {
+        for (;;) {
+            Request r;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                readable.wait(lock, [&] { return stop || !reads.empty(); });
+                if (reads.empty()) return;
+                r = std::move(reads.front());
+                reads.pop_front();
+            }
+            std::error_code ec;
+            auto            size = std::filesystem::file_size(r.path, ec);
+            if (ec) {
+                RAPID_IMAGE_LOGE("Failed to open image file %s : %s", r.path.c_str(), ec.message().c_str());
+            } else {
+                // Wait for the decoders to catch up, if too much is read already.
+                std::unique_lock<std::mutex> lock(mutex);
+                budget.wait(lock, [&] { return 0 == bytesInFlight || bytesInFlight + size <= params.maxBytesInFlight; });
+                bytesInFlight += (size_t) size;
+                r.reserved = (size_t) size;
+            }
+            if (r.reserved > 0) {
+                try {
+                    r.buffer.reset(new uint8_t[r.reserved]);
+                    std::ifstream file(r.path, std::ios::binary);
+                    if (file.read((char *) r.buffer.get(), (std::streamsize) r.reserved)) {
+                        r.data = r.buffer.get();
+                        r.size = r.reserved;
+                    } else {
+                        RAPID_IMAGE_LOGE("Failed to read image file %s : errno=%d", r.path.c_str(), errno);
+                    }
+                } catch (...) {
+                    RAPID_IMAGE_LOGE("Failed to read image file %s : exception thrown.", r.path.c_str());
+                    r.error = std::current_exception();
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                decodes.push_back(std::move(r));
+            }
+            decodable.notify_one();
+        }
+    }
+
+    void decodeLoop() {
+        for (;;) {
+            Request r;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                decodable.wait(lock, [&] { return stop || !decodes.empty(); });
+                if (decodes.empty()) return;
+                r = std::move(decodes.front());
+                decodes.pop_front();
+            }
+            Allocator::Scope scope(params.allocator);
+            Image            image;
+            auto             name = r.path.empty() ? r.name.c_str() : r.path.c_str();
+            if (r.data && !r.error) {
+                try {
+                    image = Image::load(r.data, r.size, name);
+                } catch (...) {
+                    RAPID_IMAGE_LOGE("Failed to load image %s : exception thrown.", name);
+                    r.error = std::current_exception();
+                }
+            }
+            if (r.reserved > 0) {
+                r.buffer.reset();
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    bytesInFlight -= r.reserved;
+                }
+                budget.notify_all();
+            }
+            try {
+                if (!r.promise) {
+                    r.callback(std::move(image));
+                } else if (r.error) {
+                    r.promise->set_exception(r.error);
+                } else {
+                    r.promise->set_value(std::move(image));
+                }
+            } catch (...) {
+                RAPID_IMAGE_LOGE("The callback of image %s threw an exception.", name);
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (0 == --pending) idle.notify_all();
+            }
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+ImageLoader::ImageLoader(): _impl(new Impl(Parameters())) {}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+ImageLoader::ImageLoader(const Parameters & params): _impl(new Impl(params)) {}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+ImageLoader::~ImageLoader() {}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void ImageLoader::load(std::string path, Callback callback) {
+    Impl::Request r;
+    r.path     = std::move(path);
+    r.callback = std::move(callback);
+    // with nothing to read, the request goes straight to the decoders, which fail it like any other load.
+    if (r.path.empty()) RAPID_IMAGE_LOGE("Failed to load image file: empty path.");
+    _impl->queue(std::move(r));
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void ImageLoader::load(const void * data, size_t size, Callback callback, std::string name) {
+    Impl::Request r;
+    r.data     = data;
+    r.size     = size;
+    r.name     = std::move(name);
+    r.callback = std::move(callback);
+    _impl->queue(std::move(r));
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+std::future<Image> ImageLoader::load(std::string path) {
+    Impl::Request r;
+    r.path      = std::move(path);
+    r.promise   = std::make_shared<std::promise<Image>>();
+    auto future = r.promise->get_future();
+    if (r.path.empty()) RAPID_IMAGE_LOGE("Failed to load image file: empty path.");
+    _impl->queue(std::move(r));
+    return future;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+std::future<Image> ImageLoader::load(const void * data, size_t size, std::string name) {
+    Impl::Request r;
+    r.data      = data;
+    r.size      = size;
+    r.name      = std::move(name);
+    r.promise   = std::make_shared<std::promise<Image>>();
+    auto future = r.promise->get_future();
+    _impl->queue(std::move(r));
+    return future;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+std::vector<std::future<Image>> ImageLoader::load(const std::vector<std::string> & paths) {
+    std::vector<std::future<Image>> futures;
+    futures.reserve(paths.size());
+    for (const auto & p : paths) futures.push_back(load(p));
+    return futures;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void ImageLoader::wait() { _impl->wait(); }
+
+// *********************************************************************************************************************
+// ImagePool
+// *********************************************************************************************************************
+
+// ---------------------------------------------------------------------------------------------------------------------
+/// Released buffers are in a list, most recently released first. They are indexed by descriptor, and by size for
+/// matchSize. Trimming frees from the end of the list.
+struct ImagePool::Impl {
+    struct Buffer {
+        ImageDesc desc;
+        uint8_t * data;
+    };
+    using List = std::list<Buffer>;
+
+    const Parameters                                           params;
+    mutable std::mutex                                         mutex;
+    List                                                       buffers;
+    std::unordered_map<ImageDesc, std::vector<List::iterator>> byDesc;
+    std::unordered_map<size_t, std::vector<List::iterator>>    bySize;
+    Stats                                                      stats;
+
+    Impl(const Parameters & p): params(p) {}
+
+    ~Impl() { trim(0); }
+
+    static void unindex(std::vector<List::iterator> & index, List::iterator i) {
+        auto j = std::find(index.begin(), index.end(), i);
+        RII_ASSERT(j != index.end());
+        index.erase(j);
+    }
+
+    /// Remove a buffer from the list and the indices. Return its pixels.
+    uint8_t * take(List::iterator i) {
+        auto d = byDesc.find(i->desc);
+        unindex(d->second, i);
+        if (d->second.empty()) byDesc.erase(d);
+        auto s = bySize.find(i->desc.size);
+        unindex(s->second, i);
+        if (s->second.empty()) bySize.erase(s);
+        auto data = i->data;
+        stats.bytes -= i->desc.size;
+        --stats.buffers;
+        buffers.erase(i);
+        return data;
+    }
+
+    /// Find the most recently released buffer that fits the descriptor.
+    List::iterator find(const ImageDesc & desc) {
+        auto d = byDesc.find(desc);
+        if (d != byDesc.end()) return d->second.back();
+        if (!params.matchSize) return buffers.end();
+        auto s = bySize.find(desc.size);
+        if (s == bySize.end()) return buffers.end();
+        for (auto i = s->second.rbegin(); i != s->second.rend(); ++i) {
+            if (0 == ((uintptr_t) (*i)->data % std::max<uintptr_t>(1, desc.alignment))) return *i;
+        }
+        return buffers.end();
+    }
+
+    void trim(size_t maxBytes) {
+        std::vector<uint8_t *> evicted;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            while (stats.bytes > maxBytes) evicted.push_back(take(std::prev(buffers.end())));
+            stats.evictions += evicted.size();
+        }
+        // free outside of the lock, since that could take a while for large buffers.
+        for (auto p : evicted) rii_details::afree(p);
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+ImagePool::ImagePool(): _impl(new Impl(Parameters())) {}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+ImagePool::ImagePool(const Parameters & params): _impl(new Impl(params)) {}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+ImagePool::~ImagePool() {}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+Image ImagePool::acquire(const ImageDesc & desc) {
+    if (desc.empty()) return {};
+    {
+        std::lock_guard<std::mutex> lock(_impl->mutex);
+        auto                        i = _impl->find(desc);
+        if (i != _impl->buffers.end()) {
+            ++_impl->stats.hits;
+            Image r;
+            r._proxy.desc = desc;
+            r._proxy.data = _impl->take(i);
+            return r;
+        }
+        ++_impl->stats.misses;
+    }
+    return Image(desc);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void ImagePool::release(Image && image) {
+    if (image.empty() || image.mapped() || image.size() > _impl->params.maxBytes) {
+        image.clear();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_impl->mutex);
+        auto &                      buffers = _impl->buffers;
+        buffers.push_front({std::move(image._proxy.desc), image._proxy.data});
+        _impl->byDesc[buffers.front().desc].push_back(buffers.begin());
+        _impl->bySize[buffers.front().desc.size].push_back(buffers.begin());
+        _impl->stats.bytes += buffers.front().desc.size;
+        ++_impl->stats.buffers;
+    }
+    image._proxy.desc.clear();
+    image._proxy.data = nullptr;
+    RII_ASSERT(image.empty());
+    _impl->trim(_impl->params.maxBytes);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void ImagePool::trim(size_t maxBytes) { _impl->trim(maxBytes); }
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+ImagePool::Stats ImagePool::stats() const {
+    std::lock_guard<std::mutex> lock(_impl->mutex);
+    return _impl->stats;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+void ImagePool::resetStats() {
+    std::lock_guard<std::mutex> lock(_impl->mutex);
+    _impl->stats.hits      = 0;
+    _impl->stats.misses    = 0;
+    _impl->stats.evictions = 0;
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 //
 // Image Image::load(const std::string & filename) {
@@ -42,7 +42,7 @@ SOFTWARE.
 // User configurable macros
 
 /// A monotonically increasing number that uniquely identify the revision of the header.
-#define RAPID_IMAGE_HEADER_REVISION 13
+#define RAPID_IMAGE_HEADER_REVISION 37
 
 /// \def RAPID_IMAGE_NAMESPACE
 /// Define the namespace of rapid-image library. Default value is ril, standing for Rapid Image Library
@@ -70,6 +70,14 @@ SOFTWARE.
 #define RAPID_IMAGE_ENABLE_DEBUG_BUILD 0
 #endif
 
+/// \def RAPID_IMAGE_ENABLE_SIMD
+/// Set to zero to disable the SIMD (SSE2/AVX2/F16C on x64, NEON on arm64) pixel conversion kernels. Enabled by default.
+/// The x64 kernels are selected at runtime based on CPU features. All of them produce the same results as the scalar
+/// code path.
+#ifndef RAPID_IMAGE_ENABLE_SIMD
+#define RAPID_IMAGE_ENABLE_SIMD 1
+#endif
+
 /// \def RAPID_IMAGE_THROW
 /// The macro to throw runtime exception.
 #ifndef RAPID_IMAGE_THROW
@@ -143,6 +151,8 @@ SOFTWARE.
 #include <sstream>
 #include <algorithm>
 #include <exception>
+#include <functional>
+#include <future>
 #include <memory>
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -214,6 +224,8 @@ namespace RAPID_IMAGE_NAMESPACE {
 
 using namespace std::string_literals;
 
+class Allocator;
+
 namespace rii_details {
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -230,9 +242,13 @@ inline std::string format() { return ""s; }
 
 // ---------------------------------------------------------------------------------------------------------------------
 /// \brief Allocate aligned memory. The memory must be freed with afree(). Calling free() on the returned pointer
-/// will cause undefined behavior.
+/// will cause undefined behavior. It comes from the allocator of the calling thread (see Allocator::current()).
 RII_API void * aalloc(size_t a, size_t s);
 
+/// \brief Allocate aligned memory from the allocator. Null allocator means the C heap, which hands large buffers to
+/// PageAllocator::large(). The memory must be freed with afree() too, which hands it back to the allocator.
+RII_API void * aalloc(size_t a, size_t s, Allocator * allocator);
+
 // ---------------------------------------------------------------------------------------------------------------------
 // \brief Free memory allocated by aalloc().
 RII_API void afree(void * p);
@@ -545,10 +561,10 @@ union RII_API PixelFormat {
         { 0 , 0 , 0  , 0 , { { 0 , 0  }, { 0  , 0  }, { 0  , 0  }, { 0  , 0  } } }, //LAYOUT_UNKNOWN,
         { 8 , 1 , 1  , 1 , { { 0 , 1  }, { 0  , 0  }, { 0  , 0  }, { 0  , 0  } } }, //LAYOUT_1,
         { 1 , 1 , 1  , 4 , { { 0 , 2  }, { 2  , 2  }, { 4  , 2  }, { 6  , 2  } } }, //LAYOUT_2_2_2_2,
-        { 1 , 1 , 1  , 3 , { { 0 , 3  }, { 3  , 3  }, { 8  , 2  }, { 0  , 0  } } }, //LAYOUT_3_3_2,
+        { 1 , 1 , 1  , 3 , { { 0 , 3  }, { 3  , 3  }, { 6  , 2  }, { 0  , 0  } } }, //LAYOUT_3_3_2,
         { 1 , 1 , 1  , 2 , { { 0 , 4  }, { 4  , 4  }, { 0  , 0  }, { 0  , 0  } } }, //LAYOUT_4_4,
         { 1 , 1 , 2  , 4 , { { 0 , 4  }, { 4  , 4  }, { 8  , 4  }, { 12 , 4  } } }, //LAYOUT_4_4_4_4,
-        { 1 , 1 , 2  , 4 , { { 0 , 5  }, { 10 , 5  }, { 15 , 5  }, { 15 , 1  } } }, //LAYOUT_5_5_5_1,
+        { 1 , 1 , 2  , 4 , { { 0 , 5  }, { 5  , 5  }, { 10 , 5  }, { 15 , 1  } } }, //LAYOUT_5_5_5_1,
         { 1 , 1 , 2  , 3 , { { 0 , 5  }, { 5  , 6  }, { 11 , 5  }, { 0  , 0  } } }, //LAYOUT_5_6_5,
         { 1 , 1 , 1  , 1 , { { 0 , 8  }, { 0  , 0  }, { 0  , 0  }, { 0  , 0  } } }, //LAYOUT_8,
         { 1 , 1 , 2  , 2 , { { 0 , 8  }, { 8  , 8  }, { 0  , 0  }, { 0  , 0  } } }, //LAYOUT_8_8,
@@ -559,8 +575,8 @@ union RII_API PixelFormat {
         { 1 , 1 , 4  , 4 , { { 0 , 10 }, { 10 , 10 }, { 20 , 10 }, { 30 , 2  } } }, //LAYOUT_10_10_10_2,
         { 1 , 1 , 2  , 1 , { { 0 , 16 }, { 0  , 0  }, { 0  , 0  }, { 0  , 0  } } }, //LAYOUT_16,
         { 1 , 1 , 4  , 2 , { { 0 , 16 }, { 16 , 16 }, { 0  , 0  }, { 0  , 0  } } }, //LAYOUT_16_16,
-        { 1 , 1 , 4  , 3 , { { 0 , 16 }, { 16 , 16 }, { 32 , 1  }, { 0  , 0  } } }, //LAYOUT_16_16_16,
-        { 1 , 1 , 8  , 4 , { { 0 , 16 }, { 16 , 16 }, { 32 , 16 }, { 48 , 1  } } }, //LAYOUT_16_16_16_16,
+        { 1 , 1 , 6  , 3 , { { 0 , 16 }, { 16 , 16 }, { 32 , 16 }, { 0  , 0  } } }, //LAYOUT_16_16_16,
+        { 1 , 1 , 8  , 4 , { { 0 , 16 }, { 16 , 16 }, { 32 , 16 }, { 48 , 16 } } }, //LAYOUT_16_16_16_16,
         { 1 , 1 , 4  , 1 , { { 0 , 32 }, { 0  , 0  }, { 0  , 0  }, { 0  , 0  } } }, //LAYOUT_32,
         { 1 , 1 , 8  , 2 , { { 0 , 32 }, { 32 , 32 }, { 0  , 0  }, { 0  , 0  } } }, //LAYOUT_32_32,
         { 1 , 1 , 12 , 3 , { { 0 , 32 }, { 32 , 32 }, { 64 , 32 }, { 0  , 0  } } }, //LAYOUT_32_32_32,
@@ -641,8 +657,8 @@ union RII_API PixelFormat {
         SWIZZLE_X001 = (0 << 0) | (4 << 3) | (4 << 6) | (5 << 9),
         SWIZZLE_XXX1 = (0 << 0) | (0 << 3) | (0 << 6) | (5 << 9),
         SWIZZLE_111X = (5 << 0) | (5 << 3) | (5 << 6) | (0 << 9),
-        SWIZZLE_0Y00 = (0 << 0) | (1 << 3) | (4 << 6) | (4 << 9),
-        SWIZZLE_0Y01 = (0 << 0) | (1 << 3) | (4 << 6) | (5 << 9),
+        SWIZZLE_0Y00 = (4 << 0) | (1 << 3) | (4 << 6) | (4 << 9),
+        SWIZZLE_0Y01 = (4 << 0) | (1 << 3) | (4 << 6) | (5 << 9),
     };
 
     /// @brief Construct pixel format from individual properties.
@@ -670,10 +686,10 @@ union RII_API PixelFormat {
             si0,
             si12,
             si3,
-            (Swizzle)(((int)sw0123>>0)&3),
-            (Swizzle)(((int)sw0123>>3)&3),
-            (Swizzle)(((int)sw0123>>6)&3),
-            (Swizzle)(((int)sw0123>>9)&3));
+            (Swizzle)(((int)sw0123>>0)&7),
+            (Swizzle)(((int)sw0123>>3)&7),
+            (Swizzle)(((int)sw0123>>6)&7),
+            (Swizzle)(((int)sw0123>>9)&7));
         // clang-format on
     }
 
@@ -963,6 +979,7 @@ union RII_API PixelFormat {
     static constexpr PixelFormat BC5_SNORM()                   { return make(LAYOUT_BC5, SIGN_SNORM, SWIZZLE_XY00); }
     static constexpr PixelFormat BC5_UINT()                    { return make(LAYOUT_BC5, SIGN_UINT,  SWIZZLE_XY00); }
 
+    // BC6H texels are half floats. UNORM and SNORM pick the unsigned (UF16) and signed (SF16) encodings.
     static constexpr PixelFormat BC6H_UNORM()                  { return make(LAYOUT_BC6H, SIGN_UNORM, SWIZZLE_XYZ1); }
     static constexpr PixelFormat BC6H_SNORM()                  { return make(LAYOUT_BC6H, SIGN_SNORM, SWIZZLE_XYZ1); }
     static constexpr PixelFormat BC6H_UINT()                   { return make(LAYOUT_BC6H, SIGN_UINT, SWIZZLE_XYZ1); }
@@ -1127,6 +1144,159 @@ inline constexpr uint32_t makeBGRA8(T r, T g, T b, T a) {
 
 class Image;
 
+/// @brief A hook to run parallel jobs on a user provided thread pool.
+/// It must call job(i) exactly once for each i in [0, count), on any thread in any order, and return only after all of
+/// them are done.
+using Executor = std::function<void(size_t count, const std::function<void(size_t index)> & job)>;
+
+/// @brief Set the executor that runs the parallel work of the library when the call doesn't come with one of its own,
+/// like PlaneDesc::toFloat4() and PlaneDesc::copyContent(), or parameters with a null executor and 0 threads. Null, the
+/// default, runs the work on the built-in thread pool: one thread per hardware thread (the calling thread included),
+/// started on first use. Set it before starting any work that could use it.
+RII_API void setDefaultExecutor(Executor executor);
+
+/// @brief Run job(i) for each i in [0, count), in parallel, on the executor if there's one, otherwise on the default
+/// one (see setDefaultExecutor()). Jobs may call parallelFor() themselves. When the work runs on the built-in thread
+/// pool, the first exception thrown by any job is rethrown on the calling thread, after all jobs are done.
+RII_API void parallelFor(size_t count, const std::function<void(size_t index)> & job, const Executor & executor = {});
+
+/// @brief Allocator of pixel buffers, for Image, ImageDesc::load(), PlaneDesc::generateMipmaps() and everything else
+/// that allocates through rii_details::aalloc().
+///
+/// Buffers come from the allocator of the calling thread (see Scope), which is the C heap by default. Each buffer
+/// remembers its allocator, so it goes back to the right one when freed, on any thread. An allocator must outlive the
+/// buffers it allocates. Allocators used by more than one thread must be thread safe.
+class RII_API Allocator {
+public:
+    virtual ~Allocator() = default;
+
+    /// Allocate size bytes aligned to alignment. Return null on failure.
+    virtual void * allocate(size_t size, size_t alignment) = 0;
+
+    /// Free memory returned by allocate(), with the same size and alignment.
+    virtual void deallocate(void * p, size_t size, size_t alignment) = 0;
+
+    /// @brief Return the allocator of the calling thread. null means the C heap.
+    static Allocator * current();
+
+    /// @brief Set the allocator of the calling thread. null means the C heap. Return the old one.
+    static Allocator * setCurrent(Allocator * allocator);
+
+    /// @brief Use an allocator on the calling thread for the lifetime of the scope, e.g. around a single call.
+    class Scope {
+    public:
+        RII_NO_COPY(Scope);
+        RII_NO_MOVE(Scope);
+        explicit Scope(Allocator * allocator): _old(setCurrent(allocator)) {}
+        ~Scope() { setCurrent(_old); }
+
+    private:
+        Allocator * _old;
+    };
+};
+
+/// @brief Allocate by bumping a pointer through big blocks, and free everything at once with reset().
+///
+/// deallocate() does nothing. That makes it a fit for buffers that share a life time, like the ones of a frame or of a
+/// bake job. Thread safe.
+class RII_API ArenaAllocator : public Allocator {
+public:
+    RII_NO_COPY(ArenaAllocator);
+    RII_NO_MOVE(ArenaAllocator);
+
+    /// \param blockSize Size of the blocks taken from the C heap. Larger allocations get a block of their own.
+    explicit ArenaAllocator(size_t blockSize = 64u << 20);
+    ~ArenaAllocator() override;
+
+    void * allocate(size_t size, size_t alignment) override;
+    void   deallocate(void *, size_t, size_t) override {}
+
+    /// @brief Make all memory available again. Keeps the first block, frees the others. All buffers from the arena
+    /// must be freed before, or at least never touched again, freeing them included.
+    void reset();
+
+    /// @brief Return number of bytes allocated since the last reset, alignment padding included.
+    size_t used() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+/// @brief Keep freed buffers in free lists of size classes, to hand them out again w/o going to the C heap.
+///
+/// Sizes are rounded up to 4 classes per power of 2, so a buffer takes at most 25% more memory than asked. Each class
+/// has its own lock, so threads allocating different sizes don't contend. Thread safe.
+class RII_API PoolAllocator : public Allocator {
+public:
+    RII_NO_COPY(PoolAllocator);
+    RII_NO_MOVE(PoolAllocator);
+
+    /// \param maxCachedBytes Max total size of the buffers kept in the free lists. Buffers freed beyond that go back
+    /// to the C heap.
+    /// \param maxSize Allocations larger than this bypass the pool.
+    explicit PoolAllocator(size_t maxCachedBytes = 256u << 20, size_t maxSize = 64u << 20);
+    ~PoolAllocator() override;
+
+    void * allocate(size_t size, size_t alignment) override;
+    void   deallocate(void * p, size_t size, size_t alignment) override;
+
+    /// @brief Return the buffers in the free lists to the C heap.
+    void trim();
+
+    /// @brief Return total size of the buffers in the free lists.
+    size_t cachedBytes() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+/// @brief Allocate straight from the OS, with anonymous mmap() (VirtualAlloc() on Windows), and give the memory back
+/// to the OS as soon as it is freed.
+///
+/// Large buffers allocated from the C heap come from here too (see setLargeAllocations()), so that huge images don't
+/// fragment the heap, and get huge pages to cut TLB misses when they are converted or filtered. Thread safe.
+class RII_API PageAllocator : public Allocator {
+public:
+    struct Parameters {
+        /// Back buffers of 2 MB and more with transparent huge pages (MADV_HUGEPAGE). They are 2 MB aligned for that.
+        /// Linux only. Ignored elsewhere.
+        bool hugePages = true;
+
+        /// Fault all pages in at allocation (MADV_POPULATE_WRITE, or by touching them on older kernels), instead of on
+        /// first touch. Linux only. Ignored elsewhere.
+        bool populate = false;
+
+        Parameters & setHugePages(bool h) {
+            hugePages = h;
+            return *this;
+        }
+
+        Parameters & setPopulate(bool p) {
+            populate = p;
+            return *this;
+        }
+    };
+
+    PageAllocator() = default;
+    explicit PageAllocator(const Parameters & params): _params(params) {}
+
+    void * allocate(size_t size, size_t alignment) override;
+    void   deallocate(void * p, size_t size, size_t alignment) override;
+
+    /// @brief Send allocations from the C heap (null allocator) of at least threshold bytes to a PageAllocator with
+    /// the parameters. 0 sends them all to the C heap. The default is 2 MB with default parameters. Thread safe. It
+    /// only affects later allocations. If mapping fails, the buffer comes from the C heap as usual.
+    static void setLargeAllocations(size_t threshold, const Parameters & params);
+
+    /// @brief Return the page allocator for a C heap allocation of that size, or null if it should stay in the C heap.
+    static PageAllocator * large(size_t size);
+
+private:
+    Parameters _params;
+};
+
 struct Extent3D {
     uint32_t w = 0; ///< width
     uint32_t h = 0; ///< height
@@ -1215,12 +1385,14 @@ struct RII_API PlaneDesc {
     /// check if this is an empty descriptor. Note that empty descriptor is never valid.
     bool empty() const { return PixelFormat::UNKNOWN() == format; }
 
-    /// Convert the image plane to float4 format.
+    /// Convert the image plane to float4 format. BC1 to BC7, ETC2 and ASTC compressed planes are decoded too. ASTC
+    /// SFLOAT planes keep their HDR values.
     /// \param  src Pointer to the first pixel of the whole image (not the plane!)
-    /// \return Pixel data in float4 format.
+    /// \return Pixel data in float4 format. Empty, if the format can't be decoded.
     std::vector<Float4> toFloat4(const void * src) const;
 
-    /// Convert image plane to rgba8 format.
+    /// Convert image plane to rgba8 format. BC1 to BC7, ETC2 and ASTC compressed planes are decoded too, rows of blocks
+    /// in parallel.
     /// \param  src Pointer to the first pixel of the whole image (not the plane!)
     /// \return Pixel data in rgba8 format.
     std::vector<RGBA8> toRGBA8(const void * src) const;
@@ -1229,11 +1401,160 @@ struct RII_API PlaneDesc {
     /// \param  src Pointer to the first pixel of the whole image (not the plane!)
     void fromFloat4(void * dst, size_t dstSize, size_t dstZ, const void * src) const;
 
+    /// Parameters of mipmap generation.
+    struct GenerateMipmapsParameters {
+        /// Downsampling filters.
+        enum Filter {
+            BOX,     ///< Average of the source pixels covered by the destination pixel. Fastest.
+            KAISER,  ///< Kaiser windowed sinc (radius 3, alpha 4). Sharper than box, with little ringing.
+            LANCZOS, ///< Lanczos windowed sinc (radius 3). Sharpest, but could ring around high contrast edges.
+        };
+
+        /// The maximum number of mipmap levels to generate. Set to 0 to generate full mipmap chain. Only used by
+        /// PlaneDesc::generateMipmaps(). ImageDesc::generateMipmaps() fills all levels of the image descriptor.
+        size_t maxLevels = 0;
+
+        /// Number of threads to use. 0 means all threads of the built-in thread pool, or the default executor if there
+        /// is one (see setDefaultExecutor()). 1 runs everything on the calling thread. Other values run the work on at
+        /// most that many threads of the built-in pool, even with a default executor, and never on more threads than
+        /// the pool has. Ignored when executor is set.
+        size_t threads = 0;
+
+        /// Optional hook to run the work on your own thread pool, instead of the built-in one.
+        Executor executor;
+
+        /// The downsampling filter. Filters other than box are applied as separable horizontal, vertical (then depth)
+        /// passes over float rows, with weights precomputed once per level.
+        Filter filter = BOX;
+
+        /// Treat RGB channels as sRGB encoded, and filter them in linear space. Alpha is always filtered as is.
+        /// sRGB formats (SIGN_GNORM) are always filtered in linear space, regardless of this flag.
+        bool gammaCorrect = false;
+
+        /// Generate all levels from a float working pyramid, so that each level is quantized once, instead of being
+        /// decoded and re-quantized level after level. This is faster and more accurate, especially for low bit depth
+        /// formats. The box filter uses a tiled pyramid while each level is exactly half of the previous one. Levels
+        /// of odd sized (non power of 2) images are made from the whole previous level in float, and so are all levels
+        /// of the other filters.
+        bool fused = true;
+
+        /// Optional allocator of the returned image. Null means the allocator of the calling thread. Only used by
+        /// PlaneDesc::generateMipmaps(). The working buffers are not allocated from it.
+        Allocator * allocator = nullptr;
+
+        GenerateMipmapsParameters & setMaxLevels(size_t l) {
+            maxLevels = l;
+            return *this;
+        }
+
+        GenerateMipmapsParameters & setThreads(size_t t) {
+            threads = t;
+            return *this;
+        }
+
+        GenerateMipmapsParameters & setExecutor(Executor e) {
+            executor = std::move(e);
+            return *this;
+        }
+
+        GenerateMipmapsParameters & setFused(bool f) {
+            fused = f;
+            return *this;
+        }
+
+        GenerateMipmapsParameters & setFilter(Filter f) {
+            filter = f;
+            return *this;
+        }
+
+        GenerateMipmapsParameters & setGammaCorrect(bool g) {
+            gammaCorrect = g;
+            return *this;
+        }
+
+        GenerateMipmapsParameters & setAllocator(Allocator * a) {
+            allocator = a;
+            return *this;
+        }
+    };
+
     /// @brief Generate full mipmap chain from this image plane.
     /// @param pixels The pixel data. The layout of the data must match the plane descriptor.
     /// @param maxLevels The maximum number of mipmap levels to generate. Set t0 0 to generate full mipmap chain.
     Image generateMipmaps(const void * pixels, size_t maxLevels = 0) const;
 
+    /// @brief Generate mipmap chain from this image plane, in parallel.
+    /// @param pixels The pixel data. The layout of the data must match the plane descriptor.
+    /// @param params Mipmap generation parameters: number of levels, threads and optional executor.
+    Image generateMipmaps(const void * pixels, const GenerateMipmapsParameters & params) const;
+
+    /// Parameters of block compression.
+    struct CompressParameters {
+        /// Trade off between speed and quality. The descriptions are the BC ones. ETC2 FAST fits every mode around the
+        /// average colors and 2 clusters of the texels, and QUALITY walks the base colors of each mode from there for as
+        /// long as the error goes down.
+        enum Preset {
+            FAST,    ///< Range fit: endpoints from the extent of the colors along their principal axis, plus one least squares pass.
+            QUALITY, ///< Cluster fit: best least squares endpoints over every ordered clustering of the colors. Several times slower.
+        };
+
+        Preset preset = FAST;
+
+        /// Number of threads to use. 0 means all threads of the built-in thread pool, or the default executor if there
+        /// is one (see setDefaultExecutor()). 1 runs everything on the calling thread. Other values run the work on at
+        /// most that many threads of the built-in pool, even with a default executor, and never on more threads than
+        /// the pool has. Ignored when executor is set.
+        size_t threads = 0;
+
+        /// Optional hook to run the work on your own thread pool, instead of the built-in one.
+        Executor executor;
+
+        /// BC7 only: bit mask of the modes to try, bit i for mode i. 0 means the default of the preset: modes 1 and 3 to
+        /// 7 for FAST, all of them for QUALITY. Blocks that none of the modes can encode, like blocks with alpha when
+        /// only modes 0 to 3 are on, fall back to mode 6.
+        uint32_t bc7Modes = 0;
+
+        /// BC7 only: number of partitions, out of 64, that each mode with 2 or 3 subsets fits fully. The partitions are
+        /// tried from the best estimated one down. 0 means the default of the preset: 1 for FAST, 8 for QUALITY.
+        uint32_t bc7Partitions = 0;
+
+        CompressParameters & setPreset(Preset p) {
+            preset = p;
+            return *this;
+        }
+
+        CompressParameters & setThreads(size_t t) {
+            threads = t;
+            return *this;
+        }
+
+        CompressParameters & setExecutor(Executor e) {
+            executor = std::move(e);
+            return *this;
+        }
+
+        CompressParameters & setBc7Modes(uint32_t m) {
+            bc7Modes = m;
+            return *this;
+        }
+
+        CompressParameters & setBc7Partitions(uint32_t p) {
+            bc7Partitions = p;
+            return *this;
+        }
+    };
+
+    /// @brief Compress this plane to a block compressed format, rows of blocks in parallel. BC1 to BC5, BC7 and ETC2 (with
+    /// or without EAC alpha) are supported.
+    /// Partial blocks at the right and bottom edges are padded by repeating the last column and row.
+    /// @param pixels The pixel data, in any format that toFloat4() reads. The layout of the data must match the plane descriptor.
+    /// @param format The compressed format. BC1 with an alpha channel (XYZW swizzle) gets 1-bit alpha.
+    /// @return A single plane image in the compressed format. Empty, if the format can't be encoded or the source decoded.
+    Image compress(const void * pixels, PixelFormat format, const CompressParameters & params) const;
+
+    /// @brief Compress this plane with the default parameters.
+    Image compress(const void * pixels, PixelFormat format) const;
+
     /// @brief Copy image content from one plane to another.
     /// @param dstDesc          Destination plane descriptor.
     /// @param dstData          Pointer to the first pixel of the plane. The length of the buffer must be at least dstDesc.size.
@@ -1537,10 +1858,43 @@ struct RII_API ImageDesc {
 
     /// @brief Load the image from memory buffer
     /// This method support .RIL and .DDS formats by default. It can also support loading from other common image formats if
-    /// stb_image.h is included before this header.
+    /// stb_image.h is included before this header. The buffer is parsed in place, the only copy made is the returned
+    /// pixel array. See ImageProxy::view() to skip that one too.
     /// \param name Name of the image. Optional. Used for logging only.
     AlignedUniquePtr load(const void * data, size_t size, const char * name = nullptr);
 
+    /// @brief Load the image descriptor from input stream, w/o reading or allocating the pixel array.
+    /// Supports the same formats as load(). Only the file headers are read, unless the codec of the file has no
+    /// probe function (see ImageCodec). The size field tells how many bytes load() would allocate.
+    /// \param name Name of the image. Optional. Used for logging only.
+    /// \return false on failure, in which case the descriptor is not changed.
+    bool probe(std::istream & stream, const char * name = nullptr);
+
+    /// @brief Load the image descriptor from memory buffer, w/o reading the pixel array. See probe(std::istream&).
+    bool probe(const void * data, size_t size, const char * name = nullptr);
+
+    /// @brief Load the image descriptor from file, w/o reading the pixel array. See probe(std::istream&).
+    bool probe(const std::string & path);
+
+    /// @brief Load the descriptor of a RIL image from input stream, without reading any pixels.
+    /// Use it with readRILPlane() to fetch planes on demand.
+    /// \param payload Returns stream position of the pixel array.
+    /// \param name Name of the image. Optional. Used for logging only.
+    /// \return false on failure, in which case the descriptor is not changed.
+    bool loadRILHeader(std::istream & stream, uint64_t & payload, const char * name = nullptr);
+
+    /// @brief Read pixels of one plane of a RIL image, with a positioned read. The descriptor must be the one loaded by
+    /// loadRILHeader(). Note that the checksum of the pixel array is not verified when reading part of it.
+    /// \param payload Stream position of the pixel array, returned by loadRILHeader().
+    /// \param pixels Receives the plane pixels. Must have room for plane(p).size bytes.
+    bool readRILPlane(std::istream & stream, uint64_t payload, const PlaneCoord & p, void * pixels) const;
+
+    /// @brief Load a range of mipmap levels of all faces and ranks of a RIL image, reading only those levels from the
+    /// stream. The descriptor is set to an image of levelCount levels, whose base map is firstLevel of the file.
+    /// \param levelCount Number of levels to load. 0 means all levels from firstLevel to the end of the chain.
+    /// \param name Name of the image. Optional. Used for logging only.
+    AlignedUniquePtr loadRILLevels(std::istream & stream, size_t firstLevel, size_t levelCount = 0, const char * name = nullptr);
+
     enum FileFormat {
         RIL, ///< Rapid Image Library format.
         DDS, ///< Direct Draw Surface format.
@@ -1556,6 +1910,11 @@ struct RII_API ImageDesc {
         /// @brief Quality of the compression. Only used for JPG.
         int quality = 85;
 
+        /// @brief Alignment of the pixel array from the start of the file. Only used for RIL. The default is the page
+        /// size, so that the pixels can be memory mapped (see Image::mapFile()) or read with direct I/O in place. It is
+        /// always rounded up to a multiple of the image alignment.
+        size_t payloadAlignment = 4096;
+
         SaveToStreamParameters & setFormat(FileFormat f) {
             format = f;
             return *this;
@@ -1565,8 +1924,28 @@ struct RII_API ImageDesc {
             quality = q;
             return *this;
         }
+
+        SaveToStreamParameters & setPayloadAlignment(size_t a) {
+            payloadAlignment = a;
+            return *this;
+        }
     };
 
+    /// @brief Generate (or refresh) all mipmap levels of every face and rank from their base maps, in place.
+    /// All faces and ranks are split into tiles that are processed in parallel. See GenerateMipmapsParameters::fused
+    /// for how levels are chained. Any size is supported: when a dimension is odd, each pixel of the next level is the
+    /// weighted average of 3 source pixels (polyphase box filter), so no part of the image is dropped.
+    /// \param pixels Pointer to pixels of the whole image. Level 0 of each face and rank must be filled already.
+    /// \param params Threading parameters. The maxLevels field is ignored.
+    /// \return false, if the image can't have mipmaps generated (e.g. compressed format).
+    bool generateMipmaps(void * pixels, const PlaneDesc::GenerateMipmapsParameters & params = {}) const;
+
+    /// @brief Compress all levels, faces and ranks to a block compressed format at once, e.g. the mipmap chain made by
+    /// PlaneDesc::generateMipmaps(). Rows of blocks of all planes are encoded in parallel. See PlaneDesc::compress().
+    /// \param pixels Pointer to pixels of the whole image.
+    /// \return An image with the same ranks, faces, levels and plane order, in the compressed format. Empty on failure.
+    Image compress(const void * pixels, PixelFormat format, const PlaneDesc::CompressParameters & params = {}) const;
+
     /// @brief Save the image to output stream.
     void save(const SaveToStreamParameters & params, std::ostream & stream, const void * pixels) const;
 
@@ -1602,16 +1981,85 @@ struct RII_API ImageDesc {
     }
 
 private:
+    friend struct ImageCodec;
     AlignedUniquePtr loadFromRIL(std::istream & stream, const char * name);
     AlignedUniquePtr loadFromDDS(std::istream & stream, const char * name);
 };
 
+/// @brief Run job(z, y0, y1) over tiles of rows [y0, y1) of slice z that cover the whole plane, in parallel. Rows are
+/// rows of pixel blocks for compressed formats. Tiles are about 16 KB of the plane each, so that each job is worth
+/// scheduling. See parallelFor() for where the jobs run.
+RII_API void parallelForRows(const PlaneDesc & plane, const std::function<void(uint32_t z, uint32_t y0, uint32_t y1)> & job,
+                             const Executor & executor = {});
+
+/// @brief Same as above, over all planes of an image at once. The plane parameter indexes ImageDesc::planes.
+RII_API void parallelForRows(const ImageDesc & image, const std::function<void(size_t plane, uint32_t z, uint32_t y0, uint32_t y1)> & job,
+                             const Executor & executor = {});
+
+/// @brief An image file format plug-in.
+///
+/// ImageDesc::load() reads the first few bytes of the stream once, then asks the registered codecs, latest first, if
+/// they recognize them. The first one that does loads the image. The stream is never seeked back, so loading works
+/// on pipes and sockets too (though an image shorter than MAX_HEADER_SIZE bytes can't give back the bytes after it
+/// on such streams). RIL, DDS and (if stb_image.h is included before this header) stb_image formats are
+/// registered by default. Register a codec with the same name to replace one of them. ImageDesc::save() saves with
+/// the save() of the codec that replaces a built-in one, if it has one, without the SaveToStreamParameters it can't
+/// take. Otherwise built-in formats are saved by the library itself.
+struct RII_API ImageCodec {
+    /// Max number of leading bytes passed to match().
+    static constexpr size_t MAX_HEADER_SIZE = 64;
+
+    /// Name of the codec, e.g. "ktx2". Used as the key of the registry.
+    std::string name;
+
+    /// File extensions handled by the codec, in lower case and with the leading dot, e.g. ".ktx2". Used by
+    /// ImageDesc::save() to pick the codec of a file name.
+    std::vector<std::string> extensions;
+
+    /// Check the leading bytes of a file. size is less than MAX_HEADER_SIZE only if the file itself is shorter.
+    std::function<bool(const uint8_t * header, size_t size)> match;
+
+    /// Load the whole image. The stream is at the start of the file, header bytes included. Return null on failure.
+    std::function<ImageDesc::AlignedUniquePtr(ImageDesc & desc, std::istream & stream, const char * name)> load;
+
+    /// Load the image descriptor only, w/o reading pixels. Optional.
+    std::function<bool(ImageDesc & desc, std::istream & stream, const char * name)> probe;
+
+    /// Save the image. Optional. Throw on failure.
+    std::function<void(const ImageDesc & desc, std::ostream & stream, const void * pixels)> save;
+
+    /// @brief Add a codec to the registry, replacing the one with the same name, if any.
+    /// It is matched before all codecs registered earlier. Thread safe.
+    static void registerCodec(ImageCodec codec);
+
+    /// @brief Find a codec by name. Thread safe.
+    static std::shared_ptr<const ImageCodec> find(const std::string & name);
+
+    /// @brief Find a codec by file extension (lower case, with the leading dot). Thread safe.
+    static std::shared_ptr<const ImageCodec> findByExtension(const std::string & extension);
+
+    /// @brief Find the codec that recognizes the leading bytes of a file. Thread safe.
+    /// \return null, if no codec matches.
+    static std::shared_ptr<const ImageCodec> detect(const void * header, size_t size);
+
+    /// @brief Return the codecs that the registry starts with, in registration order.
+    static std::vector<ImageCodec> builtIns();
+};
+
 /// Image descriptor combined with a pointer to pixel array. This is a convenient helper class for passing image
 /// data around w/o actually copying pixel data array.
 struct ImageProxy {
     ImageDesc desc;           ///< the image descriptor
     uint8_t * data = nullptr; ///< the image data (pixel array)
 
+    /// @brief Make a proxy of a RIL image stored in a memory buffer, pointing to the pixel array inside the buffer.
+    /// Nothing is copied. The buffer must outlive the proxy, and must be writable if the pixels are going to be modified
+    /// through the proxy. The checksum of V2 images is not verified, since that would read the whole pixel array.
+    /// \param name Name of the image. Optional. Used for logging only.
+    /// \return Empty proxy, if the buffer is not a RIL image, or its pixel array is not aligned to the image alignment
+    /// (possible with V1 images, or when the buffer itself is less aligned). Use ImageDesc::load() in that case.
+    static ImageProxy view(const void * data, size_t size, const char * name = nullptr);
+
     /// return size of the whole image in bytes.
     uint64_t size() const { return desc.size; }
 
@@ -1662,14 +2110,19 @@ public:
         RII_ASSERT(rhs._proxy.desc.empty());
         _proxy.data     = rhs._proxy.data;
         rhs._proxy.data = nullptr;
+        _mapping        = rhs._mapping;
+        rhs._mapping    = {};
     }
     ~Image() { clear(); }
     Image & operator=(Image && rhs) {
         if (this != &rhs) {
+            clear();
             _proxy.desc = std::move(rhs._proxy.desc);
             RII_ASSERT(rhs._proxy.desc.empty());
             _proxy.data     = rhs._proxy.data;
             rhs._proxy.data = nullptr;
+            _mapping        = rhs._mapping;
+            rhs._mapping    = {};
         }
         return *this;
     }
@@ -1702,6 +2155,9 @@ public:
         return _proxy.desc.empty();
     }
 
+    /// check if the pixels are mapped from a file (see mapFile()), instead of being owned by the image.
+    bool mapped() const { return nullptr != _mapping.base; }
+
     /// return offset to particular pixel
     size_t pixel(const PlaneCoord & p = {}, size_t x = 0, size_t y = 0, size_t z = 0) const { return _proxy.desc.pixel(p, x, y, z); }
 
@@ -1737,6 +2193,9 @@ public:
     /// aware of the memory and performance cost of it.
     Image clone() const { return Image(desc(), data()); }
 
+    /// Compress the whole image to a block compressed format. See ImageDesc::compress().
+    Image compress(PixelFormat format, const PlaneDesc::CompressParameters & params = {}) const { return desc().compress(data(), format, params); }
+
     /// Save image to stream
     void save(const ImageDesc::SaveToStreamParameters & params, std::ostream & stream) const { return _proxy.save(params, stream); }
 
@@ -1755,13 +2214,175 @@ public:
     /// \param name Name of the image. This is optional and is used for logging only.
     static Image load(const void * data, size_t size, const char * name = nullptr);
 
+    /// Load a range of mipmap levels from a RIL stream, without reading the other levels. See ImageDesc::loadRILLevels().
+    /// \param name Name of the image. This is optional and is used for logging only.
+    static Image loadRILLevels(std::istream & stream, size_t firstLevel, size_t levelCount = 0, const char * name = nullptr);
+
+    /// @brief Map a RIL file into memory and use its pixel array in place, without reading or copying it.
+    /// Pages are loaded on first access and shared with other processes through the OS page cache. They are mapped
+    /// copy-on-write: writing to data() is allowed, but it only changes the private copy of the touched pages, never
+    /// the file. The file must not be truncated while it is mapped.
+    /// If the file is not a RIL file, or its pixel array is not aligned to the image alignment (possible with V1 files
+    /// only), it is loaded in the regular way instead. Check mapped() to tell the 2 cases apart. The checksum of V2 files
+    /// is not verified when mapping, since that would read the whole file.
+    /// \return Empty image, if the file can't be opened or loaded.
+    static Image mapFile(const std::string & path);
+
 private:
+    friend class ImagePool;
+
+    struct Mapping {
+        void * base = nullptr; ///< start of the mapped file view.
+        size_t size = 0;       ///< size of the mapped file view.
+    };
+
     ImageProxy _proxy;
+    Mapping    _mapping;
 
 private:
     bool construct(const void * initialContent, size_t initialContentSizeInbytes);
 };
 
+/// @brief Load many images asynchronously, overlapping file reads with decoding.
+///
+/// Files are read whole on a few I/O threads, then parsed and decoded on decoder threads, so that the disks and the
+/// CPUs stay busy at the same time. Loads start in the order they are queued. Files that are read but not decoded yet
+/// are capped in total size, so queuing thousands of files at once doesn't read them all into memory first.
+/// All methods are thread safe. The destructor waits for all queued loads to finish.
+class RII_API ImageLoader {
+public:
+    struct Parameters {
+        /// Number of threads that read files.
+        size_t ioThreads = 4;
+
+        /// Number of threads that parse and decode images. 0 means std::thread::hardware_concurrency().
+        size_t decodeThreads = 0;
+
+        /// Max total size of the files that are read, but not decoded yet. A file larger than that is still loaded,
+        /// only with no other file in flight. In-memory images don't count, since they are not read.
+        size_t maxBytesInFlight = 256u << 20;
+
+        /// Optional allocator of the loaded images. Null means the C heap.
+        Allocator * allocator = nullptr;
+
+        Parameters & setIOThreads(size_t t) {
+            ioThreads = t;
+            return *this;
+        }
+
+        Parameters & setDecodeThreads(size_t t) {
+            decodeThreads = t;
+            return *this;
+        }
+
+        Parameters & setMaxBytesInFlight(size_t b) {
+            maxBytesInFlight = b;
+            return *this;
+        }
+
+        Parameters & setAllocator(Allocator * a) {
+            allocator = a;
+            return *this;
+        }
+    };
+
+    /// Called with the loaded image, or an empty one if loading failed or threw, on one of the decoder threads, even
+    /// for an empty path. It must not throw. An exception that escapes it anyway is logged and dropped.
+    using Callback = std::function<void(Image && image)>;
+
+    RII_NO_COPY(ImageLoader);
+    RII_NO_MOVE(ImageLoader);
+    ImageLoader();
+    explicit ImageLoader(const Parameters & params);
+    ~ImageLoader();
+
+    /// Queue loading of an image file.
+    void load(std::string path, Callback callback);
+
+    /// Queue loading of an image from memory buffer. The buffer must stay valid until the callback is called.
+    /// \param name Name of the image. This is optional and is used for logging only.
+    void load(const void * data, size_t size, Callback callback, std::string name = {});
+
+    /// Queue loading of an image file. The future gets an empty image if loading fails, or the exception thrown while
+    /// reading or decoding the file, if any.
+    std::future<Image> load(std::string path);
+
+    /// Queue loading of an image from memory buffer. The buffer must stay valid until the future is ready. The future
+    /// gets an empty image if loading fails, or the exception thrown while decoding the image, if any.
+    std::future<Image> load(const void * data, size_t size, std::string name = {});
+
+    /// Queue loading of a list of image files. The futures are in the same order as the paths.
+    std::vector<std::future<Image>> load(const std::vector<std::string> & paths);
+
+    /// Wait for all queued loads to finish, callbacks included.
+    void wait();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+/// @brief Recycle pixel buffers of released images, for images that are created and destroyed over and over with the
+/// same descriptors, like the textures of a streaming system.
+///
+/// Released buffers are kept in least recently released order, within a byte budget. acquire() hands out one whose
+/// descriptor matches, or (if enabled) one of the same size and enough alignment. Buffers stay with the allocator that
+/// allocated them (see Allocator). Thread safe.
+class RII_API ImagePool {
+public:
+    struct Parameters {
+        /// Max total size of the released buffers kept for reuse. The least recently released ones go first.
+        size_t maxBytes = 256u << 20;
+
+        /// Also hand out buffers of different descriptors with the same size, if they are aligned enough.
+        bool matchSize = true;
+
+        Parameters & setMaxBytes(size_t b) {
+            maxBytes = b;
+            return *this;
+        }
+
+        Parameters & setMatchSize(bool m) {
+            matchSize = m;
+            return *this;
+        }
+    };
+
+    struct Stats {
+        size_t hits      = 0; ///< number of acquire() calls served by a released buffer.
+        size_t misses    = 0; ///< number of acquire() calls that allocated a new buffer.
+        size_t evictions = 0; ///< number of released buffers freed to stay within the budget, or by trim().
+        size_t buffers   = 0; ///< number of released buffers kept for reuse.
+        size_t bytes     = 0; ///< total size of the released buffers kept for reuse.
+    };
+
+    RII_NO_COPY(ImagePool);
+    RII_NO_MOVE(ImagePool);
+    ImagePool();
+    explicit ImagePool(const Parameters & params);
+    ~ImagePool();
+
+    /// @brief Create an image, on a released buffer if there is a match. The pixels are not initialized either way.
+    Image acquire(const ImageDesc & desc);
+
+    /// @brief Keep the pixel buffer of the image for later acquire() calls, and clear the image. Mapped images (see
+    /// Image::mapFile()) are just cleared.
+    void release(Image && image);
+
+    /// @brief Free the least recently released buffers, until at most maxBytes are kept.
+    void trim(size_t maxBytes = 0);
+
+    /// @brief Return the statistics since construction, or since the last resetStats().
+    Stats stats() const;
+
+    /// @brief Reset the hit, miss and eviction counters.
+    void resetStats();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
 } // namespace RAPID_IMAGE_NAMESPACE
 
 namespace std {